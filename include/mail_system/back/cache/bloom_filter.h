@@ -0,0 +1,44 @@
+#ifndef MAIL_SYSTEM_BLOOM_FILTER_H
+#define MAIL_SYSTEM_BLOOM_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace mail_system {
+
+/**
+ * @brief 定长的Bloom过滤器
+ *
+ * 按预期元素数和误判率确定位数和哈希次数，调用方传入64位哈希值，
+ * 过滤器用双重哈希派生出k个位置。位数组是原子的64位字，add用fetch_or，
+ * 可以在其他线程并发查询的同时加入元素；查询不加锁，最多k次内存访问。
+ *
+ * 只会误判"可能存在"，不会漏判：may_contain返回false时元素一定没有加入过。
+ */
+class BloomFilter {
+public:
+    BloomFilter(size_t expected_items, double false_positive_rate);
+
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    void add(uint64_t hash);
+    bool may_contain(uint64_t hash) const;
+
+    // 设计容量，加入的元素超过容量后误判率上升，应重建
+    size_t capacity() const;
+    // 位数组大小（字节）
+    size_t memory_bytes() const;
+
+private:
+    size_t m_capacity;
+    size_t m_bitCount;
+    unsigned int m_hashCount;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_BLOOM_FILTER_H
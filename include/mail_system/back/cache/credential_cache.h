@@ -0,0 +1,116 @@
+#ifndef MAIL_SYSTEM_CREDENTIAL_CACHE_H
+#define MAIL_SYSTEM_CREDENTIAL_CACHE_H
+
+#include "mail_system/back/cache/recipient_directory.h"
+#include "mail_system/back/db/db_pool.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mail_system {
+
+/**
+ * @brief 进程内的登录凭据缓存
+ *
+ * 按小写邮件地址缓存用户ID和密码校验值，SMTP AUTH和POP3 PASS命中时不访问数据库。
+ * 校验值是 SHA-256(进程随机盐 || 数据库中的密码)，内存里不保留密码原文，比较用定长时间比较。
+ *
+ * 不存在的用户也缓存一条（有效期较短），对不存在地址的批量猜测不会打到数据库；
+ * 已存在用户的错误密码直接用缓存的校验值判定，同样不访问数据库。
+ *
+ * 缓存按地址哈希分成多个分片，每个分片一把锁。修改密码后调用invalidate()让条目立即失效；
+ * 其他进程（例如前端的用户管理）修改的密码由收件人目录读取users.updated_at发现，
+ * 在一个拉取间隔内失效；没有设置目录时在ttl到期后生效。SMTP和POP3应共用同一个实例。
+ *
+ * 设置了收件人目录时，目录的Bloom过滤器判定不存在的地址仍然查询数据库（刚注册的用户
+ * 要等下一次增量拉取才进入过滤器），但查到不存在时只在分片有空位时缓存，不淘汰已有条目，
+ * 随机地址的撞库不会把缓存里的正常用户挤出去。
+ */
+class CredentialCache {
+public:
+    enum class Result {
+        ACCEPTED,       // 用户存在且密码正确
+        REJECTED,       // 用户不存在或密码错误
+        UNAVAILABLE     // 数据库不可用，调用方应回复临时错误
+    };
+
+    // ttl为0表示不缓存，每次都查询数据库
+    CredentialCache(std::chrono::seconds ttl, std::chrono::seconds negative_ttl, size_t max_entries,
+                    size_t shard_count = 16);
+
+    ~CredentialCache();
+
+    CredentialCache(const CredentialCache&) = delete;
+    CredentialCache& operator=(const CredentialCache&) = delete;
+
+    /**
+     * @brief 校验用户名和密码
+     *
+     * 未命中时从用户所在分片读取凭据并写入缓存。
+     *
+     * @param user_id 校验通过时返回用户ID
+     */
+    Result verify(DBPool& db_pool, const std::string& mail_address, const std::string& password, int64_t& user_id);
+
+    // 设置用于快速排除不存在用户的目录，同时订阅目录的用户变更来失效缓存；传入nullptr关闭
+    void set_directory(std::shared_ptr<RecipientDirectory> directory);
+
+    // 使一个地址的缓存失效，修改密码或删除用户后调用
+    void invalidate(const std::string& mail_address);
+    // 清空缓存
+    void clear();
+
+    // 命中和未命中次数
+    uint64_t hit_count() const;
+    uint64_t miss_count() const;
+
+private:
+    using Verifier = std::array<unsigned char, 32>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        bool exists;            // false为不存在的用户
+        int64_t user_id;
+        Verifier verifier;
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        // 每次失效加一；查询数据库期间发生过失效时，查到的旧凭据不再写入
+        uint64_t generation = 0;
+    };
+
+    Shard& shard_for(const std::string& key);
+    // 计算 SHA-256(盐 || secret)
+    bool make_verifier(const std::string& secret, Verifier& verifier) const;
+    // 按缓存条目判定结果
+    Result check(const Entry& entry, const std::string& password, int64_t& user_id) const;
+    // 分片满时先清理过期条目，仍然满则随便淘汰一条
+    void make_room(Shard& shard, Clock::time_point now);
+
+    std::chrono::seconds m_ttl;
+    std::chrono::seconds m_negativeTtl;
+    size_t m_maxEntriesPerShard;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::array<unsigned char, 16> m_salt;
+    // 用std::atomic_load/atomic_store读写
+    std::shared_ptr<RecipientDirectory> m_directory;
+    // 在m_directory上注册的变更监听，受m_directoryMutex保护
+    std::mutex m_directoryMutex;
+    std::shared_ptr<RecipientDirectory> m_listenedDirectory;
+    size_t m_listenerId;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_CREDENTIAL_CACHE_H
@@ -0,0 +1,81 @@
+#ifndef MAIL_SYSTEM_QUOTA_CACHE_H
+#define MAIL_SYSTEM_QUOTA_CACHE_H
+
+#include "mail_system/back/db/db_pool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mail_system {
+
+/**
+ * @brief 进程内的邮箱配额和用量缓存
+ *
+ * 配额存在users.quota_bytes中（0表示不限制），用量是该用户各邮箱mailbox_stats.total_bytes之和，
+ * 两者在第一次检查时一起读出。之后投递成功和删除邮件时按邮件大小增减缓存的用量，
+ * 检查不再访问数据库，也不需要对mails求和。
+ *
+ * 其他进程的投递和删除在ttl到期重新读取后才反映出来；同一用户的并发投递可能一起通过检查，
+ * 配额是软限制，最多超出一封邮件。
+ */
+class QuotaCache {
+public:
+    enum class Result {
+        OK,             // 未超出配额，或用户不存在、不限制配额
+        OVER_QUOTA,     // 投递后会超出配额
+        UNAVAILABLE     // 数据库不可用，调用方自行决定是否放行
+    };
+
+    QuotaCache(std::chrono::seconds ttl, size_t max_entries, size_t shard_count = 16);
+
+    QuotaCache(const QuotaCache&) = delete;
+    QuotaCache& operator=(const QuotaCache&) = delete;
+
+    // 检查给地址再投递message_size字节后是否超出配额，未命中时从用户所在分片读取
+    Result check(DBPool& db_pool, const std::string& mail_address, uint64_t message_size);
+
+    // 投递成功后加上邮件大小，删除后减去；只更新已缓存的条目
+    void add_usage(const std::string& mail_address, int64_t delta);
+    // 使一个地址的缓存失效，修改配额后调用
+    void invalidate(const std::string& mail_address);
+    void clear();
+
+    uint64_t hit_count() const;
+    uint64_t miss_count() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        int64_t quota;          // 0表示不限制
+        int64_t used;
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        // 每次用量变化或失效加一；查询数据库期间发生过变化时，查到的用量不再写入
+        uint64_t generation = 0;
+    };
+
+    Shard& shard_for(const std::string& key);
+    static Result judge(const Entry& entry, uint64_t message_size);
+    // 分片满时先清理过期条目，仍然满则随便淘汰一条
+    void make_room(Shard& shard, Clock::time_point now);
+
+    std::chrono::seconds m_ttl;
+    size_t m_maxEntriesPerShard;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_QUOTA_CACHE_H
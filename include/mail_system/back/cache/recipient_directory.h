@@ -0,0 +1,166 @@
+#ifndef MAIL_SYSTEM_RECIPIENT_DIRECTORY_H
+#define MAIL_SYSTEM_RECIPIENT_DIRECTORY_H
+
+#include "mail_system/back/cache/bloom_filter.h"
+#include "mail_system/back/db/db_pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace mail_system {
+
+/**
+ * @brief 本地收件人目录
+ *
+ * 启动时从users表读出所有邮件地址，之后按id增量拉取新注册的用户，RCPT TO在内存中判定
+ * 收件人是否存在，不存在的地址直接回复550，对不存在用户的轰炸不会打到MySQL。
+ *
+ * 地址统一转成小写，字符串连续存放在一块内存中（intern），哈希表用开放寻址（线性探测），
+ * 槽位里只存哈希值和字符串的位置，查询时不分配内存。本地域名由用户地址推出，单独一张表。
+ *
+ * 哈希表前面还有一个Bloom过滤器和排好序的本地域名列表，两者组成一个不可变的快照，
+ * 通过原子的shared_ptr整体替换，查询方不加锁。过滤器判定不存在的地址（字典攻击里随机生成的
+ * 用户名几乎都是这样）只算几次哈希，不碰哈希表；登录时也用它挡掉不存在的用户。
+ * 增量拉取的新地址直接并发置位，全量重载、出现新域名或超出过滤器容量时重建快照。
+ *
+ * 删除的用户只能在定期全量重载时去掉；新注册的用户在下一次增量拉取之前会被拒绝，
+ * 拉取间隔决定这个窗口的长短。
+ *
+ * 自增id的分配顺序和提交顺序不一定一致，id较小、提交较晚的用户会被按id的增量拉取跳过。
+ * 每次拉取因此还按users.updated_at回看最近一段时间内注册或修改过的用户，补进目录，
+ * 并通知监听方（凭据缓存）丢弃这些地址的缓存，其他进程修改的密码在一个拉取间隔内生效。
+ */
+class RecipientDirectory {
+public:
+    // 参数为小写的邮件地址，在加载线程上调用
+    using ChangeListener = std::function<void(const std::string&)>;
+
+    enum class Lookup {
+        FOUND,              // 本地用户
+        UNKNOWN_USER,       // 本地域名下不存在的用户
+        UNKNOWN_DOMAIN,     // 不是本地域名
+        NOT_READY           // 还没有加载完成，调用方应按原来的方式校验
+    };
+
+    // poll_interval为增量拉取的间隔，reload_interval为全量重载的间隔（0表示不重载）
+    RecipientDirectory(std::chrono::seconds poll_interval, std::chrono::seconds reload_interval);
+    ~RecipientDirectory();
+
+    RecipientDirectory(const RecipientDirectory&) = delete;
+    RecipientDirectory& operator=(const RecipientDirectory&) = delete;
+
+    // 启动后台加载线程
+    void start(std::shared_ptr<DBPool> db_pool);
+    void stop();
+
+    // 查询一个地址，不区分大小写
+    Lookup lookup(std::string_view address) const;
+    // 只查Bloom过滤器，不加锁；返回false时地址一定不存在，目录未加载完成时返回true
+    bool may_exist(std::string_view address) const;
+    // 数据库确认地址已不存在（上次全量重载之后删除的用户）时调用，
+    // 之后按不存在处理，直到下次全量重载或增量拉取再次读到这个地址
+    void forget(std::string_view address);
+
+    // 注册用户变更监听，返回用于注销的编号
+    size_t add_change_listener(ChangeListener listener);
+    // 注销后不会再被调用，正在进行的调用结束后才返回
+    void remove_change_listener(size_t id);
+
+    bool is_ready() const;
+    size_t size() const;
+    // 被Bloom过滤器直接判定为不存在的次数
+    uint64_t filter_reject_count() const;
+
+private:
+    // 开放寻址的字符串集合，字符串小写后连续存放
+    class InternedSet {
+    public:
+        InternedSet();
+        // 已存在返回false
+        bool insert(std::string_view lower, uint64_t hash);
+        bool contains(std::string_view key, uint64_t hash) const;
+        size_t size() const;
+        void swap(InternedSet& other);
+        // 遍历所有字符串，顺序不定
+        void for_each(const std::function<void(std::string_view, uint64_t)>& fn) const;
+
+    private:
+        struct Slot {
+            uint64_t hash;
+            uint32_t offset;
+            uint32_t length;        // 0表示空槽
+        };
+        size_t find_slot(std::string_view key, uint64_t hash) const;
+        void grow();
+
+        std::string m_arena;
+        std::vector<Slot> m_slots;
+        size_t m_size;
+    };
+
+    // Bloom过滤器和本地域名的不可变快照，只有过滤器的位会在原地增加
+    struct Filter {
+        Filter(size_t expected_items, double false_positive_rate) : bloom(expected_items, false_positive_rate) {}
+        bool has_domain(std::string_view domain) const;
+
+        BloomFilter bloom;
+        std::vector<std::string> domains;   // 小写，已排序
+    };
+
+    // 小写后的FNV-1a，查询时不需要先复制一份小写字符串
+    static uint64_t hash_lower(std::string_view text);
+    static std::string_view domain_of(std::string_view address);
+
+    void loader_thread();
+    // 全量加载到新表，成功后替换
+    bool full_load();
+    // 拉取各分片上id大于上次位置的用户
+    bool poll();
+    // 读出各分片最近注册或修改过的用户，补进目录并通知监听方
+    bool poll_changes();
+    // 把一批小写地址加入目录，必要时重建快照
+    void add_addresses(const std::vector<std::string>& page);
+    // 分页读取一个分片上id大于last_id的用户，fn在每页上调用
+    bool fetch_users(size_t shard, int64_t& last_id, const std::function<void(std::vector<std::string>&)>& fn);
+    // 加入一个已经小写的地址及其域名，地址已存在时返回false
+    static bool insert_address(const std::string& lower, InternedSet& addresses, InternedSet& domains);
+    // 按当前的地址和域名建立快照，容量留出增长的余量
+    static std::shared_ptr<Filter> build_filter(const InternedSet& addresses, const InternedSet& domains);
+
+    std::chrono::seconds m_pollInterval;
+    std::chrono::seconds m_reloadInterval;
+    std::shared_ptr<DBPool> m_dbPool;
+
+    mutable std::shared_mutex m_tableMutex;
+    InternedSet m_addresses;
+    InternedSet m_domains;
+    std::unordered_set<std::string> m_forgotten;   // forget()过的小写地址，受m_tableMutex保护
+    std::vector<int64_t> m_lastIds;     // 每个分片已经加载到的最大id，只在加载线程上访问
+    std::atomic<bool> m_ready;
+    // 用std::atomic_load/atomic_store读写
+    std::shared_ptr<Filter> m_filter;
+    mutable std::atomic<uint64_t> m_filterRejects;
+
+    std::mutex m_listenerMutex;
+    std::vector<std::pair<size_t, ChangeListener>> m_listeners;
+    size_t m_nextListenerId;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running;
+    std::thread m_thread;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_RECIPIENT_DIRECTORY_H
@@ -0,0 +1,69 @@
+#ifndef MAIL_SYSTEM_CIRCUIT_BREAKER_H
+#define MAIL_SYSTEM_CIRCUIT_BREAKER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace mail_system {
+
+/**
+ * @brief 数据库熔断器
+ *
+ * 连续failure_threshold次访问失败或耗时超过latency_threshold时熔断（OPEN），
+ * 此后调用方不再访问数据库，直接走降级路径（例如把邮件写入本地暂存区）。
+ * 熔断open_duration之后进入HALF_OPEN，allow_request()只放行一个探测请求：
+ * 探测成功恢复为CLOSED，失败重新熔断并重新计时。
+ *
+ * is_closed()只读一个原子变量，可以在每个请求上调用。
+ */
+class CircuitBreaker {
+public:
+    enum class State {
+        CLOSED,         // 正常访问数据库
+        OPEN,           // 熔断中
+        HALF_OPEN       // 等待探测结果
+    };
+
+    CircuitBreaker(const std::string& name, unsigned int failure_threshold,
+                   std::chrono::milliseconds latency_threshold, std::chrono::milliseconds open_duration);
+
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    // 是否可以访问数据库；熔断时间已到时转为HALF_OPEN并只放行一次
+    bool allow_request();
+    // 访问成功，耗时超过阈值按失败计
+    void record_success(std::chrono::milliseconds latency);
+    // 访问失败
+    void record_failure();
+
+    State state() const;
+    bool is_closed() const;
+    // 累计熔断次数
+    uint64_t trip_count() const;
+
+    static const char* state_name(State state);
+
+private:
+    // 转为OPEN，调用方需持有m_mutex
+    void trip();
+
+    std::string m_name;
+    unsigned int m_failureThreshold;
+    std::chrono::milliseconds m_latencyThreshold;
+    std::chrono::milliseconds m_openDuration;
+
+    mutable std::mutex m_mutex;
+    std::atomic<State> m_state;
+    unsigned int m_consecutiveFailures;
+    bool m_probeInFlight;
+    std::chrono::steady_clock::time_point m_openedAt;
+    std::atomic<uint64_t> m_trips;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_CIRCUIT_BREAKER_H
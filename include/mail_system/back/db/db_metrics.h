@@ -0,0 +1,136 @@
+#ifndef MAIL_SYSTEM_DB_METRICS_H
+#define MAIL_SYSTEM_DB_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mail_system {
+
+// 按2的幂分桶的延迟直方图，单位微秒，只用原子计数，记录时不加锁
+class LatencyHistogram {
+public:
+    // 第i个桶记录 [2^i, 2^(i+1)) 微秒，最后一个桶不设上界（约8秒以上）
+    static constexpr size_t kBucketCount = 24;
+
+    void record(std::chrono::microseconds duration);
+
+    uint64_t count() const;
+    uint64_t total_us() const;
+    uint64_t max_us() const;
+    // 估算分位数（0到1），返回所在桶的上界
+    uint64_t percentile(double p) const;
+
+private:
+    std::array<std::atomic<uint64_t>, kBucketCount> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_totalUs{0};
+    std::atomic<uint64_t> m_maxUs{0};
+};
+
+/**
+ * @brief 一个连接池的运行指标
+ *
+ * 连接池记录借出等待时间、连接的创建和关闭、连接和ping失败次数以及同时借出连接数的峰值，
+ * 用来判断max_pool_size是否合适。
+ *
+ * 连接记录每条语句的执行耗时，按归一化后的SQL（字面量和IN/VALUES列表替换成?）分组，
+ * 超过阈值的语句写入固定长度的慢查询环形缓冲区，不需要打开MySQL的general log。
+ * 预处理语句只在预处理时归一化一次，执行时不加锁。
+ */
+class DBMetrics {
+public:
+    // 同一种语句的统计
+    struct QueryStats {
+        std::string fingerprint;
+        LatencyHistogram latency;
+        std::atomic<uint64_t> errors{0};
+    };
+
+    // 一条慢查询
+    struct SlowQuery {
+        std::chrono::system_clock::time_point time;
+        std::chrono::microseconds duration;
+        std::string sql;            // 预处理语句为带?的原文，不含参数
+        bool ok;
+    };
+
+    // 最多区分的语句种类，超出的计入"<other>"
+    static constexpr size_t kMaxFingerprints = 1000;
+    // 慢查询记录的SQL最大长度
+    static constexpr size_t kMaxSlowQueryText = 512;
+
+    DBMetrics(std::chrono::milliseconds slow_query_threshold, size_t slow_query_log_size);
+
+    DBMetrics(const DBMetrics&) = delete;
+    DBMetrics& operator=(const DBMetrics&) = delete;
+
+    // 归一化SQL：去掉注释，合并空白，字符串和数字替换为?，连续的?列表和(?)列表合并为一个
+    static std::string fingerprint(std::string_view sql);
+
+    // 取得一种语句的统计项，返回的指针在DBMetrics销毁前一直有效
+    QueryStats* statement_stats(std::string_view sql);
+    // 记录一次语句执行
+    void record_query(QueryStats& stats, const std::string& sql, std::chrono::microseconds duration, bool ok);
+
+    // 连接池事件
+    void record_checkout(std::chrono::microseconds wait, bool waited);
+    void record_checkout_timeout();
+    void record_in_use(size_t in_use);
+    void record_connection_created();
+    void record_connection_closed();
+    void record_connect_failure();
+    void record_validation_failure();
+
+    const LatencyHistogram& checkout_wait() const;
+    uint64_t checkouts() const;
+    uint64_t waited_checkouts() const;
+    uint64_t checkout_timeouts() const;
+    uint64_t peak_in_use() const;
+    uint64_t connections_created() const;
+    uint64_t connections_closed() const;
+    uint64_t connect_failures() const;
+    uint64_t validation_failures() const;
+
+    // 遍历所有语句的统计
+    void for_each_query(const std::function<void(const QueryStats&)>& fn) const;
+    // 最近的慢查询，从旧到新
+    std::vector<SlowQuery> slow_queries() const;
+
+    // 输出统计，语句按总耗时从高到低排列
+    void dump(std::ostream& os, size_t top_queries = 20) const;
+
+private:
+    std::chrono::microseconds m_slowThreshold;
+    size_t m_slowLogSize;
+
+    LatencyHistogram m_checkoutWait;
+    std::atomic<uint64_t> m_checkouts{0};
+    std::atomic<uint64_t> m_waitedCheckouts{0};
+    std::atomic<uint64_t> m_checkoutTimeouts{0};
+    std::atomic<uint64_t> m_peakInUse{0};
+    std::atomic<uint64_t> m_connectionsCreated{0};
+    std::atomic<uint64_t> m_connectionsClosed{0};
+    std::atomic<uint64_t> m_connectFailures{0};
+    std::atomic<uint64_t> m_validationFailures{0};
+
+    mutable std::mutex m_queryMutex;
+    std::unordered_map<std::string, std::unique_ptr<QueryStats>> m_queries;
+
+    mutable std::mutex m_slowMutex;
+    std::deque<SlowQuery> m_slowQueries;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_DB_METRICS_H
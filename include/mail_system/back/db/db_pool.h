@@ -13,16 +13,107 @@
 
 namespace mail_system {
 
+class DBPool;
+
+// 连接用途，可以容忍复制延迟的读请求能被路由到只读副本
+enum class DBAccessMode {
+    READ_WRITE,     // 写，或者必须读到最新数据的读，总是走主库
+    READ            // 允许读到稍旧数据的读
+};
+
+// 借不到连接的原因
+enum class DBCheckoutError {
+    NONE,
+    EXHAUSTED,      // 连接都在使用中，等待超时；数据库本身正常
+    UNAVAILABLE     // 连接或ping失败，或者连接池已关闭
+};
+
+// 数据库连接租约
+// 只能移动不能复制，析构或调用release()时把连接以O(1)的代价归还给连接池；
+// 连接池先于租约销毁时连接直接丢弃
+class DBConnectionLease {
+public:
+    DBConnectionLease() = default;
+    DBConnectionLease(std::shared_ptr<IDBConnection> connection,
+                      std::weak_ptr<DBPool> pool,
+                      std::shared_ptr<void> token)
+        : m_connection(std::move(connection)), m_pool(std::move(pool)), m_token(std::move(token)) {}
+
+    ~DBConnectionLease() { release(); }
+
+    DBConnectionLease(const DBConnectionLease&) = delete;
+    DBConnectionLease& operator=(const DBConnectionLease&) = delete;
+
+    DBConnectionLease(DBConnectionLease&& other) noexcept
+        : m_connection(std::move(other.m_connection)),
+          m_pool(std::move(other.m_pool)),
+          m_token(std::move(other.m_token)) {}
+
+    DBConnectionLease& operator=(DBConnectionLease&& other) noexcept {
+        if (this != &other) {
+            release();
+            m_connection = std::move(other.m_connection);
+            m_pool = std::move(other.m_pool);
+            m_token = std::move(other.m_token);
+        }
+        return *this;
+    }
+
+    IDBConnection* operator->() const { return m_connection.get(); }
+    IDBConnection& operator*() const { return *m_connection; }
+    IDBConnection* get() const { return m_connection.get(); }
+    explicit operator bool() const { return m_connection != nullptr; }
+
+    // 提前归还连接
+    inline void release();
+
+private:
+    std::shared_ptr<IDBConnection> m_connection;
+    std::weak_ptr<DBPool> m_pool;
+    // 连接池内部的连接句柄，归还时直接定位，不需要查找
+    std::shared_ptr<void> m_token;
+};
+
 // 数据库连接池抽象类
-class DBPool {
+class DBPool : public std::enable_shared_from_this<DBPool> {
 public:
     virtual ~DBPool() = default;
 
-    // 获取数据库连接
-    virtual std::shared_ptr<IDBConnection> get_connection() = 0;
+    // 获取数据库连接，租约析构时自动归还
+    virtual DBConnectionLease get_connection() = 0;
+
+    // 获取连接，借不到时给出原因；默认不区分原因，都按不可用处理
+    virtual DBConnectionLease get_connection(DBCheckoutError& error) {
+        DBConnectionLease lease = get_connection();
+        error = lease ? DBCheckoutError::NONE : DBCheckoutError::UNAVAILABLE;
+        return lease;
+    }
+
+    // 按用途获取连接；单库的连接池不区分用途
+    virtual DBConnectionLease get_connection(DBAccessMode mode) {
+        (void)mode;
+        return get_connection();
+    }
 
-    // 释放数据库连接
-    virtual void release_connection(std::shared_ptr<IDBConnection> connection) = 0;
+    // 分片数，不分片的连接池为1
+    virtual size_t get_shard_count() const { return 1; }
+
+    // 用户所在的分片，按邮件地址（不区分大小写）计算
+    virtual size_t get_shard_index(const std::string& mail_address) const {
+        (void)mail_address;
+        return 0;
+    }
+
+    // 获取指定分片的连接
+    virtual DBConnectionLease get_shard_connection(size_t shard, DBAccessMode mode) {
+        (void)shard;
+        return get_connection(mode);
+    }
+
+    // 获取用户所在分片的连接，用户的邮件、邮箱和附件都在这个分片上
+    DBConnectionLease get_user_connection(const std::string& mail_address, DBAccessMode mode) {
+        return get_shard_connection(get_shard_index(mail_address), mode);
+    }
 
     // 获取连接池大小
     virtual size_t get_pool_size() const = 0;
@@ -33,7 +124,14 @@ public:
     // 关闭连接池
     virtual void close() = 0;
 
+    // 输出连接池和语句的运行指标，组合的连接池依次输出各个子连接池
+    virtual void dump_metrics(std::ostream& os) const {
+        (void)os;
+    }
+
 protected:
+    friend class DBConnectionLease;
+
     DBPool() = default;
 
     // 初始化连接池
@@ -41,6 +139,42 @@ protected:
 
     // 创建新的连接
     virtual std::shared_ptr<IDBConnection> create_connection() = 0;
+
+    // 归还租约持有的连接，token为make_lease时传入的句柄
+    virtual void release_lease(std::shared_ptr<IDBConnection> connection, std::shared_ptr<void> token) = 0;
+
+    // 创建租约，连接池必须由shared_ptr管理才能自动归还
+    DBConnectionLease make_lease(std::shared_ptr<IDBConnection> connection, std::shared_ptr<void> token) {
+        return DBConnectionLease(std::move(connection), weak_from_this(), std::move(token));
+    }
+};
+
+inline void DBConnectionLease::release() {
+    if (!m_connection) {
+        return;
+    }
+    if (auto pool = m_pool.lock()) {
+        pool->release_lease(std::move(m_connection), std::move(m_token));
+    }
+    m_connection.reset();
+    m_token.reset();
+    m_pool.reset();
+}
+
+// 只读副本配置，账号和库名与主库相同
+struct DBReplicaConfig {
+    std::string host;
+    unsigned int port = 3306;
+};
+
+// 用户分片配置，未填写的项沿用顶层配置
+// 分片在哈希环上的位置由name决定，改名等同于换了一个分片
+struct DBShardConfig {
+    std::string name;
+    std::string host;
+    unsigned int port = 3306;
+    std::string database;
+    std::vector<DBReplicaConfig> replicas;  // 本分片的只读副本
 };
 
 // 数据库连接池配置
@@ -52,16 +186,38 @@ struct DBPoolConfig {
     std::string database;
     unsigned int port;
     size_t initial_pool_size;
+    size_t min_ready_connections;   // 启动时至少等到这么多连接就绪，其余的在后台继续建立
     size_t max_pool_size;
     unsigned int connection_timeout;
     unsigned int idle_timeout;
+    unsigned int validation_idle_threshold;  // 空闲超过该秒数的连接在借出前先ping
+    size_t statement_cache_size;    // 每个连接缓存的预处理语句数，0表示不缓存
+    size_t thread_cache_size;       // 每个线程自己保留的空闲连接数，0表示不使用线程缓存
+    std::vector<DBReplicaConfig> replicas;  // 只读副本，为空时不做读写分离
+    unsigned int max_replica_lag;           // 复制延迟超过该秒数的副本不接收读请求
+    unsigned int replica_check_interval;    // 检查副本复制延迟的间隔（秒）
+    std::vector<DBShardConfig> shards;      // 用户分片，为空时所有用户在同一个库
+    size_t shard_virtual_nodes;             // 每个分片在一致性哈希环上的虚拟节点数
+    unsigned int slow_query_threshold_ms;   // 执行时间超过该毫秒数的语句记入慢查询日志
+    size_t slow_query_log_size;             // 每个连接池保留的慢查询条数，0表示不记录
+    unsigned int metrics_log_interval;      // 定期把运行指标输出到日志的间隔（秒），0表示不输出
 
     DBPoolConfig()
         : port(3306),
           initial_pool_size(5),
+          min_ready_connections(1),
           max_pool_size(10),
           connection_timeout(5),
-          idle_timeout(60) {}
+          idle_timeout(60),
+          validation_idle_threshold(30),
+          statement_cache_size(64),
+          thread_cache_size(0),
+          max_replica_lag(5),
+          replica_check_interval(2),
+          shard_virtual_nodes(160),
+          slow_query_threshold_ms(200),
+          slow_query_log_size(100),
+          metrics_log_interval(0) {}
     void show() const {
         std::cout << "DBPoolConfig: "
                   << "\n\tachieve = " << achieve
@@ -70,9 +226,26 @@ struct DBPoolConfig {
                   << "\n\tdatabase = " << database
                   << "\n\tport = " << port
                   << "\n\tinitial_pool_size = " << initial_pool_size
+                  << "\n\tmin_ready_connections = " << min_ready_connections
                   << "\n\tmax_pool_size = " << max_pool_size
                   << "\n\tconnection_timeout = " << connection_timeout
                   << "\n\tidle_timeout = " << idle_timeout
+                  << "\n\tvalidation_idle_threshold = " << validation_idle_threshold
+                  << "\n\tstatement_cache_size = " << statement_cache_size
+                  << "\n\tthread_cache_size = " << thread_cache_size;
+        for (const auto& replica : replicas) {
+            std::cout << "\n\treplica = " << replica.host << ":" << replica.port;
+        }
+        std::cout << "\n\tmax_replica_lag = " << max_replica_lag
+                  << "\n\treplica_check_interval = " << replica_check_interval;
+        for (const auto& shard : shards) {
+            std::cout << "\n\tshard " << shard.name << " = " << shard.host << ":" << shard.port
+                      << "/" << shard.database << " (" << shard.replicas.size() << " replicas)";
+        }
+        std::cout << "\n\tshard_virtual_nodes = " << shard_virtual_nodes
+                  << "\n\tslow_query_threshold_ms = " << slow_query_threshold_ms
+                  << "\n\tslow_query_log_size = " << slow_query_log_size
+                  << "\n\tmetrics_log_interval = " << metrics_log_interval
                   << std::endl;
     }
 
@@ -97,9 +270,45 @@ struct DBPoolConfig {
         database = json.value("database", database);
         port = json.value("port", port);
         initial_pool_size = json.value("initial_pool_size", initial_pool_size);
+        min_ready_connections = json.value("min_ready_connections", min_ready_connections);
         max_pool_size = json.value("max_pool_size", max_pool_size);
         connection_timeout = json.value("connection_timeout", connection_timeout);
         idle_timeout = json.value("idle_timeout", idle_timeout);
+        validation_idle_threshold = json.value("validation_idle_threshold", validation_idle_threshold);
+        statement_cache_size = json.value("statement_cache_size", statement_cache_size);
+        thread_cache_size = json.value("thread_cache_size", thread_cache_size);
+        auto loadReplicas = [this](const nlohmann::json& items, std::vector<DBReplicaConfig>& out) {
+            out.clear();
+            for (const auto& item : items) {
+                DBReplicaConfig replica;
+                replica.host = item.value("host", replica.host);
+                replica.port = item.value("port", port);
+                out.push_back(replica);
+            }
+        };
+        if (json.contains("replicas") && json["replicas"].is_array()) {
+            loadReplicas(json["replicas"], replicas);
+        }
+        max_replica_lag = json.value("max_replica_lag", max_replica_lag);
+        replica_check_interval = json.value("replica_check_interval", replica_check_interval);
+        if (json.contains("shards") && json["shards"].is_array()) {
+            shards.clear();
+            for (const auto& item : json["shards"]) {
+                DBShardConfig shard;
+                shard.host = item.value("host", host);
+                shard.port = item.value("port", port);
+                shard.database = item.value("database", database);
+                shard.name = item.value("name", shard.host + ":" + std::to_string(shard.port) + "/" + shard.database);
+                if (item.contains("replicas") && item["replicas"].is_array()) {
+                    loadReplicas(item["replicas"], shard.replicas);
+                }
+                shards.push_back(shard);
+            }
+        }
+        shard_virtual_nodes = json.value("shard_virtual_nodes", shard_virtual_nodes);
+        slow_query_threshold_ms = json.value("slow_query_threshold_ms", slow_query_threshold_ms);
+        slow_query_log_size = json.value("slow_query_log_size", slow_query_log_size);
+        metrics_log_interval = json.value("metrics_log_interval", metrics_log_interval);
         return true;
     }
 };
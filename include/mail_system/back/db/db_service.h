@@ -1,16 +1,62 @@
 #ifndef MAIL_SYSTEM_DB_SERVICE_H
 #define MAIL_SYSTEM_DB_SERVICE_H
 
+#include <charconv>
+#include <cstdint>
+#include <ctime>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include <map>
 #include <memory>
 
 namespace mail_system {
 
+namespace db_detail {
+
+// 解析整数，整个字符串都必须是数字
+inline bool parse_int(std::string_view text, int64_t& value) {
+    if (text.empty()) {
+        return false;
+    }
+    auto res = std::from_chars(text.data(), text.data() + text.size(), value);
+    return res.ec == std::errc() && res.ptr == text.data() + text.size();
+}
+
+// 解析 "YYYY-MM-DD[ HH:MM:SS]" 格式的DATETIME/TIMESTAMP文本，按UTC换算成Unix时间
+inline bool parse_datetime(std::string_view text, std::time_t& value) {
+    int64_t field[6] = {0, 1, 1, 0, 0, 0};
+    const size_t starts[6] = {0, 5, 8, 11, 14, 17};
+    const size_t widths[6] = {4, 2, 2, 2, 2, 2};
+    if (text.size() != 10 && text.size() < 19) {
+        return false;
+    }
+    size_t fields = text.size() == 10 ? 3 : 6;
+    for (size_t i = 0; i < fields; ++i) {
+        if (!parse_int(text.substr(starts[i], widths[i]), field[i])) {
+            return false;
+        }
+    }
+    // 公历日期到1970-01-01的天数
+    int64_t y = field[0] - (field[1] <= 2 ? 1 : 0);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t mp = (field[1] + 9) % 12;
+    int64_t doy = (153 * mp + 2) / 5 + field[2] - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+    value = static_cast<std::time_t>(days * 86400 + field[3] * 3600 + field[4] * 60 + field[5]);
+    return true;
+}
+
+} // namespace db_detail
+
 // 数据库查询结果接口
 class IDBResult {
 public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
     virtual ~IDBResult() = default;
     
     // 获取结果集中的行数
@@ -25,8 +71,132 @@ public:
     virtual std::vector<std::map<std::string, std::string>> get_all_rows() const = 0;
     // 获取指定行列的数据
     virtual std::string get_value(size_t row_index, const std::string& column_name) const = 0;
+
+    // 按列名查找下标，不存在返回npos；在循环外查好，循环内按下标取值
+    virtual size_t get_column_index(const std::string& column_name) const = 0;
+    // 指定行列的数据，不拷贝，和结果对象的生命周期相同；NULL或越界返回空串
+    virtual std::string_view get_view(size_t row_index, size_t column_index) const = 0;
+    // 指定行列是否为NULL（越界也视为NULL）
+    virtual bool is_null(size_t row_index, size_t column_index) const = 0;
+
+    // 按整数读取，NULL或不是整数时返回default_value
+    int64_t get_int(size_t row_index, size_t column_index, int64_t default_value = 0) const {
+        int64_t value;
+        return db_detail::parse_int(get_view(row_index, column_index), value) ? value : default_value;
+    }
+
+    // 按DATETIME/TIMESTAMP读取（按UTC解释），NULL或格式不对时返回-1
+    std::time_t get_timestamp(size_t row_index, size_t column_index) const {
+        std::time_t value;
+        return db_detail::parse_datetime(get_view(row_index, column_index), value) ? value : -1;
+    }
+};
+
+// 只进的流式查询结果
+// 行在调用next()时才从服务器读取，内存占用与结果集大小无关，适合大结果集的扫描；
+// get_value返回的string_view只在下一次next()之前有效，需要保留的数据要自行拷贝。
+// 结果读完或对象释放之前，所属连接上不能执行其他语句，连接也必须比结果对象活得久
+class IDBStreamResult {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    virtual ~IDBStreamResult() = default;
+
+    // 获取列数
+    virtual size_t get_column_count() const = 0;
+    // 获取列名列表
+    virtual const std::vector<std::string>& get_column_names() const = 0;
+    // 读取下一行，没有更多行或出错时返回false
+    virtual bool next() = 0;
+    // 当前行指定列的数据，NULL返回空串
+    virtual std::string_view get_value(size_t column_index) const = 0;
+    // 当前行指定列是否为NULL
+    virtual bool is_null(size_t column_index) const = 0;
+    // next()返回false时用来区分正常读完和中途出错
+    virtual bool has_error() const = 0;
+    // 获取最后一次操作的错误信息
+    virtual std::string get_last_error() const = 0;
+
+    // 按列名查找下标，不存在返回npos；在循环外查好，循环内按下标取值
+    size_t find_column(const std::string& column_name) const {
+        const auto& names = get_column_names();
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i] == column_name) {
+                return i;
+            }
+        }
+        return npos;
+    }
+
+    // 当前行按整数读取，NULL或不是整数时返回default_value
+    int64_t get_int(size_t column_index, int64_t default_value = 0) const {
+        int64_t value;
+        return db_detail::parse_int(get_value(column_index), value) ? value : default_value;
+    }
+
+    // 当前行按DATETIME/TIMESTAMP读取（按UTC解释），NULL或格式不对时返回-1
+    std::time_t get_timestamp(size_t column_index) const {
+        std::time_t value;
+        return db_detail::parse_datetime(get_value(column_index), value) ? value : -1;
+    }
+};
+
+// 预处理语句接口，参数使用 ? 占位，下标从0开始
+// 语句属于创建它的连接，和连接一样同一时间只能被一个线程使用
+class IDBStatement {
+public:
+    virtual ~IDBStatement() = default;
+
+    // 获取参数个数
+    virtual size_t get_param_count() const = 0;
+    // 绑定字符串参数（二进制安全）
+    virtual bool bind(size_t index, const std::string& value) = 0;
+    // 绑定整数参数
+    virtual bool bind(size_t index, int64_t value) = 0;
+    // 绑定NULL
+    virtual bool bind_null(size_t index) = 0;
+    // 执行查询并返回结果
+    virtual std::shared_ptr<IDBResult> query() = 0;
+    // 执行查询并以流的方式逐行读取结果，结果读完之前语句不能再次执行
+    virtual std::shared_ptr<IDBStreamResult> query_stream() = 0;
+    // 执行更新操作（插入、更新、删除）
+    virtual bool execute() = 0;
+    // 上一次执行影响的行数
+    virtual uint64_t get_affected_rows() const = 0;
+    // 上一次插入生成的自增ID
+    virtual uint64_t get_insert_id() const = 0;
+    // 获取最后一次操作的错误信息
+    virtual std::string get_last_error() const = 0;
 };
 
+namespace db_detail {
+
+inline bool bind_param(IDBStatement& stmt, size_t index, const std::string& value) {
+    return stmt.bind(index, value);
+}
+
+inline bool bind_param(IDBStatement& stmt, size_t index, const char* value) {
+    return value ? stmt.bind(index, std::string(value)) : stmt.bind_null(index);
+}
+
+inline bool bind_param(IDBStatement& stmt, size_t index, std::nullptr_t) {
+    return stmt.bind_null(index);
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, bool>::type
+bind_param(IDBStatement& stmt, size_t index, T value) {
+    return stmt.bind(index, static_cast<int64_t>(value));
+}
+
+template <typename... Args>
+bool bind_all(IDBStatement& stmt, const Args&... args) {
+    size_t index = 0;
+    return (true && ... && bind_param(stmt, index++, args));
+}
+
+} // namespace db_detail
+
 // 数据库连接接口
 class IDBConnection {
 public:
@@ -38,8 +208,12 @@ public:
     virtual void disconnect() = 0;
     // 检查连接状态
     virtual bool is_connected() const = 0;
+    // 向服务器确认连接仍然可用（不执行SQL）
+    virtual bool ping() = 0;
     // 执行查询并返回结果
     virtual std::shared_ptr<IDBResult> query(const std::string& sql) = 0;
+    // 执行查询并以流的方式逐行读取结果
+    virtual std::shared_ptr<IDBStreamResult> query_stream(const std::string& sql) = 0;
     // 执行更新操作（插入、更新、删除）
     virtual bool execute(const std::string& sql) = 0;
     // 开始事务
@@ -52,6 +226,38 @@ public:
     virtual std::string get_last_error() const = 0;
     // 转义字符串
     virtual std::string escape_string(const std::string& str) const = 0;
+    // 预处理SQL，同一条SQL文本会复用连接上已缓存的语句，失败返回nullptr
+    virtual std::shared_ptr<IDBStatement> prepare(const std::string& sql) = 0;
+
+    // 参数化查询：query("SELECT ... WHERE a = ? AND b = ?", a, b)
+    template <typename... Args>
+    std::shared_ptr<IDBResult> query(const std::string& sql, const Args&... args) {
+        auto stmt = prepare(sql);
+        if (!stmt || !db_detail::bind_all(*stmt, args...)) {
+            return nullptr;
+        }
+        return stmt->query();
+    }
+
+    // 参数化的流式查询
+    template <typename... Args>
+    std::shared_ptr<IDBStreamResult> query_stream(const std::string& sql, const Args&... args) {
+        auto stmt = prepare(sql);
+        if (!stmt || !db_detail::bind_all(*stmt, args...)) {
+            return nullptr;
+        }
+        return stmt->query_stream();
+    }
+
+    // 参数化更新
+    template <typename... Args>
+    bool execute(const std::string& sql, const Args&... args) {
+        auto stmt = prepare(sql);
+        if (!stmt || !db_detail::bind_all(*stmt, args...)) {
+            return false;
+        }
+        return stmt->execute();
+    }
 };
 
 // 数据库服务抽象类
@@ -10,18 +10,34 @@
 
 namespace mail_system {
 
-// MySQL连接池实现
+/**
+ * @brief MySQL连接池实现
+ *
+ * 新连接都由维护线程在后台并行建立（TCP和认证握手同时进行），请求线程不做握手：
+ * 启动时构造函数只等到min_ready_connections个连接就绪，其余初始连接在后台继续建立；
+ * 借出时没有空闲连接且未达上限，请求线程通知维护线程新建一个连接，自己等待归还或新建的连接。
+ *
+ * thread_cache_size大于0时，每个线程归还的连接先留在线程本地缓存里，同一线程下次借出时
+ * 直接取用，不经过连接池的锁。有请求在共享队列上等待时，归还的连接不再进线程缓存，
+ * 等待的请求会把各线程缓存中的连接收回共享队列；维护线程每个周期也收回一次，
+ * 不再访问数据库的线程不会一直占着连接。
+ */
 class MySQLPool : public DBPool {
 public:
     MySQLPool(const DBPoolConfig& config, std::shared_ptr<DBService> db_service);
     ~MySQLPool() override;
 
     // DBPool接口实现
-    std::shared_ptr<IDBConnection> get_connection() override;
-    void release_connection(std::shared_ptr<IDBConnection> connection) override;
+    using DBPool::get_connection;
+    DBConnectionLease get_connection() override;
+    DBConnectionLease get_connection(DBCheckoutError& error) override;
     size_t get_pool_size() const override;
     size_t get_available_connections() const override;
     void close() override;
+    void dump_metrics(std::ostream& os) const override;
+
+    // 本连接池的运行指标
+    std::shared_ptr<DBMetrics> get_metrics() const;
 
 protected:
     // 连接包装类，用于跟踪连接的使用情况
@@ -29,35 +45,80 @@ protected:
         std::shared_ptr<IDBConnection> connection;
         std::chrono::steady_clock::time_point last_used;
         bool in_use;
+        // 在某个线程的缓存中空闲；取用和收回都先把它从true改成false，成功的一方拥有连接
+        std::atomic<bool> cached;
 
         ConnectionWrapper(std::shared_ptr<IDBConnection> conn)
             : connection(conn),
               last_used(std::chrono::steady_clock::now()),
-              in_use(false) {}
+              in_use(false),
+              cached(false) {}
+    };
+
+    // 一个线程在一个连接池上缓存的连接
+    struct ThreadCache {
+        uint64_t pool_id;
+        std::weak_ptr<void> alive;      // 连接池销毁后失效，用于清理
+        std::vector<std::shared_ptr<ConnectionWrapper>> connections;
     };
 
     void initialize_pool() override;
     std::shared_ptr<IDBConnection> create_connection() override;
+    void release_lease(std::shared_ptr<IDBConnection> connection, std::shared_ptr<void> token) override;
 
 private:
     DBPoolConfig m_config;
     std::shared_ptr<DBService> m_dbService;
+    std::shared_ptr<DBMetrics> m_metrics;
     std::vector<std::shared_ptr<ConnectionWrapper>> m_connections;
     std::queue<std::shared_ptr<ConnectionWrapper>> m_availableConnections;
     mutable std::mutex m_mutex;
     std::condition_variable m_cv;
     std::atomic<bool> m_running;
     std::thread m_maintenanceThread;
+    // 唤醒维护线程新建连接
+    std::condition_variable m_maintenanceCv;
+    // 已请求、还未开始建立的连接数
+    size_t m_pendingGrowth;
+    // 正在建立的连接数
+    size_t m_connecting;
+
+    // 同时进行握手的连接数上限
+    static constexpr size_t kMaxParallelConnects = 8;
+
+    // 线程缓存按连接池编号区分，不用地址，避免新连接池复用旧地址
+    uint64_t m_poolId;
+    std::shared_ptr<int> m_alive;
+    // 在共享队列上等待的请求数
+    std::atomic<size_t> m_waiters;
 
     // 连接池维护线程
     void maintenance_thread();
+    // 并行建立count个连接，每个连上后立即放入空闲队列
+    void open_connections(size_t count);
+    // 准备好连接并创建租约，失败时连接放回共享队列
+    DBConnectionLease lease_wrapper(const std::shared_ptr<ConnectionWrapper>& wrapper,
+                                    std::chrono::steady_clock::time_point now);
+    // 放回共享队列
+    void return_to_shared(const std::shared_ptr<ConnectionWrapper>& wrapper);
+    // 当前线程在本连接池上的缓存
+    ThreadCache& thread_cache();
+    // 从当前线程的缓存取一个连接，没有时返回空
+    std::shared_ptr<ConnectionWrapper> take_cached_connection();
+    // 尝试把归还的连接留在当前线程的缓存中，返回false时由调用方放回共享队列
+    bool cache_connection(const std::shared_ptr<ConnectionWrapper>& wrapper);
+    // 把所有线程缓存中的连接收回共享队列，调用方需持有m_mutex
+    size_t reclaim_cached_connections();
     // 检查并清理空闲连接
     void cleanup_idle_connections();
-    // 验证连接是否有效
-    bool validate_connection(std::shared_ptr<IDBConnection> connection);
+    // 借出前确保连接可用：未连接的先连接，空闲过久的先ping
+    bool prepare_connection(const std::shared_ptr<ConnectionWrapper>& wrapper,
+                            std::chrono::steady_clock::duration idle);
 };
 
 // MySQL连接池工厂实现
+// 配置了只读副本时返回RoutingDBPool，主库和每个副本各有一个MySQLPool；
+// 配置了分片时返回ShardedDBPool，每个分片按上述规则各建一个连接池
 class MySQLPoolFactory : public DBPoolFactory {
 public:
     ~MySQLPoolFactory() override = default;
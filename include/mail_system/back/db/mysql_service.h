@@ -2,16 +2,31 @@
 #define MAIL_SYSTEM_MYSQL_SERVICE_H
 
 #include "mail_system/back/db/db_service.h"
+#include "mail_system/back/db/db_metrics.h"
 #include <mysql/mysql.h>
+#include <list>
 #include <mutex>
+#include <unordered_map>
 
 namespace mail_system {
 
+// MYSQL_BIND的is_null/error等字段在MySQL 8.0起是bool*，MariaDB和MySQL 5.7的客户端库仍是my_bool*
+#if defined(MARIADB_BASE_VERSION) || defined(MARIADB_PACKAGE_VERSION) || MYSQL_VERSION_ID < 80000
+using mysql_bool = my_bool;
+#else
+using mysql_bool = bool;
+#endif
+
 // MySQL查询结果实现
+// 所有单元格的数据连续存放在一块内存中，按 行*列数+列 下标记录偏移，
+// 列名在构造时建好索引，按下标取值不分配内存
 class MySQLResult : public IDBResult {
 public:
+    // 拷贝mysql_store_result的结果后立即释放
     explicit MySQLResult(MYSQL_RES* result);
-    ~MySQLResult() override;
+    // 先给出列名，再逐个单元格追加（预处理语句的结果）
+    explicit MySQLResult(std::vector<std::string> column_names);
+    ~MySQLResult() override = default;
 
     // IDBResult接口实现
     size_t get_row_count() const override;
@@ -20,15 +35,152 @@ public:
     std::map<std::string, std::string> get_row(size_t row_index) const override;
     std::vector<std::map<std::string, std::string>> get_all_rows() const override;
     std::string get_value(size_t row_index, const std::string& column_name) const override;
+    size_t get_column_index(const std::string& column_name) const override;
+    std::string_view get_view(size_t row_index, size_t column_index) const override;
+    bool is_null(size_t row_index, size_t column_index) const override;
+
+    // 预留行数和数据字节数，避免追加时反复扩容
+    void reserve(size_t rows, size_t bytes);
+    // 按行优先顺序追加下一个单元格
+    void append_value(const char* data, size_t length);
+    void append_null();
 
 private:
-    MYSQL_RES* m_result;
     std::vector<std::string> m_columnNames;
-    std::vector<std::vector<std::string>> m_rows;
-    size_t m_rowCount;
+    std::unordered_map<std::string, size_t> m_columnIndex;
+    // 单元格数据
+    std::string m_arena;
+    // 第i个单元格的数据为 [m_offsets[i], m_offsets[i + 1])
+    std::vector<size_t> m_offsets;
+    std::vector<char> m_nulls;
     size_t m_columnCount;
 
-    void load_result_data();
+    void build_column_index();
+    size_t cell_index(size_t row_index, size_t column_index) const;
+};
+
+// 基于mysql_use_result的流式结果，行数据直接引用客户端库的读缓冲区
+class MySQLStreamResult : public IDBStreamResult {
+public:
+    MySQLStreamResult(MYSQL* mysql, MYSQL_RES* result);
+    ~MySQLStreamResult() override;
+
+    MySQLStreamResult(const MySQLStreamResult&) = delete;
+    MySQLStreamResult& operator=(const MySQLStreamResult&) = delete;
+
+    // IDBStreamResult接口实现
+    size_t get_column_count() const override;
+    const std::vector<std::string>& get_column_names() const override;
+    bool next() override;
+    std::string_view get_value(size_t column_index) const override;
+    bool is_null(size_t column_index) const override;
+    bool has_error() const override;
+    std::string get_last_error() const override;
+
+private:
+    MYSQL* m_mysql;
+    MYSQL_RES* m_result;
+    std::vector<std::string> m_columnNames;
+    MYSQL_ROW m_row;
+    unsigned long* m_lengths;
+    bool m_error;
+    std::string m_lastError;
+};
+
+class MySQLStatement;
+
+// 预处理语句的流式结果，逐行fetch到按需增长的缓冲区中
+class MySQLStatementStream : public IDBStreamResult {
+public:
+    MySQLStatementStream(std::shared_ptr<MySQLStatement> statement, MYSQL_RES* metadata);
+    ~MySQLStatementStream() override;
+
+    MySQLStatementStream(const MySQLStatementStream&) = delete;
+    MySQLStatementStream& operator=(const MySQLStatementStream&) = delete;
+
+    // IDBStreamResult接口实现
+    size_t get_column_count() const override;
+    const std::vector<std::string>& get_column_names() const override;
+    bool next() override;
+    std::string_view get_value(size_t column_index) const override;
+    bool is_null(size_t column_index) const override;
+    bool has_error() const override;
+    std::string get_last_error() const override;
+
+private:
+    std::shared_ptr<MySQLStatement> m_statement;
+    std::vector<std::string> m_columnNames;
+    std::vector<MYSQL_BIND> m_binds;
+    std::vector<std::vector<char>> m_buffers;
+    std::vector<unsigned long> m_lengths;
+    std::unique_ptr<mysql_bool[]> m_nulls;
+    bool m_hasRow;
+    bool m_done;
+    bool m_error;
+    std::string m_lastError;
+
+    // 缓冲区地址变化后需要重新绑定
+    bool bind_buffers();
+    // 结束读取并释放服务器端的结果集
+    void finish();
+    void fail(const std::string& error);
+};
+
+// MySQL预处理语句实现
+class MySQLStatement : public IDBStatement,
+                       public std::enable_shared_from_this<MySQLStatement> {
+public:
+    // metrics不为空时记录每次执行的耗时
+    MySQLStatement(MYSQL_STMT* stmt, const std::string& sql, std::shared_ptr<DBMetrics> metrics = nullptr);
+    ~MySQLStatement() override;
+
+    // IDBStatement接口实现
+    size_t get_param_count() const override;
+    bool bind(size_t index, const std::string& value) override;
+    bool bind(size_t index, int64_t value) override;
+    bool bind_null(size_t index) override;
+    std::shared_ptr<IDBResult> query() override;
+    std::shared_ptr<IDBStreamResult> query_stream() override;
+    bool execute() override;
+    uint64_t get_affected_rows() const override;
+    uint64_t get_insert_id() const override;
+    std::string get_last_error() const override;
+
+    // 释放服务器端句柄，之后所有操作都会失败
+    void close();
+    // 句柄是否可用（连接断开或重连后服务器端句柄会失效）
+    bool is_valid() const;
+    const std::string& get_sql() const;
+
+private:
+    friend class MySQLStatementStream;
+
+    MYSQL_STMT* m_stmt;
+    std::string m_sql;
+    size_t m_paramCount;
+    std::vector<MYSQL_BIND> m_params;
+    std::vector<std::string> m_stringValues;
+    std::vector<long long> m_intValues;
+    std::vector<unsigned long> m_lengths;
+    std::unique_ptr<mysql_bool[]> m_isNull;
+    std::vector<char> m_bound;
+    uint64_t m_affectedRows;
+    uint64_t m_insertId;
+    bool m_broken;
+    // 最近一次执行是否出错
+    bool m_failed;
+    std::string m_lastError;
+    std::shared_ptr<DBMetrics> m_metrics;
+    DBMetrics::QueryStats* m_queryStats;
+
+    bool check_index(size_t index);
+    // 绑定参数并执行
+    bool run();
+    // 执行并取回全部行
+    std::shared_ptr<IDBResult> fetch_all();
+    void record_error(const char* what);
+    // 记录从start开始的一次执行
+    void record_metrics(std::chrono::steady_clock::time_point start);
 };
 
 // MySQL连接实现
@@ -50,15 +202,32 @@ public:
     bool connect() override;
     void disconnect() override;
     bool is_connected() const override;
+    bool ping() override;
     std::shared_ptr<IDBResult> query(const std::string& sql) override;
+    std::shared_ptr<IDBStreamResult> query_stream(const std::string& sql) override;
     bool execute(const std::string& sql) override;
     bool begin_transaction() override;
     bool commit() override;
     bool rollback() override;
     std::string get_last_error() const override;
     std::string escape_string(const std::string& str) const override;
+    std::shared_ptr<IDBStatement> prepare(const std::string& sql) override;
+
+    // 参数化查询和更新
+    using IDBConnection::query;
+    using IDBConnection::query_stream;
+    using IDBConnection::execute;
+
+    // 设置预处理语句缓存容量，超出时淘汰最久未使用的语句
+    void set_statement_cache_capacity(size_t capacity);
+    // 设置语句耗时的统计对象，为空时不统计
+    void set_metrics(std::shared_ptr<DBMetrics> metrics);
+
+    static const size_t kDefaultStatementCacheCapacity = 64;
 
 private:
+    using StatementList = std::list<std::shared_ptr<MySQLStatement>>;
+
     MYSQL* m_mysql;
     std::string m_host;
     std::string m_user;
@@ -66,9 +235,19 @@ private:
     std::string m_database;
     unsigned int m_port;
     bool m_connected;
-    mutable std::mutex m_mutex;
+    // query/execute内部会调用is_connected/connect，需要可重入
+    mutable std::recursive_mutex m_mutex;
+
+    // 预处理语句LRU缓存，最近使用的在表头
+    StatementList m_statements;
+    std::unordered_map<std::string, StatementList::iterator> m_statementIndex;
+    size_t m_statementCacheCapacity;
+    std::shared_ptr<DBMetrics> m_metrics;
 
     void init_mysql();
+    void clear_statement_cache();
+    // 记录一条直接执行的SQL
+    void record_query(const std::string& sql, std::chrono::steady_clock::time_point start, bool ok);
 };
 
 // MySQL服务实现
@@ -0,0 +1,77 @@
+#ifndef MAIL_SYSTEM_ROUTING_DB_POOL_H
+#define MAIL_SYSTEM_ROUTING_DB_POOL_H
+
+#include "mail_system/back/db/db_pool.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace mail_system {
+
+/**
+ * @brief 读写分离的路由连接池
+ *
+ * 包装一个主库连接池和若干只读副本的连接池。get_connection()和READ_WRITE总是走主库；
+ * READ在复制延迟不超过max_replica_lag的副本之间轮询，没有可用副本时回到主库。
+ *
+ * 后台线程每隔check_interval秒查询一次各副本的复制状态（Seconds_Behind_Source），
+ * 连不上、复制线程停止或延迟过大的副本暂时不参与读路由，恢复后自动重新加入。
+ *
+ * 租约直接来自子连接池，归还时回到对应的子连接池。
+ */
+class RoutingDBPool : public DBPool {
+public:
+    RoutingDBPool(std::shared_ptr<DBPool> primary,
+                  std::vector<std::shared_ptr<DBPool>> replicas,
+                  unsigned int max_replica_lag,
+                  unsigned int check_interval);
+    ~RoutingDBPool() override;
+
+    // DBPool接口实现
+    DBConnectionLease get_connection() override;
+    DBConnectionLease get_connection(DBAccessMode mode) override;
+    size_t get_pool_size() const override;
+    size_t get_available_connections() const override;
+    void close() override;
+    void dump_metrics(std::ostream& os) const override;
+
+    // 当前参与读路由的副本数
+    size_t get_healthy_replicas() const;
+
+protected:
+    void initialize_pool() override;
+    // 连接由各子连接池创建
+    std::shared_ptr<IDBConnection> create_connection() override;
+    void release_lease(std::shared_ptr<IDBConnection> connection, std::shared_ptr<void> token) override;
+
+private:
+    struct ReplicaState {
+        std::shared_ptr<DBPool> pool;
+        std::atomic<bool> available;    // 是否参与读路由
+
+        explicit ReplicaState(std::shared_ptr<DBPool> replica_pool)
+            : pool(std::move(replica_pool)), available(false) {}
+    };
+
+    // 副本检查线程
+    void monitor_thread();
+    // 检查所有副本的复制延迟并更新可用状态
+    void check_replicas();
+    // 查询一个副本的复制延迟，不是副本或复制已停止返回-1
+    int64_t query_replica_lag(IDBConnection& connection);
+
+    std::shared_ptr<DBPool> m_primary;
+    std::vector<std::unique_ptr<ReplicaState>> m_replicas;
+    std::atomic<size_t> m_nextReplica;
+    unsigned int m_maxReplicaLag;
+    std::chrono::seconds m_checkInterval;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running;
+    std::thread m_monitorThread;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_ROUTING_DB_POOL_H
@@ -0,0 +1,65 @@
+#ifndef MAIL_SYSTEM_SHARDED_DB_POOL_H
+#define MAIL_SYSTEM_SHARDED_DB_POOL_H
+
+#include "mail_system/back/db/db_pool.h"
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+namespace mail_system {
+
+/**
+ * @brief 按用户分片的连接池
+ *
+ * 每个分片是一个独立的连接池（可以是带副本的RoutingDBPool），保存一部分用户的
+ * users、mailboxes、mails、mail_mailbox和attachments。用户按小写邮件地址的哈希
+ * 落在一致性哈希环上，每个分片在环上有shard_virtual_nodes个虚拟节点，
+ * 增加一个分片只会迁走大约1/N的用户。
+ *
+ * 哈希函数固定为FNV-1a加64位混合，不依赖std::hash，不同编译器和版本下的结果一致。
+ *
+ * 不带分片参数的get_connection()返回第0个分片，用于不属于任何用户的数据。
+ */
+class ShardedDBPool : public DBPool {
+public:
+    ShardedDBPool(std::vector<std::string> names,
+                  std::vector<std::shared_ptr<DBPool>> shards,
+                  size_t virtual_nodes);
+    ~ShardedDBPool() override;
+
+    // DBPool接口实现
+    DBConnectionLease get_connection() override;
+    DBConnectionLease get_connection(DBAccessMode mode) override;
+    size_t get_pool_size() const override;
+    size_t get_available_connections() const override;
+    void close() override;
+    void dump_metrics(std::ostream& os) const override;
+
+    size_t get_shard_count() const override;
+    size_t get_shard_index(const std::string& mail_address) const override;
+    DBConnectionLease get_shard_connection(size_t shard, DBAccessMode mode) override;
+
+    // 分片名称
+    const std::string& get_shard_name(size_t shard) const;
+
+    // 环上使用的哈希，对外公开便于迁移工具按同样的规则计算
+    static uint64_t hash_key(std::string_view key);
+
+protected:
+    // 构建哈希环
+    void initialize_pool() override;
+    // 连接由各分片的连接池创建
+    std::shared_ptr<IDBConnection> create_connection() override;
+    void release_lease(std::shared_ptr<IDBConnection> connection, std::shared_ptr<void> token) override;
+
+private:
+    std::vector<std::string> m_names;
+    std::vector<std::shared_ptr<DBPool>> m_shards;
+    size_t m_virtualNodes;
+    // (哈希值, 分片下标)，按哈希值排序
+    std::vector<std::pair<uint64_t, size_t>> m_ring;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_SHARDED_DB_POOL_H
@@ -0,0 +1,228 @@
+#ifndef MAIL_SYSTEM_FSM_ENGINE_H
+#define MAIL_SYSTEM_FSM_ENGINE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace mail_system {
+
+/**
+ * @brief 枚举取值个数
+ *
+ * 每个协议为自己的状态和事件枚举特化，例如：
+ * template<> struct FsmEnumTraits<SmtpsState> { static constexpr std::size_t count = ...; };
+ */
+template <typename Enum>
+struct FsmEnumTraits;
+
+/**
+ * @brief 事件分发结果
+ */
+enum class FsmDispatchResult {
+    OK,                   // 找到转换且守卫通过
+    INVALID_TRANSITION,   // 当前状态不接受该事件
+    GUARD_REJECTED        // 守卫拒绝了该转换
+};
+
+/**
+ * @brief 通用状态机引擎，SMTP、POP3、IMAP共用
+ *
+ * 转换表是按 [状态][事件] 下标访问的定长二维数组，查找是O(1)且不分配内存；
+ * 动作和守卫都是Owner的成员函数指针，不经过std::function。
+ * 每个转换自带命中、守卫拒绝和非法事件计数，作为各协议统一的指标来源。
+ *
+ * 转换的目标状态只是名义上的（用于日志和指标），实际状态由动作函数决定，
+ * 因为很多动作要等响应写完、或者数据库返回之后才知道下一个状态。
+ *
+ * @tparam Owner 动作和守卫所属的状态机类
+ * @tparam State 状态枚举
+ * @tparam Event 事件枚举
+ * @tparam Context 传给动作和守卫的上下文（SMTP为会话指针，POP3为会话上下文）
+ * @tparam Result 动作的返回值类型
+ */
+template <typename Owner, typename State, typename Event, typename Context, typename Result = void>
+class FsmEngine {
+public:
+    static constexpr std::size_t kStateCount = FsmEnumTraits<State>::count;
+    static constexpr std::size_t kEventCount = FsmEnumTraits<Event>::count;
+
+    using Action = Result (Owner::*)(Context, const std::string&);
+    using Guard = bool (Owner::*)(const Context&, const std::string&) const;
+
+    /**
+     * @brief 转换表中的一行
+     */
+    struct Transition {
+        State from;
+        Event event;
+        State to;
+        Action action;
+        Guard guard;
+    };
+
+    FsmEngine() : m_counters(new Counter[kStateCount * kEventCount]) {
+        for (auto& row : m_table) {
+            row.fill(Entry());
+        }
+    }
+
+    explicit FsmEngine(std::initializer_list<Transition> transitions) : FsmEngine() {
+        for (const auto& transition : transitions) {
+            add_transition(transition);
+        }
+    }
+
+    FsmEngine(FsmEngine&&) = default;
+    FsmEngine& operator=(FsmEngine&&) = default;
+
+    /**
+     * @brief 添加或覆盖一条转换
+     */
+    void add_transition(const Transition& transition) {
+        Entry& entry = m_table[index(transition.from)][index(transition.event)];
+        entry.valid = true;
+        entry.transition = transition;
+    }
+
+    void add_transition(State from, Event event, State to, Action action, Guard guard = nullptr) {
+        add_transition(Transition{from, event, to, action, guard});
+    }
+
+    /**
+     * @brief 查找转换、执行守卫并计数
+     *
+     * @return 成功时返回转换项（动作可能为空），否则返回nullptr，原因写入result
+     */
+    const Transition* resolve(const Owner& owner, State from, Event event, const Context& context,
+                              const std::string& args, FsmDispatchResult& result) const {
+        if (index(from) >= kStateCount || index(event) >= kEventCount) {
+            // 越界的枚举值（例如损坏的轨迹）不计数
+            result = FsmDispatchResult::INVALID_TRANSITION;
+            return nullptr;
+        }
+        const Entry& entry = m_table[index(from)][index(event)];
+        Counter& counter = counter_at(from, event);
+        if (!entry.valid) {
+            result = FsmDispatchResult::INVALID_TRANSITION;
+            counter.invalid.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        const Transition& transition = entry.transition;
+        if (transition.guard && !(owner.*transition.guard)(context, args)) {
+            result = FsmDispatchResult::GUARD_REJECTED;
+            counter.rejected.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        counter.hits.fetch_add(1, std::memory_order_relaxed);
+        result = FsmDispatchResult::OK;
+        return &transition;
+    }
+
+    /**
+     * @brief 查找并立即执行动作（同步协议使用）
+     */
+    FsmDispatchResult dispatch(Owner& owner, State from, Event event, Context context,
+                               const std::string& args, Result* output = nullptr) const {
+        FsmDispatchResult result;
+        const Transition* transition = resolve(owner, from, event, context, args, result);
+        if (transition && transition->action) {
+            invoke(owner, *transition, context, args, output);
+        }
+        return result;
+    }
+
+    // 转换命中次数
+    uint64_t transition_count(State from, Event event) const {
+        return counter_at(from, event).hits.load(std::memory_order_relaxed);
+    }
+
+    // 被守卫拒绝的次数
+    uint64_t rejected_count(State from, Event event) const {
+        return counter_at(from, event).rejected.load(std::memory_order_relaxed);
+    }
+
+    // 在该状态下收到非法事件的次数
+    uint64_t invalid_count(State from, Event event) const {
+        return counter_at(from, event).invalid.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 遍历所有有过计数的 (状态, 事件) 组合
+     *
+     * @param f void(State from, Event event, State to, uint64_t hits, uint64_t rejected, uint64_t invalid)
+     */
+    template <typename F>
+    void for_each_counter(F&& f) const {
+        for (std::size_t s = 0; s < kStateCount; ++s) {
+            for (std::size_t e = 0; e < kEventCount; ++e) {
+                const Counter& counter = m_counters[s * kEventCount + e];
+                uint64_t hits = counter.hits.load(std::memory_order_relaxed);
+                uint64_t rejected = counter.rejected.load(std::memory_order_relaxed);
+                uint64_t invalid = counter.invalid.load(std::memory_order_relaxed);
+                if (hits || rejected || invalid) {
+                    f(static_cast<State>(s), static_cast<Event>(e), m_table[s][e].transition.to,
+                      hits, rejected, invalid);
+                }
+            }
+        }
+    }
+
+    // 清零所有计数
+    void reset_counters() {
+        for (std::size_t i = 0; i < kStateCount * kEventCount; ++i) {
+            m_counters[i].hits.store(0, std::memory_order_relaxed);
+            m_counters[i].rejected.store(0, std::memory_order_relaxed);
+            m_counters[i].invalid.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Entry {
+        bool valid = false;
+        Transition transition{};
+    };
+
+    struct Counter {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> invalid{0};
+    };
+
+    template <typename R = Result>
+    static typename std::enable_if<std::is_void<R>::value>::type
+    invoke(Owner& owner, const Transition& transition, Context context, const std::string& args, R*) {
+        (owner.*transition.action)(context, args);
+    }
+
+    template <typename R = Result>
+    static typename std::enable_if<!std::is_void<R>::value>::type
+    invoke(Owner& owner, const Transition& transition, Context context, const std::string& args, R* output) {
+        if (output) {
+            *output = (owner.*transition.action)(context, args);
+        } else {
+            (owner.*transition.action)(context, args);
+        }
+    }
+
+    template <typename E>
+    static constexpr std::size_t index(E value) {
+        return static_cast<std::size_t>(value);
+    }
+
+    Counter& counter_at(State from, Event event) const {
+        return m_counters[index(from) * kEventCount + index(event)];
+    }
+
+    std::array<std::array<Entry, kEventCount>, kStateCount> m_table;
+    std::unique_ptr<Counter[]> m_counters;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_FSM_ENGINE_H
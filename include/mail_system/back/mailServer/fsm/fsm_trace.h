@@ -0,0 +1,81 @@
+#ifndef MAIL_SYSTEM_FSM_TRACE_H
+#define MAIL_SYSTEM_FSM_TRACE_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mail_system {
+
+// 产生事件的协议，目前只有SMTPS状态机记录轨迹
+enum class FsmProtocol : uint8_t {
+    SMTPS = 1,
+    POP3S = 2,
+    IMAPS = 3
+};
+
+// 单条事件记录，定长24字节，按本机字节序写入
+#pragma pack(push, 1)
+struct FsmTraceRecord {
+    uint64_t timestamp_us;   // 事件到达时间（微秒，system_clock）
+    uint64_t session_id;     // 会话ID
+    uint8_t protocol;        // FsmProtocol
+    uint8_t state;           // 事件到达时会话所处的状态
+    uint8_t event;           // 事件
+    uint8_t reserved;
+    uint32_t arg_length;     // 参数长度（不记录参数内容）
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FsmTraceRecord) == 24, "FsmTraceRecord must stay 24 bytes");
+
+// 状态机事件轨迹记录器
+// 记录写入内存缓冲区，缓冲区满或flush()时才落盘，可被多个会话线程共享
+class FsmTraceRecorder {
+public:
+    explicit FsmTraceRecorder(const std::string& filename, size_t buffer_records = 4096);
+    ~FsmTraceRecorder();
+
+    FsmTraceRecorder(const FsmTraceRecorder&) = delete;
+    FsmTraceRecorder& operator=(const FsmTraceRecorder&) = delete;
+
+    // 文件是否成功打开
+    bool is_open() const;
+
+    // 记录一个事件
+    void record(FsmProtocol protocol, uint64_t session_id, uint8_t state, uint8_t event, size_t arg_length);
+
+    // 将缓冲区写入文件
+    void flush();
+
+private:
+    void flush_locked();
+
+    std::ofstream m_file;
+    std::vector<FsmTraceRecord> m_buffer;
+    size_t m_bufferRecords;
+    std::mutex m_mutex;
+};
+
+// 轨迹文件读取器，供离线回放使用
+class FsmTraceReader {
+public:
+    explicit FsmTraceReader(const std::string& filename);
+
+    bool is_open() const;
+
+    // 读取下一条记录，文件结束返回false
+    bool next(FsmTraceRecord& record);
+
+    // 回到文件开头
+    void rewind();
+
+private:
+    std::ifstream m_file;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_FSM_TRACE_H
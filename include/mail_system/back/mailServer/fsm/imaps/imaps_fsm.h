@@ -7,6 +7,7 @@
 #include <boost/msm/front/functor_row.hpp>
 #include <boost/msm/back/state_machine.hpp>
 #include <boost/mpl/vector.hpp>
+#include "mail_system/back/mailServer/fsm/fsm_engine.h"
 
 namespace mail_system {
 
@@ -27,6 +28,17 @@ enum class ImapsEvent {
     COMMAND
 };
 
+// 供FsmEngine使用，IMAP处理函数实现后直接套用同一套转换表
+template <>
+struct FsmEnumTraits<ImapsState> {
+    static constexpr std::size_t count = static_cast<std::size_t>(ImapsState::ERROR) + 1;
+};
+
+template <>
+struct FsmEnumTraits<ImapsEvent> {
+    static constexpr std::size_t count = static_cast<std::size_t>(ImapsEvent::COMMAND) + 1;
+};
+
 class ImapsContext {
 public:
     ImapsContext() : authenticated(false), selected_mailbox("") {}
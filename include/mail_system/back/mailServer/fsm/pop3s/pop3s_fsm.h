@@ -5,7 +5,13 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <ostream>
 #include "mail_system/back/db/db_pool.h"
+#include "mail_system/back/storage/blob_reclaimer.h"
+#include "mail_system/back/storage/blob_store.h"
+#include "mail_system/back/cache/credential_cache.h"
+#include "mail_system/back/cache/quota_cache.h"
+#include "mail_system/back/mailServer/fsm/fsm_engine.h"
 
 namespace mail_system {
 
@@ -33,29 +39,52 @@ enum class Pop3sEvent {
     UNKNOWN         // 未知命令
 };
 
-// POP3S上下文结构
-struct Pop3sContext {
-    std::string username;       // 当前用户名
-    int userId;                 // 用户ID
-    std::vector<Pop3MailInfo> mails; // 用户邮件列表
-};
-
 // 邮件信息结构
 struct Pop3MailInfo {
     int id;                     // 邮件ID
+    int64_t entry_id;           // 用户收件箱中的mail_mailbox记录ID
     std::string from;           // 发件人
     std::string to;             // 收件人
     std::string subject;        // 主题
-    std::string content;        // 内容
+    std::string content;        // 内容，RETR/TOP时才加载
+    std::string body_hash;      // 原始邮件在blob存储中的hash，为空表示正文在数据库中
     std::string date;           // 日期
     int size;                   // 大小
     bool deleted;               // 是否标记为删除
+    bool loaded = false;        // content是否已加载
+    bool retrieved = false;     // 本次会话中是否被RETR过，UPDATE时标记为已读
+};
+
+// POP3S上下文结构
+struct Pop3sContext {
+    std::string username;       // 当前用户名
+    int userId = -1;            // 用户ID
+    std::vector<Pop3MailInfo> mails; // 用户邮件列表
+    bool listLoaded = false;    // 邮件列表是否已加载，只用STAT的会话不加载
+    size_t snapshotCount = 0;   // 登录时收件箱的邮件数
+    uint64_t snapshotBytes = 0; // 登录时收件箱的总大小
+    int64_t snapshotNextUid = -1; // 登录时收件箱的next_uid，列表只加载uid小于它的邮件，-1表示不限制
+};
+
+template <>
+struct FsmEnumTraits<Pop3sState> {
+    static constexpr std::size_t count = static_cast<std::size_t>(Pop3sState::UPDATE) + 1;
+};
+
+template <>
+struct FsmEnumTraits<Pop3sEvent> {
+    static constexpr std::size_t count = static_cast<std::size_t>(Pop3sEvent::UNKNOWN) + 1;
 };
 
 // POP3S状态机类
 class Pop3sFsm {
 public:
-    explicit Pop3sFsm(std::shared_ptr<DBPool> db_pool);
+    // credential_cache为空时每次登录都查询数据库；quota_cache为空时删除邮件不更新缓存的用量；
+    // blob_reclaimer为空时只在删除时尝试回收一次，没删掉的留给运行中的回收线程
+    explicit Pop3sFsm(std::shared_ptr<DBPool> db_pool, std::shared_ptr<BlobStore> blob_store = nullptr,
+                      std::shared_ptr<CredentialCache> credential_cache = nullptr,
+                      std::shared_ptr<QuotaCache> quota_cache = nullptr,
+                      std::shared_ptr<BlobReclaimer> blob_reclaimer = nullptr);
     virtual ~Pop3sFsm();
 
     // 处理POP3命令
@@ -65,50 +94,80 @@ public:
     // 重置状态机
     void reset();
 
+    // 命令名映射为事件
+    static Pop3sEvent parse_command(const std::string& command);
+    // 输出各转换的命中次数
+    static void dump_transition_stats(std::ostream& os);
+
 protected:
     // 验证用户
     bool authenticate_user(const std::string& username, const std::string& password);
+    // 登录时读取收件箱摘要（mailbox_stats），确定本次会话的邮件范围
+    bool load_mailbox_summary();
     // 加载用户邮件
     bool load_user_mails();
+    // 需要逐封信息的命令在第一次使用时加载邮件列表
+    bool ensure_mail_list();
     // 更新邮件状态
     bool update_mail_status();
+    // 按需加载邮件内容：blob存储中的读原始邮件，旧邮件从数据库读正文
+    bool load_mail_content(Pop3MailInfo& mail);
 
 private:
-    // 处理USER命令
-    std::string handle_user(const std::string& args);
-    // 处理PASS命令
-    std::string handle_pass(const std::string& args);
-    // 处理STAT命令
-    std::string handle_stat();
-    // 处理LIST命令
-    std::string handle_list(const std::string& args);
-    // 处理RETR命令
-    std::string handle_retr(const std::string& args);
-    // 处理DELE命令
-    std::string handle_dele(const std::string& args);
-    // 处理NOOP命令
-    std::string handle_noop();
-    // 处理RSET命令
-    std::string handle_rset();
-    // 处理QUIT命令
-    std::string handle_quit();
-    // 处理TOP命令
-    std::string handle_top(const std::string& args);
-    // 处理UIDL命令
-    std::string handle_uidl(const std::string& args);
-    // 处理未知命令
-    std::string handle_unknown(const std::string& command);
-
+    using Engine = FsmEngine<Pop3sFsm, Pop3sState, Pop3sEvent, Pop3sContext&, std::string>;
+
+    // 状态转换表，所有POP3S会话共享
+    static const Engine& engine();
+
+    // 状态处理函数，状态合法性由转换表保证
+    std::string handle_user(Pop3sContext& context, const std::string& args);
+    std::string handle_pass(Pop3sContext& context, const std::string& args);
+    std::string handle_stat(Pop3sContext& context, const std::string& args);
+    std::string handle_list(Pop3sContext& context, const std::string& args);
+    std::string handle_retr(Pop3sContext& context, const std::string& args);
+    std::string handle_dele(Pop3sContext& context, const std::string& args);
+    std::string handle_noop(Pop3sContext& context, const std::string& args);
+    std::string handle_rset(Pop3sContext& context, const std::string& args);
+    std::string handle_quit(Pop3sContext& context, const std::string& args);
+    std::string handle_top(Pop3sContext& context, const std::string& args);
+    std::string handle_uidl(Pop3sContext& context, const std::string& args);
+    // 处理未知命令，args为命令名
+    std::string handle_unknown(Pop3sContext& context, const std::string& args);
+
+    // 守卫：PASS之前必须先给出USER
+    bool has_username(Pop3sContext& context, const std::string& args) const;
+    // 守卫拒绝时的回复
+    static const char* guard_reply(Pop3sEvent event);
+
+    // 当前状态
+    Pop3sState m_state;
+    // 会话上下文
+    Pop3sContext m_context;
     // 邮件映射表（邮件序号 -> 邮件索引）
     std::map<int, size_t> m_mailMap;
     // 数据库连接池
     std::shared_ptr<DBPool> m_dbPool;
+    // 原始邮件的blob存储
+    std::shared_ptr<BlobStore> m_blobStore;
+    // 登录凭据缓存，由工厂创建，所有会话共享
+    std::shared_ptr<CredentialCache> m_credentialCache;
+    // 配额缓存，通常与SMTP共用，删除邮件后减去用量
+    std::shared_ptr<QuotaCache> m_quotaCache;
+    // 引用归零的blob交给它回收
+    std::shared_ptr<BlobReclaimer> m_blobReclaimer;
 };
 
 // POP3S状态机工厂类
 class Pop3sFsmFactory {
 public:
-    explicit Pop3sFsmFactory(std::shared_ptr<DBPool> db_pool);
+    // 通常由MailServices::make_pop3_fsm_factory()创建，与SMTP共用缓存、目录和blob回收线程。
+    // credential_cache为空时使用默认参数创建一个；recipient_directory不为空时设置到凭据缓存上，
+    // 登录同样先经过目录的Bloom过滤器；blob_reclaimer由调用方启动，为空时各状态机只在删除时尝试回收一次
+    explicit Pop3sFsmFactory(std::shared_ptr<DBPool> db_pool, std::shared_ptr<BlobStore> blob_store = nullptr,
+                             std::shared_ptr<CredentialCache> credential_cache = nullptr,
+                             std::shared_ptr<QuotaCache> quota_cache = nullptr,
+                             std::shared_ptr<RecipientDirectory> recipient_directory = nullptr,
+                             std::shared_ptr<BlobReclaimer> blob_reclaimer = nullptr);
     virtual ~Pop3sFsmFactory();
 
     // 创建新的状态机实例
@@ -117,6 +176,14 @@ public:
 private:
     // 数据库连接池
     std::shared_ptr<DBPool> m_dbPool;
+    // 原始邮件的blob存储
+    std::shared_ptr<BlobStore> m_blobStore;
+    // 登录凭据缓存
+    std::shared_ptr<CredentialCache> m_credentialCache;
+    // 配额缓存
+    std::shared_ptr<QuotaCache> m_quotaCache;
+    // blob回收
+    std::shared_ptr<BlobReclaimer> m_blobReclaimer;
 };
 
 } // namespace mail_system
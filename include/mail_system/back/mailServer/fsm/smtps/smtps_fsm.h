@@ -4,11 +4,17 @@
 #include "mail_system/back/mailServer/session/smtps_session.h"
 #include "mail_system/back/db/db_pool.h"
 #include "mail_system/back/db/db_service.h"
+#include "mail_system/back/mailServer/mail_services.h"
 #include "mail_system/back/thread_pool/thread_pool_base.h"
+#include "mail_system/back/mailServer/fsm/fsm_trace.h"
+#include <algorithm>
 #include <functional>
 #include <map>
 #include <string>
 #include <regex>
+#include <stdexcept>
+#include <unordered_set>
+#include <boost/algorithm/string.hpp>
 
 namespace mail_system {
 
@@ -21,41 +27,82 @@ protected:
     std::shared_ptr<ThreadPoolBase> m_ioThreadPool;
     std::shared_ptr<ThreadPoolBase> m_workerThreadPool;
     std::shared_ptr<DBPool> m_dbPool;
+    // 与POP3共用的存储和缓存组件，未配置数据库时为空
+    std::shared_ptr<MailServices> m_services;
+    // 邮件入库的组提交写入器，未配置数据库时为空
+    std::shared_ptr<MailBatchWriter> m_mailWriter;
+    // 数据库熔断器，收件人校验和邮件写入共用，未配置数据库时为空
+    std::shared_ptr<CircuitBreaker> m_dbBreaker;
+    // 登录凭据缓存，未配置数据库时为空
+    std::shared_ptr<CredentialCache> m_credentialCache;
+    // 本地收件人目录，RCPT TO时判定收件人是否存在，未启用时为空
+    std::shared_ptr<RecipientDirectory> m_recipientDirectory;
+    // 收件人的配额和用量缓存，未配置数据库时为空
+    std::shared_ptr<QuotaCache> m_quotaCache;
+    ServerConfig m_config;
+    std::shared_ptr<FsmTraceRecorder> m_traceRecorder;
 public:
+    // services为空时按config自行创建，通常由SmtpsServer创建后传入，与POP3共用
     SmtpsFsm(std::shared_ptr<ThreadPoolBase> io_thread_pool,
              std::shared_ptr<ThreadPoolBase> worker_thread_pool,
-             std::shared_ptr<DBPool> db_pool)
+             std::shared_ptr<DBPool> db_pool,
+             const ServerConfig& config,
+             std::shared_ptr<MailServices> services = nullptr)
         : m_ioThreadPool(io_thread_pool),
           m_workerThreadPool(worker_thread_pool),
-          m_dbPool(db_pool) {}
+          m_dbPool(db_pool),
+          m_services(services),
+          m_config(config) {
+        if (m_dbPool && !m_services) {
+            m_services = std::make_shared<MailServices>(m_dbPool, m_config);
+        }
+        if (m_services) {
+            m_mailWriter = m_services->mail_writer();
+            m_dbBreaker = m_services->db_breaker();
+            m_credentialCache = m_services->credential_cache();
+            m_recipientDirectory = m_services->recipient_directory();
+            m_quotaCache = m_services->quota_cache();
+        }
+    }
     virtual ~SmtpsFsm() = default;
 
     // 处理事件
     virtual void process_event(std::weak_ptr<SmtpsSession> session, SmtpsEvent event, const std::string& args) = 0;
 
+    // 与POP3共用的存储和缓存组件，未配置数据库时为空
+    std::shared_ptr<MailServices> services() const {
+        return m_services;
+    }
+
+    // 设置事件轨迹记录器，传入nullptr关闭记录
+    void set_trace_recorder(std::shared_ptr<FsmTraceRecorder> recorder) {
+        m_traceRecorder = recorder;
+    }
+
     // 获取状态名称
     static std::string get_state_name(SmtpsState state);
 
     // 获取事件名称
     static std::string get_event_name(SmtpsEvent event);
 
+    // Base64解码（SASL响应），输入不合法时返回false
+    static bool decode_base64(const std::string& input, std::string& output);
+
     // 数据库操作
 
-    bool auth_user(std::weak_ptr<SmtpsSession> session, const std::string& username, const std::string& password) {
+    // 校验登录凭据，UNAVAILABLE表示数据库暂不可用，调用方应回复临时错误
+    CredentialCache::Result auth_user(std::weak_ptr<SmtpsSession> session, const std::string& username,
+                                      const std::string& password) {
         auto s = session.lock();
         if (!s) {
             std::cerr << "Session is expired in auth_user" << std::endl;
-            return false;
+            return CredentialCache::Result::REJECTED;
         }
-        auto connection = m_dbPool->get_connection();
-        if (connection && connection->is_connected()) {
-            std::string sql = "SELECT * FROM users WHERE username = '" +
-                              connection->escape_string(username) + "' AND password = '" +
-                              connection->escape_string(password) + "'";
-            auto result = connection->query(sql);
-            return result->get_row_count();
+        if (!m_dbPool || !m_credentialCache) {
+            return CredentialCache::Result::REJECTED;
         }
-        return false;
+        int64_t userId = -1;
+        return m_credentialCache->verify(*m_dbPool, username, password, userId);
     }
 
     void get_mail_data(std::weak_ptr<SmtpsSession> session, std::string& mail_data) {
@@ -75,18 +122,112 @@ public:
         }
     }
 
-    void save_mail_data(mail* d) {
-        std::unique_ptr<mail> data;
-        data.reset(d);
-        auto connection = m_dbPool->get_connection();
-        if (connection && connection->is_connected()) {
-            std::string sql = "INSERT INTO mails (sender, recipient, subjiect, body) VALUES ('" +
-                              connection->escape_string(data->from) + "', '" +
-                              connection->escape_string(data->to) + "', '" +
-                              connection->escape_string(data->header) + "', '" +
-                              connection->escape_string(data->body) + "')";
-            connection->execute(sql);
+    // 批量校验整个信封的收件人，每个分片一次查询筛选出本地存在的地址
+    // 返回false表示数据库暂不可用，调用方应回复4xx临时错误
+    bool filter_local_recipients(const std::vector<std::string>& recipients, std::vector<std::string>& accepted) {
+        accepted.clear();
+        if (!m_dbPool) {
+            // 未配置数据库时无法校验，全部放行
+            accepted = recipients;
+            return true;
+        }
+        if (recipients.empty()) {
+            return true;
+        }
+        // 熔断期间不查询，调用方按数据库不可用处理
+        if (m_dbBreaker && !m_dbBreaker->allow_request()) {
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        bool ok = query_local_recipients(recipients, accepted);
+        if (m_dbBreaker) {
+            if (ok) {
+                m_dbBreaker->record_success(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start));
+            } else {
+                m_dbBreaker->record_failure();
+            }
+        }
+        return ok;
+    }
+
+    // 一次查询校验会话里推迟的收件人，按RCPT TO的顺序逐个回复250/550/452，
+    // 数据库不可用时全部回复451。在工作线程上执行
+    void flush_deferred_recipients(std::weak_ptr<SmtpsSession> session);
+
+    // 收件人再收size字节后是否超出配额
+    // 熔断期间或数据库不可用时不拒收，配额只是软限制，不值得因此让邮件退回重试
+    bool over_quota(const std::string& recipient, uint64_t size) {
+        if (!m_dbPool || !m_quotaCache) {
+            return false;
+        }
+        if (m_dbBreaker && !m_dbBreaker->is_closed()) {
+            return false;
+        }
+        return m_quotaCache->check(*m_dbPool, recipient, size) == QuotaCache::Result::OVER_QUOTA;
+    }
+
+private:
+    // 按分片查询收件人是否存在，任何一个分片失败都返回false
+    bool query_local_recipients(const std::vector<std::string>& recipients, std::vector<std::string>& accepted) {
+        // 用户按邮件地址分布在各分片上，收件人按分片分组
+        std::vector<std::vector<const std::string*>> groups(std::max<size_t>(m_dbPool->get_shard_count(), 1));
+        for (const auto& recipient : recipients) {
+            size_t shard = groups.size() == 1 ? 0 : m_dbPool->get_shard_index(recipient);
+            if (shard < groups.size()) {
+                groups[shard].push_back(&recipient);
+            }
+        }
+
+        // 数据库的排序规则不区分大小写，这里统一转成小写再匹配
+        std::unordered_set<std::string> existing;
+        for (size_t shard = 0; shard < groups.size(); ++shard) {
+            const auto& group = groups[shard];
+            if (group.empty()) {
+                continue;
+            }
+            auto connection = m_dbPool->get_shard_connection(shard, DBAccessMode::READ);
+            if (!connection || !connection->is_connected()) {
+                return false;
+            }
+            // 占位符个数向上取到2的幂，多出的位置重复最后一个地址，
+            // 100个收件人以内只有8种语句，不会挤占连接上的预处理语句缓存
+            size_t slots = 1;
+            while (slots < group.size()) {
+                slots <<= 1;
+            }
+            std::string sql = "SELECT mail_address FROM users WHERE mail_address IN (?";
+            for (size_t i = 1; i < slots; ++i) {
+                sql += ", ?";
+            }
+            sql += ")";
+            std::shared_ptr<IDBResult> result;
+            auto stmt = connection->prepare(sql);
+            if (stmt) {
+                bool bound = true;
+                for (size_t i = 0; i < slots && bound; ++i) {
+                    bound = stmt->bind(i, *group[std::min(i, group.size() - 1)]);
+                }
+                if (bound) {
+                    result = stmt->query();
+                }
+            }
+            connection.release();
+            if (!result) {
+                return false;
+            }
+
+            size_t column = result->get_column_index("mail_address");
+            for (size_t i = 0; i < result->get_row_count(); ++i) {
+                existing.insert(boost::algorithm::to_lower_copy(std::string(result->get_view(i, column))));
+            }
+        }
+        for (const auto& recipient : recipients) {
+            if (existing.count(boost::algorithm::to_lower_copy(recipient))) {
+                accepted.push_back(recipient);
+            }
         }
+        return true;
     }
 };
 
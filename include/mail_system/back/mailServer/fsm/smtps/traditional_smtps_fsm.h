@@ -2,39 +2,42 @@
 #define TRADITIONAL_SMTPS_FSM_H
 
 #include "smtps_fsm.h"
-#include <map>
-#include <functional>
+#include "mail_system/back/mailServer/fsm/fsm_engine.h"
+#include <ostream>
 
 namespace mail_system {
 
+template <>
+struct FsmEnumTraits<SmtpsState> {
+    static constexpr std::size_t count = static_cast<std::size_t>(SmtpsState::CLOSED) + 1;
+};
+
+template <>
+struct FsmEnumTraits<SmtpsEvent> {
+    static constexpr std::size_t count = static_cast<std::size_t>(SmtpsEvent::RSET) + 1;
+};
+
 // 传统的SMTPS状态机实现
 class TraditionalSmtpsFsm : public SmtpsFsm {
 public:
     TraditionalSmtpsFsm(std::shared_ptr<ThreadPoolBase> io_thread_pool,
              std::shared_ptr<ThreadPoolBase> worker_thread_pool,
-             std::shared_ptr<DBPool> db_pool);
+             std::shared_ptr<DBPool> db_pool,
+             const ServerConfig& config,
+             std::shared_ptr<MailServices> services = nullptr);
     ~TraditionalSmtpsFsm() override = default;
 
     // 处理事件
     void process_event(std::weak_ptr<SmtpsSession> session, SmtpsEvent event, const std::string& args) override;
 
+    // 输出各转换的命中次数
+    static void dump_transition_stats(std::ostream& os);
 
 private:
+    using Engine = FsmEngine<TraditionalSmtpsFsm, SmtpsState, SmtpsEvent, std::weak_ptr<SmtpsSession>>;
 
-    // 状态转换表类型
-    using StateTransitionTable = std::map<std::pair<SmtpsState, SmtpsEvent>, SmtpsState>;
-    
-    // 状态转换表
-    StateTransitionTable transition_table_;
-
-    // 状态处理函数表
-    std::map<SmtpsState, std::map<SmtpsEvent, StateHandler>> state_handlers_;
-
-    // 初始化状态转换表
-    void init_transition_table();
-
-    // 初始化状态处理函数
-    void init_state_handlers();
+    // 状态转换表，所有SMTPS状态机实例共享，计数按协议汇总
+    static const Engine& engine();
 
     // 状态处理函数 handle_[state]_[event]
     void handle_init_connect(std::weak_ptr<SmtpsSession> session, const std::string& args);
@@ -44,14 +47,21 @@ private:
     void handle_wait_auth_username(std::weak_ptr<SmtpsSession> session, const std::string& args);
     void handle_wait_auth_password(std::weak_ptr<SmtpsSession> session, const std::string& args);
 
+    // SASL辅助函数
+    void handle_plain_response(std::shared_ptr<SmtpsSession> s, const std::string& response);
+    void finish_auth(std::shared_ptr<SmtpsSession> s, const std::string& username, const std::string& password);
+    void cancel_auth(std::shared_ptr<SmtpsSession> s);
+
     void handle_wait_auth_mail_from(std::weak_ptr<SmtpsSession> session, const std::string& args);
+    // 解析MAIL FROM的SIZE参数，超出上限时回复552并返回false
+    bool accept_size_parameter(std::shared_ptr<SmtpsSession> s, const std::string& args);
 
     void handle_wait_mail_from_mail_from(std::weak_ptr<SmtpsSession> session, const std::string& args);
     void handle_wait_rcpt_to_rcpt_to(std::weak_ptr<SmtpsSession> session, const std::string& args);
     void handle_wait_data_data(std::weak_ptr<SmtpsSession> session, const std::string& args);
     void handle_in_message_data(std::weak_ptr<SmtpsSession> session, const std::string& args);
     void handle_in_message_data_end(std::weak_ptr<SmtpsSession> session, const std::string& args);
-    void handle_wait_quit_quit(std::weak_ptr<SmtpsSession> session, const std::string& args);
+    void handle_rset(std::weak_ptr<SmtpsSession> session, const std::string& args);
     void handle_error(std::weak_ptr<SmtpsSession> session, const std::string& args);
 };
 
@@ -0,0 +1,69 @@
+#ifndef MAIL_SYSTEM_MAIL_SERVICES_H
+#define MAIL_SYSTEM_MAIL_SERVICES_H
+
+#include "mail_system/back/mailServer/server_config.h"
+#include "mail_system/back/db/db_pool.h"
+#include "mail_system/back/db/circuit_breaker.h"
+#include "mail_system/back/storage/blob_store.h"
+#include "mail_system/back/storage/blob_reclaimer.h"
+#include "mail_system/back/storage/mail_spool.h"
+#include "mail_system/back/storage/mail_writer.h"
+#include "mail_system/back/cache/credential_cache.h"
+#include "mail_system/back/cache/quota_cache.h"
+#include "mail_system/back/cache/recipient_directory.h"
+#include <memory>
+
+namespace mail_system {
+
+class Pop3sFsmFactory;
+
+/**
+ * @brief 各协议共用的存储和缓存组件
+ *
+ * 按配置创建blob存储、邮件日志、数据库熔断器、组提交写入器、凭据缓存、配额缓存和收件人目录，
+ * 配置了blob存储时同时创建并启动blob回收线程。SMTP和POP3从同一个实例取得这些组件，
+ * POP3删除邮件后的用量变化立即反映到SMTP的配额检查上。
+ *
+ * 配置的blob存储或邮件日志不可用时抛出std::runtime_error，不能悄悄改成把正文写进数据库。
+ */
+class MailServices {
+public:
+    MailServices(std::shared_ptr<DBPool> db_pool, const ServerConfig& config);
+    ~MailServices();
+
+    MailServices(const MailServices&) = delete;
+    MailServices& operator=(const MailServices&) = delete;
+
+    std::shared_ptr<DBPool> db_pool() const { return m_dbPool; }
+    // 原始邮件的blob存储，未配置时为空
+    std::shared_ptr<BlobStore> blob_store() const { return m_blobStore; }
+    // 引用归零的blob由它回收，未配置blob存储时为空
+    std::shared_ptr<BlobReclaimer> blob_reclaimer() const { return m_blobReclaimer; }
+    // 数据库熔断器，收件人校验和邮件写入共用
+    std::shared_ptr<CircuitBreaker> db_breaker() const { return m_dbBreaker; }
+    // 邮件入库的组提交写入器
+    std::shared_ptr<MailBatchWriter> mail_writer() const { return m_mailWriter; }
+    // 登录凭据缓存，修改密码后通过它让旧凭据失效
+    std::shared_ptr<CredentialCache> credential_cache() const { return m_credentialCache; }
+    // 配额缓存，删除邮件的地方通过它减去用量，修改配额后通过它让旧值失效
+    std::shared_ptr<QuotaCache> quota_cache() const { return m_quotaCache; }
+    // 本地收件人目录，未启用时为空
+    std::shared_ptr<RecipientDirectory> recipient_directory() const { return m_recipientDirectory; }
+
+    // 创建共用这些组件的POP3状态机工厂
+    std::shared_ptr<Pop3sFsmFactory> make_pop3_fsm_factory() const;
+
+private:
+    std::shared_ptr<DBPool> m_dbPool;
+    std::shared_ptr<BlobStore> m_blobStore;
+    std::shared_ptr<BlobReclaimer> m_blobReclaimer;
+    std::shared_ptr<CircuitBreaker> m_dbBreaker;
+    std::shared_ptr<MailBatchWriter> m_mailWriter;
+    std::shared_ptr<CredentialCache> m_credentialCache;
+    std::shared_ptr<QuotaCache> m_quotaCache;
+    std::shared_ptr<RecipientDirectory> m_recipientDirectory;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_MAIL_SERVICES_H
@@ -24,6 +24,7 @@ struct ServerConfig {
 
     size_t maxMessageSize;            // 最大消息大小
     size_t maxConnections;            // 最大连接数
+    size_t max_recipients;            // 单个事务允许的最大收件人数
     
     // 线程池配置
     size_t io_thread_count;           // IO线程池大小
@@ -33,6 +34,17 @@ struct ServerConfig {
     // 数据库配置
     bool use_database;                // 是否使用数据库
     DBPoolConfig db_pool_config;     // 数据库连接池配置
+
+    // 存储配置
+    size_t mail_batch_size;          // 组提交时一批最多写入的邮件数，1表示逐封直接写入
+    uint32_t mail_batch_delay_ms;    // 凑批时最多等待的毫秒数
+    std::string blob_store_path;     // 原始邮件的blob存储目录，为空则正文存入mails.body
+    std::string spool_path;          // 邮件预写日志的目录，落盘后即回复250；为空则写库后才回复，数据库不可用时回复4xx
+    uint32_t spool_sync_delay_ms;    // 预写日志合并fsync时最多等待的毫秒数
+    uint32_t spool_segment_size_mb;  // 预写日志单个段文件的大小上限
+    uint32_t db_breaker_failures;    // 连续失败（或超时）多少次后熔断数据库写入
+    uint32_t db_breaker_latency_ms;  // 一次写入超过该毫秒数按失败计
+    uint32_t db_breaker_open_seconds; // 熔断后至少等待多少秒再探测数据库
     
     // 超时配置
     uint32_t connection_timeout;      // 连接超时时间（秒）
@@ -42,10 +54,20 @@ struct ServerConfig {
     // 安全配置
     bool require_auth;               // 是否要求认证
     size_t max_auth_attempts;        // 最大认证尝试次数
+    uint32_t credential_cache_ttl;   // 登录凭据缓存的有效期（秒），0表示不缓存
+    uint32_t credential_cache_negative_ttl; // 不存在的用户在缓存中的有效期（秒）
+    size_t credential_cache_size;    // 凭据缓存的最大条目数
+    uint32_t recipient_directory_poll_seconds;   // 收件人目录增量拉取新用户的间隔（秒），0表示不启用目录
+    uint32_t recipient_directory_reload_seconds; // 收件人目录全量重载的间隔（秒），用于去掉已删除的用户
+    uint32_t quota_cache_ttl;        // 缓存的配额和用量多久后重新从数据库读取（秒），0表示每次都读
+    size_t quota_cache_size;         // 配额缓存的最大条目数
     
     // 日志配置
     std::string log_level;           // 日志级别
     std::string log_file;            // 日志文件路径
+
+    // 调试配置
+    std::string fsm_trace_file;      // 状态机事件轨迹文件，为空则不记录
     
     ServerConfig()
         : address("0.0.0.0")
@@ -53,14 +75,29 @@ struct ServerConfig {
         , use_ssl(false)
         , maxMessageSize(1024 * 1024)  // 1MB
         , maxConnections(1000)
+        , max_recipients(100)
         , io_thread_count(std::thread::hardware_concurrency())
         , worker_thread_count(std::thread::hardware_concurrency())
         , use_database(false)
+        , mail_batch_size(64)
+        , mail_batch_delay_ms(5)
+        , spool_sync_delay_ms(2)
+        , spool_segment_size_mb(64)
+        , db_breaker_failures(5)
+        , db_breaker_latency_ms(2000)
+        , db_breaker_open_seconds(10)
         , connection_timeout(300)      // 5分钟
         , read_timeout(60)            // 1分钟
         , write_timeout(60)           // 1分钟
         , require_auth(true)
         , max_auth_attempts(3)
+        , credential_cache_ttl(300)
+        , credential_cache_negative_ttl(60)
+        , credential_cache_size(100000)
+        , recipient_directory_poll_seconds(5)
+        , recipient_directory_reload_seconds(600)
+        , quota_cache_ttl(60)
+        , quota_cache_size(100000)
         , log_level("info")
     {}
 
@@ -75,6 +112,7 @@ struct ServerConfig {
                   << "\ndhFile = " << dhFile
                   << "\nmaxMessageSize = " << maxMessageSize
                   << "\nmaxConnections = " << maxConnections
+                  << "\nmax_recipients = " << max_recipients
                   << "\nio_thread_count = " << io_thread_count
                   << "\nworker_thread_count = " << worker_thread_count
                   << "\nuse_database = " << (use_database ? "true" : "false")
@@ -82,13 +120,30 @@ struct ServerConfig {
         if (use_database) {
             db_pool_config.show();
         }
-        std::cout << "\nconnection_timeout = " << connection_timeout
+        std::cout << "\nmail_batch_size = " << mail_batch_size
+                  << "\nmail_batch_delay_ms = " << mail_batch_delay_ms
+                  << "\nblob_store_path = " << blob_store_path
+                  << "\nspool_path = " << spool_path
+                  << "\nspool_sync_delay_ms = " << spool_sync_delay_ms
+                  << "\nspool_segment_size_mb = " << spool_segment_size_mb
+                  << "\ndb_breaker_failures = " << db_breaker_failures
+                  << "\ndb_breaker_latency_ms = " << db_breaker_latency_ms
+                  << "\ndb_breaker_open_seconds = " << db_breaker_open_seconds
+                  << "\nconnection_timeout = " << connection_timeout
                   << "\nread_timeout = " << read_timeout
                   << "\nwrite_timeout = " << write_timeout
                   << "\nrequire_auth = " << (require_auth ? "true" : "false")
                   << "\nmax_auth_attempts = " << max_auth_attempts
+                  << "\ncredential_cache_ttl = " << credential_cache_ttl
+                  << "\ncredential_cache_negative_ttl = " << credential_cache_negative_ttl
+                  << "\ncredential_cache_size = " << credential_cache_size
+                  << "\nrecipient_directory_poll_seconds = " << recipient_directory_poll_seconds
+                  << "\nrecipient_directory_reload_seconds = " << recipient_directory_reload_seconds
+                  << "\nquota_cache_ttl = " << quota_cache_ttl
+                  << "\nquota_cache_size = " << quota_cache_size
                   << "\nlog_level = " << log_level
                   << "\nlog_file = " << log_file
+                  << "\nfsm_trace_file = " << fsm_trace_file
                   << std::endl;
     }
     
@@ -145,6 +200,7 @@ struct ServerConfig {
         dhFile = json_config.value("dhFile", dhFile);
         maxMessageSize = json_config.value("maxMessageSize", maxMessageSize);
         maxConnections = json_config.value("maxConnections", maxConnections);
+        max_recipients = json_config.value("max_recipients", max_recipients);
         io_thread_count = json_config.value("io_thread_count", io_thread_count);
         worker_thread_count = json_config.value("worker_thread_count", worker_thread_count);
         use_database = json_config.value("use_database", use_database);
@@ -152,13 +208,32 @@ struct ServerConfig {
             std::string db_config_file = json_config.value("db_config_file", "");
             db_pool_config.loadFromJson(db_config_file);
         }
+        mail_batch_size = json_config.value("mail_batch_size", mail_batch_size);
+        mail_batch_delay_ms = json_config.value("mail_batch_delay_ms", mail_batch_delay_ms);
+        blob_store_path = json_config.value("blob_store_path", blob_store_path);
+        spool_path = json_config.value("spool_path", spool_path);
+        spool_sync_delay_ms = json_config.value("spool_sync_delay_ms", spool_sync_delay_ms);
+        spool_segment_size_mb = json_config.value("spool_segment_size_mb", spool_segment_size_mb);
+        db_breaker_failures = json_config.value("db_breaker_failures", db_breaker_failures);
+        db_breaker_latency_ms = json_config.value("db_breaker_latency_ms", db_breaker_latency_ms);
+        db_breaker_open_seconds = json_config.value("db_breaker_open_seconds", db_breaker_open_seconds);
         connection_timeout = json_config.value("connection_timeout", connection_timeout);
         read_timeout = json_config.value("read_timeout", read_timeout);
         write_timeout = json_config.value("write_timeout", write_timeout);
         require_auth = json_config.value("require_auth", require_auth);
         max_auth_attempts = json_config.value("max_auth_attempts", max_auth_attempts);
+        credential_cache_ttl = json_config.value("credential_cache_ttl", credential_cache_ttl);
+        credential_cache_negative_ttl = json_config.value("credential_cache_negative_ttl", credential_cache_negative_ttl);
+        credential_cache_size = json_config.value("credential_cache_size", credential_cache_size);
+        recipient_directory_poll_seconds = json_config.value("recipient_directory_poll_seconds",
+                                                             recipient_directory_poll_seconds);
+        recipient_directory_reload_seconds = json_config.value("recipient_directory_reload_seconds",
+                                                               recipient_directory_reload_seconds);
+        quota_cache_ttl = json_config.value("quota_cache_ttl", quota_cache_ttl);
+        quota_cache_size = json_config.value("quota_cache_size", quota_cache_size);
         log_level = json_config.value("log_level", log_level);
         log_file = json_config.value("log_file", log_file);
+        fsm_trace_file = json_config.value("fsm_trace_file", fsm_trace_file);
 
         return true;
     }
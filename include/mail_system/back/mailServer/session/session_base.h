@@ -33,6 +33,9 @@ public:
     // 获取客户端地址
     std::string get_client_ip() const;
 
+    // 获取会话ID（进程内唯一）
+    uint64_t get_session_id() const;
+
     boost::asio::ssl::stream<boost::asio::ip::tcp::socket>& get_ssl_socket();
 
     mail* get_mail();
@@ -41,14 +44,17 @@ public:
     void set_server(ServerBase* server);
 
     // 执行SSL握手
-    void do_handshake(std::function<void(std::weak_ptr<SessionBase> session, const boost::system::error_code&)> callback);
+    virtual void do_handshake(std::function<void(std::weak_ptr<SessionBase> session, const boost::system::error_code&)> callback);
 
 
     // 异步读取数据
-    void async_read(std::function<void(const boost::system::error_code&, std::size_t)> callback = nullptr);
+    virtual void async_read(std::function<void(const boost::system::error_code&, std::size_t)> callback = nullptr);
 
     // 异步写入数据
-    void async_write(const std::string& data, std::function<void(const boost::system::error_code&)> callback = nullptr);
+    virtual void async_write(const std::string& data, std::function<void(const boost::system::error_code&)> callback = nullptr);
+
+    // 一次写入完成后继续处理输入，默认直接读取下一段数据
+    virtual void read_next();
 
     // 处理接收到的数据（由派生类实现）
     virtual void handle_read(const std::string& data) = 0;
@@ -82,6 +88,9 @@ protected:
 
     // 会话是否已关闭
     bool closed_;
+
+    // 会话ID
+    uint64_t session_id_;
     public:
     // 指向服务器的指针，用于访问IO线程池
     ServerBase* m_server;
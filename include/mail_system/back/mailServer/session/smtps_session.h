@@ -36,24 +36,50 @@ enum class SmtpsEvent {
     DATA_END,        // 收到数据结束标记（.）
     QUIT,            // 收到QUIT命令
     ERROR,           // 发生错误
-    TIMEOUT          // 超时
+    TIMEOUT,         // 超时
+    RSET             // 收到RSET命令（追加在末尾，保持已录制轨迹中的事件编号不变）
+};
+
+// 推迟回复的RCPT TO：reply为空的等待数据库校验，否则在前面的收件人回复之后原样回复
+struct DeferredRecipient {
+    std::string address;
+    std::string reply;
 };
 
 // SMTP会话上下文
 struct SmtpsContext {
     std::string client_hostname;     // 客户端主机名
     std::string client_username;     // 客户端用户名
+    std::string auth_mechanism;      // 正在进行的SASL机制（PLAIN/LOGIN）
+    size_t auth_failures = 0;        // 认证失败次数
     std::string sender_address;      // 发件人地址
     std::vector<std::string> recipient_addresses;  // 收件人地址列表
+    std::vector<std::string> unconfirmed_recipients; // 只经内存目录确认的收件人，DATA时再向数据库确认
+    std::vector<DeferredRecipient> deferred_recipients; // 还没有回复的RCPT TO，一组RCPT TO结束时一次查询后按顺序回复
+    uint64_t declared_size = 0;      // MAIL FROM的SIZE参数，没有给出时为0
     // std::string message_data;        // 邮件内容
-    bool is_authenticated;           // 是否已认证
+    bool is_authenticated = false;   // 是否已认证
     
+    // 清理当前邮件事务（MAIL FROM/RCPT TO），保留连接级别的状态
+    void clear_transaction() {
+        sender_address.clear();
+        recipient_addresses.clear();
+        unconfirmed_recipients.clear();
+        deferred_recipients.clear();
+        declared_size = 0;
+    }
+
     // 清理上下文数据
     void clear() {
         client_hostname.clear();
         client_username.clear();
+        auth_mechanism.clear();
+        auth_failures = 0;
         sender_address.clear();
         recipient_addresses.clear();
+        unconfirmed_recipients.clear();
+        deferred_recipients.clear();
+        declared_size = 0;
         // message_data.clear();
         is_authenticated = false;
     }
@@ -79,12 +105,24 @@ public:
         stay_times = 0;
     }
 
+    // 命令没有产生回复（例如收件人被推迟校验）时，由状态机调用以继续处理已收到的命令
+    virtual void continue_commands();
+
 protected:
     // 处理接收到的数据
     void handle_read(const std::string& data) override;
+
+    // 上一条回复写完后再处理缓冲中的下一条命令，状态在写完成的回调里更新
+    void read_next() override;
+
+    // 逐条处理缓冲中完整的命令行；推迟校验的收件人在一组RCPT TO结束时先统一回复
+    void process_buffered_commands();
     
     void process_command(const std::string& command);
 
+    // 邮件数据接收完毕：去掉结束标记、还原点号转义并拆分邮件头和正文
+    void finish_message();
+
 public:
     SmtpsContext context_;           // 会话上下文
 
@@ -94,6 +132,7 @@ private:
     std::shared_ptr<SmtpsFsm> m_fsm;  // 状态机
     SmtpsState current_state_;      // 当前状态
     bool m_receivingData;            // 是否在接收数据模式
+    std::string m_commandBuffer;     // 已收到但还没处理的命令（客户端可以流水线发送多条）
 };
 
 } // namespace mail_system
@@ -4,6 +4,7 @@
 #include "server_base.h"
 #include "fsm/smtps/smtps_fsm.h"
 #include "fsm/smtps/traditional_smtps_fsm.h"
+#include "mail_services.h"
 #include "mail_system/back/mailServer/session/smtps_session.h"
 
 namespace mail_system {
@@ -16,11 +17,18 @@ namespace mail_system {
          std::shared_ptr<DBPool> dbPool = nullptr);
         virtual ~SmtpsServer() override;
 
+        // 与POP3共用的存储和缓存组件，POP3服务器通过它的make_pop3_fsm_factory()创建状态机工厂
+        std::shared_ptr<MailServices> services() const {
+            return m_services;
+        }
+
     protected:
         // 处理新连接
         void handle_accept(std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket >>&& ssl_socket,
              const boost::system::error_code& error);
 
+        // 各协议共用的存储和缓存，blob回收线程也在这里启动
+        std::shared_ptr<MailServices> m_services;
         std::shared_ptr<SmtpsFsm> m_fsm;
     };
 
@@ -0,0 +1,66 @@
+#ifndef MAIL_SYSTEM_BLOB_RECLAIMER_H
+#define MAIL_SYSTEM_BLOB_RECLAIMER_H
+
+#include "mail_system/back/db/db_pool.h"
+#include "mail_system/back/storage/blob_store.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace mail_system {
+
+/**
+ * @brief 回收引用归零的blob
+ *
+ * 邮件删除提交后，原来引用的blob在BlobStore中登记为待回收，并立即尝试回收一次。
+ * 刚被其他写入方复用过的blob（修改时间在grace之内）暂不删除，留待后台线程每隔interval重试，
+ * 登记保存在磁盘上，进程重启后继续处理。
+ *
+ * 一个blob可能被多个分片的mails行引用，回收前逐个分片确认没有引用；
+ * 已经重新被引用的blob取消登记，等那封邮件删除时再登记。
+ */
+class BlobReclaimer {
+public:
+    BlobReclaimer(std::shared_ptr<DBPool> db_pool, std::shared_ptr<BlobStore> blob_store,
+                  std::chrono::seconds grace = std::chrono::seconds(600),
+                  std::chrono::seconds interval = std::chrono::seconds(300));
+    ~BlobReclaimer();
+
+    BlobReclaimer(const BlobReclaimer&) = delete;
+    BlobReclaimer& operator=(const BlobReclaimer&) = delete;
+
+    // 启动后台重试线程
+    void start();
+    // 停止后台线程，未回收的登记留到下次启动
+    void stop();
+
+    // 登记一个不再被本邮件引用的blob并尝试回收，删除邮件的事务提交后调用
+    void release(const std::string& hash);
+    // 处理所有登记，返回删除的blob数
+    size_t sweep();
+
+private:
+    // 尝试回收一个已登记的blob，返回是否删除了文件；已无须处理的登记在这里取消
+    bool try_reclaim(const std::string& hash);
+    // 逐个分片查询blob是否仍被引用，查询失败返回false
+    bool check_references(const std::string& hash, bool& referenced);
+    void sweeper_thread();
+
+    std::shared_ptr<DBPool> m_dbPool;
+    std::shared_ptr<BlobStore> m_blobStore;
+    std::chrono::seconds m_grace;
+    std::chrono::seconds m_interval;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running;
+    std::thread m_thread;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_BLOB_RECLAIMER_H
@@ -0,0 +1,93 @@
+#ifndef MAIL_SYSTEM_BLOB_STORE_H
+#define MAIL_SYSTEM_BLOB_STORE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mail_system {
+
+/**
+ * @brief 按内容寻址的本地blob存储，用来存放原始邮件
+ *
+ * 每个blob以内容的SHA-256命名，存放在 root/ab/cd/<hash>，两级目录各256个分片，
+ * 单个目录下的文件数不会过多。相同内容只存一份。
+ *
+ * 写入先落到 root/tmp 下的临时文件，fsync后rename到最终位置，再fsync所在目录，
+ * 读者要么看不到文件，要么看到完整的内容。批量写入时所有文件先写完，
+ * 同一目录只fsync一次。打开时删除已经退出的进程留下的临时文件。
+ *
+ * 引用归零的blob在 root/reclaim 下登记一个同名的空文件，回收成功或重新被引用后删除，
+ * 进程重启后登记仍在，由BlobReclaimer继续回收。
+ */
+class BlobStore {
+public:
+    explicit BlobStore(const std::string& root);
+
+    BlobStore(const BlobStore&) = delete;
+    BlobStore& operator=(const BlobStore&) = delete;
+
+    // 根目录是否可用
+    bool is_open() const;
+    const std::string& get_root() const;
+
+    // 写入一个blob，hash返回内容的SHA-256（十六进制小写）
+    bool put(const std::string& data, std::string& hash);
+    // 批量写入，hashes与blobs一一对应；任何一个失败都返回false
+    bool put_batch(const std::vector<const std::string*>& blobs, std::vector<std::string>& hashes);
+
+    // 读取整个blob
+    bool read(const std::string& hash, std::string& data) const;
+    // 打开blob用于流式读取
+    bool open(const std::string& hash, std::ifstream& stream) const;
+    // blob是否存在
+    bool exists(const std::string& hash) const;
+    // blob大小，不存在返回-1
+    int64_t size(const std::string& hash) const;
+    // 删除blob，不存在也视为成功
+    bool remove(const std::string& hash);
+    // blob超过min_idle没有被写入或复用时才删除，返回是否删除了文件
+    // 用于引用计数归零后的回收：并发写入同样内容的一方可能已经复用了这个blob但还没提交
+    bool remove_if_idle(const std::string& hash, std::chrono::seconds min_idle);
+
+    // 登记待回收的blob，重复登记无副作用
+    bool mark_released(const std::string& hash);
+    // 所有已登记待回收的blob
+    std::vector<std::string> list_released() const;
+    // 取消登记
+    void clear_released(const std::string& hash);
+
+    // blob的存放路径
+    std::string path_for(const std::string& hash) const;
+
+    // 计算SHA-256，返回十六进制小写字符串
+    static std::string compute_hash(const std::string& data);
+
+private:
+    // hash必须是64位十六进制，防止路径穿越
+    static bool is_valid_hash(const std::string& hash);
+    // 写临时文件并fsync，成功时返回临时文件路径
+    bool write_temp(const std::string& data, const std::string& hash, std::string& temp_path);
+    static bool sync_directory(const std::string& dir);
+    // 刷新已有blob的修改时间，blob不存在返回false
+    bool touch(const std::string& hash);
+    // 删除已经退出的进程写了一半的临时文件
+    void remove_stale_temp_files();
+
+    std::string m_root;
+    std::string m_tempDir;
+    std::string m_reclaimDir;
+    bool m_open;
+    std::atomic<uint64_t> m_tempCounter;
+    // 复用已有blob时的刷新和remove_if_idle的检查、删除互斥，
+    // 不会出现复用方以为blob还在、回收方却已经按旧的修改时间把它删掉
+    std::mutex m_reuseMutex;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_BLOB_STORE_H
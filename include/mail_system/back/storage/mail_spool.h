@@ -0,0 +1,142 @@
+#ifndef MAIL_SYSTEM_MAIL_SPOOL_H
+#define MAIL_SYSTEM_MAIL_SPOOL_H
+
+#include "mail_system/back/entities/mail.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mail_system {
+
+/**
+ * @brief 邮件的预写日志（WAL）
+ *
+ * 邮件连同信封追加到分段的只追加日志 dir/<序号>.wal，每条记录带长度和CRC32。
+ * 追加只做write，后台刷盘线程每sync_delay把这段时间内所有会话追加的记录一次fdatasync，
+ * 落盘后再逐条回调，调用方在回调里回复250。并发的会话共享一次fsync，不必每封邮件一次。
+ *
+ * 邮件写入数据库之后remove追加一条完成记录；最老的段中没有待处理的邮件时整段删除。
+ * 启动时按顺序扫描所有段，没有完成记录的邮件就是待回放的邮件，最后一段末尾不完整的记录被截掉。
+ *
+ * 每条待处理的邮件同一时间只属于一个处理者：append追加的记录由调用方占用，
+ * load取出的记录由回放方占用，处理完后remove，或者release交还给回放线程。
+ *
+ * 无法解析的记录另存到 dir/bad，不再参与回放，由管理员处理。
+ */
+class MailSpool {
+public:
+    // 日志中的一封邮件
+    struct Entry {
+        uint64_t id;
+        std::unique_ptr<mail> data;
+        std::vector<std::string> recipients;
+    };
+    // ok为true时记录已经落盘，id用于remove和release
+    using AppendCallback = std::function<void(bool ok, uint64_t id)>;
+
+    MailSpool(const std::string& dir, uint32_t sync_delay_ms = 2, size_t segment_size = 64 * 1024 * 1024);
+    ~MailSpool();
+
+    MailSpool(const MailSpool&) = delete;
+    MailSpool& operator=(const MailSpool&) = delete;
+
+    // 目录是否可用
+    bool is_open() const;
+    const std::string& get_dir() const;
+
+    // 异步追加一封邮件，落盘后在刷盘线程上回调，回调中不要做耗时操作；记录由调用方占用
+    void append(const mail& data, const std::vector<std::string>& recipients, AppendCallback callback);
+    // 同步追加，返回true时已经落盘；记录不被占用，由回放线程取走
+    bool store(const mail& data, const std::vector<std::string>& recipients);
+    // 按写入顺序取出最多max_count封未被占用的邮件，取出的记录由调用方占用
+    std::vector<Entry> load(size_t max_count);
+    // 放弃占用，记录留给回放线程
+    void release(uint64_t id);
+    // 邮件已经写入数据库，追加完成记录
+    bool remove(uint64_t id);
+    // 多次回放失败的邮件另存到bad目录（<时间>-<id>.rec，不覆盖已有文件），然后从日志中移除
+    bool quarantine(uint64_t id);
+
+    // 停止接收新的追加，已追加的记录刷盘并回调后返回；remove等操作仍然可用
+    void close();
+
+    // 日志中待处理的邮件数
+    size_t pending_count() const;
+    // fdatasync次数，与追加次数对比可以看出合并的效果
+    uint64_t sync_count() const;
+
+private:
+    // 一个日志段
+    struct Segment {
+        uint64_t seq;
+        std::string path;
+        int fd;
+        uint64_t size;
+        size_t live;                // 段中待处理的邮件数
+        ~Segment();
+    };
+    // 一封待处理的邮件在日志中的位置
+    struct Location {
+        std::shared_ptr<Segment> segment;
+        uint64_t offset;            // 记录的起始位置
+        uint32_t length;            // 记录的总长度
+        bool claimed;
+    };
+    struct Waiter {
+        uint64_t id;
+        AppendCallback callback;
+    };
+
+    // 扫描已有的段，重建待处理邮件的索引，调用方需持有m_mutex
+    bool recover();
+    // 扫描一个段，返回有效数据的长度
+    uint64_t scan_segment(const std::shared_ptr<Segment>& segment, uint64_t file_size);
+    // 打开一个新段作为当前段，调用方需持有m_mutex
+    bool open_segment(uint64_t seq);
+    // 当前段已满时切换到新段，旧段随下一次刷盘落盘，调用方需持有m_mutex
+    bool rotate_if_needed(size_t incoming);
+    // 追加一条记录到当前段，调用方需持有m_mutex
+    bool write_record(const std::string& record, uint64_t& offset);
+    // 删除最老的已经全部处理完的段，调用方需持有m_mutex
+    void drop_finished_segments();
+    // 读出一条记录的内容
+    bool read_record(const Location& location, std::string& payload) const;
+    void flusher_thread();
+
+    static std::string make_record(uint8_t type, uint64_t id, const std::string& payload);
+    static void encode(const mail& data, const std::vector<std::string>& recipients, std::string& out);
+    static bool decode(const std::string& in, Entry& entry);
+    static bool sync_directory(const std::string& dir);
+
+    std::string m_dir;
+    std::string m_badDir;
+    std::chrono::milliseconds m_syncDelay;
+    size_t m_segmentSize;
+    bool m_open;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_flushCv;
+    bool m_accepting;
+    std::atomic<uint64_t> m_nextId;
+    std::map<uint64_t, std::shared_ptr<Segment>> m_segments;
+    std::shared_ptr<Segment> m_active;
+    std::map<uint64_t, Location> m_index;
+    std::vector<Waiter> m_waiters;
+    // 上次刷盘后写过的段
+    std::vector<std::shared_ptr<Segment>> m_dirty;
+    size_t m_unsyncedBytes;
+    std::thread m_flusher;
+    std::atomic<uint64_t> m_syncs;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_MAIL_SPOOL_H
@@ -0,0 +1,162 @@
+#ifndef MAIL_SYSTEM_MAIL_WRITER_H
+#define MAIL_SYSTEM_MAIL_WRITER_H
+
+#include "mail_system/back/db/circuit_breaker.h"
+#include "mail_system/back/db/db_pool.h"
+#include "mail_system/back/entities/mail.h"
+#include "mail_system/back/storage/blob_store.h"
+#include "mail_system/back/storage/mail_spool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mail_system {
+
+/**
+ * @brief 邮件入库的组提交写入器
+ *
+ * 各会话收完的邮件先进入同一个队列，后台线程按条数或等待时间凑成一批，
+ * 在一个事务里用多行INSERT写入mails和mail_mailbox，提交后再逐封回调。
+ * 一批邮件只需要一次redo日志刷盘；调用方在回调里回复250，
+ * 所以客户端收到250时邮件已经落库。
+ *
+ * 配置了blob存储时，原始邮件按内容寻址写入blob存储（整批共享目录fsync），
+ * mails表只保存hash、大小和主题；否则正文直接写入mails.body。
+ *
+ * 一封邮件无论有多少收件人都只写一行mails，每个收件人一条mail_mailbox记录，
+ * mails.ref_count是引用它的mail_mailbox记录数，由删除方递减，减到0时删除邮件。
+ *
+ * 数据库按用户分片时，一封邮件按收件人所在分片拆开，每个分片写一行mails和本分片用户的记录。
+ *
+ * max_batch_size为1且没有配置预写日志时不启动后台线程，submit在调用线程上直接写入。
+ *
+ * 配置了预写日志（MailSpool）时，邮件先追加到日志，与其他会话的邮件共享一次fsync，
+ * 落盘后立即回调成功，写库在后台完成，成功后在日志中标记完成。
+ * 写库失败或熔断期间邮件留在日志里，后台回放线程在熔断器恢复后按顺序写回数据库，
+ * 启动时日志中未完成的邮件也由它回放，客户端不会因为数据库故障收到4xx。
+ *
+ * 配置了熔断器时，每次写库的结果和耗时都记入熔断器；熔断期间不再访问数据库，
+ * 回放线程每秒尝试一次探测。
+ */
+class MailBatchWriter {
+public:
+    // ok为false表示写入失败，调用方应回复4xx让客户端稍后重试
+    using CommitCallback = std::function<void(bool ok)>;
+
+    MailBatchWriter(std::shared_ptr<DBPool> db_pool, size_t max_batch_size, uint32_t max_batch_delay_ms,
+                    std::shared_ptr<BlobStore> blob_store = nullptr,
+                    std::shared_ptr<MailSpool> spool = nullptr,
+                    std::shared_ptr<CircuitBreaker> breaker = nullptr);
+    ~MailBatchWriter();
+
+    MailBatchWriter(const MailBatchWriter&) = delete;
+    MailBatchWriter& operator=(const MailBatchWriter&) = delete;
+
+    /**
+     * @brief 提交一封邮件
+     *
+     * @param data 邮件内容
+     * @param recipients 已校验过的本地收件人，每人在收件箱中得到一条mail_mailbox记录
+     * @param callback 所在批次提交或失败后调用，运行在写入线程上，不要做耗时操作
+     */
+    void submit(std::unique_ptr<mail> data, std::vector<std::string> recipients, CommitCallback callback);
+
+    // 停止后台线程，队列中剩余的邮件写完后才返回
+    void stop();
+
+    // 已提交的批次数
+    uint64_t batch_count() const;
+    // 已写入的邮件数
+    uint64_t mail_count() const;
+    // 写入预写日志的邮件数
+    uint64_t spooled_count() const;
+
+    // 数据库熔断中
+    bool is_degraded() const;
+    // 数据库不可用时能否先把邮件写入预写日志
+    bool can_spool() const;
+
+private:
+    struct PendingMail {
+        std::unique_ptr<mail> data;
+        std::vector<std::string> recipients;
+        CommitCallback callback;
+        std::vector<char> committed_shards;     // 已经提交过的分片，重试时跳过
+        uint64_t spool_id = 0;                  // 预写日志中的记录，0表示不在日志中
+    };
+    using Batch = std::vector<PendingMail>;
+
+    // 一封邮件落在某个分片上的收件人
+    struct ShardMail {
+        size_t index;                           // 在Batch中的下标
+        std::vector<std::string> recipients;
+    };
+    // blob存储中的hash和大小，下标从begin开始
+    struct BlobRefs {
+        size_t begin;
+        const std::vector<std::string>& hashes;
+        const std::vector<size_t>& sizes;
+    };
+
+    // 放入写库队列，已停止时预写日志中的邮件留给下次启动回放
+    void enqueue(PendingMail pending);
+    void writer_thread();
+    void replayer_thread();
+    // 熔断期间探测各分片，探测结果决定熔断器是否恢复
+    void probe_database();
+    // 每个分片执行一次SELECT 1，不记入熔断器
+    bool database_reachable();
+    // 把暂存区的邮件写回数据库，直到暂存区清空、熔断或没有进展
+    void replay_spool();
+    // 写库一次，结果和耗时记入熔断器
+    bool write_batch_guarded(Batch& batch, size_t begin, size_t end);
+    // 整批失败后逐封重试有成功的，向熔断器报告数据库可用
+    void record_partial_success(const std::vector<char>& results);
+    // 把邮件尚未提交的分片上的收件人写入预写日志
+    bool spool_mail(const PendingMail& pending);
+    // 预写日志中的邮件写库后的收尾：成功时标记完成，部分分片成功时另存剩余收件人，
+    // 否则交还给回放线程；返回邮件是否已经不在日志中等待
+    bool finish_spooled(const PendingMail& pending, bool ok);
+    // [begin, end) 内的邮件按分片拆开，每个分片一个事务，失败时回滚该分片
+    bool write_batch(Batch& batch, size_t begin, size_t end);
+    // 在一个分片上写入items中的邮件和该分片用户的收件箱记录
+    bool write_shard(size_t shard, Batch& batch, const std::vector<ShardMail>& items, const BlobRefs& blobs);
+    // 生成一条INSERT语句的插入令牌前缀
+    std::string next_insert_token();
+    // 写入并逐封回调；整批失败时逐封单独重试，避免一封坏邮件拖累整批
+    void commit_batch(Batch& batch);
+
+    std::shared_ptr<DBPool> m_dbPool;
+    std::shared_ptr<BlobStore> m_blobStore;
+    std::shared_ptr<MailSpool> m_spool;
+    std::shared_ptr<CircuitBreaker> m_breaker;
+    size_t m_maxBatchSize;
+    std::chrono::milliseconds m_maxBatchDelay;
+    std::deque<PendingMail> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_running;
+    std::thread m_thread;
+    std::condition_variable m_replayCv;
+    std::thread m_replayThread;
+    // 日志中的邮件单独回放失败的次数，只在回放线程上访问
+    std::unordered_map<uint64_t, unsigned int> m_replayFailures;
+    std::atomic<uint64_t> m_batchCount;
+    std::atomic<uint64_t> m_mailCount;
+    std::atomic<uint64_t> m_spooledCount;
+    uint64_t m_tokenPrefix;             // 写入mails.insert_token的随机前缀
+    std::atomic<uint64_t> m_tokenSequence;
+};
+
+} // namespace mail_system
+
+#endif // MAIL_SYSTEM_MAIL_WRITER_H
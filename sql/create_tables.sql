@@ -5,23 +5,31 @@ CREATE TABLE IF NOT EXISTS users (
     password VARCHAR(255) NOT NULL COMMENT '加密存储的密码',
     name VARCHAR(100) NOT NULL COMMENT '用户名称',
     telephone VARCHAR(20) COMMENT '电话号码',
+    quota_bytes BIGINT NOT NULL DEFAULT 0 COMMENT '邮箱配额（字节），0表示不限制；用量见mailbox_stats.total_bytes',
     register_time TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP COMMENT '注册时间',
-    INDEX idx_mail_address (mail_address)
+    updated_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP COMMENT '最后修改时间，凭据缓存据此失效',
+    INDEX idx_mail_address (mail_address),
+    INDEX idx_updated_at (updated_at)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='用户信息表';
 
 -- 创建邮件表
 CREATE TABLE IF NOT EXISTS mails (
     id BIGINT PRIMARY KEY AUTO_INCREMENT,
     sender VARCHAR(255) NOT NULL COMMENT '发件人邮箱地址',
-    recipient VARCHAR(255) NOT NULL COMMENT '收件人邮箱地址',
+    recipient TEXT NOT NULL COMMENT '收件人邮箱地址，逗号分隔，仅供展示；投递关系见mail_mailbox',
     subject VARCHAR(255) NOT NULL COMMENT '邮件主题',
-    body TEXT COMMENT '邮件正文',
+    body TEXT COMMENT '邮件正文（未启用blob存储时使用）',
+    body_hash CHAR(64) NULL COMMENT '原始邮件在blob存储中的SHA-256',
+    body_size BIGINT NOT NULL DEFAULT 0 COMMENT '原始邮件大小（字节）',
+    ref_count INT NOT NULL DEFAULT 0 COMMENT '引用本邮件的mail_mailbox记录数，归零时删除邮件',
+    insert_token VARCHAR(48) NULL COMMENT '批量写入时用于读回自增ID的令牌',
     send_time TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP COMMENT '发送时间',
     is_draft BOOLEAN NOT NULL DEFAULT FALSE COMMENT '是否为草稿',
     is_read BOOLEAN NOT NULL DEFAULT FALSE COMMENT '是否已读',
     INDEX idx_sender (sender),
-    INDEX idx_recipient (recipient),
-    INDEX idx_send_time (send_time)
+    INDEX idx_send_time (send_time),
+    INDEX idx_body_hash (body_hash),
+    INDEX idx_insert_token (insert_token)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='邮件信息表';
 
 -- 创建附件表
@@ -59,6 +67,8 @@ CREATE TABLE IF NOT EXISTS mail_mailbox (
     is_starred BOOLEAN NOT NULL DEFAULT FALSE COMMENT '是否标星',
     is_important BOOLEAN NOT NULL DEFAULT FALSE COMMENT '是否重要',
     is_deleted BOOLEAN NOT NULL DEFAULT FALSE COMMENT '是否已删除',
+    is_read BOOLEAN NOT NULL DEFAULT FALSE COMMENT '该用户是否已读',
+    uid BIGINT NOT NULL DEFAULT 0 COMMENT '邮箱内单调递增的编号，由触发器分配',
     add_time TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP COMMENT '添加时间',
     FOREIGN KEY (mail_id) REFERENCES mails(id) ON DELETE CASCADE,
     FOREIGN KEY (mailbox_id) REFERENCES mailboxes(id) ON DELETE CASCADE,
@@ -66,9 +76,23 @@ CREATE TABLE IF NOT EXISTS mail_mailbox (
     UNIQUE KEY uk_mail_box_user (mail_id, mailbox_id, user_id),
     INDEX idx_mail_id (mail_id),
     INDEX idx_mailbox_id (mailbox_id),
+    INDEX idx_mailbox_uid (mailbox_id, uid),
     INDEX idx_user_id (user_id)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='邮件-邮箱关联表';
 
+-- 创建邮箱统计表
+-- 由mail_mailbox上的触发器随投递、标记已读/删除、移动和删除同步维护，读邮箱摘要只需一次主键查询
+-- 注意：外键级联删除不触发触发器，直接删除mails行前应先删除对应的mail_mailbox记录，
+-- 否则用rebuild_mailbox_stats修正
+CREATE TABLE IF NOT EXISTS mailbox_stats (
+    mailbox_id BIGINT PRIMARY KEY COMMENT '邮箱ID',
+    message_count BIGINT NOT NULL DEFAULT 0 COMMENT '未删除的邮件数',
+    unread_count BIGINT NOT NULL DEFAULT 0 COMMENT '未删除且未读的邮件数',
+    total_bytes BIGINT NOT NULL DEFAULT 0 COMMENT '未删除邮件的总大小（字节）',
+    next_uid BIGINT NOT NULL DEFAULT 1 COMMENT '下一封投递的邮件的uid',
+    FOREIGN KEY (mailbox_id) REFERENCES mailboxes(id) ON DELETE CASCADE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='邮箱统计表';
+
 -- 创建系统默认邮箱的存储过程
 DELIMITER //
 CREATE PROCEDURE create_default_mailboxes(IN p_user_id BIGINT)
@@ -95,6 +119,99 @@ BEGIN
 END //
 DELIMITER ;
 
+-- 新建邮箱时创建统计行
+DELIMITER //
+CREATE TRIGGER after_mailbox_insert
+AFTER INSERT ON mailboxes
+FOR EACH ROW
+BEGIN
+    INSERT IGNORE INTO mailbox_stats (mailbox_id) VALUES (NEW.id);
+END //
+DELIMITER ;
+
+-- 投递：分配uid并累加统计
+-- 放在BEFORE触发器里才能给NEW.uid赋值；语句失败时触发器的修改随语句一起回滚
+DELIMITER //
+CREATE TRIGGER before_mail_mailbox_insert
+BEFORE INSERT ON mail_mailbox
+FOR EACH ROW
+BEGIN
+    DECLARE v_uid BIGINT;
+    DECLARE v_size BIGINT DEFAULT 0;
+    SELECT body_size INTO v_size FROM mails WHERE id = NEW.mail_id;
+    INSERT IGNORE INTO mailbox_stats (mailbox_id) VALUES (NEW.mailbox_id);
+    -- 锁住统计行，同一邮箱的并发投递按顺序分配uid
+    SELECT next_uid INTO v_uid FROM mailbox_stats WHERE mailbox_id = NEW.mailbox_id FOR UPDATE;
+    SET NEW.uid = v_uid;
+    UPDATE mailbox_stats
+    SET next_uid = v_uid + 1,
+        message_count = message_count + IF(NEW.is_deleted, 0, 1),
+        unread_count = unread_count + IF(NEW.is_deleted OR NEW.is_read, 0, 1),
+        total_bytes = total_bytes + IF(NEW.is_deleted, 0, v_size)
+    WHERE mailbox_id = NEW.mailbox_id;
+END //
+DELIMITER ;
+
+-- 标记已读/删除或移动到其他邮箱：从旧邮箱减去，再加到新邮箱
+DELIMITER //
+CREATE TRIGGER after_mail_mailbox_update
+AFTER UPDATE ON mail_mailbox
+FOR EACH ROW
+BEGIN
+    DECLARE v_size BIGINT DEFAULT 0;
+    IF OLD.mailbox_id <> NEW.mailbox_id OR OLD.is_read <> NEW.is_read OR OLD.is_deleted <> NEW.is_deleted THEN
+        SELECT body_size INTO v_size FROM mails WHERE id = NEW.mail_id;
+        UPDATE mailbox_stats
+        SET message_count = message_count - IF(OLD.is_deleted, 0, 1),
+            unread_count = unread_count - IF(OLD.is_deleted OR OLD.is_read, 0, 1),
+            total_bytes = total_bytes - IF(OLD.is_deleted, 0, v_size)
+        WHERE mailbox_id = OLD.mailbox_id;
+        UPDATE mailbox_stats
+        SET message_count = message_count + IF(NEW.is_deleted, 0, 1),
+            unread_count = unread_count + IF(NEW.is_deleted OR NEW.is_read, 0, 1),
+            total_bytes = total_bytes + IF(NEW.is_deleted, 0, v_size)
+        WHERE mailbox_id = NEW.mailbox_id;
+    END IF;
+END //
+DELIMITER ;
+
+-- 删除：减去统计，uid不回收
+DELIMITER //
+CREATE TRIGGER after_mail_mailbox_delete
+AFTER DELETE ON mail_mailbox
+FOR EACH ROW
+BEGIN
+    DECLARE v_size BIGINT DEFAULT 0;
+    SELECT body_size INTO v_size FROM mails WHERE id = OLD.mail_id;
+    UPDATE mailbox_stats
+    SET message_count = message_count - IF(OLD.is_deleted, 0, 1),
+        unread_count = unread_count - IF(OLD.is_deleted OR OLD.is_read, 0, 1),
+        total_bytes = total_bytes - IF(OLD.is_deleted, 0, v_size)
+    WHERE mailbox_id = OLD.mailbox_id;
+END //
+DELIMITER ;
+
+-- 按明细重新计算一个邮箱的统计，用于修正绕过触发器造成的偏差
+DELIMITER //
+CREATE PROCEDURE rebuild_mailbox_stats(IN p_mailbox_id BIGINT)
+BEGIN
+    INSERT INTO mailbox_stats (mailbox_id, message_count, unread_count, total_bytes, next_uid)
+    SELECT p_mailbox_id,
+           COALESCE(SUM(NOT mm.is_deleted), 0),
+           COALESCE(SUM(NOT mm.is_deleted AND NOT mm.is_read), 0),
+           COALESCE(SUM(IF(mm.is_deleted, 0, m.body_size)), 0),
+           COALESCE(MAX(mm.uid), 0) + 1
+    FROM mail_mailbox mm
+    LEFT JOIN mails m ON m.id = mm.mail_id
+    WHERE mm.mailbox_id = p_mailbox_id
+    ON DUPLICATE KEY UPDATE
+        message_count = VALUES(message_count),
+        unread_count = VALUES(unread_count),
+        total_bytes = VALUES(total_bytes),
+        next_uid = GREATEST(next_uid, VALUES(next_uid));
+END //
+DELIMITER ;
+
 -- 创建用户注册后自动创建默认邮箱的触发器
 DELIMITER //
 CREATE TRIGGER after_user_insert
@@ -0,0 +1,10 @@
+-- 邮件原文移出数据库，存放在按内容寻址的blob存储中
+-- 已有的邮件保留在body列中，新邮件body为NULL，只记录hash和大小
+ALTER TABLE mails
+    MODIFY COLUMN body TEXT NULL COMMENT '邮件正文（未启用blob存储时使用）',
+    ADD COLUMN body_hash CHAR(64) NULL COMMENT '原始邮件在blob存储中的SHA-256' AFTER body,
+    ADD COLUMN body_size BIGINT NOT NULL DEFAULT 0 COMMENT '原始邮件大小（字节）' AFTER body_hash,
+    ADD INDEX idx_body_hash (body_hash);
+
+-- 旧邮件的大小按正文长度回填
+UPDATE mails SET body_size = LENGTH(body) WHERE body_hash IS NULL AND body IS NOT NULL;
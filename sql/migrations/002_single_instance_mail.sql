@@ -0,0 +1,20 @@
+-- 多收件人邮件只存一份：mails一行，每个收件人一条mail_mailbox记录
+-- mails.ref_count记录引用数，最后一个收件人删除时才删除邮件；已读状态按用户记录在mail_mailbox上
+ALTER TABLE mails
+    MODIFY COLUMN recipient TEXT NOT NULL COMMENT '收件人邮箱地址，逗号分隔，仅供展示；投递关系见mail_mailbox',
+    DROP INDEX idx_recipient,
+    ADD COLUMN ref_count INT NOT NULL DEFAULT 0 COMMENT '引用本邮件的mail_mailbox记录数，归零时删除邮件' AFTER body_size;
+
+ALTER TABLE mail_mailbox
+    ADD COLUMN is_read BOOLEAN NOT NULL DEFAULT FALSE COMMENT '该用户是否已读' AFTER is_deleted;
+
+-- 旧版本只写了mails.recipient，按收件人补齐收件箱记录
+INSERT IGNORE INTO mail_mailbox (mail_id, mailbox_id, user_id, is_read)
+SELECT m.id, b.id, u.id, m.is_read
+FROM mails m
+JOIN users u ON FIND_IN_SET(u.mail_address, m.recipient) > 0
+JOIN mailboxes b ON b.user_id = u.id AND b.box_type = 1;
+
+-- 回填引用计数
+UPDATE mails m
+SET m.ref_count = (SELECT COUNT(*) FROM mail_mailbox mm WHERE mm.mail_id = m.id);
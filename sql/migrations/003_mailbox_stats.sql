@@ -0,0 +1,130 @@
+-- 邮箱统计表：邮件数、未读数、总大小和下一个uid，由mail_mailbox上的触发器维护
+-- 先回填历史数据，最后创建触发器；执行期间应停止投递
+
+-- 早期未启用blob存储时写入的正文没有记录大小
+UPDATE mails SET body_size = LENGTH(body) WHERE body_hash IS NULL AND body IS NOT NULL AND body_size = 0;
+
+ALTER TABLE mail_mailbox
+    ADD COLUMN uid BIGINT NOT NULL DEFAULT 0 COMMENT '邮箱内单调递增的编号，由触发器分配' AFTER is_read,
+    ADD INDEX idx_mailbox_uid (mailbox_id, uid);
+
+CREATE TABLE IF NOT EXISTS mailbox_stats (
+    mailbox_id BIGINT PRIMARY KEY COMMENT '邮箱ID',
+    message_count BIGINT NOT NULL DEFAULT 0 COMMENT '未删除的邮件数',
+    unread_count BIGINT NOT NULL DEFAULT 0 COMMENT '未删除且未读的邮件数',
+    total_bytes BIGINT NOT NULL DEFAULT 0 COMMENT '未删除邮件的总大小（字节）',
+    next_uid BIGINT NOT NULL DEFAULT 1 COMMENT '下一封投递的邮件的uid',
+    FOREIGN KEY (mailbox_id) REFERENCES mailboxes(id) ON DELETE CASCADE
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4 COMMENT='邮箱统计表';
+
+-- 已有记录按投递顺序编号
+UPDATE mail_mailbox mm
+JOIN (
+    SELECT id, ROW_NUMBER() OVER (PARTITION BY mailbox_id ORDER BY id) AS rn
+    FROM mail_mailbox
+) numbered ON numbered.id = mm.id
+SET mm.uid = numbered.rn;
+
+INSERT INTO mailbox_stats (mailbox_id, message_count, unread_count, total_bytes, next_uid)
+SELECT b.id,
+       COALESCE(SUM(NOT mm.is_deleted), 0),
+       COALESCE(SUM(NOT mm.is_deleted AND NOT mm.is_read), 0),
+       COALESCE(SUM(IF(mm.is_deleted, 0, m.body_size)), 0),
+       COALESCE(MAX(mm.uid), 0) + 1
+FROM mailboxes b
+LEFT JOIN mail_mailbox mm ON mm.mailbox_id = b.id
+LEFT JOIN mails m ON m.id = mm.mail_id
+GROUP BY b.id;
+
+-- 新建邮箱时创建统计行
+DELIMITER //
+CREATE TRIGGER after_mailbox_insert
+AFTER INSERT ON mailboxes
+FOR EACH ROW
+BEGIN
+    INSERT IGNORE INTO mailbox_stats (mailbox_id) VALUES (NEW.id);
+END //
+DELIMITER ;
+
+-- 投递：分配uid并累加统计
+-- 放在BEFORE触发器里才能给NEW.uid赋值；语句失败时触发器的修改随语句一起回滚
+DELIMITER //
+CREATE TRIGGER before_mail_mailbox_insert
+BEFORE INSERT ON mail_mailbox
+FOR EACH ROW
+BEGIN
+    DECLARE v_uid BIGINT;
+    DECLARE v_size BIGINT DEFAULT 0;
+    SELECT body_size INTO v_size FROM mails WHERE id = NEW.mail_id;
+    INSERT IGNORE INTO mailbox_stats (mailbox_id) VALUES (NEW.mailbox_id);
+    -- 锁住统计行，同一邮箱的并发投递按顺序分配uid
+    SELECT next_uid INTO v_uid FROM mailbox_stats WHERE mailbox_id = NEW.mailbox_id FOR UPDATE;
+    SET NEW.uid = v_uid;
+    UPDATE mailbox_stats
+    SET next_uid = v_uid + 1,
+        message_count = message_count + IF(NEW.is_deleted, 0, 1),
+        unread_count = unread_count + IF(NEW.is_deleted OR NEW.is_read, 0, 1),
+        total_bytes = total_bytes + IF(NEW.is_deleted, 0, v_size)
+    WHERE mailbox_id = NEW.mailbox_id;
+END //
+DELIMITER ;
+
+-- 标记已读/删除或移动到其他邮箱：从旧邮箱减去，再加到新邮箱
+DELIMITER //
+CREATE TRIGGER after_mail_mailbox_update
+AFTER UPDATE ON mail_mailbox
+FOR EACH ROW
+BEGIN
+    DECLARE v_size BIGINT DEFAULT 0;
+    IF OLD.mailbox_id <> NEW.mailbox_id OR OLD.is_read <> NEW.is_read OR OLD.is_deleted <> NEW.is_deleted THEN
+        SELECT body_size INTO v_size FROM mails WHERE id = NEW.mail_id;
+        UPDATE mailbox_stats
+        SET message_count = message_count - IF(OLD.is_deleted, 0, 1),
+            unread_count = unread_count - IF(OLD.is_deleted OR OLD.is_read, 0, 1),
+            total_bytes = total_bytes - IF(OLD.is_deleted, 0, v_size)
+        WHERE mailbox_id = OLD.mailbox_id;
+        UPDATE mailbox_stats
+        SET message_count = message_count + IF(NEW.is_deleted, 0, 1),
+            unread_count = unread_count + IF(NEW.is_deleted OR NEW.is_read, 0, 1),
+            total_bytes = total_bytes + IF(NEW.is_deleted, 0, v_size)
+        WHERE mailbox_id = NEW.mailbox_id;
+    END IF;
+END //
+DELIMITER ;
+
+-- 删除：减去统计，uid不回收
+DELIMITER //
+CREATE TRIGGER after_mail_mailbox_delete
+AFTER DELETE ON mail_mailbox
+FOR EACH ROW
+BEGIN
+    DECLARE v_size BIGINT DEFAULT 0;
+    SELECT body_size INTO v_size FROM mails WHERE id = OLD.mail_id;
+    UPDATE mailbox_stats
+    SET message_count = message_count - IF(OLD.is_deleted, 0, 1),
+        unread_count = unread_count - IF(OLD.is_deleted OR OLD.is_read, 0, 1),
+        total_bytes = total_bytes - IF(OLD.is_deleted, 0, v_size)
+    WHERE mailbox_id = OLD.mailbox_id;
+END //
+DELIMITER ;
+
+-- 按明细重新计算一个邮箱的统计，用于修正绕过触发器造成的偏差
+DELIMITER //
+CREATE PROCEDURE rebuild_mailbox_stats(IN p_mailbox_id BIGINT)
+BEGIN
+    INSERT INTO mailbox_stats (mailbox_id, message_count, unread_count, total_bytes, next_uid)
+    SELECT p_mailbox_id,
+           COALESCE(SUM(NOT mm.is_deleted), 0),
+           COALESCE(SUM(NOT mm.is_deleted AND NOT mm.is_read), 0),
+           COALESCE(SUM(IF(mm.is_deleted, 0, m.body_size)), 0),
+           COALESCE(MAX(mm.uid), 0) + 1
+    FROM mail_mailbox mm
+    LEFT JOIN mails m ON m.id = mm.mail_id
+    WHERE mm.mailbox_id = p_mailbox_id
+    ON DUPLICATE KEY UPDATE
+        message_count = VALUES(message_count),
+        unread_count = VALUES(unread_count),
+        total_bytes = VALUES(total_bytes),
+        next_uid = GREATEST(next_uid, VALUES(next_uid));
+END //
+DELIMITER ;
@@ -0,0 +1,3 @@
+-- 用户邮箱配额：0表示不限制，用量取该用户各邮箱mailbox_stats.total_bytes之和（依赖003）
+ALTER TABLE users
+    ADD COLUMN quota_bytes BIGINT NOT NULL DEFAULT 0 COMMENT '邮箱配额（字节），0表示不限制；用量见mailbox_stats.total_bytes' AFTER telephone;
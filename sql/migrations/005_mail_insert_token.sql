@@ -0,0 +1,5 @@
+-- 批量写入按令牌读回自增ID：多行INSERT分到的ID不保证连续
+-- （innodb_autoinc_lock_mode=2 或 auto_increment_increment>1 时）
+ALTER TABLE mails
+    ADD COLUMN insert_token VARCHAR(48) NULL COMMENT '批量写入时用于读回自增ID的令牌' AFTER ref_count,
+    ADD INDEX idx_insert_token (insert_token);
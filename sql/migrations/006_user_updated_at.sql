@@ -0,0 +1,5 @@
+-- 用户最后修改时间：服务端的凭据缓存按它发现其他进程修改的密码
+ALTER TABLE users
+    ADD COLUMN updated_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP
+        COMMENT '最后修改时间，凭据缓存据此失效' AFTER register_time,
+    ADD INDEX idx_updated_at (updated_at);
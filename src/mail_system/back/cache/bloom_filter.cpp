@@ -0,0 +1,66 @@
+#include "mail_system/back/cache/bloom_filter.h"
+#include <algorithm>
+#include <cmath>
+
+namespace mail_system {
+
+namespace {
+
+// splitmix64的终结步骤，打散调用方哈希值的低位，并派生出第二个哈希值
+uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+} // namespace
+
+BloomFilter::BloomFilter(size_t expected_items, double false_positive_rate)
+    : m_capacity(std::max<size_t>(expected_items, 1)) {
+    double p = std::clamp(false_positive_rate, 1e-6, 0.5);
+    const double ln2 = std::log(2.0);
+    // m = -n ln p / (ln 2)^2，k = m / n * ln 2
+    double bits = std::ceil(-static_cast<double>(m_capacity) * std::log(p) / (ln2 * ln2));
+    size_t words = std::max<size_t>(static_cast<size_t>(bits / 64) + 1, 1);
+    m_bitCount = words * 64;
+    m_hashCount = static_cast<unsigned int>(
+        std::clamp(std::lround(static_cast<double>(m_bitCount) / m_capacity * ln2), 1L, 16L));
+    m_words.reset(new std::atomic<uint64_t>[words]);
+    for (size_t i = 0; i < words; ++i) {
+        m_words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void BloomFilter::add(uint64_t hash) {
+    uint64_t h1 = mix(hash);
+    uint64_t h2 = mix(h1) | 1;
+    for (unsigned int i = 0; i < m_hashCount; ++i) {
+        uint64_t bit = (h1 + i * h2) % m_bitCount;
+        m_words[bit >> 6].fetch_or(uint64_t(1) << (bit & 63), std::memory_order_relaxed);
+    }
+}
+
+bool BloomFilter::may_contain(uint64_t hash) const {
+    uint64_t h1 = mix(hash);
+    uint64_t h2 = mix(h1) | 1;
+    for (unsigned int i = 0; i < m_hashCount; ++i) {
+        uint64_t bit = (h1 + i * h2) % m_bitCount;
+        if (!(m_words[bit >> 6].load(std::memory_order_relaxed) & (uint64_t(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t BloomFilter::capacity() const {
+    return m_capacity;
+}
+
+size_t BloomFilter::memory_bytes() const {
+    return m_bitCount / 8;
+}
+
+} // namespace mail_system
@@ -0,0 +1,199 @@
+#include "mail_system/back/cache/credential_cache.h"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <iostream>
+
+namespace mail_system {
+
+namespace {
+
+std::string normalize_address(const std::string& address) {
+    std::string key(address);
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return key;
+}
+
+} // namespace
+
+CredentialCache::CredentialCache(std::chrono::seconds ttl, std::chrono::seconds negative_ttl, size_t max_entries,
+                                 size_t shard_count)
+    : m_ttl(ttl),
+      m_negativeTtl(negative_ttl),
+      m_listenerId(0),
+      m_hits(0),
+      m_misses(0) {
+    shard_count = std::max<size_t>(shard_count, 1);
+    m_maxEntriesPerShard = std::max<size_t>(max_entries / shard_count, 1);
+    for (size_t i = 0; i < shard_count; ++i) {
+        m_shards.push_back(std::make_unique<Shard>());
+    }
+    if (RAND_bytes(m_salt.data(), static_cast<int>(m_salt.size())) != 1) {
+        // 拿不到随机数时退化为固定盐，只影响校验值的不可预测性
+        std::cerr << "Credential cache: RAND_bytes failed, using a fixed salt" << std::endl;
+        m_salt.fill(0x5a);
+    }
+}
+
+CredentialCache::~CredentialCache() {
+    set_directory(nullptr);
+}
+
+CredentialCache::Shard& CredentialCache::shard_for(const std::string& key) {
+    return *m_shards[std::hash<std::string>()(key) % m_shards.size()];
+}
+
+bool CredentialCache::make_verifier(const std::string& secret, Verifier& verifier) const {
+    unsigned int length = 0;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx) {
+        return false;
+    }
+    bool ok = EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 &&
+              EVP_DigestUpdate(ctx, m_salt.data(), m_salt.size()) == 1 &&
+              EVP_DigestUpdate(ctx, secret.data(), secret.size()) == 1 &&
+              EVP_DigestFinal_ex(ctx, verifier.data(), &length) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok && length == verifier.size();
+}
+
+CredentialCache::Result CredentialCache::check(const Entry& entry, const std::string& password,
+                                               int64_t& user_id) const {
+    if (!entry.exists) {
+        return Result::REJECTED;
+    }
+    Verifier candidate;
+    if (!make_verifier(password, candidate)) {
+        return Result::UNAVAILABLE;
+    }
+    if (CRYPTO_memcmp(candidate.data(), entry.verifier.data(), candidate.size()) != 0) {
+        return Result::REJECTED;
+    }
+    user_id = entry.user_id;
+    return Result::ACCEPTED;
+}
+
+void CredentialCache::make_room(Shard& shard, Clock::time_point now) {
+    if (shard.entries.size() < m_maxEntriesPerShard) {
+        return;
+    }
+    for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (it->second.expires <= now) {
+            it = shard.entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (shard.entries.size() >= m_maxEntriesPerShard) {
+        shard.entries.erase(shard.entries.begin());
+    }
+}
+
+void CredentialCache::set_directory(std::shared_ptr<RecipientDirectory> directory) {
+    std::lock_guard<std::mutex> lock(m_directoryMutex);
+    std::atomic_store(&m_directory, directory);
+    if (m_listenedDirectory == directory) {
+        return;
+    }
+    if (m_listenedDirectory) {
+        m_listenedDirectory->remove_change_listener(m_listenerId);
+    }
+    m_listenedDirectory = directory;
+    m_listenerId = directory ? directory->add_change_listener([this](const std::string& address) {
+        invalidate(address);
+    }) : 0;
+}
+
+CredentialCache::Result CredentialCache::verify(DBPool& db_pool, const std::string& mail_address,
+                                                const std::string& password, int64_t& user_id) {
+    const std::string key = normalize_address(mail_address);
+    Shard& shard = shard_for(key);
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            if (it->second.expires > Clock::now()) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return check(it->second, password, user_id);
+            }
+            shard.entries.erase(it);
+        }
+        generation = shard.generation;
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    // 过滤器判定不存在的地址仍然查一次数据库：刚注册的用户要等下一次拉取才进入过滤器
+    std::shared_ptr<RecipientDirectory> directory = std::atomic_load(&m_directory);
+    const bool filtered = directory && !directory->may_exist(mail_address);
+
+    // 只按地址查询，密码在本地比较，错误的密码也能用同一条缓存判定
+    Entry entry{false, -1, Verifier{}, Clock::time_point()};
+    {
+        auto connection = db_pool.get_user_connection(mail_address, DBAccessMode::READ);
+        if (!connection || !connection->is_connected()) {
+            return Result::UNAVAILABLE;
+        }
+        auto result = connection->query("SELECT id, password FROM users WHERE mail_address = ?", mail_address);
+        if (!result) {
+            return Result::UNAVAILABLE;
+        }
+        if (result->get_row_count() > 0) {
+            size_t passwordCol = result->get_column_index("password");
+            entry.exists = true;
+            entry.user_id = result->get_int(0, result->get_column_index("id"), -1);
+            if (!make_verifier(std::string(result->get_view(0, passwordCol)), entry.verifier)) {
+                return Result::UNAVAILABLE;
+            }
+        }
+    }
+
+    Result outcome = check(entry, password, user_id);
+    std::chrono::seconds ttl = entry.exists ? m_ttl : m_negativeTtl;
+    if (ttl.count() > 0) {
+        auto now = Clock::now();
+        entry.expires = now + ttl;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.generation == generation) {
+            if (filtered && !entry.exists) {
+                // 过滤器外的不存在地址只占空位，不淘汰已有条目，随机地址的撞库挤不掉正常用户
+                if (shard.entries.size() < m_maxEntriesPerShard) {
+                    shard.entries[key] = entry;
+                }
+            } else {
+                make_room(shard, now);
+                shard.entries[key] = entry;
+            }
+        }
+    }
+    return outcome;
+}
+
+void CredentialCache::invalidate(const std::string& mail_address) {
+    const std::string key = normalize_address(mail_address);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries.erase(key);
+    ++shard.generation;
+}
+
+void CredentialCache::clear() {
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->entries.clear();
+        ++shard->generation;
+    }
+}
+
+uint64_t CredentialCache::hit_count() const {
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+uint64_t CredentialCache::miss_count() const {
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+} // namespace mail_system
@@ -0,0 +1,146 @@
+#include "mail_system/back/cache/quota_cache.h"
+#include <algorithm>
+#include <cctype>
+#include <functional>
+
+namespace mail_system {
+
+namespace {
+
+std::string normalize_address(const std::string& address) {
+    std::string key(address);
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return key;
+}
+
+} // namespace
+
+QuotaCache::QuotaCache(std::chrono::seconds ttl, size_t max_entries, size_t shard_count)
+    : m_ttl(ttl),
+      m_hits(0),
+      m_misses(0) {
+    shard_count = std::max<size_t>(shard_count, 1);
+    m_maxEntriesPerShard = std::max<size_t>(max_entries / shard_count, 1);
+    for (size_t i = 0; i < shard_count; ++i) {
+        m_shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+QuotaCache::Shard& QuotaCache::shard_for(const std::string& key) {
+    return *m_shards[std::hash<std::string>()(key) % m_shards.size()];
+}
+
+QuotaCache::Result QuotaCache::judge(const Entry& entry, uint64_t message_size) {
+    if (entry.quota <= 0) {
+        return Result::OK;
+    }
+    int64_t remaining = entry.quota - std::max<int64_t>(entry.used, 0);
+    return remaining >= 0 && message_size <= static_cast<uint64_t>(remaining) ? Result::OK : Result::OVER_QUOTA;
+}
+
+void QuotaCache::make_room(Shard& shard, Clock::time_point now) {
+    if (shard.entries.size() < m_maxEntriesPerShard) {
+        return;
+    }
+    for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (it->second.expires <= now) {
+            it = shard.entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (shard.entries.size() >= m_maxEntriesPerShard) {
+        shard.entries.erase(shard.entries.begin());
+    }
+}
+
+QuotaCache::Result QuotaCache::check(DBPool& db_pool, const std::string& mail_address, uint64_t message_size) {
+    const std::string key = normalize_address(mail_address);
+    Shard& shard = shard_for(key);
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            if (it->second.expires > Clock::now()) {
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return judge(it->second, message_size);
+            }
+            shard.entries.erase(it);
+        }
+        generation = shard.generation;
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+
+    // 用量由mail_mailbox上的触发器维护在mailbox_stats里，每个用户只有几个邮箱
+    Entry entry{0, 0, Clock::time_point()};
+    {
+        auto connection = db_pool.get_user_connection(mail_address, DBAccessMode::READ);
+        if (!connection || !connection->is_connected()) {
+            return Result::UNAVAILABLE;
+        }
+        auto result = connection->query("SELECT u.quota_bytes, COALESCE(SUM(s.total_bytes), 0) AS used_bytes "
+                                        "FROM users u "
+                                        "LEFT JOIN mailboxes b ON b.user_id = u.id "
+                                        "LEFT JOIN mailbox_stats s ON s.mailbox_id = b.id "
+                                        "WHERE u.mail_address = ? GROUP BY u.id, u.quota_bytes",
+                                        mail_address);
+        if (!result) {
+            return Result::UNAVAILABLE;
+        }
+        if (result->get_row_count() > 0) {
+            entry.quota = result->get_int(0, result->get_column_index("quota_bytes"), 0);
+            entry.used = result->get_int(0, result->get_column_index("used_bytes"), 0);
+        }
+    }
+
+    Result outcome = judge(entry, message_size);
+    if (m_ttl.count() > 0) {
+        auto now = Clock::now();
+        entry.expires = now + m_ttl;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.generation == generation) {
+            make_room(shard, now);
+            shard.entries[key] = entry;
+        }
+    }
+    return outcome;
+}
+
+void QuotaCache::add_usage(const std::string& mail_address, int64_t delta) {
+    const std::string key = normalize_address(mail_address);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        it->second.used += delta;
+    }
+    ++shard.generation;
+}
+
+void QuotaCache::invalidate(const std::string& mail_address) {
+    const std::string key = normalize_address(mail_address);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries.erase(key);
+    ++shard.generation;
+}
+
+void QuotaCache::clear() {
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->entries.clear();
+        ++shard->generation;
+    }
+}
+
+uint64_t QuotaCache::hit_count() const {
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+uint64_t QuotaCache::miss_count() const {
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+} // namespace mail_system
@@ -0,0 +1,436 @@
+#include "mail_system/back/cache/recipient_directory.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace mail_system {
+
+namespace {
+
+// 每次从一个分片读取的用户数
+const size_t kPageSize = 5000;
+const size_t kInitialSlots = 1024;
+// Bloom过滤器的目标误判率，约每个地址10位
+const double kFilterFalsePositiveRate = 0.01;
+// 读取变更时在拉取间隔之外多回看的时间，覆盖从库延迟和慢提交；同一地址重复通知无害
+const std::chrono::seconds kChangeWindowSlack(30);
+
+inline char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// key按小写比较，stored已经是小写
+int compare_folded(std::string_view key, std::string_view stored) {
+    size_t n = std::min(key.size(), stored.size());
+    for (size_t i = 0; i < n; ++i) {
+        char a = fold(key[i]);
+        if (a != stored[i]) {
+            return static_cast<unsigned char>(a) < static_cast<unsigned char>(stored[i]) ? -1 : 1;
+        }
+    }
+    return key.size() == stored.size() ? 0 : (key.size() < stored.size() ? -1 : 1);
+}
+
+std::string to_lower(std::string_view text) {
+    std::string lower(text);
+    for (char& c : lower) {
+        c = fold(c);
+    }
+    return lower;
+}
+
+} // namespace
+
+// InternedSet实现
+
+RecipientDirectory::InternedSet::InternedSet() : m_slots(kInitialSlots, Slot{0, 0, 0}), m_size(0) {}
+
+size_t RecipientDirectory::InternedSet::find_slot(std::string_view key, uint64_t hash) const {
+    const size_t mask = m_slots.size() - 1;
+    size_t i = static_cast<size_t>(hash) & mask;
+    while (true) {
+        const Slot& slot = m_slots[i];
+        if (slot.length == 0) {
+            return i;
+        }
+        if (slot.hash == hash && slot.length == key.size()) {
+            const char* stored = m_arena.data() + slot.offset;
+            size_t k = 0;
+            while (k < key.size() && fold(key[k]) == stored[k]) {
+                ++k;
+            }
+            if (k == key.size()) {
+                return i;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+void RecipientDirectory::InternedSet::grow() {
+    // 字符串不动，只按保存的哈希值重新摆放槽位
+    std::vector<Slot> old(m_slots.size() * 2, Slot{0, 0, 0});
+    old.swap(m_slots);
+    const size_t mask = m_slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.length == 0) {
+            continue;
+        }
+        size_t i = static_cast<size_t>(slot.hash) & mask;
+        while (m_slots[i].length != 0) {
+            i = (i + 1) & mask;
+        }
+        m_slots[i] = slot;
+    }
+}
+
+bool RecipientDirectory::InternedSet::insert(std::string_view lower, uint64_t hash) {
+    if (lower.empty() || lower.size() > std::numeric_limits<uint32_t>::max() ||
+        m_arena.size() + lower.size() > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+    // 装载因子超过0.7时扩容，线性探测的链不会太长
+    if ((m_size + 1) * 10 > m_slots.size() * 7) {
+        grow();
+    }
+    size_t i = find_slot(lower, hash);
+    if (m_slots[i].length != 0) {
+        return false;
+    }
+    m_slots[i] = Slot{hash, static_cast<uint32_t>(m_arena.size()), static_cast<uint32_t>(lower.size())};
+    m_arena.append(lower.data(), lower.size());
+    ++m_size;
+    return true;
+}
+
+bool RecipientDirectory::InternedSet::contains(std::string_view key, uint64_t hash) const {
+    return !key.empty() && m_slots[find_slot(key, hash)].length != 0;
+}
+
+size_t RecipientDirectory::InternedSet::size() const {
+    return m_size;
+}
+
+void RecipientDirectory::InternedSet::for_each(const std::function<void(std::string_view, uint64_t)>& fn) const {
+    for (const Slot& slot : m_slots) {
+        if (slot.length != 0) {
+            fn(std::string_view(m_arena.data() + slot.offset, slot.length), slot.hash);
+        }
+    }
+}
+
+void RecipientDirectory::InternedSet::swap(InternedSet& other) {
+    m_arena.swap(other.m_arena);
+    m_slots.swap(other.m_slots);
+    std::swap(m_size, other.m_size);
+}
+
+// Filter实现
+
+bool RecipientDirectory::Filter::has_domain(std::string_view domain) const {
+    auto it = std::lower_bound(domains.begin(), domains.end(), domain,
+                               [](const std::string& stored, std::string_view key) {
+                                   return compare_folded(key, stored) > 0;
+                               });
+    return it != domains.end() && compare_folded(domain, *it) == 0;
+}
+
+// RecipientDirectory实现
+
+RecipientDirectory::RecipientDirectory(std::chrono::seconds poll_interval, std::chrono::seconds reload_interval)
+    : m_pollInterval(std::max(poll_interval, std::chrono::seconds(1))),
+      m_reloadInterval(reload_interval),
+      m_ready(false),
+      m_filterRejects(0),
+      m_nextListenerId(1),
+      m_running(false) {}
+
+RecipientDirectory::~RecipientDirectory() {
+    stop();
+}
+
+void RecipientDirectory::start(std::shared_ptr<DBPool> db_pool) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running || !db_pool) {
+        return;
+    }
+    m_dbPool = db_pool;
+    m_running = true;
+    m_thread = std::thread(&RecipientDirectory::loader_thread, this);
+}
+
+void RecipientDirectory::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+uint64_t RecipientDirectory::hash_lower(std::string_view text) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (char c : text) {
+        hash ^= static_cast<unsigned char>(fold(c));
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string_view RecipientDirectory::domain_of(std::string_view address) {
+    size_t at = address.rfind('@');
+    return at == std::string_view::npos ? std::string_view() : address.substr(at + 1);
+}
+
+RecipientDirectory::Lookup RecipientDirectory::lookup(std::string_view address) const {
+    if (!m_ready.load(std::memory_order_acquire)) {
+        return Lookup::NOT_READY;
+    }
+    const uint64_t hash = hash_lower(address);
+    std::string_view domain = domain_of(address);
+    std::shared_ptr<Filter> filter = std::atomic_load(&m_filter);
+    if (filter && !filter->bloom.may_contain(hash)) {
+        // 一定不存在，不需要查哈希表
+        m_filterRejects.fetch_add(1, std::memory_order_relaxed);
+        return filter->has_domain(domain) ? Lookup::UNKNOWN_USER : Lookup::UNKNOWN_DOMAIN;
+    }
+    std::shared_lock<std::shared_mutex> lock(m_tableMutex);
+    if (m_addresses.contains(address, hash) && (m_forgotten.empty() || !m_forgotten.count(to_lower(address)))) {
+        return Lookup::FOUND;
+    }
+    return m_domains.contains(domain, hash_lower(domain)) ? Lookup::UNKNOWN_USER : Lookup::UNKNOWN_DOMAIN;
+}
+
+bool RecipientDirectory::may_exist(std::string_view address) const {
+    std::shared_ptr<Filter> filter = std::atomic_load(&m_filter);
+    if (!filter || !m_ready.load(std::memory_order_acquire)) {
+        return true;
+    }
+    if (filter->bloom.may_contain(hash_lower(address))) {
+        return true;
+    }
+    m_filterRejects.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void RecipientDirectory::forget(std::string_view address) {
+    std::unique_lock<std::shared_mutex> lock(m_tableMutex);
+    m_forgotten.insert(to_lower(address));
+}
+
+size_t RecipientDirectory::add_change_listener(ChangeListener listener) {
+    std::lock_guard<std::mutex> lock(m_listenerMutex);
+    size_t id = m_nextListenerId++;
+    m_listeners.emplace_back(id, std::move(listener));
+    return id;
+}
+
+void RecipientDirectory::remove_change_listener(size_t id) {
+    std::lock_guard<std::mutex> lock(m_listenerMutex);
+    m_listeners.erase(std::remove_if(m_listeners.begin(), m_listeners.end(),
+                                     [id](const auto& entry) { return entry.first == id; }),
+                      m_listeners.end());
+}
+
+uint64_t RecipientDirectory::filter_reject_count() const {
+    return m_filterRejects.load(std::memory_order_relaxed);
+}
+
+bool RecipientDirectory::is_ready() const {
+    return m_ready.load(std::memory_order_acquire);
+}
+
+size_t RecipientDirectory::size() const {
+    std::shared_lock<std::shared_mutex> lock(m_tableMutex);
+    return m_addresses.size();
+}
+
+bool RecipientDirectory::insert_address(const std::string& lower, InternedSet& addresses, InternedSet& domains) {
+    if (!addresses.insert(lower, hash_lower(lower))) {
+        return false;
+    }
+    std::string_view domain = domain_of(lower);
+    domains.insert(domain, hash_lower(domain));
+    return true;
+}
+
+std::shared_ptr<RecipientDirectory::Filter> RecipientDirectory::build_filter(const InternedSet& addresses,
+                                                                             const InternedSet& domains) {
+    // 容量取当前地址数的两倍，增量拉取的新用户可以原地加入，直到超出容量才重建
+    auto filter = std::make_shared<Filter>(std::max<size_t>(addresses.size() * 2, kInitialSlots),
+                                           kFilterFalsePositiveRate);
+    addresses.for_each([&filter](std::string_view, uint64_t hash) { filter->bloom.add(hash); });
+    domains.for_each([&filter](std::string_view domain, uint64_t) { filter->domains.emplace_back(domain); });
+    std::sort(filter->domains.begin(), filter->domains.end());
+    return filter;
+}
+
+bool RecipientDirectory::fetch_users(size_t shard, int64_t& last_id,
+                                     const std::function<void(std::vector<std::string>&)>& fn) {
+    auto connection = m_dbPool->get_shard_connection(shard, DBAccessMode::READ);
+    if (!connection || !connection->is_connected()) {
+        return false;
+    }
+    // 按主键分页，每页都是一次范围扫描
+    static const std::string sql =
+        "SELECT id, mail_address FROM users WHERE id > ? ORDER BY id LIMIT " + std::to_string(kPageSize);
+    while (true) {
+        auto stmt = connection->prepare(sql);
+        if (!stmt || !stmt->bind(0, last_id)) {
+            return false;
+        }
+        auto result = stmt->query();
+        if (!result) {
+            std::cerr << "Recipient directory: query failed: " << stmt->get_last_error() << std::endl;
+            return false;
+        }
+        size_t rows = result->get_row_count();
+        size_t idCol = result->get_column_index("id");
+        size_t addressCol = result->get_column_index("mail_address");
+        std::vector<std::string> page;
+        page.reserve(rows);
+        for (size_t row = 0; row < rows; ++row) {
+            last_id = std::max(last_id, result->get_int(row, idCol, last_id));
+            page.push_back(to_lower(result->get_view(row, addressCol)));
+        }
+        if (!page.empty()) {
+            fn(page);
+        }
+        if (rows < kPageSize) {
+            return true;
+        }
+    }
+}
+
+bool RecipientDirectory::full_load() {
+    InternedSet addresses;
+    InternedSet domains;
+    std::vector<int64_t> lastIds(std::max<size_t>(m_dbPool->get_shard_count(), 1), 0);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t shard = 0; shard < lastIds.size(); ++shard) {
+        bool ok = fetch_users(shard, lastIds[shard], [&](std::vector<std::string>& page) {
+            for (const auto& address : page) {
+                insert_address(address, addresses, domains);
+            }
+        });
+        if (!ok) {
+            std::cerr << "Recipient directory: failed to load shard " << shard << std::endl;
+            return false;
+        }
+    }
+    size_t count = addresses.size();
+    std::shared_ptr<Filter> filter = build_filter(addresses, domains);
+    {
+        std::unique_lock<std::shared_mutex> lock(m_tableMutex);
+        m_addresses.swap(addresses);
+        m_domains.swap(domains);
+        m_forgotten.clear();
+        std::atomic_store(&m_filter, filter);
+    }
+    m_lastIds = std::move(lastIds);
+    m_ready.store(true, std::memory_order_release);
+    std::cout << "Recipient directory: loaded " << count << " address(es) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              << "ms, filter " << filter->bloom.memory_bytes() / 1024 << "KB" << std::endl;
+    return true;
+}
+
+void RecipientDirectory::add_addresses(const std::vector<std::string>& page) {
+    std::unique_lock<std::shared_mutex> lock(m_tableMutex);
+    std::shared_ptr<Filter> filter = std::atomic_load(&m_filter);
+    bool rebuild = !filter;
+    for (const auto& address : page) {
+        if (!m_forgotten.empty()) {
+            // 删除后又重新注册的用户
+            m_forgotten.erase(address);
+        }
+        if (!insert_address(address, m_addresses, m_domains) || rebuild) {
+            continue;
+        }
+        if (m_addresses.size() > filter->bloom.capacity() || !filter->has_domain(domain_of(address))) {
+            rebuild = true;
+        } else {
+            filter->bloom.add(hash_lower(address));
+        }
+    }
+    if (rebuild) {
+        std::atomic_store(&m_filter, build_filter(m_addresses, m_domains));
+    }
+}
+
+bool RecipientDirectory::poll() {
+    bool ok = true;
+    for (size_t shard = 0; shard < m_lastIds.size(); ++shard) {
+        ok = fetch_users(shard, m_lastIds[shard], [this](std::vector<std::string>& page) {
+            add_addresses(page);
+        }) && ok;
+    }
+    return ok;
+}
+
+bool RecipientDirectory::poll_changes() {
+    // 按数据库时钟回看，不受本机时钟影响；窗口覆盖两次拉取之间的间隔
+    const int64_t window = (m_pollInterval + kChangeWindowSlack).count() * 2;
+    bool ok = true;
+    for (size_t shard = 0; shard < std::max<size_t>(m_dbPool->get_shard_count(), 1); ++shard) {
+        auto connection = m_dbPool->get_shard_connection(shard, DBAccessMode::READ);
+        if (!connection || !connection->is_connected()) {
+            ok = false;
+            continue;
+        }
+        auto result = connection->query(
+            "SELECT mail_address FROM users WHERE updated_at >= NOW() - INTERVAL ? SECOND", window);
+        if (!result) {
+            std::cerr << "Recipient directory: change query failed: " << connection->get_last_error() << std::endl;
+            ok = false;
+            continue;
+        }
+        size_t addressCol = result->get_column_index("mail_address");
+        std::vector<std::string> page;
+        page.reserve(result->get_row_count());
+        for (size_t row = 0; row < result->get_row_count(); ++row) {
+            page.push_back(to_lower(result->get_view(row, addressCol)));
+        }
+        if (page.empty()) {
+            continue;
+        }
+        // 新用户的updated_at就是注册时间：id较小却较晚提交的用户，按id增量拉取时已被跳过，在这里补上
+        add_addresses(page);
+        std::lock_guard<std::mutex> lock(m_listenerMutex);
+        for (const auto& address : page) {
+            for (const auto& entry : m_listeners) {
+                entry.second(address);
+            }
+        }
+    }
+    return ok;
+}
+
+void RecipientDirectory::loader_thread() {
+    auto nextReload = std::chrono::steady_clock::now() + m_reloadInterval;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        lock.unlock();
+        auto now = std::chrono::steady_clock::now();
+        if (!is_ready() || (m_reloadInterval.count() > 0 && now >= nextReload)) {
+            // 全量重载去掉已删除的用户；失败时保留旧表，下一轮再试
+            if (full_load()) {
+                nextReload = now + m_reloadInterval;
+            }
+        } else {
+            poll();
+        }
+        if (is_ready()) {
+            poll_changes();
+        }
+        lock.lock();
+        m_cv.wait_for(lock, m_pollInterval, [this] { return !m_running; });
+    }
+}
+
+} // namespace mail_system
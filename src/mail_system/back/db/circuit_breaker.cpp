@@ -0,0 +1,101 @@
+#include "mail_system/back/db/circuit_breaker.h"
+#include <algorithm>
+#include <iostream>
+
+namespace mail_system {
+
+CircuitBreaker::CircuitBreaker(const std::string& name, unsigned int failure_threshold,
+                               std::chrono::milliseconds latency_threshold, std::chrono::milliseconds open_duration)
+    : m_name(name),
+      m_failureThreshold(std::max(failure_threshold, 1u)),
+      m_latencyThreshold(latency_threshold),
+      m_openDuration(open_duration),
+      m_state(State::CLOSED),
+      m_consecutiveFailures(0),
+      m_probeInFlight(false),
+      m_trips(0) {}
+
+const char* CircuitBreaker::state_name(State state) {
+    switch (state) {
+        case State::CLOSED: return "CLOSED";
+        case State::OPEN: return "OPEN";
+        case State::HALF_OPEN: return "HALF_OPEN";
+    }
+    return "UNKNOWN";
+}
+
+bool CircuitBreaker::allow_request() {
+    if (m_state.load(std::memory_order_acquire) == State::CLOSED) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    State state = m_state.load(std::memory_order_relaxed);
+    if (state == State::CLOSED) {
+        return true;
+    }
+    if (state == State::OPEN && std::chrono::steady_clock::now() - m_openedAt >= m_openDuration) {
+        m_state.store(State::HALF_OPEN, std::memory_order_release);
+        m_probeInFlight = false;
+        state = State::HALF_OPEN;
+    }
+    if (state == State::HALF_OPEN && !m_probeInFlight) {
+        m_probeInFlight = true;
+        return true;
+    }
+    return false;
+}
+
+void CircuitBreaker::record_success(std::chrono::milliseconds latency) {
+    if (m_latencyThreshold.count() > 0 && latency > m_latencyThreshold) {
+        std::cerr << "Circuit breaker " << m_name << ": slow call (" << latency.count() << "ms)" << std::endl;
+        record_failure();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_consecutiveFailures = 0;
+    State state = m_state.load(std::memory_order_relaxed);
+    if (state == State::HALF_OPEN) {
+        m_probeInFlight = false;
+        m_state.store(State::CLOSED, std::memory_order_release);
+        std::cout << "Circuit breaker " << m_name << ": closed" << std::endl;
+    }
+    // OPEN期间完成的旧请求不改变状态，恢复只由探测决定
+}
+
+void CircuitBreaker::record_failure() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    State state = m_state.load(std::memory_order_relaxed);
+    if (state == State::HALF_OPEN) {
+        trip();
+        return;
+    }
+    if (state == State::OPEN) {
+        return;
+    }
+    if (++m_consecutiveFailures >= m_failureThreshold) {
+        trip();
+    }
+}
+
+void CircuitBreaker::trip() {
+    m_openedAt = std::chrono::steady_clock::now();
+    m_probeInFlight = false;
+    m_consecutiveFailures = 0;
+    m_state.store(State::OPEN, std::memory_order_release);
+    m_trips.fetch_add(1, std::memory_order_relaxed);
+    std::cerr << "Circuit breaker " << m_name << ": open for " << m_openDuration.count() << "ms" << std::endl;
+}
+
+CircuitBreaker::State CircuitBreaker::state() const {
+    return m_state.load(std::memory_order_acquire);
+}
+
+bool CircuitBreaker::is_closed() const {
+    return state() == State::CLOSED;
+}
+
+uint64_t CircuitBreaker::trip_count() const {
+    return m_trips.load(std::memory_order_relaxed);
+}
+
+} // namespace mail_system
@@ -61,9 +61,8 @@ void db_example() {
             std::cerr << "Query failed: " << connection->get_last_error() << std::endl;
         }
         
-        // 7. 执行更新操作
-        std::string updateSql = "UPDATE users SET last_login = NOW() WHERE id = 1";
-        if (connection->execute(updateSql)) {
+        // 7. 执行更新操作（参数化，语句会缓存在连接上复用）
+        if (connection->execute("UPDATE users SET last_login = NOW() WHERE id = ?", 1)) {
             std::cout << "Update successful" << std::endl;
         } else {
             std::cerr << "Update failed: " << connection->get_last_error() << std::endl;
@@ -81,8 +80,8 @@ void db_example() {
             std::cerr << "Transaction rolled back: " << e.what() << std::endl;
         }
         
-        // 9. 释放连接回连接池
-        dbPool->release_connection(connection);
+        // 9. 释放连接回连接池（租约析构时也会自动归还）
+        connection.release();
         
         // 10. 关闭连接池
         dbPool->close();
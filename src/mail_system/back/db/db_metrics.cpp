@@ -0,0 +1,355 @@
+#include "mail_system/back/db/db_metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+
+namespace mail_system {
+
+namespace {
+
+void update_max(std::atomic<uint64_t>& target, uint64_t value) {
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (value > current &&
+           !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+bool is_ident_char(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+size_t trim_end(const std::string& text, size_t end) {
+    while (end > 0 && text[end - 1] == ' ') {
+        --end;
+    }
+    return end;
+}
+
+// out以item结尾时，把 "item, item" 合并成一个item
+// 括号项要求前面不是标识符，避免把 f(?), g(?) 当成值列表
+void collapse_list(std::string& out, std::string_view item, bool paren) {
+    size_t itemStart = out.size() - item.size();
+    if (paren && itemStart > 0 && is_ident_char(out[itemStart - 1])) {
+        return;
+    }
+    size_t end = trim_end(out, itemStart);
+    if (end == 0 || out[end - 1] != ',') {
+        return;
+    }
+    end = trim_end(out, end - 1);
+    if (end < item.size() || out.compare(end - item.size(), item.size(), item.data(), item.size()) != 0) {
+        return;
+    }
+    if (paren && end > item.size() && is_ident_char(out[end - item.size() - 1])) {
+        return;
+    }
+    out.resize(end);
+}
+
+bool ends_with(const std::string& text, std::string_view suffix) {
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(), suffix.data(), suffix.size()) == 0;
+}
+
+} // namespace
+
+// LatencyHistogram实现
+
+void LatencyHistogram::record(std::chrono::microseconds duration) {
+    uint64_t us = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+    size_t bucket = 0;
+    for (uint64_t v = us; v > 1 && bucket + 1 < kBucketCount; v >>= 1) {
+        ++bucket;
+    }
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_totalUs.fetch_add(us, std::memory_order_relaxed);
+    update_max(m_maxUs, us);
+}
+
+uint64_t LatencyHistogram::count() const {
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::total_us() const {
+    return m_totalUs.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max_us() const {
+    return m_maxUs.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * total));
+    target = std::max<uint64_t>(target, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            if (i + 1 == kBucketCount) {
+                break;
+            }
+            return std::min<uint64_t>(uint64_t(1) << (i + 1), max_us());
+        }
+    }
+    return max_us();
+}
+
+// DBMetrics实现
+
+DBMetrics::DBMetrics(std::chrono::milliseconds slow_query_threshold, size_t slow_query_log_size)
+    : m_slowThreshold(std::chrono::duration_cast<std::chrono::microseconds>(slow_query_threshold)),
+      m_slowLogSize(slow_query_log_size) {}
+
+std::string DBMetrics::fingerprint(std::string_view sql) {
+    std::string out;
+    out.reserve(sql.size());
+    bool pendingSpace = false;
+    auto emit = [&](char c) {
+        if (pendingSpace && !out.empty()) {
+            out.push_back(' ');
+        }
+        pendingSpace = false;
+        out.push_back(c);
+    };
+    auto emit_placeholder = [&]() {
+        emit('?');
+        collapse_list(out, "?", false);
+    };
+
+    size_t i = 0;
+    const size_t n = sql.size();
+    while (i < n) {
+        char c = sql[i];
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            pendingSpace = true;
+            ++i;
+        } else if (c == '#' || (c == '-' && i + 1 < n && sql[i + 1] == '-' &&
+                                (i + 2 == n || std::isspace(static_cast<unsigned char>(sql[i + 2]))))) {
+            // 单行注释
+            while (i < n && sql[i] != '\n') {
+                ++i;
+            }
+            pendingSpace = true;
+        } else if (c == '/' && i + 1 < n && sql[i + 1] == '*') {
+            size_t end = sql.find("*/", i + 2);
+            i = end == std::string_view::npos ? n : end + 2;
+            pendingSpace = true;
+        } else if (c == '\'' || c == '"') {
+            // 字符串字面量，支持反斜杠转义和连续两个引号
+            ++i;
+            while (i < n) {
+                if (sql[i] == '\\') {
+                    i += 2;
+                } else if (sql[i] == c) {
+                    if (i + 1 < n && sql[i + 1] == c) {
+                        i += 2;
+                    } else {
+                        ++i;
+                        break;
+                    }
+                } else {
+                    ++i;
+                }
+            }
+            emit_placeholder();
+        } else if (c == '`') {
+            // 带引号的标识符原样保留
+            size_t end = sql.find('`', i + 1);
+            end = end == std::string_view::npos ? n : end + 1;
+            for (size_t k = i; k < end; ++k) {
+                emit(sql[k]);
+            }
+            i = end;
+        } else if (c == '?') {
+            // 预处理语句的占位符
+            ++i;
+            emit_placeholder();
+        } else if (std::isdigit(static_cast<unsigned char>(c))) {
+            // 数字（包括0x前缀和小数），标识符中间的数字在下面整段复制
+            while (i < n && (is_ident_char(sql[i]) || sql[i] == '.')) {
+                ++i;
+            }
+            emit_placeholder();
+        } else if (is_ident_char(c)) {
+            while (i < n && is_ident_char(sql[i])) {
+                emit(sql[i++]);
+            }
+        } else {
+            emit(c);
+            ++i;
+            if (c == ')' && ends_with(out, "(?)")) {
+                collapse_list(out, "(?)", true);
+            }
+        }
+    }
+    return out;
+}
+
+DBMetrics::QueryStats* DBMetrics::statement_stats(std::string_view sql) {
+    std::string key = fingerprint(sql);
+    std::lock_guard<std::mutex> lock(m_queryMutex);
+    auto it = m_queries.find(key);
+    if (it == m_queries.end()) {
+        if (m_queries.size() >= kMaxFingerprints) {
+            key = "<other>";
+            it = m_queries.find(key);
+        }
+        if (it == m_queries.end()) {
+            auto stats = std::make_unique<QueryStats>();
+            stats->fingerprint = key;
+            it = m_queries.emplace(key, std::move(stats)).first;
+        }
+    }
+    return it->second.get();
+}
+
+void DBMetrics::record_query(QueryStats& stats, const std::string& sql, std::chrono::microseconds duration, bool ok) {
+    stats.latency.record(duration);
+    if (!ok) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (duration < m_slowThreshold || m_slowLogSize == 0) {
+        return;
+    }
+    SlowQuery entry{std::chrono::system_clock::now(), duration, sql.substr(0, kMaxSlowQueryText), ok};
+    std::lock_guard<std::mutex> lock(m_slowMutex);
+    m_slowQueries.push_back(std::move(entry));
+    while (m_slowQueries.size() > m_slowLogSize) {
+        m_slowQueries.pop_front();
+    }
+}
+
+void DBMetrics::record_checkout(std::chrono::microseconds wait, bool waited) {
+    m_checkoutWait.record(wait);
+    m_checkouts.fetch_add(1, std::memory_order_relaxed);
+    if (waited) {
+        m_waitedCheckouts.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void DBMetrics::record_checkout_timeout() {
+    m_checkoutTimeouts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DBMetrics::record_in_use(size_t in_use) {
+    update_max(m_peakInUse, in_use);
+}
+
+void DBMetrics::record_connection_created() {
+    m_connectionsCreated.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DBMetrics::record_connection_closed() {
+    m_connectionsClosed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DBMetrics::record_connect_failure() {
+    m_connectFailures.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DBMetrics::record_validation_failure() {
+    m_validationFailures.fetch_add(1, std::memory_order_relaxed);
+}
+
+const LatencyHistogram& DBMetrics::checkout_wait() const {
+    return m_checkoutWait;
+}
+
+uint64_t DBMetrics::checkouts() const {
+    return m_checkouts.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::waited_checkouts() const {
+    return m_waitedCheckouts.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::checkout_timeouts() const {
+    return m_checkoutTimeouts.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::peak_in_use() const {
+    return m_peakInUse.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::connections_created() const {
+    return m_connectionsCreated.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::connections_closed() const {
+    return m_connectionsClosed.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::connect_failures() const {
+    return m_connectFailures.load(std::memory_order_relaxed);
+}
+
+uint64_t DBMetrics::validation_failures() const {
+    return m_validationFailures.load(std::memory_order_relaxed);
+}
+
+void DBMetrics::for_each_query(const std::function<void(const QueryStats&)>& fn) const {
+    std::lock_guard<std::mutex> lock(m_queryMutex);
+    for (const auto& item : m_queries) {
+        fn(*item.second);
+    }
+}
+
+std::vector<DBMetrics::SlowQuery> DBMetrics::slow_queries() const {
+    std::lock_guard<std::mutex> lock(m_slowMutex);
+    return std::vector<SlowQuery>(m_slowQueries.begin(), m_slowQueries.end());
+}
+
+void DBMetrics::dump(std::ostream& os, size_t top_queries) const {
+    const auto& wait = m_checkoutWait;
+    os << "  checkouts=" << checkouts()
+       << " waited=" << waited_checkouts()
+       << " timeouts=" << checkout_timeouts()
+       << " peak_in_use=" << peak_in_use()
+       << " created=" << connections_created()
+       << " closed=" << connections_closed()
+       << " connect_failures=" << connect_failures()
+       << " validation_failures=" << validation_failures() << std::endl;
+    os << "  checkout_wait_us: avg=" << (wait.count() ? wait.total_us() / wait.count() : 0)
+       << " p50=" << wait.percentile(0.5)
+       << " p95=" << wait.percentile(0.95)
+       << " p99=" << wait.percentile(0.99)
+       << " max=" << wait.max_us() << std::endl;
+
+    std::vector<const QueryStats*> queries;
+    for_each_query([&queries](const QueryStats& stats) { queries.push_back(&stats); });
+    std::sort(queries.begin(), queries.end(), [](const QueryStats* a, const QueryStats* b) {
+        return a->latency.total_us() > b->latency.total_us();
+    });
+    if (queries.size() > top_queries) {
+        queries.resize(top_queries);
+    }
+    for (const QueryStats* stats : queries) {
+        const auto& latency = stats->latency;
+        os << "  query count=" << latency.count()
+           << " errors=" << stats->errors.load(std::memory_order_relaxed)
+           << " total_ms=" << latency.total_us() / 1000
+           << " avg_us=" << (latency.count() ? latency.total_us() / latency.count() : 0)
+           << " p95_us=" << latency.percentile(0.95)
+           << " max_us=" << latency.max_us()
+           << " | " << stats->fingerprint << std::endl;
+    }
+
+    for (const auto& slow : slow_queries()) {
+        std::time_t time = std::chrono::system_clock::to_time_t(slow.time);
+        std::tm tm{};
+        localtime_r(&time, &tm);
+        os << "  slow " << std::put_time(&tm, "%Y-%m-%d %H:%M:%S")
+           << " " << slow.duration.count() / 1000 << "ms"
+           << (slow.ok ? "" : " [error]")
+           << " | " << slow.sql << std::endl;
+    }
+}
+
+} // namespace mail_system
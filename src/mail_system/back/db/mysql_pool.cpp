@@ -1,4 +1,7 @@
 #include "mail_system/back/db/mysql_pool.h"
+#include "mail_system/back/db/routing_db_pool.h"
+#include "mail_system/back/db/sharded_db_pool.h"
+#include <algorithm>
 #include <iostream>
 
 namespace mail_system {
@@ -7,12 +10,36 @@ namespace mail_system {
 std::unique_ptr<MySQLPoolFactory> MySQLPoolFactory::s_instance = nullptr;
 std::mutex MySQLPoolFactory::s_mutex;
 
+namespace {
+std::atomic<uint64_t> s_nextPoolId(1);
+}
+
 // MySQLPool实现
 
 MySQLPool::MySQLPool(const DBPoolConfig& config, std::shared_ptr<DBService> db_service)
-    : m_config(config), m_dbService(db_service), m_running(true) {
+    : m_config(config),
+      m_dbService(db_service),
+      m_metrics(std::make_shared<DBMetrics>(std::chrono::milliseconds(config.slow_query_threshold_ms),
+                                            config.slow_query_log_size)),
+      m_running(true),
+      m_pendingGrowth(0),
+      m_connecting(0),
+      m_poolId(s_nextPoolId.fetch_add(1)),
+      m_alive(std::make_shared<int>(0)),
+      m_waiters(0) {
     initialize_pool();
     m_maintenanceThread = std::thread(&MySQLPool::maintenance_thread, this);
+
+    // 至少有min_ready_connections个连接就绪后再返回，其余的在后台继续建立
+    size_t target = std::min(m_config.min_ready_connections, m_config.initial_pool_size);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait_for(lock, std::chrono::seconds(m_config.connection_timeout), [this, target] {
+        return m_connections.size() >= target || (m_pendingGrowth == 0 && m_connecting == 0);
+    });
+    if (m_connections.size() < target) {
+        std::cerr << "MySQL pool " << m_config.host << ":" << m_config.port << ": only "
+                  << m_connections.size() << " of " << target << " connections ready after warm-up" << std::endl;
+    }
 }
 
 MySQLPool::~MySQLPool() {
@@ -22,91 +49,249 @@ MySQLPool::~MySQLPool() {
 void MySQLPool::initialize_pool() {
     std::lock_guard<std::mutex> lock(m_mutex);
 
-    // 创建初始连接
-    for (size_t i = 0; i < m_config.initial_pool_size; ++i) {
-        auto connection = create_connection();
-        if (connection) {
-            auto wrapper = std::make_shared<ConnectionWrapper>(connection);
-            m_connections.push_back(wrapper);
-            m_availableConnections.push(wrapper);
+    // 初始连接交给维护线程并行建立
+    m_pendingGrowth = m_config.initial_pool_size;
+}
+
+void MySQLPool::open_connections(size_t count) {
+    std::atomic<size_t> remaining(count);
+    auto worker = [this, &remaining] {
+        while (true) {
+            size_t left = remaining.load();
+            if (left == 0) {
+                return;
+            }
+            if (!remaining.compare_exchange_weak(left, left - 1)) {
+                continue;
+            }
+            auto connection = create_connection();
+            bool connected = connection && connection->connect();
+            if (connection && !connected) {
+                m_metrics->record_connect_failure();
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_connecting;
+            if (connected && m_running) {
+                auto wrapper = std::make_shared<ConnectionWrapper>(connection);
+                m_connections.push_back(wrapper);
+                m_availableConnections.push(wrapper);
+            } else if (connected) {
+                connection->disconnect();
+            }
+            // 等待借出的请求和等待预热的构造函数都在m_cv上
+            m_cv.notify_all();
         }
+    };
+
+    std::vector<std::thread> workers;
+    size_t parallel = std::min(count, kMaxParallelConnects);
+    for (size_t i = 1; i < parallel; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
     }
 }
 
 std::shared_ptr<IDBConnection> MySQLPool::create_connection() {
-    return m_dbService->create_connection(
+    auto connection = m_dbService->create_connection(
         m_config.host,
         m_config.user,
         m_config.password,
         m_config.database,
         m_config.port
     );
+    if (auto mysql = std::dynamic_pointer_cast<MySQLConnection>(connection)) {
+        mysql->set_statement_cache_capacity(m_config.statement_cache_size);
+        mysql->set_metrics(m_metrics);
+    }
+    if (connection) {
+        m_metrics->record_connection_created();
+    }
+    return connection;
 }
 
-std::shared_ptr<IDBConnection> MySQLPool::get_connection() {
-    std::unique_lock<std::mutex> lock(m_mutex);
-
-    // 等待可用连接，最多等待连接超时时间
-    auto timeout = std::chrono::seconds(m_config.connection_timeout);
-    bool hasConnection = m_cv.wait_for(lock, timeout, [this] {
-        return !m_availableConnections.empty() || !m_running;
-    });
+DBConnectionLease MySQLPool::get_connection() {
+    DBCheckoutError error;
+    return get_connection(error);
+}
 
-    if (!m_running) {
-        return nullptr;
+DBConnectionLease MySQLPool::get_connection(DBCheckoutError& error) {
+    auto start = std::chrono::steady_clock::now();
+    error = DBCheckoutError::UNAVAILABLE;
+    if (m_config.thread_cache_size > 0 && m_running) {
+        // 本线程缓存命中时不加锁
+        if (auto cached = take_cached_connection()) {
+            m_metrics->record_checkout(std::chrono::microseconds(0), false);
+            DBConnectionLease lease = lease_wrapper(cached, start);
+            if (lease) {
+                error = DBCheckoutError::NONE;
+            }
+            return lease;
+        }
     }
 
-    if (!hasConnection) {
-        // 超时，检查是否可以创建新连接
-        if (m_connections.size() < m_config.max_pool_size) {
-            auto connection = create_connection();
-            if (connection) {
-                auto wrapper = std::make_shared<ConnectionWrapper>(connection);
-                wrapper->in_use = true;
-                m_connections.push_back(wrapper);
-                return wrapper->connection;
+    bool waited = false;
+    std::shared_ptr<ConnectionWrapper> wrapper;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return DBConnectionLease();
+        }
+
+        bool contended = m_availableConnections.empty();
+        if (contended) {
+            // 先登记等待，再收回各线程缓存中的连接；之后归还的连接都直接进共享队列
+            m_waiters.fetch_add(1);
+            if (m_config.thread_cache_size > 0) {
+                reclaim_cached_connections();
+            }
+        }
+        if (m_availableConnections.empty()) {
+            waited = true;
+            // 未达上限时请维护线程在后台新建连接，请求线程不做握手
+            if (m_connections.size() + m_pendingGrowth + m_connecting < m_config.max_pool_size) {
+                ++m_pendingGrowth;
+                m_maintenanceCv.notify_one();
+            }
+        }
+        // 等待其他租约归还或新连接建立，最多等待连接超时时间
+        auto timeout = std::chrono::seconds(m_config.connection_timeout);
+        bool hasConnection = m_cv.wait_for(lock, timeout, [this] {
+            return !m_availableConnections.empty() || !m_running;
+        });
+        if (contended) {
+            m_waiters.fetch_sub(1);
+        }
+        if (!m_running || !hasConnection) {
+            if (!hasConnection) {
+                m_metrics->record_checkout_timeout();
+                // 连接数已到上限说明只是太忙；还没到上限却等不到新连接，说明连不上数据库
+                if (m_running && m_connections.size() >= m_config.max_pool_size) {
+                    error = DBCheckoutError::EXHAUSTED;
+                }
             }
+            return DBConnectionLease();
         }
-        return nullptr;
+        wrapper = m_availableConnections.front();
+        m_availableConnections.pop();
+        wrapper->in_use = true;
+        m_metrics->record_in_use(m_connections.size() - m_availableConnections.size());
     }
 
-    // 获取可用连接
-    auto wrapper = m_availableConnections.front();
-    m_availableConnections.pop();
-    wrapper->in_use = true;
+    auto now = std::chrono::steady_clock::now();
+    m_metrics->record_checkout(std::chrono::duration_cast<std::chrono::microseconds>(now - start), waited);
+    DBConnectionLease lease = lease_wrapper(wrapper, now);
+    if (lease) {
+        error = DBCheckoutError::NONE;
+    }
+    return lease;
+}
+
+DBConnectionLease MySQLPool::lease_wrapper(const std::shared_ptr<ConnectionWrapper>& wrapper,
+                                           std::chrono::steady_clock::time_point now) {
+    // 连接和ping都涉及网络往返，不持有连接池的锁
+    auto idle = now - wrapper->last_used;
+    if (!prepare_connection(wrapper, idle)) {
+        return_to_shared(wrapper);
+        return DBConnectionLease();
+    }
+    wrapper->last_used = now;
+    return make_lease(wrapper->connection, wrapper);
+}
+
+void MySQLPool::release_lease(std::shared_ptr<IDBConnection> connection, std::shared_ptr<void> token) {
+    (void)connection;
+    auto wrapper = std::static_pointer_cast<ConnectionWrapper>(token);
+    if (!wrapper) {
+        return;
+    }
+    if (m_config.thread_cache_size > 0 && m_running && cache_connection(wrapper)) {
+        return;
+    }
+    return_to_shared(wrapper);
+}
+
+void MySQLPool::return_to_shared(const std::shared_ptr<ConnectionWrapper>& wrapper) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        // 连接池已关闭
+        wrapper->connection->disconnect();
+        return;
+    }
+    wrapper->in_use = false;
     wrapper->last_used = std::chrono::steady_clock::now();
+    m_availableConnections.push(wrapper);
+    m_cv.notify_one();
+}
 
-    // 验证连接是否有效
-    if (!validate_connection(wrapper->connection)) {
-        // 连接无效，创建新连接
-        wrapper->connection = create_connection();
-        if (!wrapper->connection) {
-            // 无法创建新连接
-            wrapper->in_use = false;
-            return nullptr;
+MySQLPool::ThreadCache& MySQLPool::thread_cache() {
+    thread_local std::vector<ThreadCache> caches;
+    for (auto& cache : caches) {
+        if (cache.pool_id == m_poolId) {
+            return cache;
         }
     }
+    // 顺便清理已销毁的连接池留下的缓存
+    caches.erase(std::remove_if(caches.begin(), caches.end(),
+                                [](const ThreadCache& cache) { return cache.alive.expired(); }),
+                 caches.end());
+    caches.push_back(ThreadCache{m_poolId, m_alive, {}});
+    return caches.back();
+}
 
-    return wrapper->connection;
+std::shared_ptr<MySQLPool::ConnectionWrapper> MySQLPool::take_cached_connection() {
+    auto& connections = thread_cache().connections;
+    while (!connections.empty()) {
+        auto wrapper = std::move(connections.back());
+        connections.pop_back();
+        // 标记已被清除说明连接被收回了共享队列，这里的指针作废
+        if (wrapper->cached.exchange(false)) {
+            return wrapper;
+        }
+    }
+    return nullptr;
 }
 
-void MySQLPool::release_connection(std::shared_ptr<IDBConnection> connection) {
-    if (!connection) {
-        return;
+bool MySQLPool::cache_connection(const std::shared_ptr<ConnectionWrapper>& wrapper) {
+    if (m_waiters.load() > 0) {
+        return false;
     }
+    auto& connections = thread_cache().connections;
+    if (connections.size() >= m_config.thread_cache_size) {
+        return false;
+    }
+    wrapper->last_used = std::chrono::steady_clock::now();
+    wrapper->cached.store(true);
+    connections.push_back(wrapper);
 
-    std::lock_guard<std::mutex> lock(m_mutex);
+    // 等待的请求先登记再扫描标记，这里先设标记再检查登记，两边至少有一方能看到对方
+    if (m_waiters.load() == 0) {
+        return true;
+    }
+    connections.pop_back();
+    if (!wrapper->cached.exchange(false)) {
+        // 已经被等待的请求收走
+        return true;
+    }
+    return false;
+}
 
-    // 查找连接包装器
+size_t MySQLPool::reclaim_cached_connections() {
+    size_t reclaimed = 0;
     for (auto& wrapper : m_connections) {
-        if (wrapper->connection == connection) {
+        if (wrapper->cached.load() && wrapper->cached.exchange(false)) {
             wrapper->in_use = false;
-            wrapper->last_used = std::chrono::steady_clock::now();
             m_availableConnections.push(wrapper);
-            m_cv.notify_one();
-            break;
+            ++reclaimed;
         }
     }
+    if (reclaimed > 0) {
+        m_cv.notify_all();
+    }
+    return reclaimed;
 }
 
 size_t MySQLPool::get_pool_size() const {
@@ -119,6 +304,26 @@ size_t MySQLPool::get_available_connections() const {
     return m_availableConnections.size();
 }
 
+void MySQLPool::dump_metrics(std::ostream& os) const {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t cached = std::count_if(m_connections.begin(), m_connections.end(),
+                                      [](const std::shared_ptr<ConnectionWrapper>& wrapper) {
+                                          return wrapper->cached.load();
+                                      });
+        os << "MySQL pool " << m_config.host << ":" << m_config.port << "/" << m_config.database
+           << ": size=" << m_connections.size()
+           << " available=" << m_availableConnections.size()
+           << " thread_cached=" << cached
+           << " max=" << m_config.max_pool_size << std::endl;
+    }
+    m_metrics->dump(os);
+}
+
+std::shared_ptr<DBMetrics> MySQLPool::get_metrics() const {
+    return m_metrics;
+}
+
 void MySQLPool::close() {
     {
         std::lock_guard<std::mutex> lock(m_mutex);
@@ -129,6 +334,7 @@ void MySQLPool::close() {
     }
 
     m_cv.notify_all();
+    m_maintenanceCv.notify_all();
 
     // 等待维护线程结束
     if (m_maintenanceThread.joinable()) {
@@ -140,6 +346,7 @@ void MySQLPool::close() {
     for (auto& wrapper : m_connections) {
         if (wrapper->connection) {
             wrapper->connection->disconnect();
+            m_metrics->record_connection_closed();
         }
     }
     m_connections.clear();
@@ -150,10 +357,48 @@ void MySQLPool::close() {
 }
 
 void MySQLPool::maintenance_thread() {
+    const auto cleanupInterval = std::chrono::seconds(10);
+    auto lastReport = std::chrono::steady_clock::now();
+    auto nextCleanup = lastReport + cleanupInterval;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
     while (m_running) {
-        // 每10秒检查一次空闲连接
-        std::this_thread::sleep_for(std::chrono::seconds(10));
-        cleanup_idle_connections();
+        m_maintenanceCv.wait_until(lock, nextCleanup, [this] {
+            return m_pendingGrowth > 0 || !m_running;
+        });
+        if (!m_running) {
+            break;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= nextCleanup) {
+            // 每10秒检查一次空闲连接；线程缓存中的连接先收回来，由空闲清理统一处理
+            nextCleanup = now + cleanupInterval;
+            reclaim_cached_connections();
+            lock.unlock();
+            cleanup_idle_connections();
+            if (m_config.metrics_log_interval > 0 &&
+                now - lastReport >= std::chrono::seconds(m_config.metrics_log_interval)) {
+                dump_metrics(std::cout);
+                lastReport = now;
+            }
+            lock.lock();
+
+            // 预热时没连上的初始连接在这里补足，数据库不可用时每个周期只重试一次
+            size_t total = m_connections.size() + m_pendingGrowth + m_connecting;
+            if (total < m_config.initial_pool_size) {
+                m_pendingGrowth += m_config.initial_pool_size - total;
+            }
+        }
+
+        if (m_pendingGrowth > 0) {
+            size_t count = m_pendingGrowth;
+            m_pendingGrowth = 0;
+            m_connecting += count;
+            lock.unlock();
+            open_connections(count);
+            lock.lock();
+        }
     }
 }
 
@@ -188,6 +433,7 @@ void MySQLPool::cleanup_idle_connections() {
 
             // 断开连接并从连接池中移除
             wrapper->connection->disconnect();
+            m_metrics->record_connection_closed();
             it = m_connections.erase(it);
         } else {
             ++it;
@@ -195,18 +441,32 @@ void MySQLPool::cleanup_idle_connections() {
     }
 }
 
-bool MySQLPool::validate_connection(std::shared_ptr<IDBConnection> connection) {
+bool MySQLPool::prepare_connection(const std::shared_ptr<ConnectionWrapper>& wrapper,
+                                   std::chrono::steady_clock::duration idle) {
+    auto& connection = wrapper->connection;
     if (!connection->is_connected()) {
+        if (connection->connect()) {
+            return true;
+        }
+        m_metrics->record_connect_failure();
         return false;
     }
 
-    // 执行简单查询来验证连接
-    try {
-        auto result = connection->query("SELECT 1");
-        return result != nullptr;
-    } catch (...) {
-        return false;
+    // 刚用过的连接直接借出，空闲超过阈值的才ping一次
+    if (idle < std::chrono::seconds(m_config.validation_idle_threshold)) {
+        return true;
+    }
+    if (connection->ping()) {
+        return true;
+    }
+    std::cerr << "Pooled MySQL connection failed ping, reconnecting" << std::endl;
+    m_metrics->record_validation_failure();
+    connection->disconnect();
+    if (connection->connect()) {
+        return true;
     }
+    m_metrics->record_connect_failure();
+    return false;
 }
 
 // MySQLPoolFactory实现
@@ -215,7 +475,38 @@ std::shared_ptr<DBPool> MySQLPoolFactory::create_pool(
     const DBPoolConfig& config,
     std::shared_ptr<DBService> db_service
 ) {
-    return std::make_shared<MySQLPool>(config, db_service);
+    if (!config.shards.empty()) {
+        // 每个分片按普通配置单独建池，分片自己的副本同样做读写分离
+        std::vector<std::string> names;
+        std::vector<std::shared_ptr<DBPool>> shards;
+        for (const auto& shard : config.shards) {
+            DBPoolConfig shardConfig = config;
+            shardConfig.shards.clear();
+            shardConfig.host = shard.host;
+            shardConfig.port = shard.port;
+            shardConfig.database = shard.database;
+            shardConfig.replicas = shard.replicas;
+            names.push_back(shard.name);
+            shards.push_back(create_pool(shardConfig, db_service));
+        }
+        return std::make_shared<ShardedDBPool>(std::move(names), std::move(shards), config.shard_virtual_nodes);
+    }
+
+    auto primary = std::make_shared<MySQLPool>(config, db_service);
+    if (config.replicas.empty()) {
+        return primary;
+    }
+
+    std::vector<std::shared_ptr<DBPool>> replicas;
+    for (const auto& replica : config.replicas) {
+        DBPoolConfig replicaConfig = config;
+        replicaConfig.host = replica.host;
+        replicaConfig.port = replica.port;
+        replicaConfig.replicas.clear();
+        replicas.push_back(std::make_shared<MySQLPool>(replicaConfig, db_service));
+    }
+    return std::make_shared<RoutingDBPool>(primary, std::move(replicas),
+                                           config.max_replica_lag, config.replica_check_interval);
 }
 
 MySQLPoolFactory& MySQLPoolFactory::get_instance() {
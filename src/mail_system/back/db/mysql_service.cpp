@@ -1,4 +1,6 @@
 #include "mail_system/back/db/mysql_service.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
@@ -11,47 +13,84 @@ std::mutex MySQLService::s_mutex;
 // MySQLResult实现
 
 MySQLResult::MySQLResult(MYSQL_RES* result)
-    : m_result(result), m_rowCount(0), m_columnCount(0) {
-    if (m_result) {
-        load_result_data();
-    }
-}
-
-MySQLResult::~MySQLResult() {
-    if (m_result) {
-        mysql_free_result(m_result);
-        m_result = nullptr;
+    : m_offsets(1, 0), m_columnCount(0) {
+    if (!result) {
+        return;
     }
-}
-
-void MySQLResult::load_result_data() {
-    m_rowCount = mysql_num_rows(m_result);
-    m_columnCount = mysql_num_fields(m_result);
+    m_columnCount = mysql_num_fields(result);
 
     // 获取列名
-    MYSQL_FIELD* fields = mysql_fetch_fields(m_result);
+    MYSQL_FIELD* fields = mysql_fetch_fields(result);
+    m_columnNames.reserve(m_columnCount);
     for (size_t i = 0; i < m_columnCount; ++i) {
         m_columnNames.push_back(fields[i].name);
     }
+    build_column_index();
 
-    // 获取所有行数据
+    // 结果集已在客户端内存中，先统计总长度，一次分配好再拷贝
+    size_t rowCount = mysql_num_rows(result);
+    size_t totalBytes = 0;
     MYSQL_ROW row;
-    while ((row = mysql_fetch_row(m_result))) {
-        std::vector<std::string> rowData;
-        unsigned long* lengths = mysql_fetch_lengths(m_result);
+    while ((row = mysql_fetch_row(result))) {
+        unsigned long* lengths = mysql_fetch_lengths(result);
+        for (size_t i = 0; i < m_columnCount; ++i) {
+            totalBytes += lengths[i];
+        }
+    }
+    reserve(rowCount, totalBytes);
+
+    mysql_data_seek(result, 0);
+    while ((row = mysql_fetch_row(result))) {
+        unsigned long* lengths = mysql_fetch_lengths(result);
         for (size_t i = 0; i < m_columnCount; ++i) {
             if (row[i]) {
-                rowData.push_back(std::string(row[i], lengths[i]));
+                append_value(row[i], lengths[i]);
             } else {
-                rowData.push_back("");
+                append_null();
             }
         }
-        m_rows.push_back(rowData);
     }
+    mysql_free_result(result);
+}
+
+MySQLResult::MySQLResult(std::vector<std::string> column_names)
+    : m_columnNames(std::move(column_names)),
+      m_offsets(1, 0),
+      m_columnCount(m_columnNames.size()) {
+    build_column_index();
+}
+
+void MySQLResult::build_column_index() {
+    m_columnIndex.reserve(m_columnCount);
+    for (size_t i = 0; i < m_columnCount; ++i) {
+        // 重名的列以第一个为准，与原来的线性查找一致
+        m_columnIndex.emplace(m_columnNames[i], i);
+    }
+}
+
+void MySQLResult::reserve(size_t rows, size_t bytes) {
+    m_arena.reserve(bytes);
+    m_offsets.reserve(rows * m_columnCount + 1);
+    m_nulls.reserve(rows * m_columnCount);
+}
+
+void MySQLResult::append_value(const char* data, size_t length) {
+    m_arena.append(data, length);
+    m_offsets.push_back(m_arena.size());
+    m_nulls.push_back(0);
+}
+
+void MySQLResult::append_null() {
+    m_offsets.push_back(m_arena.size());
+    m_nulls.push_back(1);
+}
+
+size_t MySQLResult::cell_index(size_t row_index, size_t column_index) const {
+    return row_index * m_columnCount + column_index;
 }
 
 size_t MySQLResult::get_row_count() const {
-    return m_rowCount;
+    return m_columnCount ? m_nulls.size() / m_columnCount : 0;
 }
 
 size_t MySQLResult::get_column_count() const {
@@ -64,9 +103,9 @@ std::vector<std::string> MySQLResult::get_column_names() const {
 
 std::map<std::string, std::string> MySQLResult::get_row(size_t row_index) const {
     std::map<std::string, std::string> rowMap;
-    if (row_index < m_rowCount) {
+    if (row_index < get_row_count()) {
         for (size_t i = 0; i < m_columnCount; ++i) {
-            rowMap[m_columnNames[i]] = m_rows[row_index][i];
+            rowMap[m_columnNames[i]] = std::string(get_view(row_index, i));
         }
     }
     return rowMap;
@@ -74,29 +113,551 @@ std::map<std::string, std::string> MySQLResult::get_row(size_t row_index) const
 
 std::vector<std::map<std::string, std::string>> MySQLResult::get_all_rows() const {
     std::vector<std::map<std::string, std::string>> allRows;
-    for (size_t i = 0; i < m_rowCount; ++i) {
+    size_t rowCount = get_row_count();
+    allRows.reserve(rowCount);
+    for (size_t i = 0; i < rowCount; ++i) {
         allRows.push_back(get_row(i));
     }
     return allRows;
 }
 
 std::string MySQLResult::get_value(size_t row_index, const std::string& column_name) const {
-    if (row_index >= m_rowCount) {
-        return "";
+    return std::string(get_view(row_index, get_column_index(column_name)));
+}
+
+size_t MySQLResult::get_column_index(const std::string& column_name) const {
+    auto it = m_columnIndex.find(column_name);
+    return it == m_columnIndex.end() ? npos : it->second;
+}
+
+std::string_view MySQLResult::get_view(size_t row_index, size_t column_index) const {
+    if (is_null(row_index, column_index)) {
+        return std::string_view();
     }
+    size_t cell = cell_index(row_index, column_index);
+    return std::string_view(m_arena.data() + m_offsets[cell], m_offsets[cell + 1] - m_offsets[cell]);
+}
 
-    for (size_t i = 0; i < m_columnCount; ++i) {
-        if (m_columnNames[i] == column_name) {
-            return m_rows[row_index][i];
+bool MySQLResult::is_null(size_t row_index, size_t column_index) const {
+    if (column_index >= m_columnCount || row_index >= get_row_count()) {
+        return true;
+    }
+    return m_nulls[cell_index(row_index, column_index)] != 0;
+}
+
+// MySQLStreamResult实现
+
+MySQLStreamResult::MySQLStreamResult(MYSQL* mysql, MYSQL_RES* result)
+    : m_mysql(mysql), m_result(result), m_row(nullptr), m_lengths(nullptr), m_error(false) {
+    unsigned int columnCount = mysql_num_fields(m_result);
+    MYSQL_FIELD* fields = mysql_fetch_fields(m_result);
+    m_columnNames.reserve(columnCount);
+    for (unsigned int i = 0; i < columnCount; ++i) {
+        m_columnNames.push_back(fields[i].name);
+    }
+}
+
+MySQLStreamResult::~MySQLStreamResult() {
+    if (m_result) {
+        // 未读完的行由客户端库读出丢弃，连接随后可以继续使用
+        mysql_free_result(m_result);
+        m_result = nullptr;
+    }
+}
+
+size_t MySQLStreamResult::get_column_count() const {
+    return m_columnNames.size();
+}
+
+const std::vector<std::string>& MySQLStreamResult::get_column_names() const {
+    return m_columnNames;
+}
+
+bool MySQLStreamResult::next() {
+    if (!m_result) {
+        return false;
+    }
+    m_row = mysql_fetch_row(m_result);
+    if (!m_row) {
+        if (mysql_errno(m_mysql) != 0) {
+            m_error = true;
+            m_lastError = mysql_error(m_mysql);
+            std::cerr << "MySQL fetch row error: " << m_lastError << std::endl;
+        }
+        mysql_free_result(m_result);
+        m_result = nullptr;
+        m_lengths = nullptr;
+        return false;
+    }
+    m_lengths = mysql_fetch_lengths(m_result);
+    return true;
+}
+
+std::string_view MySQLStreamResult::get_value(size_t column_index) const {
+    if (!m_row || column_index >= m_columnNames.size() || !m_row[column_index]) {
+        return std::string_view();
+    }
+    return std::string_view(m_row[column_index], m_lengths[column_index]);
+}
+
+bool MySQLStreamResult::is_null(size_t column_index) const {
+    return !m_row || column_index >= m_columnNames.size() || !m_row[column_index];
+}
+
+bool MySQLStreamResult::has_error() const {
+    return m_error;
+}
+
+std::string MySQLStreamResult::get_last_error() const {
+    return m_lastError;
+}
+
+// MySQLStatement实现
+
+namespace {
+// 这些错误说明服务器端的语句句柄已经不存在，需要重新预处理
+bool is_stale_statement_error(unsigned int err) {
+    return err == 2006    // CR_SERVER_GONE_ERROR
+        || err == 2013    // CR_SERVER_LOST
+        || err == 1243;   // ER_UNKNOWN_STMT_HANDLER
+}
+}
+
+MySQLStatement::MySQLStatement(MYSQL_STMT* stmt, const std::string& sql, std::shared_ptr<DBMetrics> metrics)
+    : m_stmt(stmt),
+      m_sql(sql),
+      m_paramCount(stmt ? mysql_stmt_param_count(stmt) : 0),
+      m_params(m_paramCount),
+      m_stringValues(m_paramCount),
+      m_intValues(m_paramCount, 0),
+      m_lengths(m_paramCount, 0),
+      m_isNull(new mysql_bool[m_paramCount + 1]()),
+      m_bound(m_paramCount, 0),
+      m_affectedRows(0),
+      m_insertId(0),
+      m_broken(stmt == nullptr),
+      m_failed(false),
+      m_metrics(std::move(metrics)),
+      m_queryStats(nullptr) {
+    if (m_metrics) {
+        // 归一化只在预处理时做一次，执行时直接累加到同一个统计项
+        m_queryStats = m_metrics->statement_stats(m_sql);
+    }
+    std::memset(m_params.data(), 0, m_params.size() * sizeof(MYSQL_BIND));
+    if (m_stmt) {
+        // 结果集存到客户端时更新各列的max_length，用于一次分配足够的缓冲区
+        mysql_bool update_max_length = 1;
+        mysql_stmt_attr_set(m_stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+    }
+}
+
+MySQLStatement::~MySQLStatement() {
+    close();
+}
+
+void MySQLStatement::close() {
+    if (m_stmt) {
+        mysql_stmt_close(m_stmt);
+        m_stmt = nullptr;
+    }
+    m_broken = true;
+}
+
+bool MySQLStatement::is_valid() const {
+    return m_stmt && !m_broken;
+}
+
+const std::string& MySQLStatement::get_sql() const {
+    return m_sql;
+}
+
+size_t MySQLStatement::get_param_count() const {
+    return m_paramCount;
+}
+
+bool MySQLStatement::check_index(size_t index) {
+    if (index >= m_paramCount) {
+        m_lastError = "Parameter index " + std::to_string(index) + " out of range for: " + m_sql;
+        std::cerr << "MySQL bind error: " << m_lastError << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MySQLStatement::bind(size_t index, const std::string& value) {
+    if (!check_index(index)) {
+        return false;
+    }
+    m_stringValues[index] = value;
+    m_lengths[index] = value.size();
+    m_isNull[index] = false;
+    MYSQL_BIND& param = m_params[index];
+    std::memset(&param, 0, sizeof(param));
+    param.buffer_type = MYSQL_TYPE_STRING;
+    param.buffer = &m_stringValues[index][0];
+    param.buffer_length = value.size();
+    param.length = &m_lengths[index];
+    param.is_null = &m_isNull[index];
+    m_bound[index] = 1;
+    return true;
+}
+
+bool MySQLStatement::bind(size_t index, int64_t value) {
+    if (!check_index(index)) {
+        return false;
+    }
+    m_intValues[index] = value;
+    m_isNull[index] = false;
+    MYSQL_BIND& param = m_params[index];
+    std::memset(&param, 0, sizeof(param));
+    param.buffer_type = MYSQL_TYPE_LONGLONG;
+    param.buffer = &m_intValues[index];
+    param.is_null = &m_isNull[index];
+    m_bound[index] = 1;
+    return true;
+}
+
+bool MySQLStatement::bind_null(size_t index) {
+    if (!check_index(index)) {
+        return false;
+    }
+    m_isNull[index] = true;
+    MYSQL_BIND& param = m_params[index];
+    std::memset(&param, 0, sizeof(param));
+    param.buffer_type = MYSQL_TYPE_NULL;
+    param.is_null = &m_isNull[index];
+    m_bound[index] = 1;
+    return true;
+}
+
+void MySQLStatement::record_error(const char* what) {
+    m_failed = true;
+    m_lastError = m_stmt ? mysql_stmt_error(m_stmt) : "Statement is closed";
+    if (m_stmt && is_stale_statement_error(mysql_stmt_errno(m_stmt))) {
+        m_broken = true;
+    }
+    std::cerr << "MySQL " << what << " error: " << m_lastError << std::endl;
+}
+
+bool MySQLStatement::run() {
+    m_failed = true;
+    if (!is_valid()) {
+        m_lastError = "Statement is no longer valid: " + m_sql;
+        return false;
+    }
+    if (std::find(m_bound.begin(), m_bound.end(), 0) != m_bound.end()) {
+        m_lastError = "Not all parameters are bound for: " + m_sql;
+        std::cerr << "MySQL bind error: " << m_lastError << std::endl;
+        return false;
+    }
+    if (m_paramCount > 0 && mysql_stmt_bind_param(m_stmt, m_params.data())) {
+        record_error("bind param");
+        return false;
+    }
+    if (mysql_stmt_execute(m_stmt) != 0) {
+        record_error("stmt execute");
+        return false;
+    }
+    // 绑定只对一次执行有效，避免下次执行时沿用旧参数
+    std::fill(m_bound.begin(), m_bound.end(), 0);
+    m_failed = false;
+    return true;
+}
+
+void MySQLStatement::record_metrics(std::chrono::steady_clock::time_point start) {
+    if (!m_queryStats) {
+        return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    m_metrics->record_query(*m_queryStats, m_sql, elapsed, !m_failed);
+}
+
+std::shared_ptr<IDBResult> MySQLStatement::query() {
+    auto start = std::chrono::steady_clock::now();
+    auto result = fetch_all();
+    record_metrics(start);
+    return result;
+}
+
+std::shared_ptr<IDBResult> MySQLStatement::fetch_all() {
+    if (!run()) {
+        return nullptr;
+    }
+    if (mysql_stmt_store_result(m_stmt) != 0) {
+        record_error("stmt store result");
+        return nullptr;
+    }
+    MYSQL_RES* metadata = mysql_stmt_result_metadata(m_stmt);
+    if (!metadata) {
+        // 没有结果集的语句
+        mysql_stmt_free_result(m_stmt);
+        return nullptr;
+    }
+
+    unsigned int columnCount = mysql_num_fields(metadata);
+    MYSQL_FIELD* fields = mysql_fetch_fields(metadata);
+    std::vector<std::string> columnNames;
+    columnNames.reserve(columnCount);
+
+    // 所有列都按字符串取回，缓冲区按本次结果集各列的最大长度分配
+    std::vector<MYSQL_BIND> binds(columnCount);
+    std::vector<std::string> buffers(columnCount);
+    std::vector<unsigned long> lengths(columnCount, 0);
+    std::unique_ptr<mysql_bool[]> nulls(new mysql_bool[columnCount + 1]());
+    std::memset(binds.data(), 0, binds.size() * sizeof(MYSQL_BIND));
+    for (unsigned int i = 0; i < columnCount; ++i) {
+        columnNames.push_back(fields[i].name);
+        buffers[i].resize(std::max<unsigned long>(fields[i].max_length, 1));
+        binds[i].buffer_type = MYSQL_TYPE_STRING;
+        binds[i].buffer = &buffers[i][0];
+        binds[i].buffer_length = buffers[i].size();
+        binds[i].length = &lengths[i];
+        binds[i].is_null = &nulls[i];
+    }
+    mysql_free_result(metadata);
+
+    if (columnCount > 0 && mysql_stmt_bind_result(m_stmt, binds.data())) {
+        record_error("bind result");
+        mysql_stmt_free_result(m_stmt);
+        return nullptr;
+    }
+    auto result = std::make_shared<MySQLResult>(std::move(columnNames));
+    result->reserve(mysql_stmt_num_rows(m_stmt), 0);
+    std::string truncated;
+    while (true) {
+        int rc = mysql_stmt_fetch(m_stmt);
+        if (rc == MYSQL_NO_DATA) {
+            break;
         }
+        if (rc == 1) {
+            record_error("stmt fetch");
+            mysql_stmt_free_result(m_stmt);
+            return nullptr;
+        }
+        for (unsigned int i = 0; i < columnCount; ++i) {
+            if (nulls[i]) {
+                result->append_null();
+            } else if (lengths[i] > buffers[i].size()) {
+                // 截断的列单独再取一次
+                truncated.resize(lengths[i]);
+                MYSQL_BIND column;
+                std::memset(&column, 0, sizeof(column));
+                column.buffer_type = MYSQL_TYPE_STRING;
+                column.buffer = &truncated[0];
+                column.buffer_length = lengths[i];
+                mysql_stmt_fetch_column(m_stmt, &column, i, 0);
+                result->append_value(truncated.data(), lengths[i]);
+            } else {
+                result->append_value(buffers[i].data(), lengths[i]);
+            }
+        }
+    }
+    mysql_stmt_free_result(m_stmt);
+
+    return result;
+}
+
+bool MySQLStatement::execute() {
+    auto start = std::chrono::steady_clock::now();
+    if (!run()) {
+        record_metrics(start);
+        return false;
+    }
+    m_affectedRows = mysql_stmt_affected_rows(m_stmt);
+    m_insertId = mysql_stmt_insert_id(m_stmt);
+    if (mysql_stmt_field_count(m_stmt) > 0) {
+        // 用execute执行了查询语句，丢弃结果集以免阻塞连接
+        mysql_stmt_store_result(m_stmt);
+        mysql_stmt_free_result(m_stmt);
+    }
+    record_metrics(start);
+    return true;
+}
+
+uint64_t MySQLStatement::get_affected_rows() const {
+    return m_affectedRows;
+}
+
+uint64_t MySQLStatement::get_insert_id() const {
+    return m_insertId;
+}
+
+std::string MySQLStatement::get_last_error() const {
+    return m_lastError;
+}
+
+std::shared_ptr<IDBStreamResult> MySQLStatement::query_stream() {
+    // 流式读取只统计执行到返回第一行之前的时间，逐行读取的时间由调用方决定
+    auto start = std::chrono::steady_clock::now();
+    bool ok = run();
+    record_metrics(start);
+    if (!ok) {
+        return nullptr;
+    }
+    MYSQL_RES* metadata = mysql_stmt_result_metadata(m_stmt);
+    if (!metadata) {
+        // 没有结果集的语句
+        return nullptr;
+    }
+    // 不调用mysql_stmt_store_result，行在fetch时才从服务器读取
+    auto stream = std::make_shared<MySQLStatementStream>(shared_from_this(), metadata);
+    mysql_free_result(metadata);
+    if (stream->has_error()) {
+        return nullptr;
+    }
+    return stream;
+}
+
+// MySQLStatementStream实现
+
+namespace {
+// 流式读取时还不知道每列的最大长度，先分配较小的缓冲区，遇到更长的值再扩容
+const unsigned long kInitialStreamBufferSize = 256;
+}
+
+MySQLStatementStream::MySQLStatementStream(std::shared_ptr<MySQLStatement> statement, MYSQL_RES* metadata)
+    : m_statement(std::move(statement)), m_hasRow(false), m_done(false), m_error(false) {
+    unsigned int columnCount = mysql_num_fields(metadata);
+    MYSQL_FIELD* fields = mysql_fetch_fields(metadata);
+    m_columnNames.reserve(columnCount);
+    m_buffers.resize(columnCount);
+    m_lengths.assign(columnCount, 0);
+    m_nulls.reset(new mysql_bool[columnCount + 1]());
+    for (unsigned int i = 0; i < columnCount; ++i) {
+        m_columnNames.push_back(fields[i].name);
+        unsigned long size = std::min<unsigned long>(fields[i].length, kInitialStreamBufferSize);
+        m_buffers[i].resize(std::max<unsigned long>(size, 1));
     }
-    return "";
+    if (!bind_buffers()) {
+        finish();
+    }
+}
+
+MySQLStatementStream::~MySQLStatementStream() {
+    finish();
+}
+
+bool MySQLStatementStream::bind_buffers() {
+    size_t columnCount = m_columnNames.size();
+    m_binds.assign(columnCount, MYSQL_BIND());
+    std::memset(m_binds.data(), 0, m_binds.size() * sizeof(MYSQL_BIND));
+    for (size_t i = 0; i < columnCount; ++i) {
+        m_binds[i].buffer_type = MYSQL_TYPE_STRING;
+        m_binds[i].buffer = m_buffers[i].data();
+        m_binds[i].buffer_length = m_buffers[i].size();
+        m_binds[i].length = &m_lengths[i];
+        m_binds[i].is_null = &m_nulls[i];
+    }
+    if (columnCount > 0 && mysql_stmt_bind_result(m_statement->m_stmt, m_binds.data())) {
+        fail(mysql_stmt_error(m_statement->m_stmt));
+        return false;
+    }
+    return true;
+}
+
+void MySQLStatementStream::finish() {
+    m_hasRow = false;
+    if (m_done) {
+        return;
+    }
+    m_done = true;
+    if (m_statement->is_valid()) {
+        // 丢弃尚未读取的行，语句可以再次执行
+        mysql_stmt_free_result(m_statement->m_stmt);
+    }
+}
+
+void MySQLStatementStream::fail(const std::string& error) {
+    m_error = true;
+    m_lastError = error;
+    std::cerr << "MySQL stmt stream error: " << m_lastError << std::endl;
+}
+
+size_t MySQLStatementStream::get_column_count() const {
+    return m_columnNames.size();
+}
+
+const std::vector<std::string>& MySQLStatementStream::get_column_names() const {
+    return m_columnNames;
+}
+
+bool MySQLStatementStream::next() {
+    if (m_done) {
+        return false;
+    }
+    if (!m_statement->is_valid()) {
+        // 语句被缓存淘汰或连接已断开
+        fail("Statement closed while streaming: " + m_statement->get_sql());
+        m_done = true;
+        m_hasRow = false;
+        return false;
+    }
+
+    MYSQL_STMT* stmt = m_statement->m_stmt;
+    int rc = mysql_stmt_fetch(stmt);
+    if (rc == MYSQL_NO_DATA) {
+        finish();
+        return false;
+    }
+    if (rc == 1) {
+        m_statement->record_error("stmt fetch");
+        fail(m_statement->get_last_error());
+        finish();
+        return false;
+    }
+
+    // 截断的列扩容后单独再取一次，并为后续的行重新绑定更大的缓冲区
+    bool grown = false;
+    for (size_t i = 0; i < m_columnNames.size(); ++i) {
+        if (m_nulls[i] || m_lengths[i] <= m_buffers[i].size()) {
+            continue;
+        }
+        m_buffers[i].resize(m_lengths[i]);
+        MYSQL_BIND column;
+        std::memset(&column, 0, sizeof(column));
+        column.buffer_type = MYSQL_TYPE_STRING;
+        column.buffer = m_buffers[i].data();
+        column.buffer_length = m_buffers[i].size();
+        if (mysql_stmt_fetch_column(stmt, &column, static_cast<unsigned int>(i), 0) != 0) {
+            m_statement->record_error("stmt fetch column");
+            fail(m_statement->get_last_error());
+            finish();
+            return false;
+        }
+        grown = true;
+    }
+    if (grown && !bind_buffers()) {
+        finish();
+        return false;
+    }
+    m_hasRow = true;
+    return true;
+}
+
+std::string_view MySQLStatementStream::get_value(size_t column_index) const {
+    if (!m_hasRow || column_index >= m_columnNames.size() || m_nulls[column_index]) {
+        return std::string_view();
+    }
+    return std::string_view(m_buffers[column_index].data(), m_lengths[column_index]);
+}
+
+bool MySQLStatementStream::is_null(size_t column_index) const {
+    return !m_hasRow || column_index >= m_columnNames.size() || m_nulls[column_index];
+}
+
+bool MySQLStatementStream::has_error() const {
+    return m_error;
+}
+
+std::string MySQLStatementStream::get_last_error() const {
+    return m_lastError;
 }
 
 // MySQLConnection实现
 
 MySQLConnection::MySQLConnection()
-    : m_mysql(nullptr), m_port(3306), m_connected(false) {
+    : m_mysql(nullptr), m_port(3306), m_connected(false),
+      m_statementCacheCapacity(kDefaultStatementCacheCapacity) {
     init_mysql();
 }
 
@@ -134,7 +695,7 @@ void MySQLConnection::set_connection_params(
 }
 
 bool MySQLConnection::connect() {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     
     if (m_connected) {
         return true;
@@ -163,8 +724,10 @@ bool MySQLConnection::connect() {
 }
 
 void MySQLConnection::disconnect() {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+    // 语句句柄必须在连接关闭前释放
+    clear_statement_cache();
     if (m_mysql) {
         mysql_close(m_mysql);
         m_mysql = nullptr;
@@ -173,12 +736,29 @@ void MySQLConnection::disconnect() {
 }
 
 bool MySQLConnection::is_connected() const {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     return m_connected && m_mysql;
 }
 
+bool MySQLConnection::ping() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (!m_connected || !m_mysql) {
+        return false;
+    }
+    // 开启了自动重连时，ping可能在内部换成新的会话，旧会话上的预处理语句随之失效
+    unsigned long threadId = mysql_thread_id(m_mysql);
+    if (mysql_ping(m_mysql) != 0) {
+        std::cerr << "MySQL ping failed: " << mysql_error(m_mysql) << std::endl;
+        return false;
+    }
+    if (mysql_thread_id(m_mysql) != threadId) {
+        clear_statement_cache();
+    }
+    return true;
+}
+
 std::shared_ptr<IDBResult> MySQLConnection::query(const std::string& sql) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     
     if (!is_connected()) {
         if (!connect()) {
@@ -186,8 +766,10 @@ std::shared_ptr<IDBResult> MySQLConnection::query(const std::string& sql) {
         }
     }
 
+    auto start = std::chrono::steady_clock::now();
     if (mysql_query(m_mysql, sql.c_str()) != 0) {
         std::cerr << "MySQL query error: " << mysql_error(m_mysql) << std::endl;
+        record_query(sql, start, false);
         return nullptr;
     }
 
@@ -195,19 +777,52 @@ std::shared_ptr<IDBResult> MySQLConnection::query(const std::string& sql) {
     if (!result) {
         if (mysql_field_count(m_mysql) == 0) {
             // 没有结果集的查询（如INSERT, UPDATE, DELETE）
+            record_query(sql, start, true);
             return nullptr;
         } else {
             // 查询出错
             std::cerr << "MySQL store result error: " << mysql_error(m_mysql) << std::endl;
+            record_query(sql, start, false);
             return nullptr;
         }
     }
 
-    return std::make_shared<MySQLResult>(result);
+    auto rows = std::make_shared<MySQLResult>(result);
+    record_query(sql, start, true);
+    return rows;
+}
+
+std::shared_ptr<IDBStreamResult> MySQLConnection::query_stream(const std::string& sql) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+    if (!is_connected()) {
+        if (!connect()) {
+            return nullptr;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (mysql_real_query(m_mysql, sql.c_str(), sql.length()) != 0) {
+        std::cerr << "MySQL query error: " << mysql_error(m_mysql) << std::endl;
+        record_query(sql, start, false);
+        return nullptr;
+    }
+    record_query(sql, start, true);
+
+    // 与mysql_store_result不同，mysql_use_result只读取结果集的元数据
+    MYSQL_RES* result = mysql_use_result(m_mysql);
+    if (!result) {
+        if (mysql_field_count(m_mysql) != 0) {
+            std::cerr << "MySQL use result error: " << mysql_error(m_mysql) << std::endl;
+        }
+        return nullptr;
+    }
+
+    return std::make_shared<MySQLStreamResult>(m_mysql, result);
 }
 
 bool MySQLConnection::execute(const std::string& sql) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     
     if (!is_connected()) {
         if (!connect()) {
@@ -215,11 +830,14 @@ bool MySQLConnection::execute(const std::string& sql) {
         }
     }
 
+    auto start = std::chrono::steady_clock::now();
     if (mysql_query(m_mysql, sql.c_str()) != 0) {
         std::cerr << "MySQL execute error: " << mysql_error(m_mysql) << std::endl;
+        record_query(sql, start, false);
         return false;
     }
 
+    record_query(sql, start, true);
     return true;
 }
 
@@ -236,7 +854,7 @@ bool MySQLConnection::rollback() {
 }
 
 std::string MySQLConnection::get_last_error() const {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     
     if (m_mysql) {
         return mysql_error(m_mysql);
@@ -245,17 +863,95 @@ std::string MySQLConnection::get_last_error() const {
 }
 
 std::string MySQLConnection::escape_string(const std::string& str) const {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     
     if (!m_mysql) {
         return str;
     }
 
-    char* escaped = new char[str.length() * 2 + 1];
-    mysql_real_escape_string(m_mysql, escaped, str.c_str(), str.length());
-    std::string result(escaped);
-    delete[] escaped;
-    return result;
+    std::string escaped(str.length() * 2 + 1, '\0');
+    unsigned long length = mysql_real_escape_string(m_mysql, &escaped[0], str.c_str(), str.length());
+    escaped.resize(length);
+    return escaped;
+}
+
+std::shared_ptr<IDBStatement> MySQLConnection::prepare(const std::string& sql) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+
+    auto it = m_statementIndex.find(sql);
+    if (it != m_statementIndex.end()) {
+        if ((*it->second)->is_valid()) {
+            // 命中缓存，移到表头
+            m_statements.splice(m_statements.begin(), m_statements, it->second);
+            return m_statements.front();
+        }
+        // 重连后句柄失效，丢弃后重新预处理
+        m_statements.erase(it->second);
+        m_statementIndex.erase(it);
+    }
+
+    if (!is_connected()) {
+        if (!connect()) {
+            return nullptr;
+        }
+    }
+
+    MYSQL_STMT* stmt = mysql_stmt_init(m_mysql);
+    if (!stmt) {
+        std::cerr << "MySQL stmt init error: " << mysql_error(m_mysql) << std::endl;
+        return nullptr;
+    }
+    if (mysql_stmt_prepare(stmt, sql.c_str(), sql.length()) != 0) {
+        std::cerr << "MySQL prepare error: " << mysql_stmt_error(stmt) << std::endl;
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+
+    auto statement = std::make_shared<MySQLStatement>(stmt, sql, m_metrics);
+    if (m_statementCacheCapacity == 0) {
+        return statement;
+    }
+    m_statements.push_front(statement);
+    m_statementIndex[sql] = m_statements.begin();
+    while (m_statements.size() > m_statementCacheCapacity) {
+        // 淘汰最久未使用的语句：只放掉缓存的引用，调用方仍持有时由最后一个持有者析构时关闭
+        m_statementIndex.erase(m_statements.back()->get_sql());
+        m_statements.pop_back();
+    }
+    return statement;
+}
+
+void MySQLConnection::set_statement_cache_capacity(size_t capacity) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_statementCacheCapacity = capacity;
+    while (m_statements.size() > m_statementCacheCapacity) {
+        m_statementIndex.erase(m_statements.back()->get_sql());
+        m_statements.pop_back();
+    }
+}
+
+void MySQLConnection::set_metrics(std::shared_ptr<DBMetrics> metrics) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_metrics = std::move(metrics);
+    // 已缓存的语句还指向旧的统计对象，之后重新预处理；语句句柄在连接上仍然有效，不必关闭
+    m_statements.clear();
+    m_statementIndex.clear();
+}
+
+void MySQLConnection::record_query(const std::string& sql, std::chrono::steady_clock::time_point start, bool ok) {
+    if (!m_metrics) {
+        return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    m_metrics->record_query(*m_metrics->statement_stats(sql), sql, elapsed, ok);
+}
+
+void MySQLConnection::clear_statement_cache() {
+    for (auto& statement : m_statements) {
+        statement->close();
+    }
+    m_statements.clear();
+    m_statementIndex.clear();
 }
 
 // MySQLService实现
@@ -0,0 +1,180 @@
+#include "mail_system/back/db/routing_db_pool.h"
+#include <algorithm>
+#include <iostream>
+
+namespace mail_system {
+
+RoutingDBPool::RoutingDBPool(std::shared_ptr<DBPool> primary,
+                             std::vector<std::shared_ptr<DBPool>> replicas,
+                             unsigned int max_replica_lag,
+                             unsigned int check_interval)
+    : m_primary(std::move(primary)),
+      m_nextReplica(0),
+      m_maxReplicaLag(max_replica_lag),
+      m_checkInterval(std::max(1u, check_interval)),
+      m_running(true) {
+    for (auto& replica : replicas) {
+        if (replica) {
+            m_replicas.push_back(std::make_unique<ReplicaState>(std::move(replica)));
+        }
+    }
+    initialize_pool();
+    if (!m_replicas.empty()) {
+        m_monitorThread = std::thread(&RoutingDBPool::monitor_thread, this);
+    }
+}
+
+RoutingDBPool::~RoutingDBPool() {
+    close();
+}
+
+void RoutingDBPool::initialize_pool() {
+    // 启动时先检查一遍，读请求从一开始就能路由到副本
+    check_replicas();
+}
+
+std::shared_ptr<IDBConnection> RoutingDBPool::create_connection() {
+    return nullptr;
+}
+
+void RoutingDBPool::release_lease(std::shared_ptr<IDBConnection>, std::shared_ptr<void>) {
+    // 租约都来自子连接池，不会归还到这里
+}
+
+DBConnectionLease RoutingDBPool::get_connection() {
+    return m_primary->get_connection();
+}
+
+DBConnectionLease RoutingDBPool::get_connection(DBAccessMode mode) {
+    if (mode == DBAccessMode::READ && !m_replicas.empty()) {
+        // 从轮询位置开始找第一个可用的副本
+        size_t start = m_nextReplica.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < m_replicas.size(); ++i) {
+            ReplicaState& replica = *m_replicas[(start + i) % m_replicas.size()];
+            if (!replica.available.load(std::memory_order_acquire)) {
+                continue;
+            }
+            DBCheckoutError error;
+            auto lease = replica.pool->get_connection(error);
+            if (lease) {
+                return lease;
+            }
+            // 连接或ping失败才摘除副本，等下次检查再决定是否恢复；
+            // 连接都被占用只说明副本忙，换下一个副本，不影响它的可用状态
+            if (error == DBCheckoutError::UNAVAILABLE) {
+                replica.available.store(false, std::memory_order_release);
+            }
+        }
+    }
+    return m_primary->get_connection();
+}
+
+size_t RoutingDBPool::get_pool_size() const {
+    size_t size = m_primary->get_pool_size();
+    for (const auto& replica : m_replicas) {
+        size += replica->pool->get_pool_size();
+    }
+    return size;
+}
+
+size_t RoutingDBPool::get_available_connections() const {
+    size_t available = m_primary->get_available_connections();
+    for (const auto& replica : m_replicas) {
+        available += replica->pool->get_available_connections();
+    }
+    return available;
+}
+
+size_t RoutingDBPool::get_healthy_replicas() const {
+    size_t healthy = 0;
+    for (const auto& replica : m_replicas) {
+        if (replica->available.load(std::memory_order_acquire)) {
+            ++healthy;
+        }
+    }
+    return healthy;
+}
+
+void RoutingDBPool::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_monitorThread.joinable()) {
+        m_monitorThread.join();
+    }
+    for (auto& replica : m_replicas) {
+        replica->available.store(false, std::memory_order_release);
+        replica->pool->close();
+    }
+    m_primary->close();
+}
+
+void RoutingDBPool::dump_metrics(std::ostream& os) const {
+    os << "Routing pool: " << get_healthy_replicas() << "/" << m_replicas.size() << " replicas healthy" << std::endl;
+    m_primary->dump_metrics(os);
+    for (const auto& replica : m_replicas) {
+        replica->pool->dump_metrics(os);
+    }
+}
+
+void RoutingDBPool::monitor_thread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        m_cv.wait_for(lock, m_checkInterval, [this] { return !m_running; });
+        if (!m_running) {
+            break;
+        }
+        lock.unlock();
+        check_replicas();
+        lock.lock();
+    }
+}
+
+void RoutingDBPool::check_replicas() {
+    for (size_t i = 0; i < m_replicas.size(); ++i) {
+        auto& replica = m_replicas[i];
+        int64_t lag = -1;
+        {
+            auto lease = replica->pool->get_connection();
+            if (lease) {
+                lag = query_replica_lag(*lease);
+            }
+        }
+        bool available = lag >= 0 && lag <= static_cast<int64_t>(m_maxReplicaLag);
+        bool wasAvailable = replica->available.exchange(available, std::memory_order_acq_rel);
+        if (wasAvailable != available) {
+            if (available) {
+                std::cout << "DB replica " << i << " back in rotation, lag " << lag << "s" << std::endl;
+            } else {
+                std::cerr << "DB replica " << i << " removed from rotation, lag "
+                          << (lag < 0 ? std::string("unknown") : std::to_string(lag) + "s") << std::endl;
+            }
+        }
+    }
+}
+
+int64_t RoutingDBPool::query_replica_lag(IDBConnection& connection) {
+    // MySQL 8.0.22起为SHOW REPLICA STATUS，旧版本只认SHOW SLAVE STATUS
+    auto result = connection.query("SHOW REPLICA STATUS");
+    size_t column = IDBResult::npos;
+    if (result) {
+        column = result->get_column_index("Seconds_Behind_Source");
+    } else {
+        result = connection.query("SHOW SLAVE STATUS");
+        if (result) {
+            column = result->get_column_index("Seconds_Behind_Master");
+        }
+    }
+    if (!result || result->get_row_count() == 0 || column == IDBResult::npos) {
+        return -1;
+    }
+    // 复制线程停止时延迟为NULL
+    return result->get_int(0, column, -1);
+}
+
+} // namespace mail_system
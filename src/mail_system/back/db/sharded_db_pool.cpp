@@ -0,0 +1,132 @@
+#include "mail_system/back/db/sharded_db_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace mail_system {
+
+ShardedDBPool::ShardedDBPool(std::vector<std::string> names,
+                             std::vector<std::shared_ptr<DBPool>> shards,
+                             size_t virtual_nodes)
+    : m_names(std::move(names)),
+      m_shards(std::move(shards)),
+      m_virtualNodes(std::max<size_t>(virtual_nodes, 1)) {
+    if (m_shards.empty()) {
+        throw std::invalid_argument("ShardedDBPool needs at least one shard");
+    }
+    m_names.resize(m_shards.size());
+    for (size_t i = 0; i < m_names.size(); ++i) {
+        if (m_names[i].empty()) {
+            m_names[i] = "shard-" + std::to_string(i);
+        }
+    }
+    initialize_pool();
+}
+
+ShardedDBPool::~ShardedDBPool() {
+    close();
+}
+
+uint64_t ShardedDBPool::hash_key(std::string_view key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    // FNV-1a的低位分布不够均匀，再做一次murmur3的64位混合
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+void ShardedDBPool::initialize_pool() {
+    m_ring.clear();
+    m_ring.reserve(m_shards.size() * m_virtualNodes);
+    for (size_t shard = 0; shard < m_shards.size(); ++shard) {
+        for (size_t node = 0; node < m_virtualNodes; ++node) {
+            m_ring.emplace_back(hash_key(m_names[shard] + "#" + std::to_string(node)), shard);
+        }
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+}
+
+std::shared_ptr<IDBConnection> ShardedDBPool::create_connection() {
+    return nullptr;
+}
+
+void ShardedDBPool::release_lease(std::shared_ptr<IDBConnection>, std::shared_ptr<void>) {
+    // 租约都来自各分片的连接池，不会归还到这里
+}
+
+size_t ShardedDBPool::get_shard_count() const {
+    return m_shards.size();
+}
+
+size_t ShardedDBPool::get_shard_index(const std::string& mail_address) const {
+    if (m_shards.size() == 1) {
+        return 0;
+    }
+    std::string key(mail_address);
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    // 顺时针找到第一个虚拟节点，越过环尾回到开头
+    uint64_t hash = hash_key(key);
+    auto it = std::lower_bound(m_ring.begin(), m_ring.end(), std::make_pair(hash, size_t(0)));
+    if (it == m_ring.end()) {
+        it = m_ring.begin();
+    }
+    return it->second;
+}
+
+const std::string& ShardedDBPool::get_shard_name(size_t shard) const {
+    return m_names.at(shard);
+}
+
+DBConnectionLease ShardedDBPool::get_shard_connection(size_t shard, DBAccessMode mode) {
+    if (shard >= m_shards.size()) {
+        return DBConnectionLease();
+    }
+    return m_shards[shard]->get_connection(mode);
+}
+
+DBConnectionLease ShardedDBPool::get_connection() {
+    return m_shards.front()->get_connection();
+}
+
+DBConnectionLease ShardedDBPool::get_connection(DBAccessMode mode) {
+    return m_shards.front()->get_connection(mode);
+}
+
+size_t ShardedDBPool::get_pool_size() const {
+    size_t size = 0;
+    for (const auto& shard : m_shards) {
+        size += shard->get_pool_size();
+    }
+    return size;
+}
+
+size_t ShardedDBPool::get_available_connections() const {
+    size_t available = 0;
+    for (const auto& shard : m_shards) {
+        available += shard->get_available_connections();
+    }
+    return available;
+}
+
+void ShardedDBPool::dump_metrics(std::ostream& os) const {
+    for (size_t i = 0; i < m_shards.size(); ++i) {
+        os << "Shard " << m_names[i] << ":" << std::endl;
+        m_shards[i]->dump_metrics(os);
+    }
+}
+
+void ShardedDBPool::close() {
+    for (auto& shard : m_shards) {
+        shard->close();
+    }
+}
+
+} // namespace mail_system
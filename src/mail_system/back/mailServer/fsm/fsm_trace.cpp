@@ -0,0 +1,106 @@
+#include "mail_system/back/mailServer/fsm/fsm_trace.h"
+#include <chrono>
+#include <iostream>
+
+namespace mail_system {
+
+namespace {
+// 文件头：魔数 + 版本号
+const char kTraceMagic[4] = {'M', 'S', 'F', 'T'};
+const uint32_t kTraceVersion = 1;
+}
+
+// FsmTraceRecorder实现
+
+FsmTraceRecorder::FsmTraceRecorder(const std::string& filename, size_t buffer_records)
+    : m_file(filename, std::ios::binary | std::ios::trunc),
+      m_bufferRecords(buffer_records == 0 ? 1 : buffer_records) {
+    if (!m_file.is_open()) {
+        std::cerr << "Failed to open FSM trace file: " << filename << std::endl;
+        return;
+    }
+    m_file.write(kTraceMagic, sizeof(kTraceMagic));
+    m_file.write(reinterpret_cast<const char*>(&kTraceVersion), sizeof(kTraceVersion));
+    m_buffer.reserve(m_bufferRecords);
+}
+
+FsmTraceRecorder::~FsmTraceRecorder() {
+    flush();
+}
+
+bool FsmTraceRecorder::is_open() const {
+    return m_file.is_open();
+}
+
+void FsmTraceRecorder::record(FsmProtocol protocol, uint64_t session_id, uint8_t state, uint8_t event, size_t arg_length) {
+    if (!m_file.is_open()) {
+        return;
+    }
+    FsmTraceRecord record;
+    record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.session_id = session_id;
+    record.protocol = static_cast<uint8_t>(protocol);
+    record.state = state;
+    record.event = event;
+    record.reserved = 0;
+    record.arg_length = static_cast<uint32_t>(arg_length);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffer.push_back(record);
+    if (m_buffer.size() >= m_bufferRecords) {
+        flush_locked();
+    }
+}
+
+void FsmTraceRecorder::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flush_locked();
+}
+
+void FsmTraceRecorder::flush_locked() {
+    if (!m_file.is_open() || m_buffer.empty()) {
+        return;
+    }
+    m_file.write(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size() * sizeof(FsmTraceRecord));
+    m_file.flush();
+    m_buffer.clear();
+}
+
+// FsmTraceReader实现
+
+FsmTraceReader::FsmTraceReader(const std::string& filename)
+    : m_file(filename, std::ios::binary) {
+    if (!m_file.is_open()) {
+        std::cerr << "Failed to open FSM trace file: " << filename << std::endl;
+        return;
+    }
+    rewind();
+}
+
+bool FsmTraceReader::is_open() const {
+    return m_file.is_open();
+}
+
+bool FsmTraceReader::next(FsmTraceRecord& record) {
+    if (!m_file.is_open()) {
+        return false;
+    }
+    return static_cast<bool>(m_file.read(reinterpret_cast<char*>(&record), sizeof(record)));
+}
+
+void FsmTraceReader::rewind() {
+    m_file.clear();
+    m_file.seekg(0);
+    char magic[sizeof(kTraceMagic)] = {0};
+    uint32_t version = 0;
+    m_file.read(magic, sizeof(magic));
+    m_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!m_file || std::string(magic, sizeof(magic)) != std::string(kTraceMagic, sizeof(kTraceMagic))
+        || version != kTraceVersion) {
+        std::cerr << "Invalid FSM trace file header" << std::endl;
+        m_file.close();
+    }
+}
+
+} // namespace mail_system
@@ -1,56 +1,47 @@
 #include "mail_system/back/mailServer/fsm/pop3s/pop3s_fsm.h"
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
 #include <boost/algorithm/string.hpp>
 
 namespace mail_system {
 
-Pop3sFsm::Pop3sFsm(std::shared_ptr<DBPool> db_pool)
+Pop3sFsm::Pop3sFsm(std::shared_ptr<DBPool> db_pool, std::shared_ptr<BlobStore> blob_store,
+                   std::shared_ptr<CredentialCache> credential_cache, std::shared_ptr<QuotaCache> quota_cache,
+                   std::shared_ptr<BlobReclaimer> blob_reclaimer)
     : m_state(Pop3sState::AUTHORIZATION),
-      m_userId(-1),
-      m_dbPool(db_pool) {
+      m_dbPool(db_pool),
+      m_blobStore(blob_store),
+      m_credentialCache(credential_cache),
+      m_quotaCache(quota_cache),
+      m_blobReclaimer(blob_reclaimer) {
+    if (!m_credentialCache) {
+        // 不缓存，只借用它的校验逻辑
+        m_credentialCache = std::make_shared<CredentialCache>(std::chrono::seconds(0), std::chrono::seconds(0), 1, 1);
+    }
+    if (m_blobStore && !m_blobReclaimer) {
+        // 不启动线程，删除时登记并尝试一次
+        m_blobReclaimer = std::make_shared<BlobReclaimer>(m_dbPool, m_blobStore);
+    }
 }
 
 Pop3sFsm::~Pop3sFsm() = default;
 
 std::string Pop3sFsm::process_command(const std::string& command, const std::string& args) {
     try {
-        // 处理不同的POP3命令
-        if (command == "USER") {
-            return handle_user(args);
-        }
-        else if (command == "PASS") {
-            return handle_pass(args);
-        }
-        else if (command == "STAT") {
-            return handle_stat();
-        }
-        else if (command == "LIST") {
-            return handle_list(args);
-        }
-        else if (command == "RETR") {
-            return handle_retr(args);
-        }
-        else if (command == "DELE") {
-            return handle_dele(args);
-        }
-        else if (command == "NOOP") {
-            return handle_noop();
-        }
-        else if (command == "RSET") {
-            return handle_rset();
-        }
-        else if (command == "QUIT") {
-            return handle_quit();
-        }
-        else if (command == "TOP") {
-            return handle_top(args);
-        }
-        else if (command == "UIDL") {
-            return handle_uidl(args);
-        }
-        else {
-            return handle_unknown(command);
+        Pop3sEvent event = parse_command(command);
+        std::string response;
+        // 未知命令把命令名交给处理函数
+        const std::string& event_args = event == Pop3sEvent::UNKNOWN ? command : args;
+        switch (engine().dispatch(*this, m_state, event, m_context, event_args, &response)) {
+            case FsmDispatchResult::OK:
+                return response;
+            case FsmDispatchResult::GUARD_REJECTED:
+                return guard_reply(event);
+            default:
+                return "-ERR Command not valid in this state";
         }
     }
     catch (const std::exception& e) {
@@ -59,77 +50,188 @@ std::string Pop3sFsm::process_command(const std::string& command, const std::str
     }
 }
 
+Pop3sEvent Pop3sFsm::parse_command(const std::string& command) {
+    static const std::unordered_map<std::string, Pop3sEvent> commands = {
+        {"USER", Pop3sEvent::USER}, {"PASS", Pop3sEvent::PASS}, {"STAT", Pop3sEvent::STAT},
+        {"LIST", Pop3sEvent::LIST}, {"RETR", Pop3sEvent::RETR}, {"DELE", Pop3sEvent::DELE},
+        {"NOOP", Pop3sEvent::NOOP}, {"RSET", Pop3sEvent::RSET}, {"QUIT", Pop3sEvent::QUIT},
+        {"TOP", Pop3sEvent::TOP}, {"UIDL", Pop3sEvent::UIDL}
+    };
+    auto it = commands.find(command);
+    return it != commands.end() ? it->second : Pop3sEvent::UNKNOWN;
+}
+
+const Pop3sFsm::Engine& Pop3sFsm::engine() {
+    static const Engine table = [] {
+        using S = Pop3sState;
+        using E = Pop3sEvent;
+        Engine engine({
+            {S::AUTHORIZATION, E::USER, S::AUTHORIZATION, &Pop3sFsm::handle_user, nullptr},
+            {S::AUTHORIZATION, E::PASS, S::TRANSACTION,   &Pop3sFsm::handle_pass, &Pop3sFsm::has_username},
+            {S::AUTHORIZATION, E::QUIT, S::UPDATE,        &Pop3sFsm::handle_quit, nullptr},
+            {S::TRANSACTION,   E::STAT, S::TRANSACTION,   &Pop3sFsm::handle_stat, nullptr},
+            {S::TRANSACTION,   E::LIST, S::TRANSACTION,   &Pop3sFsm::handle_list, nullptr},
+            {S::TRANSACTION,   E::RETR, S::TRANSACTION,   &Pop3sFsm::handle_retr, nullptr},
+            {S::TRANSACTION,   E::DELE, S::TRANSACTION,   &Pop3sFsm::handle_dele, nullptr},
+            {S::TRANSACTION,   E::NOOP, S::TRANSACTION,   &Pop3sFsm::handle_noop, nullptr},
+            {S::TRANSACTION,   E::RSET, S::TRANSACTION,   &Pop3sFsm::handle_rset, nullptr},
+            {S::TRANSACTION,   E::TOP,  S::TRANSACTION,   &Pop3sFsm::handle_top,  nullptr},
+            {S::TRANSACTION,   E::UIDL, S::TRANSACTION,   &Pop3sFsm::handle_uidl, nullptr},
+            {S::TRANSACTION,   E::QUIT, S::UPDATE,        &Pop3sFsm::handle_quit, nullptr},
+            // QUIT在任何状态下都有效
+            {S::UPDATE,        E::QUIT, S::UPDATE,        &Pop3sFsm::handle_quit, nullptr},
+        });
+        // 未知命令在任何状态下都只回复错误
+        for (auto state : {S::AUTHORIZATION, S::TRANSACTION, S::UPDATE}) {
+            engine.add_transition(state, E::UNKNOWN, state, &Pop3sFsm::handle_unknown);
+        }
+        return engine;
+    }();
+    return table;
+}
+
+bool Pop3sFsm::has_username(Pop3sContext& context, const std::string&) const {
+    return !context.username.empty();
+}
+
+const char* Pop3sFsm::guard_reply(Pop3sEvent event) {
+    switch (event) {
+        case Pop3sEvent::PASS:
+            return "-ERR Need username first";
+        default:
+            return "-ERR Command not valid now";
+    }
+}
+
+void Pop3sFsm::dump_transition_stats(std::ostream& os) {
+    engine().for_each_counter([&os](Pop3sState from, Pop3sEvent event, Pop3sState to,
+                                    uint64_t hits, uint64_t rejected, uint64_t invalid) {
+        os << static_cast<int>(from) << " -> " << static_cast<int>(event) << " -> " << static_cast<int>(to)
+           << ": hits=" << hits << " rejected=" << rejected << " invalid=" << invalid << std::endl;
+    });
+}
+
 Pop3sState Pop3sFsm::get_state() const {
     return m_state;
 }
 
 void Pop3sFsm::reset() {
     m_state = Pop3sState::AUTHORIZATION;
-    m_username.clear();
-    m_userId = -1;
-    m_mails.clear();
+    m_context = Pop3sContext();
     m_mailMap.clear();
 }
 
 bool Pop3sFsm::authenticate_user(const std::string& username, const std::string& password) {
     try {
-        auto db_conn = m_dbPool->get_connection();
-        if (!db_conn) {
+        // 轮询的客户端每次都重新登录，凭据缓存命中时不访问数据库
+        int64_t userId = -1;
+        if (m_credentialCache->verify(*m_dbPool, username, password, userId) != CredentialCache::Result::ACCEPTED) {
             return false;
         }
+        m_context.userId = static_cast<int>(userId);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error authenticating user: " << e.what() << std::endl;
+        return false;
+    }
+}
 
-        // 查询用户
-        std::string sql = "SELECT id FROM users WHERE username = ? AND password = ?";
-        auto result = db_conn->query(sql, username, password);
-        
-        m_dbPool->release_connection(db_conn);
+bool Pop3sFsm::load_mailbox_summary() {
+    try {
+        auto db_conn = m_dbPool->get_user_connection(m_context.username, DBAccessMode::READ);
+        if (!db_conn) {
+            return false;
+        }
 
-        if (!result.empty()) {
-            m_userId = std::stoi(result[0]["id"]);
-            return true;
+        // 摘要由mail_mailbox上的触发器维护，与收件箱大小无关
+        auto result = db_conn->query("SELECT s.message_count, s.total_bytes, s.next_uid FROM mailboxes b "
+                                     "JOIN mailbox_stats s ON s.mailbox_id = b.id "
+                                     "WHERE b.user_id = ? AND b.box_type = 1",
+                                     m_context.userId);
+        if (!result) {
+            return false;
+        }
+        if (result->get_row_count() == 0) {
+            // 没有统计行（例如还未执行迁移），退回到直接加载列表
+            db_conn.release();
+            return load_user_mails();
         }
 
-        return false;
+        m_context.snapshotCount = static_cast<size_t>(result->get_int(0, result->get_column_index("message_count")));
+        m_context.snapshotBytes = static_cast<uint64_t>(result->get_int(0, result->get_column_index("total_bytes")));
+        m_context.snapshotNextUid = result->get_int(0, result->get_column_index("next_uid"), -1);
+        m_context.listLoaded = false;
+        return true;
     }
     catch (const std::exception& e) {
-        std::cerr << "Error authenticating user: " << e.what() << std::endl;
+        std::cerr << "Error loading mailbox summary: " << e.what() << std::endl;
         return false;
     }
 }
 
+bool Pop3sFsm::ensure_mail_list() {
+    return m_context.listLoaded || load_user_mails();
+}
+
 bool Pop3sFsm::load_user_mails() {
     try {
-        auto db_conn = m_dbPool->get_connection();
+        auto db_conn = m_dbPool->get_user_connection(m_context.username, DBAccessMode::READ);
         if (!db_conn) {
             return false;
         }
 
-        // 查询用户的邮件
-        std::string sql = "SELECT id, sender, recipients, subject, content, created_at, "
-                         "LENGTH(content) as size FROM emails WHERE recipients LIKE ?";
-        auto result = db_conn->query(sql, "%" + m_username + "%");
-        
-        m_dbPool->release_connection(db_conn);
+        // 通过收件箱记录查询用户的邮件，多收件人的邮件只有一行mails，每个收件人各有一条mail_mailbox
+        // 列表里不带正文，正文在RETR/TOP时按需读取
+        auto result = db_conn->query_stream("SELECT mm.id AS entry_id, m.id, m.sender, m.recipient, m.subject, "
+                                            "m.send_time, m.body_hash, "
+                                            "IF(m.body_hash IS NULL, LENGTH(m.body), m.body_size) AS size "
+                                            "FROM mail_mailbox mm "
+                                            "JOIN mailboxes b ON b.id = mm.mailbox_id AND b.box_type = 1 "
+                                            "JOIN mails m ON m.id = mm.mail_id "
+                                            "WHERE mm.user_id = ? AND mm.is_deleted = FALSE AND mm.uid < ? "
+                                            "ORDER BY mm.id",
+                                            m_context.userId,
+                                            m_context.snapshotNextUid < 0 ? INT64_MAX : m_context.snapshotNextUid);
+        if (!result) {
+            return false;
+        }
+
+        const size_t entryCol = result->find_column("entry_id");
+        const size_t idCol = result->find_column("id");
+        const size_t senderCol = result->find_column("sender");
+        const size_t recipientCol = result->find_column("recipient");
+        const size_t subjectCol = result->find_column("subject");
+        const size_t timeCol = result->find_column("send_time");
+        const size_t hashCol = result->find_column("body_hash");
+        const size_t sizeCol = result->find_column("size");
 
-        m_mails.clear();
+        m_context.mails.clear();
         m_mailMap.clear();
         int msg_number = 1;
 
-        for (const auto& row : result) {
+        while (result->next()) {
             Pop3MailInfo mail;
-            mail.id = std::stoi(row.at("id"));
-            mail.from = row.at("sender");
-            mail.to = row.at("recipients");
-            mail.subject = row.at("subject");
-            mail.content = row.at("content");
-            mail.date = row.at("created_at");
-            mail.size = std::stoi(row.at("size"));
+            mail.id = static_cast<int>(result->get_int(idCol));
+            mail.entry_id = result->get_int(entryCol);
+            mail.from = std::string(result->get_value(senderCol));
+            mail.to = std::string(result->get_value(recipientCol));
+            mail.subject = std::string(result->get_value(subjectCol));
+            mail.body_hash = std::string(result->get_value(hashCol));
+            mail.date = std::string(result->get_value(timeCol));
+            mail.size = static_cast<int>(result->get_int(sizeCol));
             mail.deleted = false;
 
-            m_mails.push_back(mail);
-            m_mailMap[msg_number++] = m_mails.size() - 1;
+            m_context.mails.push_back(std::move(mail));
+            m_mailMap[msg_number++] = m_context.mails.size() - 1;
+        }
+        if (result->has_error()) {
+            m_context.mails.clear();
+            m_mailMap.clear();
+            return false;
         }
 
+        m_context.listLoaded = true;
         return true;
     }
     catch (const std::exception& e) {
@@ -138,22 +240,112 @@ bool Pop3sFsm::load_user_mails() {
     }
 }
 
+bool Pop3sFsm::load_mail_content(Pop3MailInfo& mail) {
+    if (mail.loaded) {
+        return true;
+    }
+    try {
+        if (!mail.body_hash.empty()) {
+            if (!m_blobStore || !m_blobStore->read(mail.body_hash, mail.content)) {
+                std::cerr << "Message blob " << mail.body_hash << " is not available" << std::endl;
+                return false;
+            }
+        } else {
+            auto db_conn = m_dbPool->get_user_connection(m_context.username, DBAccessMode::READ);
+            if (!db_conn) {
+                return false;
+            }
+            auto result = db_conn->query("SELECT body FROM mails WHERE id = ?", mail.id);
+            if (!result || result->get_row_count() == 0) {
+                return false;
+            }
+            mail.content = std::string(result->get_view(0, result->get_column_index("body")));
+        }
+        mail.loaded = true;
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error loading mail content: " << e.what() << std::endl;
+        return false;
+    }
+}
+
 bool Pop3sFsm::update_mail_status() {
     try {
-        auto db_conn = m_dbPool->get_connection();
+        auto db_conn = m_dbPool->get_user_connection(m_context.username, DBAccessMode::READ_WRITE);
         if (!db_conn) {
             return false;
         }
 
-        // 删除标记为删除的邮件
-        for (const auto& mail : m_mails) {
-            if (mail.deleted) {
-                std::string sql = "DELETE FROM emails WHERE id = ?";
-                db_conn->execute(sql, mail.id);
+        std::vector<std::string> releasedBlobs;
+        int64_t freedBytes = 0;
+        if (!db_conn->begin_transaction()) {
+            return false;
+        }
+        auto abort = [&db_conn](const std::string& what, const std::string& error) {
+            std::cerr << "POP3 update: " << what << " failed: " << error << std::endl;
+            db_conn->rollback();
+            return false;
+        };
+
+        for (const auto& mail : m_context.mails) {
+            if (!mail.deleted) {
+                if (mail.retrieved &&
+                    !db_conn->execute("UPDATE mail_mailbox SET is_read = TRUE WHERE id = ?", mail.entry_id)) {
+                    return abort("mark read", db_conn->get_last_error());
+                }
+                continue;
+            }
+
+            // 删除的只是本用户的收件箱记录，邮件本身由其他收件人共享
+            // 先锁住邮件行，同一封邮件的引用计数并发递减时按顺序进行
+            auto row = db_conn->query("SELECT ref_count, body_hash FROM mails WHERE id = ? FOR UPDATE", mail.id);
+            if (!row) {
+                return abort("lock mail", db_conn->get_last_error());
+            }
+            auto stmt = db_conn->prepare("DELETE FROM mail_mailbox WHERE id = ? AND user_id = ?");
+            if (!stmt || !stmt->bind(0, mail.entry_id) || !stmt->bind(1, static_cast<int64_t>(m_context.userId)) ||
+                !stmt->execute()) {
+                return abort("delete mailbox entry", stmt ? stmt->get_last_error() : db_conn->get_last_error());
+            }
+            if (stmt->get_affected_rows() == 0 || row->get_row_count() == 0) {
+                // 记录已经被别的会话删除了，引用早已释放
+                continue;
+            }
+            freedBytes += mail.size;
+
+            if (row->get_int(0, row->get_column_index("ref_count")) > 1) {
+                if (!db_conn->execute("UPDATE mails SET ref_count = ref_count - 1 WHERE id = ?", mail.id)) {
+                    return abort("release reference", db_conn->get_last_error());
+                }
+                continue;
+            }
+            // 最后一个引用，删除邮件（附件随外键级联删除）
+            if (!db_conn->execute("DELETE FROM mails WHERE id = ?", mail.id)) {
+                return abort("delete mail", db_conn->get_last_error());
+            }
+            size_t hashCol = row->get_column_index("body_hash");
+            if (!row->is_null(0, hashCol)) {
+                releasedBlobs.emplace_back(row->get_view(0, hashCol));
+            }
+        }
+
+        if (!db_conn->commit()) {
+            return abort("commit", db_conn->get_last_error());
+        }
+        if (m_quotaCache && freedBytes > 0) {
+            m_quotaCache->add_usage(m_context.username, -freedBytes);
+        }
+
+        // 相同内容的blob可能被其他邮件共用，由回收器确认所有分片都没有引用后再删除
+        // 先归还本分片的连接，逐个分片查询时不会同时占用两个连接
+        db_conn.release();
+        if (m_blobReclaimer) {
+            for (const auto& hash : releasedBlobs) {
+                m_blobReclaimer->release(hash);
             }
         }
 
-        m_dbPool->release_connection(db_conn);
         return true;
     }
     catch (const std::exception& e) {
@@ -162,35 +354,24 @@ bool Pop3sFsm::update_mail_status() {
     }
 }
 
-std::string Pop3sFsm::handle_user(const std::string& args) {
-    if (m_state != Pop3sState::AUTHORIZATION) {
-        return "-ERR Command not valid in this state";
-    }
-
+std::string Pop3sFsm::handle_user(Pop3sContext& context, const std::string& args) {
     if (args.empty()) {
         return "-ERR Missing username";
     }
 
-    m_username = args;
+    context.username = args;
     return "+OK User accepted";
 }
 
-std::string Pop3sFsm::handle_pass(const std::string& args) {
-    if (m_state != Pop3sState::AUTHORIZATION) {
-        return "-ERR Command not valid in this state";
-    }
-
-    if (m_username.empty()) {
-        return "-ERR Need username first";
-    }
-
+std::string Pop3sFsm::handle_pass(Pop3sContext& context, const std::string& args) {
+    // 先给出USER由转换表的守卫保证
     if (args.empty()) {
         return "-ERR Missing password";
     }
 
-    if (authenticate_user(m_username, args)) {
+    if (authenticate_user(context.username, args)) {
         m_state = Pop3sState::TRANSACTION;
-        if (load_user_mails()) {
+        if (load_mailbox_summary()) {
             return "+OK Logged in";
         }
         else {
@@ -201,15 +382,16 @@ std::string Pop3sFsm::handle_pass(const std::string& args) {
     return "-ERR Invalid username or password";
 }
 
-std::string Pop3sFsm::handle_stat() {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
+std::string Pop3sFsm::handle_stat(Pop3sContext& context, const std::string& args) {
+    if (!context.listLoaded) {
+        // 还没有加载列表，也就不会有DELE标记，直接用登录时的摘要
+        return "+OK " + std::to_string(context.snapshotCount) + " " + std::to_string(context.snapshotBytes);
     }
 
     size_t count = 0;
     size_t total_size = 0;
 
-    for (const auto& mail : m_mails) {
+    for (const auto& mail : context.mails) {
         if (!mail.deleted) {
             count++;
             total_size += mail.size;
@@ -219,19 +401,18 @@ std::string Pop3sFsm::handle_stat() {
     return "+OK " + std::to_string(count) + " " + std::to_string(total_size);
 }
 
-std::string Pop3sFsm::handle_list(const std::string& args) {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
+std::string Pop3sFsm::handle_list(Pop3sContext& context, const std::string& args) {
+    if (!ensure_mail_list()) {
+        return "-ERR Unable to load mailbox";
     }
-
     if (!args.empty()) {
         // 列出特定邮件
         try {
             int msg_number = std::stoi(args);
             auto it = m_mailMap.find(msg_number);
-            if (it != m_mailMap.end() && !m_mails[it->second].deleted) {
+            if (it != m_mailMap.end() && !context.mails[it->second].deleted) {
                 return "+OK " + std::to_string(msg_number) + " " + 
-                       std::to_string(m_mails[it->second].size);
+                       std::to_string(context.mails[it->second].size);
             }
             return "-ERR No such message";
         }
@@ -245,8 +426,8 @@ std::string Pop3sFsm::handle_list(const std::string& args) {
     ss << "+OK Mailbox scan listing follows\r\n";
     
     for (const auto& pair : m_mailMap) {
-        if (!m_mails[pair.second].deleted) {
-            ss << pair.first << " " << m_mails[pair.second].size << "\r\n";
+        if (!context.mails[pair.second].deleted) {
+            ss << pair.first << " " << context.mails[pair.second].size << "\r\n";
         }
     }
     
@@ -254,25 +435,33 @@ std::string Pop3sFsm::handle_list(const std::string& args) {
     return ss.str();
 }
 
-std::string Pop3sFsm::handle_retr(const std::string& args) {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
+std::string Pop3sFsm::handle_retr(Pop3sContext& context, const std::string& args) {
+    if (!ensure_mail_list()) {
+        return "-ERR Unable to load mailbox";
     }
-
     try {
         int msg_number = std::stoi(args);
         auto it = m_mailMap.find(msg_number);
-        if (it != m_mailMap.end() && !m_mails[it->second].deleted) {
-            const auto& mail = m_mails[it->second];
+        if (it != m_mailMap.end() && !context.mails[it->second].deleted) {
+            auto& mail = context.mails[it->second];
+            if (!load_mail_content(mail)) {
+                return "-ERR Unable to read message";
+            }
+            mail.retrieved = true;
             std::stringstream ss;
-            ss << "+OK " << mail.size << " octets\r\n"
-               << "From: " << mail.from << "\r\n"
-               << "To: " << mail.to << "\r\n"
-               << "Subject: " << mail.subject << "\r\n"
-               << "Date: " << mail.date << "\r\n"
-               << "\r\n"
-               << mail.content << "\r\n"
-               << ".\r\n";
+            ss << "+OK " << mail.size << " octets\r\n";
+            if (!mail.body_hash.empty()) {
+                // blob中保存的是完整的原始邮件，直接返回
+                ss << mail.content << "\r\n";
+            } else {
+                ss << "From: " << mail.from << "\r\n"
+                   << "To: " << mail.to << "\r\n"
+                   << "Subject: " << mail.subject << "\r\n"
+                   << "Date: " << mail.date << "\r\n"
+                   << "\r\n"
+                   << mail.content << "\r\n";
+            }
+            ss << ".\r\n";
             return ss.str();
         }
         return "-ERR No such message";
@@ -282,16 +471,15 @@ std::string Pop3sFsm::handle_retr(const std::string& args) {
     }
 }
 
-std::string Pop3sFsm::handle_dele(const std::string& args) {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
+std::string Pop3sFsm::handle_dele(Pop3sContext& context, const std::string& args) {
+    if (!ensure_mail_list()) {
+        return "-ERR Unable to load mailbox";
     }
-
     try {
         int msg_number = std::stoi(args);
         auto it = m_mailMap.find(msg_number);
-        if (it != m_mailMap.end() && !m_mails[it->second].deleted) {
-            m_mails[it->second].deleted = true;
+        if (it != m_mailMap.end() && !context.mails[it->second].deleted) {
+            context.mails[it->second].deleted = true;
             return "+OK Message deleted";
         }
         return "-ERR No such message";
@@ -301,28 +489,20 @@ std::string Pop3sFsm::handle_dele(const std::string& args) {
     }
 }
 
-std::string Pop3sFsm::handle_noop() {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
-    }
-
+std::string Pop3sFsm::handle_noop(Pop3sContext& context, const std::string& args) {
     return "+OK";
 }
 
-std::string Pop3sFsm::handle_rset() {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
-    }
-
+std::string Pop3sFsm::handle_rset(Pop3sContext& context, const std::string& args) {
     // 取消所有删除标记
-    for (auto& mail : m_mails) {
+    for (auto& mail : context.mails) {
         mail.deleted = false;
     }
 
     return "+OK";
 }
 
-std::string Pop3sFsm::handle_quit() {
+std::string Pop3sFsm::handle_quit(Pop3sContext& context, const std::string& args) {
     std::string response;
     
     if (m_state == Pop3sState::TRANSACTION) {
@@ -342,11 +522,10 @@ std::string Pop3sFsm::handle_quit() {
     return response;
 }
 
-std::string Pop3sFsm::handle_top(const std::string& args) {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
+std::string Pop3sFsm::handle_top(Pop3sContext& context, const std::string& args) {
+    if (!ensure_mail_list()) {
+        return "-ERR Unable to load mailbox";
     }
-
     std::istringstream iss(args);
     std::string msg_number_str;
     std::string lines_str;
@@ -357,18 +536,29 @@ std::string Pop3sFsm::handle_top(const std::string& args) {
         int lines = std::stoi(lines_str);
 
         auto it = m_mailMap.find(msg_number);
-        if (it != m_mailMap.end() && !m_mails[it->second].deleted) {
-            const auto& mail = m_mails[it->second];
+        if (it != m_mailMap.end() && !context.mails[it->second].deleted) {
+            auto& mail = context.mails[it->second];
+            if (!load_mail_content(mail)) {
+                return "-ERR Unable to read message";
+            }
             std::stringstream ss;
-            ss << "+OK Top of message follows\r\n"
-               << "From: " << mail.from << "\r\n"
-               << "To: " << mail.to << "\r\n"
-               << "Subject: " << mail.subject << "\r\n"
-               << "Date: " << mail.date << "\r\n"
-               << "\r\n";
+            ss << "+OK Top of message follows\r\n";
+            std::string body = mail.content;
+            if (!mail.body_hash.empty()) {
+                // 原始邮件自带邮件头，按第一个空行拆开
+                size_t separator = mail.content.find("\r\n\r\n");
+                ss << mail.content.substr(0, separator) << "\r\n\r\n";
+                body = separator == std::string::npos ? std::string() : mail.content.substr(separator + 4);
+            } else {
+                ss << "From: " << mail.from << "\r\n"
+                   << "To: " << mail.to << "\r\n"
+                   << "Subject: " << mail.subject << "\r\n"
+                   << "Date: " << mail.date << "\r\n"
+                   << "\r\n";
+            }
 
             // 只返回指定行数的邮件内容
-            std::istringstream content_stream(mail.content);
+            std::istringstream content_stream(body);
             std::string line;
             int line_count = 0;
             while (line_count < lines && std::getline(content_stream, line)) {
@@ -386,19 +576,18 @@ std::string Pop3sFsm::handle_top(const std::string& args) {
     }
 }
 
-std::string Pop3sFsm::handle_uidl(const std::string& args) {
-    if (m_state != Pop3sState::TRANSACTION) {
-        return "-ERR Command not valid in this state";
+std::string Pop3sFsm::handle_uidl(Pop3sContext& context, const std::string& args) {
+    if (!ensure_mail_list()) {
+        return "-ERR Unable to load mailbox";
     }
-
     if (!args.empty()) {
         // 列出特定邮件的UIDL
         try {
             int msg_number = std::stoi(args);
             auto it = m_mailMap.find(msg_number);
-            if (it != m_mailMap.end() && !m_mails[it->second].deleted) {
+            if (it != m_mailMap.end() && !context.mails[it->second].deleted) {
                 return "+OK " + std::to_string(msg_number) + " " + 
-                       std::to_string(m_mails[it->second].id);
+                       std::to_string(context.mails[it->second].id);
             }
             return "-ERR No such message";
         }
@@ -412,8 +601,8 @@ std::string Pop3sFsm::handle_uidl(const std::string& args) {
     ss << "+OK UIDL listing follows\r\n";
     
     for (const auto& pair : m_mailMap) {
-        if (!m_mails[pair.second].deleted) {
-            ss << pair.first << " " << m_mails[pair.second].id << "\r\n";
+        if (!context.mails[pair.second].deleted) {
+            ss << pair.first << " " << context.mails[pair.second].id << "\r\n";
         }
     }
     
@@ -421,20 +610,35 @@ std::string Pop3sFsm::handle_uidl(const std::string& args) {
     return ss.str();
 }
 
-std::string Pop3sFsm::handle_unknown(const std::string& command) {
+std::string Pop3sFsm::handle_unknown(Pop3sContext& context, const std::string& args) {
     return "-ERR Unknown command";
 }
 
 // Pop3sFsmFactory实现
 
-Pop3sFsmFactory::Pop3sFsmFactory(std::shared_ptr<DBPool> db_pool)
-    : m_dbPool(db_pool) {
+Pop3sFsmFactory::Pop3sFsmFactory(std::shared_ptr<DBPool> db_pool, std::shared_ptr<BlobStore> blob_store,
+                                 std::shared_ptr<CredentialCache> credential_cache,
+                                 std::shared_ptr<QuotaCache> quota_cache,
+                                 std::shared_ptr<RecipientDirectory> recipient_directory,
+                                 std::shared_ptr<BlobReclaimer> blob_reclaimer)
+    : m_dbPool(db_pool),
+      m_blobStore(blob_store),
+      m_credentialCache(credential_cache),
+      m_quotaCache(quota_cache),
+      m_blobReclaimer(blob_reclaimer) {
+    if (!m_credentialCache) {
+        m_credentialCache = std::make_shared<CredentialCache>(std::chrono::seconds(300), std::chrono::seconds(60),
+                                                              100000);
+    }
+    if (recipient_directory) {
+        m_credentialCache->set_directory(recipient_directory);
+    }
 }
 
 Pop3sFsmFactory::~Pop3sFsmFactory() = default;
 
 std::unique_ptr<Pop3sFsm> Pop3sFsmFactory::create_fsm() {
-    return std::make_unique<Pop3sFsm>(m_dbPool);
+    return std::make_unique<Pop3sFsm>(m_dbPool, m_blobStore, m_credentialCache, m_quotaCache, m_blobReclaimer);
 }
 
 } // namespace mail_system
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include "mail_system/back/mailServer/fsm/smtps/smtps_fsm.h"
 #include <unordered_map>
+#include <iostream>
+#include <array>
+#include <cstdint>
 
 namespace mail_system {
 
@@ -37,7 +40,8 @@ std::string SmtpsFsm::get_event_name(SmtpsEvent event) {
         {SmtpsEvent::DATA_END, "DATA_END"},
         {SmtpsEvent::QUIT, "QUIT"},
         {SmtpsEvent::ERROR, "ERROR"},
-        {SmtpsEvent::TIMEOUT, "TIMEOUT"}
+        {SmtpsEvent::TIMEOUT, "TIMEOUT"},
+        {SmtpsEvent::RSET, "RSET"}
     };
 
     auto it = event_names.find(event);
@@ -47,4 +51,95 @@ std::string SmtpsFsm::get_event_name(SmtpsEvent event) {
     return "UNKNOWN_EVENT";
 }
 
+bool SmtpsFsm::decode_base64(const std::string& input, std::string& output) {
+    static const auto decode_table = [] {
+        std::array<int8_t, 256> table;
+        table.fill(-1);
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; ++i) {
+            table[static_cast<unsigned char>(alphabet[i])] = static_cast<int8_t>(i);
+        }
+        return table;
+    }();
+
+    output.clear();
+    if (input.size() % 4 != 0) {
+        return false;
+    }
+    output.reserve(input.size() / 4 * 3);
+
+    uint32_t buffer = 0;
+    int bits = 0;
+    size_t padding = 0;
+    for (size_t i = 0; i < input.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(input[i]);
+        if (c == '=') {
+            // 填充只能出现在末尾，且最多两个
+            if (i + 2 < input.size() || ++padding > 2) {
+                return false;
+            }
+            continue;
+        }
+        if (padding > 0 || decode_table[c] < 0) {
+            return false;
+        }
+        buffer = (buffer << 6) | static_cast<uint32_t>(decode_table[c]);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            output += static_cast<char>((buffer >> bits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+void SmtpsFsm::flush_deferred_recipients(std::weak_ptr<SmtpsSession> session) {
+    m_workerThreadPool->post([this, session]() {
+        auto s = session.lock();
+        if (!s) {
+            std::cerr << "Session is expired in flush_deferred_recipients" << std::endl;
+            return;
+        }
+        std::vector<DeferredRecipient> deferred;
+        deferred.swap(s->context_.deferred_recipients);
+        if (deferred.empty()) {
+            // 事务已被重置，没有要回复的收件人
+            s->continue_commands();
+            return;
+        }
+
+        std::vector<std::string> addresses;
+        for (const auto& entry : deferred) {
+            if (entry.reply.empty()) {
+                addresses.push_back(entry.address);
+            }
+        }
+        std::vector<std::string> accepted;
+        bool available = filter_local_recipients(addresses, accepted);
+        std::unordered_set<std::string> existing(accepted.begin(), accepted.end());
+        auto& recipients = s->context_.recipient_addresses;
+        std::string replies;
+        for (const auto& entry : deferred) {
+            const std::string& recipient = entry.address;
+            if (!entry.reply.empty()) {
+                replies += entry.reply;
+            } else if (!available) {
+                // 数据库不可用时无法确认，让发信方稍后重试，不能先接收再在回放时丢掉
+                replies += "451 4.3.0 <" + recipient + ">: Temporary failure validating recipient\r\n";
+            } else if (!existing.count(recipient)) {
+                replies += "550 5.1.1 <" + recipient + ">: Recipient address rejected: User unknown\r\n";
+            } else if (over_quota(recipient, std::max<uint64_t>(s->context_.declared_size, 1))) {
+                replies += "452 4.2.2 <" + recipient + ">: Mailbox full\r\n";
+            } else {
+                recipients.push_back(recipient);
+                replies += "250 Ok\r\n";
+            }
+        }
+        SmtpsState next_state = recipients.empty() ? SmtpsState::WAIT_RCPT_TO : SmtpsState::WAIT_DATA;
+        s->async_write(replies, [s, next_state](const boost::system::error_code &){
+            s->set_current_state(next_state);
+        });
+    });
+}
+
 } // namespace mail_system
\ No newline at end of file
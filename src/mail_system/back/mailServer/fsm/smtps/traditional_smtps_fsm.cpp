@@ -1,14 +1,17 @@
 #include "mail_system/back/mailServer/fsm/smtps/traditional_smtps_fsm.h"
 #include <iostream>
+#include <algorithm>
+#include <ctime>
 
 namespace mail_system {
 
 TraditionalSmtpsFsm::TraditionalSmtpsFsm(std::shared_ptr<ThreadPoolBase> io_thread_pool,
                                            std::shared_ptr<ThreadPoolBase> worker_thread_pool,
-                                           std::shared_ptr<DBPool> db_pool)
-    : SmtpsFsm(io_thread_pool, worker_thread_pool, db_pool) {
-    init_transition_table();
-    init_state_handlers();
+                                           std::shared_ptr<DBPool> db_pool,
+                                           const ServerConfig& config,
+                                           std::shared_ptr<MailServices> services)
+    : SmtpsFsm(io_thread_pool, worker_thread_pool, db_pool, config, services) {
+    engine();
 }
 
 void TraditionalSmtpsFsm::process_event(std::weak_ptr<SmtpsSession> s, SmtpsEvent event, const std::string& args) {
@@ -18,129 +21,88 @@ void TraditionalSmtpsFsm::process_event(std::weak_ptr<SmtpsSession> s, SmtpsEven
         std::cerr << "Session is expired in process_event" << std::endl;
         return;
     }
-    if(session->get_current_state() == SmtpsState::CLOSED) {
+    SmtpsState state = session->get_current_state();
+    if (m_traceRecorder) {
+        m_traceRecorder->record(FsmProtocol::SMTPS, session->get_session_id(),
+                                static_cast<uint8_t>(state), static_cast<uint8_t>(event), args.size());
+    }
+    if(state == SmtpsState::CLOSED) {
         session->close();
         return;
     }
 
-    if(session->get_current_state() == SmtpsState::IN_MESSAGE && event == SmtpsEvent::DATA)
-        std::cout << "in message with data\n";
-    auto transition_key = std::make_pair(session->get_current_state(), event);
-    auto transition_it = transition_table_.find(transition_key);
-    
-    if (transition_it != transition_table_.end()) {
-        // 找到有效的状态转换
-        SmtpsState next_state = transition_it->second;
-        
-        // 查找状态处理函数
-        auto state_handler_it = state_handlers_.find(session->get_current_state());
-        if (state_handler_it != state_handlers_.end()) {
-            auto event_handler_it = state_handler_it->second.find(event);
-            if (event_handler_it != state_handler_it->second.end()) {
-                // 执行状态处理函数
-                m_workerThreadPool->post([session, handler = event_handler_it->second, args]() {
-                    // std::cout << "before handler\n";
-                    handler(session, args);
-                    // 更新会话状态
-                    // session->set_current_state(next_state);
-                });
-            }
-        }
-        else {
-            std::cout << "No handler for state " << get_state_name(session->get_current_state()) << " and event " << get_event_name(event) << std::endl;
-            return;
-        }
-        
-        std::cout << "SMTPS FSM: " << get_state_name(session->get_current_state()) << " -> " 
-                  << get_event_name(event) << " -> " << get_state_name(next_state) << std::endl;
-    } else {
+    FsmDispatchResult result;
+    const Engine::Transition* transition = engine().resolve(*this, state, event, s, args, result);
+    if (!transition) {
         // 无效的状态转换
-        std::cerr << "SMTPS FSM: Invalid transition from " << get_state_name(session->get_current_state()) 
+        std::cerr << "SMTPS FSM: Invalid transition from " << get_state_name(state)
                   << " on event " << get_event_name(event) << std::endl;
-        
+
         // 处理错误
         handle_error(session, "Invalid command sequence");
+        return;
     }
-}
 
-void TraditionalSmtpsFsm::init_transition_table() {
-    // 初始化状态转换表
-    transition_table_[std::make_pair(SmtpsState::INIT, SmtpsEvent::CONNECT)] = SmtpsState::GREETING;
-    transition_table_[std::make_pair(SmtpsState::WAIT_EHLO, SmtpsEvent::EHLO)] = SmtpsState::WAIT_AUTH;
-    transition_table_[std::make_pair(SmtpsState::GREETING, SmtpsEvent::EHLO)] = SmtpsState::WAIT_AUTH;
-    transition_table_[std::make_pair(SmtpsState::WAIT_AUTH, SmtpsEvent::AUTH)] = SmtpsState::WAIT_AUTH_USERNAME;
-    transition_table_[std::make_pair(SmtpsState::WAIT_AUTH_USERNAME, SmtpsEvent::AUTH)] = SmtpsState::WAIT_AUTH_PASSWORD;
-    transition_table_[std::make_pair(SmtpsState::WAIT_AUTH_PASSWORD, SmtpsEvent::AUTH)] = SmtpsState::WAIT_MAIL_FROM;
-    // 添加可选认证路径 - 允许直接从WAIT_AUTH状态转到WAIT_MAIL_FROM状态
-    transition_table_[std::make_pair(SmtpsState::WAIT_AUTH, SmtpsEvent::MAIL_FROM)] = SmtpsState::WAIT_RCPT_TO;
-    transition_table_[std::make_pair(SmtpsState::WAIT_MAIL_FROM, SmtpsEvent::MAIL_FROM)] = SmtpsState::WAIT_RCPT_TO;
-    transition_table_[std::make_pair(SmtpsState::WAIT_RCPT_TO, SmtpsEvent::RCPT_TO)] = SmtpsState::WAIT_DATA;
-    transition_table_[std::make_pair(SmtpsState::WAIT_DATA, SmtpsEvent::DATA)] = SmtpsState::IN_MESSAGE;
-    transition_table_[std::make_pair(SmtpsState::IN_MESSAGE, SmtpsEvent::DATA)] = SmtpsState::IN_MESSAGE;
-    transition_table_[std::make_pair(SmtpsState::IN_MESSAGE, SmtpsEvent::DATA_END)] = SmtpsState::WAIT_QUIT;
-    
-    // QUIT命令可以在多个状态下接收
-    for (int i = 0;i < 11; ++i)
-        transition_table_[std::make_pair(static_cast<SmtpsState>(i), SmtpsEvent::QUIT)] = SmtpsState::CLOSED;
-    
-    for (int i = 0;i < 11; ++i) {
-        // 错误处理
-        transition_table_[std::make_pair(static_cast<SmtpsState>(i), SmtpsEvent::ERROR)] = static_cast<SmtpsState>(i);
-        // 超时处理
-        transition_table_[std::make_pair(static_cast<SmtpsState>(i), SmtpsEvent::TIMEOUT)] = static_cast<SmtpsState>(i);
+    if (transition->action) {
+        // 执行状态处理函数，处理函数自己决定何时更新会话状态
+        m_workerThreadPool->post([this, session, action = transition->action, args]() {
+            (this->*action)(session, args);
+        });
     }
-}
-
-void TraditionalSmtpsFsm::init_state_handlers() {
-    // 初始化状态处理函数
-    state_handlers_[SmtpsState::INIT][SmtpsEvent::CONNECT] = 
-        std::bind(&TraditionalSmtpsFsm::handle_init_connect, this, std::placeholders::_1, std::placeholders::_2);
 
-    state_handlers_[SmtpsState::WAIT_EHLO][SmtpsEvent::EHLO] = 
-        std::bind(&TraditionalSmtpsFsm::handle_greeting_ehlo, this, std::placeholders::_1, std::placeholders::_2);
-    
-    state_handlers_[SmtpsState::GREETING][SmtpsEvent::EHLO] = 
-        std::bind(&TraditionalSmtpsFsm::handle_greeting_ehlo, this, std::placeholders::_1, std::placeholders::_2);
-
-    state_handlers_[SmtpsState::WAIT_AUTH][SmtpsEvent::AUTH] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_auth_auth, this, std::placeholders::_1, std::placeholders::_2);
+    std::cout << "SMTPS FSM: " << get_state_name(state) << " -> "
+              << get_event_name(event) << " -> " << get_state_name(transition->to) << std::endl;
+}
 
-    state_handlers_[SmtpsState::WAIT_AUTH_USERNAME][SmtpsEvent::AUTH] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_auth_username, this, std::placeholders::_1, std::placeholders::_2);
+const TraditionalSmtpsFsm::Engine& TraditionalSmtpsFsm::engine() {
+    static const Engine table = [] {
+        using S = SmtpsState;
+        using E = SmtpsEvent;
+        using F = TraditionalSmtpsFsm;
+        Engine engine({
+            {S::INIT,               E::CONNECT,   S::GREETING,           &F::handle_init_connect,             nullptr},
+            {S::WAIT_EHLO,          E::EHLO,      S::WAIT_AUTH,          &F::handle_greeting_ehlo,            nullptr},
+            {S::GREETING,           E::EHLO,      S::WAIT_AUTH,          &F::handle_greeting_ehlo,            nullptr},
+            {S::WAIT_AUTH,          E::AUTH,      S::WAIT_AUTH_USERNAME, &F::handle_wait_auth_auth,           nullptr},
+            {S::WAIT_AUTH_USERNAME, E::AUTH,      S::WAIT_AUTH_PASSWORD, &F::handle_wait_auth_username,       nullptr},
+            {S::WAIT_AUTH_PASSWORD, E::AUTH,      S::WAIT_MAIL_FROM,     &F::handle_wait_auth_password,       nullptr},
+            // 可选认证路径 - 允许直接从WAIT_AUTH状态开始事务
+            {S::WAIT_AUTH,          E::MAIL_FROM, S::WAIT_RCPT_TO,       &F::handle_wait_auth_mail_from,      nullptr},
+            {S::WAIT_MAIL_FROM,     E::MAIL_FROM, S::WAIT_RCPT_TO,       &F::handle_wait_mail_from_mail_from, nullptr},
+            {S::WAIT_RCPT_TO,       E::RCPT_TO,   S::WAIT_DATA,          &F::handle_wait_rcpt_to_rcpt_to,     nullptr},
+            // 同一事务可以连续发送多个RCPT TO
+            {S::WAIT_DATA,          E::RCPT_TO,   S::WAIT_DATA,          &F::handle_wait_rcpt_to_rcpt_to,     nullptr},
+            {S::WAIT_DATA,          E::DATA,      S::IN_MESSAGE,         &F::handle_wait_data_data,           nullptr},
+            {S::IN_MESSAGE,         E::DATA,      S::IN_MESSAGE,         &F::handle_in_message_data,          nullptr},
+            // 一封邮件结束后回到等待MAIL FROM，同一连接可以继续投递下一封
+            {S::IN_MESSAGE,         E::DATA_END,  S::WAIT_MAIL_FROM,     &F::handle_in_message_data_end,      nullptr},
+            // RSET放弃当前事务
+            {S::WAIT_AUTH,          E::RSET,      S::WAIT_AUTH,          &F::handle_rset,                     nullptr},
+            {S::WAIT_MAIL_FROM,     E::RSET,      S::WAIT_MAIL_FROM,     &F::handle_rset,                     nullptr},
+            {S::WAIT_RCPT_TO,       E::RSET,      S::WAIT_MAIL_FROM,     &F::handle_rset,                     nullptr},
+            {S::WAIT_DATA,          E::RSET,      S::WAIT_MAIL_FROM,     &F::handle_rset,                     nullptr},
+        });
 
-    state_handlers_[SmtpsState::WAIT_AUTH_PASSWORD][SmtpsEvent::AUTH] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_auth_password, this, std::placeholders::_1, std::placeholders::_2);
-    
-    // 添加可选认证路径的处理函数
-    state_handlers_[SmtpsState::WAIT_AUTH][SmtpsEvent::MAIL_FROM] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_auth_mail_from, this, std::placeholders::_1, std::placeholders::_2);
-    
-    state_handlers_[SmtpsState::WAIT_MAIL_FROM][SmtpsEvent::MAIL_FROM] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_mail_from_mail_from, this, std::placeholders::_1, std::placeholders::_2);
-    
-    state_handlers_[SmtpsState::WAIT_RCPT_TO][SmtpsEvent::RCPT_TO] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_rcpt_to_rcpt_to, this, std::placeholders::_1, std::placeholders::_2);
-    
-    state_handlers_[SmtpsState::WAIT_DATA][SmtpsEvent::DATA] = 
-        std::bind(&TraditionalSmtpsFsm::handle_wait_data_data, this, std::placeholders::_1, std::placeholders::_2);
+        for (int i = 0; i <= static_cast<int>(S::WAIT_QUIT); ++i) {
+            auto state = static_cast<S>(i);
+            // QUIT命令可以在多个状态下接收，由会话直接关闭连接
+            engine.add_transition(state, E::QUIT, S::CLOSED, nullptr);
+            // 错误处理
+            engine.add_transition(state, E::ERROR, state, &F::handle_error);
+            // 超时处理
+            engine.add_transition(state, E::TIMEOUT, state, nullptr);
+        }
+        return engine;
+    }();
+    return table;
+}
 
-    state_handlers_[SmtpsState::IN_MESSAGE][SmtpsEvent::DATA] = 
-        std::bind(&TraditionalSmtpsFsm::handle_in_message_data, this, std::placeholders::_1, std::placeholders::_2);
-    
-    state_handlers_[SmtpsState::IN_MESSAGE][SmtpsEvent::DATA_END] = 
-        std::bind(&TraditionalSmtpsFsm::handle_in_message_data_end, this, std::placeholders::_1, std::placeholders::_2);
-    
-    // 退出处理函数
-    for (int i = 1; i < static_cast<int>(SmtpsState::WAIT_QUIT) + 1; ++i) {
-        state_handlers_[static_cast<SmtpsState>(i)][SmtpsEvent::ERROR] = 
-            std::bind(&TraditionalSmtpsFsm::handle_wait_quit_quit, this, std::placeholders::_1, std::placeholders::_2);
-    }
-    
-    // 错误处理函数
-    for (int i = 0; i < static_cast<int>(SmtpsState::WAIT_QUIT) + 1; ++i) {
-        state_handlers_[static_cast<SmtpsState>(i)][SmtpsEvent::ERROR] = 
-            std::bind(&TraditionalSmtpsFsm::handle_error, this, std::placeholders::_1, std::placeholders::_2);
-    }
+void TraditionalSmtpsFsm::dump_transition_stats(std::ostream& os) {
+    engine().for_each_counter([&os](SmtpsState from, SmtpsEvent event, SmtpsState to,
+                                    uint64_t hits, uint64_t rejected, uint64_t invalid) {
+        os << get_state_name(from) << " -> " << get_event_name(event) << " -> " << get_state_name(to)
+           << ": hits=" << hits << " rejected=" << rejected << " invalid=" << invalid << std::endl;
+    });
 }
 
 void TraditionalSmtpsFsm::handle_init_connect(std::weak_ptr<SmtpsSession> session, const std::string& args) {
@@ -181,8 +143,10 @@ void TraditionalSmtpsFsm::handle_greeting_ehlo(std::weak_ptr<SmtpsSession> sessi
 
     // 发送支持的SMTP扩展
     std::string response = "250-" + args + " Hello\r\n"
-                          "250-SIZE 10240000\r\n"  // 10MB 最大消息大小
+                          "250-SIZE " + std::to_string(m_config.maxMessageSize) + "\r\n"
+                          "250-AUTH PLAIN LOGIN\r\n"  // PLAIN支持初始响应（SASL-IR），一个往返完成认证
                           "250-8BITMIME\r\n"
+                          "250-PIPELINING\r\n"  // 一组RCPT TO的收件人一次查询数据库
                           "250 SMTPUTF8\r\n";
     s->async_write(response, [s](const boost::system::error_code &){
         s->set_current_state(SmtpsState::WAIT_AUTH);
@@ -195,16 +159,48 @@ void TraditionalSmtpsFsm::handle_wait_auth_auth(std::weak_ptr<SmtpsSession> sess
         std::cerr << "Session is expired in handle_wait_auth_auth" << std::endl;
         return;
     }
-    // 处理AUTH命令
-    if (args.empty()) {
+    // 处理AUTH命令：AUTH <mechanism> [initial-response]
+    std::string mechanism = args;
+    std::string initial_response;
+    size_t space_pos = args.find(' ');
+    if (space_pos != std::string::npos) {
+        mechanism = args.substr(0, space_pos);
+        initial_response = boost::algorithm::trim_copy(args.substr(space_pos + 1));
+    }
+    boost::algorithm::to_upper(mechanism);
+    if (mechanism.empty()) {
         s->async_write("501 Syntax error in parameters or arguments\r\n");
         return;
     }
+    s->context_.auth_mechanism = mechanism;
+
+    if (mechanism == "PLAIN") {
+        if (initial_response.empty()) {
+            // 客户端没有携带初始响应，用空的质询索取
+            s->async_write("334 \r\n", [s](const boost::system::error_code &){
+                s->set_current_state(SmtpsState::WAIT_AUTH_PASSWORD);
+            });
+            return;
+        }
+        // 初始响应中已包含全部凭据，一个往返完成认证
+        handle_plain_response(s, initial_response);
+        return;
+    }
 
-    // 发送认证请求
-    s->async_write("334 VXNlcm5hbWU6\r\n", [s](const boost::system::error_code &){
-        s->set_current_state(SmtpsState::WAIT_AUTH_USERNAME);
-    }); // "Username:" in base64
+    if (mechanism == "LOGIN") {
+        if (initial_response.empty()) {
+            s->async_write("334 VXNlcm5hbWU6\r\n", [s](const boost::system::error_code &){
+                s->set_current_state(SmtpsState::WAIT_AUTH_USERNAME);
+            }); // "Username:" in base64
+            return;
+        }
+        // 初始响应即为用户名
+        handle_wait_auth_username(s, initial_response);
+        return;
+    }
+
+    s->context_.auth_mechanism.clear();
+    s->async_write("504 Unrecognized authentication type\r\n");
 }
 
 void TraditionalSmtpsFsm::handle_wait_auth_username(std::weak_ptr<SmtpsSession> session, const std::string& args) {
@@ -214,7 +210,18 @@ void TraditionalSmtpsFsm::handle_wait_auth_username(std::weak_ptr<SmtpsSession>
         std::cerr << "Session is expired in handle_wait_auth_username" << std::endl;
         return;
     }
-    s->context_.client_username = args;
+    if (args == "*") {
+        cancel_auth(s);
+        return;
+    }
+    std::string username;
+    if (!decode_base64(args, username) || username.empty()) {
+        s->async_write("501 Cannot decode response\r\n", [s](const boost::system::error_code &){
+            s->set_current_state(SmtpsState::WAIT_AUTH);
+        });
+        return;
+    }
+    s->context_.client_username = username;
     s->async_write("334 UGFzc3dvcmQ6\r\n", [s](const boost::system::error_code &){
         s->set_current_state(SmtpsState::WAIT_AUTH_PASSWORD);
     }); // "Password:" in base64
@@ -227,15 +234,84 @@ void TraditionalSmtpsFsm::handle_wait_auth_password(std::weak_ptr<SmtpsSession>
         std::cerr << "Session is expired in handle_wait_auth_password" << std::endl;
         return;
     }
-    if (auth_user(s, s->context_.client_username, args)) {
+    if (args == "*") {
+        cancel_auth(s);
+        return;
+    }
+    if (s->context_.auth_mechanism == "PLAIN") {
+        handle_plain_response(s, args);
+        return;
+    }
+    std::string password;
+    if (!decode_base64(args, password)) {
+        s->async_write("501 Cannot decode response\r\n", [s](const boost::system::error_code &){
+            s->set_current_state(SmtpsState::WAIT_AUTH);
+        });
+        return;
+    }
+    finish_auth(s, s->context_.client_username, password);
+}
+
+void TraditionalSmtpsFsm::handle_plain_response(std::shared_ptr<SmtpsSession> s, const std::string& response) {
+    // PLAIN的响应格式为 authzid \0 authcid \0 passwd（RFC 4616）
+    std::string decoded;
+    size_t first_nul = std::string::npos;
+    size_t second_nul = std::string::npos;
+    if (decode_base64(response, decoded)) {
+        first_nul = decoded.find('\0');
+        if (first_nul != std::string::npos) {
+            second_nul = decoded.find('\0', first_nul + 1);
+        }
+    }
+    if (second_nul == std::string::npos) {
+        s->async_write("501 Cannot decode response\r\n", [s](const boost::system::error_code &){
+            s->set_current_state(SmtpsState::WAIT_AUTH);
+        });
+        return;
+    }
+    std::string username = decoded.substr(first_nul + 1, second_nul - first_nul - 1);
+    std::string password = decoded.substr(second_nul + 1);
+    s->context_.client_username = username;
+    finish_auth(s, username, password);
+}
+
+void TraditionalSmtpsFsm::finish_auth(std::shared_ptr<SmtpsSession> s, const std::string& username, const std::string& password) {
+    s->context_.auth_mechanism.clear();
+    CredentialCache::Result result = username.empty() ? CredentialCache::Result::REJECTED
+                                                      : auth_user(s, username, password);
+    if (result == CredentialCache::Result::UNAVAILABLE) {
+        // 数据库不可用时无法判断凭据对错，回复临时错误让客户端稍后重试，不计入失败次数
+        s->async_write("454 4.7.0 Temporary authentication failure\r\n", [s](const boost::system::error_code &){
+            s->set_current_state(SmtpsState::WAIT_AUTH);
+        });
+        return;
+    }
+    if (result == CredentialCache::Result::ACCEPTED) {
         s->context_.is_authenticated = true;
+        s->context_.auth_failures = 0;
         s->async_write("235 Authentication successful\r\n", [s](const boost::system::error_code &){
             s->set_current_state(SmtpsState::WAIT_MAIL_FROM);
-    });
-    } else {
-        s->async_write("535 Authentication failed\r\n");
-        handle_error(s, "Authentication failed");
+        });
+        return;
     }
+    // 认证失败后回到WAIT_AUTH允许重试，超过次数则断开
+    if (++s->context_.auth_failures >= m_config.max_auth_attempts) {
+        s->async_write("535 Authentication failed\r\n", [s](const boost::system::error_code &){
+            s->close();
+        });
+        return;
+    }
+    s->async_write("535 Authentication failed\r\n", [s](const boost::system::error_code &){
+        s->set_current_state(SmtpsState::WAIT_AUTH);
+    });
+}
+
+void TraditionalSmtpsFsm::cancel_auth(std::shared_ptr<SmtpsSession> s) {
+    s->context_.auth_mechanism.clear();
+    s->context_.client_username.clear();
+    s->async_write("501 Authentication cancelled\r\n", [s](const boost::system::error_code &){
+        s->set_current_state(SmtpsState::WAIT_AUTH);
+    });
 }
 
 void TraditionalSmtpsFsm::handle_wait_auth_mail_from(std::weak_ptr<SmtpsSession> session, const std::string& args) {
@@ -258,6 +334,9 @@ void TraditionalSmtpsFsm::handle_wait_auth_mail_from(std::weak_ptr<SmtpsSession>
     std::regex mail_from_regex(R"(FROM:\s*<([^>]*)>)", std::regex_constants::icase);
     std::smatch matches;
     if (std::regex_search(args, matches, mail_from_regex) && matches.size() > 1) {
+        if (!accept_size_parameter(s, args)) {
+            return;
+        }
         // 保存发件人地址
         s->context_.sender_address = matches[1];
         s->async_write("250 Ok\r\n", [s](const boost::system::error_code &){
@@ -268,6 +347,23 @@ void TraditionalSmtpsFsm::handle_wait_auth_mail_from(std::weak_ptr<SmtpsSession>
     }
 }
 
+bool TraditionalSmtpsFsm::accept_size_parameter(std::shared_ptr<SmtpsSession> s, const std::string& args) {
+    // RFC 1870：MAIL FROM:<addr> SIZE=<字节数>，超出上限时在传输正文之前就拒绝
+    static const std::regex size_regex(R"(\sSIZE=(\d{1,19})(\s|$))", std::regex_constants::icase);
+    std::smatch matches;
+    s->context_.declared_size = 0;
+    if (!std::regex_search(args, matches, size_regex)) {
+        return true;
+    }
+    uint64_t size = std::stoull(matches[1].str());
+    if (size > m_config.maxMessageSize) {
+        s->async_write("552 5.3.4 Message size exceeds fixed maximum message size\r\n");
+        return false;
+    }
+    s->context_.declared_size = size;
+    return true;
+}
+
 void TraditionalSmtpsFsm::handle_wait_mail_from_mail_from(std::weak_ptr<SmtpsSession> session, const std::string& args) {
     // 解析MAIL FROM命令
     
@@ -281,6 +377,9 @@ void TraditionalSmtpsFsm::handle_wait_mail_from_mail_from(std::weak_ptr<SmtpsSes
     std::regex mail_from_regex(R"(FROM:\s*<([^>]*)>)", std::regex_constants::icase);
     std::smatch matches;
     if (std::regex_search(args, matches, mail_from_regex) && matches.size() > 1) {
+        if (!accept_size_parameter(s, args)) {
+            return;
+        }
         // 保存发件人地址
         s->context_.sender_address = matches[1];
         s->async_write("250 Ok\r\n", [s](const boost::system::error_code &){
@@ -297,18 +396,83 @@ void TraditionalSmtpsFsm::handle_wait_rcpt_to_rcpt_to(std::weak_ptr<SmtpsSession
         std::cerr << "Session is expired in handle_wait_rcpt_to_rcpt_to" << std::endl;
         return;
     }
+    auto& deferred = s->context_.deferred_recipients;
+    // 前面还有等待数据库校验的收件人时，这条的回复排在它们后面一起发送，保证回复顺序与命令一致
+    auto reply = [&s, &deferred](const std::string& response) {
+        if (deferred.empty()) {
+            s->async_write(response);
+        } else {
+            deferred.push_back({std::string(), response});
+            s->continue_commands();
+        }
+    };
+
     // 解析RCPT TO命令
     std::regex rcpt_to_regex(R"(TO:\s*<([^>]*)>)", std::regex_constants::icase);
     std::smatch matches;
-    if (std::regex_search(args, matches, rcpt_to_regex) && matches.size() > 1) {
-        for(auto& match : matches)
-            s->context_.recipient_addresses.push_back(match);
-        s->async_write("250 Ok\r\n", [s](const boost::system::error_code &){
-            s->set_current_state(SmtpsState::WAIT_DATA);
-    });
-    } else {
-        s->async_write("501 Syntax error in parameters or arguments\r\n");
+    if (!std::regex_search(args, matches, rcpt_to_regex) || matches.size() <= 1) {
+        reply("501 Syntax error in parameters or arguments\r\n");
+        return;
+    }
+    std::string recipient = matches[1];
+    auto& recipients = s->context_.recipient_addresses;
+    size_t pending = 0;
+    bool duplicate = std::find(recipients.begin(), recipients.end(), recipient) != recipients.end();
+    for (const auto& entry : deferred) {
+        if (entry.reply.empty()) {
+            ++pending;
+            duplicate = duplicate || entry.address == recipient;
+        }
+    }
+    if (duplicate) {
+        reply("250 Ok\r\n");
+        return;
+    }
+    if (recipients.size() + pending >= m_config.max_recipients) {
+        reply("452 Too many recipients\r\n");
+        return;
     }
+    // 每个收件人在RCPT TO时就给出结果，接收下来的收件人在DATA时不会再被悄悄丢掉
+    // 目录加载完成时在内存中判定
+    bool fromDirectory = false;
+    if (m_recipientDirectory) {
+        switch (m_recipientDirectory->lookup(recipient)) {
+            case RecipientDirectory::Lookup::UNKNOWN_USER:
+                reply("550 5.1.1 <" + recipient + ">: Recipient address rejected: User unknown\r\n");
+                return;
+            case RecipientDirectory::Lookup::UNKNOWN_DOMAIN:
+                reply("550 5.7.1 <" + recipient + ">: Relay access denied\r\n");
+                return;
+            case RecipientDirectory::Lookup::FOUND:
+                fromDirectory = true;
+                break;
+            default:
+                break;
+        }
+    }
+    if (!fromDirectory) {
+        // 目录无法判定时先不回复，流水线发送的这组RCPT TO结束后一次查询数据库，
+        // 再按顺序逐个回复（见flush_deferred_recipients）
+        deferred.push_back({recipient, std::string()});
+        s->continue_commands();
+        return;
+    }
+    // 尽量在RCPT就按收件人拒绝，其他收件人照常投递：给出了SIZE时按声明的大小，
+    // 否则只拒绝已经满了的邮箱；正文到达后还会按实际大小再检查一次。
+    // 邮箱满是暂时的，用4xx让发信方稍后只重试这个收件人
+    if (over_quota(recipient, std::max<uint64_t>(s->context_.declared_size, 1))) {
+        reply("452 4.2.2 <" + recipient + ">: Mailbox full\r\n");
+        return;
+    }
+    recipients.push_back(recipient);
+    s->context_.unconfirmed_recipients.push_back(recipient);
+    if (!deferred.empty()) {
+        reply("250 Ok\r\n");
+        return;
+    }
+    s->async_write("250 Ok\r\n", [s](const boost::system::error_code &){
+        s->set_current_state(SmtpsState::WAIT_DATA);
+    });
 }
 
 void TraditionalSmtpsFsm::handle_wait_data_data(std::weak_ptr<SmtpsSession> session, const std::string& args) {
@@ -323,6 +487,35 @@ void TraditionalSmtpsFsm::handle_wait_data_data(std::weak_ptr<SmtpsSession> sess
         return;
     }
 
+    if (s->context_.recipient_addresses.empty()) {
+        s->async_write("554 No valid recipients\r\n", [s](const boost::system::error_code &){
+            s->set_current_state(SmtpsState::WAIT_RCPT_TO);
+        });
+        return;
+    }
+
+    // 收件人都已在RCPT TO时校验过。只经内存目录确认的收件人可能在上次全量重载之后被删除，
+    // 这里对整个信封做一次数据库确认；数据库不可用时按目录的结果接收
+    auto& unconfirmed = s->context_.unconfirmed_recipients;
+    std::vector<std::string> confirmed;
+    if (!unconfirmed.empty() && filter_local_recipients(unconfirmed, confirmed) &&
+        confirmed.size() != unconfirmed.size()) {
+        for (const auto& recipient : unconfirmed) {
+            if (std::find(confirmed.begin(), confirmed.end(), recipient) == confirmed.end()) {
+                std::cerr << "SMTPS FSM: recipient " << recipient << " no longer exists" << std::endl;
+                m_recipientDirectory->forget(recipient);
+            }
+        }
+        // 已经回复过250的收件人不能悄悄丢掉：整个事务临时失败，重试时这些地址在RCPT TO就会收到550
+        s->context_.clear_transaction();
+        SmtpsState next_state = s->context_.is_authenticated ? SmtpsState::WAIT_MAIL_FROM : SmtpsState::WAIT_AUTH;
+        s->async_write("451 4.1.1 Recipient list changed, retry the transaction\r\n",
+                       [s, next_state](const boost::system::error_code &){
+            s->set_current_state(next_state);
+        });
+        return;
+    }
+
     s->async_write("354 Start mail input; end with <CRLF>.<CRLF>\r\n", [s](const boost::system::error_code& ec){
         std::dynamic_pointer_cast<SmtpsSession>(s)->set_current_state(SmtpsState::IN_MESSAGE);
     });
@@ -344,32 +537,89 @@ void TraditionalSmtpsFsm::handle_in_message_data_end(std::weak_ptr<SmtpsSession>
         std::cerr << "Session is expired in handle_in_message_data_end" << std::endl;
         return;
     }
-    s->async_write("250 Message accepted for delivery\r\n", [s](const boost::system::error_code &){
-        s->set_current_state(SmtpsState::WAIT_QUIT);
-    });
-}
+    // 每封邮件在自己的DATA结束时交给存储，不再等到QUIT
+    std::unique_ptr<mail> data(s->get_mail());
+    if (!data) {
+        data.reset(new mail());
+    }
+    data->from = s->context_.sender_address;
+    data->to = boost::algorithm::join(s->context_.recipient_addresses, ",");
+    data->send_time = std::time(nullptr);
+    data->is_draft = false;
+    data->is_read = false;
+    std::vector<std::string> recipients = s->context_.recipient_addresses;
 
-void TraditionalSmtpsFsm::handle_wait_quit_quit(std::weak_ptr<SmtpsSession> session, const std::string& args) {
-    auto s = session.lock();
-    if (!s) {
-        std::cerr << "Session is expired in handle_wait_quit_quit" << std::endl;
+    s->context_.clear_transaction();
+    SmtpsState next_state = s->context_.is_authenticated ? SmtpsState::WAIT_MAIL_FROM : SmtpsState::WAIT_AUTH;
+
+    const uint64_t size = data->header.size() + data->body.size();
+    // 没有声明SIZE或者声明得比实际小的邮件，在这里按实际大小拒绝
+    if (size > m_config.maxMessageSize) {
+        s->async_write("552 5.3.4 Message size exceeds fixed maximum message size\r\n",
+                       [s, next_state](const boost::system::error_code &){
+            s->set_current_state(next_state);
+        });
         return;
     }
 
-    if (!args.empty()) {
-        s->async_write("501 Syntax error in parameters or arguments\r\n", [s](const boost::system::error_code& ec){s->close();});
+    // DATA之后只有一个回复，不能按收件人区分。所有收件人都超出配额时永久拒绝；
+    // 只有部分超出时回复452，发信方稍后整封重试，其他收件人不会因此收到退信
+    std::vector<std::string> overQuota;
+    for (const auto& recipient : recipients) {
+        if (over_quota(recipient, size)) {
+            overQuota.push_back(recipient);
+        }
+    }
+    if (!overQuota.empty()) {
+        std::string reply = overQuota.size() == recipients.size()
+            ? "552 5.2.2 <" + overQuota.front() + ">: Mailbox full, message exceeds quota\r\n"
+            : "452 4.2.2 <" + overQuota.front() + ">: Mailbox full, try again later\r\n";
+        s->async_write(reply, [s, next_state](const boost::system::error_code &){
+            s->set_current_state(next_state);
+        });
         return;
     }
-    s->async_write("221 Bye\r\n", [session, this](const boost::system::error_code& ec){
-        auto s = session.lock();
+    if (!m_mailWriter) {
+        // 未配置数据库，邮件不落库
+        s->async_write("250 Message accepted for delivery\r\n", [s, next_state](const boost::system::error_code &){
+            s->set_current_state(next_state);
+        });
+        return;
+    }
+
+    // 邮件写入预写日志或所在的批次提交之后才回复250
+    std::weak_ptr<SmtpsSession> weak = s;
+    std::vector<std::string> delivered = recipients;
+    m_mailWriter->submit(std::move(data), std::move(recipients),
+                         [weak, next_state, quota = m_quotaCache, delivered = std::move(delivered), size](bool ok) {
+        if (ok && quota) {
+            for (const auto& recipient : delivered) {
+                quota->add_usage(recipient, static_cast<int64_t>(size));
+            }
+        }
+        auto s = weak.lock();
         if (!s) {
-            std::cerr << "Session is expired in handle_wait_quit_quit" << std::endl;
             return;
         }
-        mail *m = s->get_mail();
-        s->m_server->m_workerThreadPool->post([this, m](){save_mail_data(m);});
-        s->context_.clear(); // 清理上下文数据
-        s->close();
+        const char* reply = ok ? "250 Message accepted for delivery\r\n"
+                               : "451 Requested action aborted: local error in processing\r\n";
+        s->async_write(reply, [s, next_state](const boost::system::error_code &){
+            s->set_current_state(next_state);
+        });
+    });
+}
+
+void TraditionalSmtpsFsm::handle_rset(std::weak_ptr<SmtpsSession> session, const std::string& args) {
+    auto s = session.lock();
+    if (!s) {
+        std::cerr << "Session is expired in handle_rset" << std::endl;
+        return;
+    }
+    // 只清理当前事务，认证状态保留
+    s->context_.clear_transaction();
+    SmtpsState next_state = s->context_.is_authenticated ? SmtpsState::WAIT_MAIL_FROM : SmtpsState::WAIT_AUTH;
+    s->async_write("250 Ok\r\n", [s, next_state](const boost::system::error_code &){
+        s->set_current_state(next_state);
     });
 }
 
@@ -0,0 +1,64 @@
+#include "mail_system/back/mailServer/mail_services.h"
+#include "mail_system/back/mailServer/fsm/pop3s/pop3s_fsm.h"
+#include <chrono>
+#include <stdexcept>
+
+namespace mail_system {
+
+MailServices::MailServices(std::shared_ptr<DBPool> db_pool, const ServerConfig& config)
+    : m_dbPool(db_pool) {
+    if (!m_dbPool) {
+        return;
+    }
+    if (!config.blob_store_path.empty()) {
+        m_blobStore = std::make_shared<BlobStore>(config.blob_store_path);
+        if (!m_blobStore->is_open()) {
+            // 不能悄悄改成把正文写进数据库，两种存储方式读取路径不同
+            throw std::runtime_error("Blob store is not available: " + config.blob_store_path);
+        }
+        // 写入方登记的无引用blob和删除邮件后引用归零的blob都由后台线程回收
+        m_blobReclaimer = std::make_shared<BlobReclaimer>(m_dbPool, m_blobStore);
+        m_blobReclaimer->start();
+    }
+    std::shared_ptr<MailSpool> spool;
+    if (!config.spool_path.empty()) {
+        spool = std::make_shared<MailSpool>(config.spool_path, config.spool_sync_delay_ms,
+                                            size_t(config.spool_segment_size_mb) * 1024 * 1024);
+        if (!spool->is_open()) {
+            throw std::runtime_error("Mail spool is not available: " + config.spool_path);
+        }
+    }
+    m_dbBreaker = std::make_shared<CircuitBreaker>(
+        "mail db", config.db_breaker_failures,
+        std::chrono::milliseconds(config.db_breaker_latency_ms),
+        std::chrono::seconds(config.db_breaker_open_seconds));
+    m_mailWriter = std::make_shared<MailBatchWriter>(m_dbPool, config.mail_batch_size,
+                                                     config.mail_batch_delay_ms, m_blobStore,
+                                                     spool, m_dbBreaker);
+    m_credentialCache = std::make_shared<CredentialCache>(
+        std::chrono::seconds(config.credential_cache_ttl),
+        std::chrono::seconds(config.credential_cache_negative_ttl),
+        config.credential_cache_size);
+    m_quotaCache = std::make_shared<QuotaCache>(std::chrono::seconds(config.quota_cache_ttl),
+                                                config.quota_cache_size);
+    if (config.recipient_directory_poll_seconds > 0) {
+        m_recipientDirectory = std::make_shared<RecipientDirectory>(
+            std::chrono::seconds(config.recipient_directory_poll_seconds),
+            std::chrono::seconds(config.recipient_directory_reload_seconds));
+        m_recipientDirectory->start(m_dbPool);
+        m_credentialCache->set_directory(m_recipientDirectory);
+    }
+}
+
+MailServices::~MailServices() {
+    if (m_blobReclaimer) {
+        m_blobReclaimer->stop();
+    }
+}
+
+std::shared_ptr<Pop3sFsmFactory> MailServices::make_pop3_fsm_factory() const {
+    return std::make_shared<Pop3sFsmFactory>(m_dbPool, m_blobStore, m_credentialCache, m_quotaCache,
+                                             m_recipientDirectory, m_blobReclaimer);
+}
+
+} // namespace mail_system
@@ -1,14 +1,19 @@
 #include "mail_system/back/mailServer/session/session_base.h"
 #include "mail_system/back/mailServer/server_base.h"
 #include <iostream>
+#include <atomic>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
 namespace mail_system {
 
+namespace {
+std::atomic<uint64_t> g_next_session_id{1};
+}
+
 SessionBase::SessionBase(std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> &&socket, ServerBase* server)
-    : m_socket(std::move(socket)), mail_(nullptr), usr_(nullptr), m_server(server), closed_(false), read_buffer_(4096) {
+    : m_socket(std::move(socket)), mail_(nullptr), usr_(nullptr), m_server(server), closed_(false), read_buffer_(4096), session_id_(g_next_session_id++) {
     // // 生成唯一的会话ID
     // boost::uuids::random_generator generator;
     // m_sessionId = to_string(generator());
@@ -96,8 +101,8 @@ void SessionBase::async_write(const std::string& data, std::function<void(const
                 else {
                     std::cout << "async writing " << data << " without callback.\n";
                 }
-                // 写入成功，继续读取
-                self->async_read();
+                // 写入成功，继续处理输入
+                self->read_next();
             } else {
                 std::cerr << "Error writing data: " << error.message() << std::endl;
                 self->handle_error(error);
@@ -105,6 +110,10 @@ void SessionBase::async_write(const std::string& data, std::function<void(const
         });
 }
 
+void SessionBase::read_next() {
+    async_read();
+}
+
 std::string SessionBase::get_client_ip() const {
     if (!client_address_.empty()) {
         return client_address_;
@@ -123,6 +132,10 @@ std::string SessionBase::get_client_ip() const {
     return client_address_;
 }
 
+uint64_t SessionBase::get_session_id() const {
+    return session_id_;
+}
+
 boost::asio::ssl::stream<boost::asio::ip::tcp::socket>& SessionBase::get_ssl_socket() {
     return *m_socket;
 }
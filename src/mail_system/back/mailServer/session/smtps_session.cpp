@@ -5,6 +5,13 @@
 
 namespace mail_system {
 
+namespace {
+
+// 单条命令的长度上限，AUTH的初始响应可能比普通命令长得多
+const size_t kMaxCommandLength = 16 * 1024;
+
+} // namespace
+
 SmtpsSession::SmtpsSession(ServerBase* server, std::unique_ptr<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> &&socket, std::shared_ptr<SmtpsFsm> fsm)
     : SessionBase(std::move(socket), server), current_state_(SmtpsState::INIT), m_fsm(fsm), m_receivingData(false), stay_times(0) {
     if (!m_fsm) {
@@ -91,51 +98,31 @@ void SmtpsSession::handle_read(const std::string& data) {
         }
         std::cout << "enter handle_read in SmtpsSession" << std::endl;
         auto self = shared_from_this();
-        // 去除行尾的\r\n
-        std::string line = data;
-        boost::algorithm::trim_right_if(line, boost::algorithm::is_any_of("\r\n"));
-        
+
         if (current_state_ == SmtpsState::IN_MESSAGE) {
-            // 检查是否为数据结束标记
-            if (line == ".") {
+            if (mail_ == nullptr) {
+                mail_ = std::make_unique<mail>();
+            }
+            // 一次读取可能只是某一行的一部分，也可能包含多行，原样累积后再统一处理
+            mail_->body.append(data);
+
+            // 检查是否为数据结束标记（可能与正文在同一次读取中到达）
+            const std::string& body = mail_->body;
+            bool data_end = body == ".\r\n" || body == ".\n" ||
+                            boost::algorithm::ends_with(body, "\r\n.\r\n") ||
+                            boost::algorithm::ends_with(body, "\n.\n");
+            if (data_end) {
+                finish_message();
                 // 处理邮件数据结束事件
                 m_fsm->process_event(std::dynamic_pointer_cast<SmtpsSession>(self), SmtpsEvent::DATA_END, std::string());
-                // self->async_write("250 OK\r\n", [self](const boost::system::error_code& error) {
-                //     if (error) {
-                //         std::cerr << "Error: " << error.message() << std::endl;
-                //         return;
-                //     }
-                //     std::cout << "process data end up" << std::endl;
-                //     std::dynamic_pointer_cast<SmtpsSession>(self)->set_current_state(SmtpsState::WAIT_QUIT);
-                //     self->async_read();
-                // });
                 return;
             }
-            else {
-                // 如果行以.开头，去掉一个.（SMTP协议规定）
-                if (!line.empty() && line[0] == '.') {
-                    line = line.substr(1);
-                }
-                if (mail_ == nullptr) {
-                    mail_ = std::make_unique<mail>();
-                }
-                mail_->header = line.substr(0, line.find("\n\n"));
-                mail_->body = line.substr(line.find("\n\n") + 2);
-                
-                // 处理数据事件（可选，取决于状态机是否需要处理每一行数据）
-                // // 调试信息
-                // std::cout << "[DEBUG] Object address: " << this << std::endl;
-                // std::cout << "[DEBUG] FSM vtable: " << typeid(*m_fsm).name() << std::endl;
-                // // 调用栈回溯
-                // std::cout << "[DEBUG] Call stack trace: " << std::endl;
-                // 实际调用
-                m_fsm->process_event(std::dynamic_pointer_cast<SmtpsSession>(self), SmtpsEvent::DATA, std::string());
-                // self->async_read();
-            }
+            m_fsm->process_event(std::dynamic_pointer_cast<SmtpsSession>(self), SmtpsEvent::DATA, std::string());
         }
         else {
-            // 处理命令
-            process_command(line);
+            // 一次读取可能包含半条命令，也可能是流水线发送的多条命令
+            m_commandBuffer.append(data);
+            process_buffered_commands();
         }
     }
     catch (const std::exception& e) {
@@ -145,6 +132,65 @@ void SmtpsSession::handle_read(const std::string& data) {
     }
 }
 
+void SmtpsSession::read_next() {
+    if (closed_) {
+        return;
+    }
+    if (current_state_ == SmtpsState::IN_MESSAGE) {
+        // DATA之后紧跟着到达的正文已经在命令缓冲里了
+        if (!m_commandBuffer.empty()) {
+            std::string data;
+            data.swap(m_commandBuffer);
+            handle_read(data);
+            return;
+        }
+        async_read();
+        return;
+    }
+    process_buffered_commands();
+}
+
+void SmtpsSession::continue_commands() {
+    auto self = std::dynamic_pointer_cast<SmtpsSession>(shared_from_this());
+    boost::asio::post(m_socket->get_executor(), [self]() {
+        self->read_next();
+    });
+}
+
+void SmtpsSession::process_buffered_commands() {
+    if (closed_) {
+        return;
+    }
+    auto self = std::dynamic_pointer_cast<SmtpsSession>(shared_from_this());
+    size_t eol = m_commandBuffer.find('\n');
+    if (eol == std::string::npos) {
+        // 客户端在等回复了：先回复推迟校验的收件人
+        if (!context_.deferred_recipients.empty()) {
+            m_fsm->flush_deferred_recipients(self);
+            return;
+        }
+        if (m_commandBuffer.size() > kMaxCommandLength) {
+            m_commandBuffer.clear();
+            async_write("500 5.5.2 Line too long\r\n");
+            return;
+        }
+        async_read();
+        return;
+    }
+
+    std::string line = m_commandBuffer.substr(0, eol + 1);
+    // 一组RCPT TO到此结束，后面的命令要等收件人都回复之后再处理
+    if (!context_.deferred_recipients.empty() &&
+        !boost::algorithm::istarts_with(line, "RCPT ")) {
+        m_fsm->flush_deferred_recipients(self);
+        return;
+    }
+    m_commandBuffer.erase(0, eol + 1);
+    // 去除行尾的\r\n
+    boost::algorithm::trim_right_if(line, boost::algorithm::is_any_of("\r\n"));
+    process_command(line);
+}
+
 void SmtpsSession::process_command(const std::string& command) {
     try {
         std::cout << "SMTPS command: " << command << std::endl;
@@ -184,6 +230,8 @@ void SmtpsSession::process_command(const std::string& command) {
             event = SmtpsEvent::RCPT_TO;
         } else if (cmd == "DATA") {
             event = SmtpsEvent::DATA;
+        } else if (cmd == "RSET") {
+            event = SmtpsEvent::RSET;
         } else if (cmd == "QUIT") {
             event = SmtpsEvent::QUIT;
             // 强制关闭会话
@@ -208,4 +256,40 @@ void SmtpsSession::process_command(const std::string& command) {
     }
 }
 
+void SmtpsSession::finish_message() {
+    std::string& raw = mail_->body;
+
+    // 去掉结束标记 "." 及其行尾，保留正文最后一行的换行
+    size_t terminator = raw.size() >= 3 && raw.compare(raw.size() - 3, 3, ".\r\n") == 0 ? 3 : 2;
+    raw.resize(raw.size() - terminator);
+
+    // 以.开头的行在传输时被多加了一个.（SMTP协议规定），这里去掉
+    std::string message;
+    message.reserve(raw.size());
+    bool line_start = true;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (line_start && raw[i] == '.') {
+            line_start = false;
+            continue;
+        }
+        line_start = raw[i] == '\n';
+        message += raw[i];
+    }
+
+    // 第一个空行之前是邮件头，之后是正文
+    size_t separator = message.find("\r\n\r\n");
+    size_t separator_length = 4;
+    if (separator == std::string::npos) {
+        separator = message.find("\n\n");
+        separator_length = 2;
+    }
+    if (separator == std::string::npos) {
+        mail_->header = message;
+        mail_->body.clear();
+    } else {
+        mail_->header = message.substr(0, separator);
+        mail_->body = message.substr(separator + separator_length);
+    }
+}
+
 } // namespace mail_system
\ No newline at end of file
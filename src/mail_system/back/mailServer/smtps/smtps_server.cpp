@@ -8,7 +8,14 @@ SmtpsServer::SmtpsServer(const ServerConfig& config,
       std::shared_ptr<ThreadPoolBase> wokerThreadPool,
        std::shared_ptr<DBPool> dbPool)
         : ServerBase(config, ioThreadPool, wokerThreadPool, dbPool) {
-    m_fsm = std::make_shared<TraditionalSmtpsFsm>(m_ioThreadPool, m_workerThreadPool, m_dbPool);
+    if (m_dbPool) {
+        m_services = std::make_shared<MailServices>(m_dbPool, config);
+    }
+    m_fsm = std::make_shared<TraditionalSmtpsFsm>(m_ioThreadPool, m_workerThreadPool, m_dbPool, config, m_services);
+    if (!config.fsm_trace_file.empty()) {
+        m_fsm->set_trace_recorder(std::make_shared<FsmTraceRecorder>(config.fsm_trace_file));
+        std::cout << "SMTPS FSM trace enabled: " << config.fsm_trace_file << std::endl;
+    }
 }
 
 SmtpsServer::~SmtpsServer() {
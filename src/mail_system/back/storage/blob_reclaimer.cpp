@@ -0,0 +1,124 @@
+#include "mail_system/back/storage/blob_reclaimer.h"
+#include <iostream>
+
+namespace mail_system {
+
+BlobReclaimer::BlobReclaimer(std::shared_ptr<DBPool> db_pool, std::shared_ptr<BlobStore> blob_store,
+                             std::chrono::seconds grace, std::chrono::seconds interval)
+    : m_dbPool(db_pool),
+      m_blobStore(blob_store),
+      m_grace(grace),
+      m_interval(interval),
+      m_running(false) {}
+
+BlobReclaimer::~BlobReclaimer() {
+    stop();
+}
+
+void BlobReclaimer::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running || !m_blobStore) {
+        return;
+    }
+    m_running = true;
+    m_thread = std::thread(&BlobReclaimer::sweeper_thread, this);
+}
+
+void BlobReclaimer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_cv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void BlobReclaimer::release(const std::string& hash) {
+    if (!m_blobStore) {
+        return;
+    }
+    // 先登记再尝试：这次没删掉（仍在grace内或查询失败）时由后台线程重试
+    m_blobStore->mark_released(hash);
+    try_reclaim(hash);
+}
+
+size_t BlobReclaimer::sweep() {
+    if (!m_blobStore) {
+        return 0;
+    }
+    size_t removed = 0;
+    for (const auto& hash : m_blobStore->list_released()) {
+        if (try_reclaim(hash)) {
+            ++removed;
+        }
+    }
+    if (removed > 0) {
+        std::cout << "Blob reclaimer: removed " << removed << " blobs" << std::endl;
+    }
+    return removed;
+}
+
+bool BlobReclaimer::try_reclaim(const std::string& hash) {
+    if (!m_blobStore->exists(hash)) {
+        m_blobStore->clear_released(hash);
+        return false;
+    }
+    bool referenced = false;
+    if (!check_references(hash, referenced)) {
+        return false;
+    }
+    if (referenced) {
+        m_blobStore->clear_released(hash);
+        return false;
+    }
+    // 引用为0但刚被复用过的blob可能有尚未提交的引用，过了grace再删
+    if (!m_blobStore->remove_if_idle(hash, m_grace)) {
+        return false;
+    }
+    m_blobStore->clear_released(hash);
+    return true;
+}
+
+bool BlobReclaimer::check_references(const std::string& hash, bool& referenced) {
+    referenced = false;
+    try {
+        // 多收件人的邮件在每个收件人分片上各有一行mails，引用同一个blob
+        for (size_t shard = 0; shard < m_dbPool->get_shard_count(); ++shard) {
+            auto db_conn = m_dbPool->get_shard_connection(shard, DBAccessMode::READ_WRITE);
+            if (!db_conn) {
+                return false;
+            }
+            auto refs = db_conn->query("SELECT id FROM mails WHERE body_hash = ? LIMIT 1", hash);
+            if (!refs) {
+                std::cerr << "Blob reclaimer: reference check failed: " << db_conn->get_last_error() << std::endl;
+                return false;
+            }
+            if (refs->get_row_count() > 0) {
+                referenced = true;
+                return true;
+            }
+        }
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Blob reclaimer: reference check failed: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void BlobReclaimer::sweeper_thread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        lock.unlock();
+        sweep();
+        lock.lock();
+        m_cv.wait_for(lock, m_interval, [this] { return !m_running; });
+    }
+}
+
+} // namespace mail_system
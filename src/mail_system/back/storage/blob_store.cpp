@@ -0,0 +1,335 @@
+#include "mail_system/back/storage/blob_store.h"
+#include <openssl/evp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <unordered_set>
+
+namespace mail_system {
+
+namespace fs = std::filesystem;
+
+BlobStore::BlobStore(const std::string& root)
+    : m_root(root), m_tempDir(root + "/tmp"), m_reclaimDir(root + "/reclaim"), m_open(false), m_tempCounter(0) {
+    std::error_code ec;
+    fs::create_directories(m_tempDir, ec);
+    if (!ec) {
+        fs::create_directories(m_reclaimDir, ec);
+    }
+    if (ec) {
+        std::cerr << "Failed to create blob store at " << m_root << ": " << ec.message() << std::endl;
+        return;
+    }
+    m_open = true;
+    remove_stale_temp_files();
+}
+
+void BlobStore::remove_stale_temp_files() {
+    // 临时文件名为 <hash>.<pid>.<序号>，写入进程还在时文件可能正要rename，不能删除
+    std::error_code ec;
+    size_t removed = 0;
+    for (fs::directory_iterator it(m_tempDir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        size_t first = name.find('.');
+        size_t second = first == std::string::npos ? std::string::npos : name.find('.', first + 1);
+        pid_t pid = 0;
+        if (second != std::string::npos) {
+            pid = static_cast<pid_t>(std::atol(name.substr(first + 1, second - first - 1).c_str()));
+        }
+        if (pid > 0 && pid != ::getpid() && (::kill(pid, 0) == 0 || errno != ESRCH)) {
+            continue;
+        }
+        std::error_code removeError;
+        if (fs::remove(it->path(), removeError)) {
+            ++removed;
+        }
+    }
+    if (removed > 0) {
+        std::cout << "Blob store: removed " << removed << " leftover temp file(s) in " << m_tempDir << std::endl;
+    }
+}
+
+bool BlobStore::is_open() const {
+    return m_open;
+}
+
+const std::string& BlobStore::get_root() const {
+    return m_root;
+}
+
+std::string BlobStore::compute_hash(const std::string& data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx) {
+        return "";
+    }
+    bool ok = EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 &&
+              EVP_DigestUpdate(ctx, data.data(), data.size()) == 1 &&
+              EVP_DigestFinal_ex(ctx, digest, &length) == 1;
+    EVP_MD_CTX_free(ctx);
+    if (!ok) {
+        return "";
+    }
+
+    static const char kHex[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(length * 2);
+    for (unsigned int i = 0; i < length; ++i) {
+        hex += kHex[digest[i] >> 4];
+        hex += kHex[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+bool BlobStore::is_valid_hash(const std::string& hash) {
+    if (hash.size() != 64) {
+        return false;
+    }
+    for (char c : hash) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string BlobStore::path_for(const std::string& hash) const {
+    return m_root + "/" + hash.substr(0, 2) + "/" + hash.substr(2, 2) + "/" + hash;
+}
+
+bool BlobStore::exists(const std::string& hash) const {
+    struct stat st;
+    return is_valid_hash(hash) && ::stat(path_for(hash).c_str(), &st) == 0;
+}
+
+int64_t BlobStore::size(const std::string& hash) const {
+    struct stat st;
+    if (!is_valid_hash(hash) || ::stat(path_for(hash).c_str(), &st) != 0) {
+        return -1;
+    }
+    return static_cast<int64_t>(st.st_size);
+}
+
+bool BlobStore::write_temp(const std::string& data, const std::string& hash, std::string& temp_path) {
+    temp_path = m_tempDir + "/" + hash + "." + std::to_string(::getpid()) + "." +
+                std::to_string(m_tempCounter.fetch_add(1, std::memory_order_relaxed));
+    int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        std::cerr << "Blob store: open " << temp_path << " failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const char* cursor = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+        ssize_t written = ::write(fd, cursor, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Blob store: write " << temp_path << " failed: " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            ::unlink(temp_path.c_str());
+            return false;
+        }
+        cursor += written;
+        remaining -= static_cast<size_t>(written);
+    }
+
+    // 内容必须先落盘再rename，否则掉电后可能出现完整文件名、残缺内容的blob
+    if (::fdatasync(fd) != 0) {
+        std::cerr << "Blob store: fdatasync " << temp_path << " failed: " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        ::unlink(temp_path.c_str());
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+bool BlobStore::sync_directory(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+bool BlobStore::put(const std::string& data, std::string& hash) {
+    std::vector<std::string> hashes;
+    if (!put_batch({&data}, hashes)) {
+        return false;
+    }
+    hash = hashes.front();
+    return true;
+}
+
+bool BlobStore::put_batch(const std::vector<const std::string*>& blobs, std::vector<std::string>& hashes) {
+    hashes.clear();
+    if (!m_open) {
+        return false;
+    }
+
+    // 1. 计算hash，已存在的内容（包括本批内重复的）不再写入，只刷新修改时间
+    struct PendingBlob {
+        std::string hash;
+        std::string temp_path;
+    };
+    std::vector<PendingBlob> pending;
+    std::unordered_set<std::string> seen;
+    hashes.reserve(blobs.size());
+    for (const std::string* blob : blobs) {
+        std::string hash = compute_hash(*blob);
+        if (hash.empty()) {
+            std::cerr << "Blob store: failed to hash blob" << std::endl;
+            return false;
+        }
+        hashes.push_back(hash);
+        if (!seen.insert(hash).second || touch(hash)) {
+            continue;
+        }
+        PendingBlob entry{hash, ""};
+        if (!write_temp(*blob, hash, entry.temp_path)) {
+            for (const auto& written : pending) {
+                ::unlink(written.temp_path.c_str());
+            }
+            return false;
+        }
+        pending.push_back(std::move(entry));
+    }
+
+    // 2. 所有文件都已落盘，再逐个rename到分片目录
+    std::set<std::string> dirty;
+    bool ok = true;
+    for (const auto& entry : pending) {
+        std::string path = path_for(entry.hash);
+        std::string dir = path.substr(0, path.rfind('/'));
+        std::error_code ec;
+        if (fs::create_directories(dir, ec)) {
+            // 新建的分片目录本身也要在父目录中持久化
+            dirty.insert(dir.substr(0, dir.rfind('/')));
+            dirty.insert(m_root);
+        }
+        if (ec || ::rename(entry.temp_path.c_str(), path.c_str()) != 0) {
+            std::cerr << "Blob store: rename to " << path << " failed: "
+                      << (ec ? ec.message() : std::strerror(errno)) << std::endl;
+            ::unlink(entry.temp_path.c_str());
+            ok = false;
+            continue;
+        }
+        dirty.insert(dir);
+    }
+
+    // 3. 每个目录只fsync一次，整批共享
+    for (const auto& dir : dirty) {
+        if (!sync_directory(dir)) {
+            std::cerr << "Blob store: fsync directory " << dir << " failed: " << std::strerror(errno) << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool BlobStore::read(const std::string& hash, std::string& data) const {
+    std::ifstream stream;
+    if (!open(hash, stream)) {
+        return false;
+    }
+    stream.seekg(0, std::ios::end);
+    std::streamoff length = stream.tellg();
+    stream.seekg(0, std::ios::beg);
+    if (length < 0) {
+        return false;
+    }
+    data.resize(static_cast<size_t>(length));
+    return length == 0 || static_cast<bool>(stream.read(&data[0], length));
+}
+
+bool BlobStore::open(const std::string& hash, std::ifstream& stream) const {
+    if (!is_valid_hash(hash)) {
+        return false;
+    }
+    stream.open(path_for(hash), std::ios::binary);
+    return stream.is_open();
+}
+
+bool BlobStore::touch(const std::string& hash) {
+    if (!is_valid_hash(hash)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_reuseMutex);
+    return ::utimensat(AT_FDCWD, path_for(hash).c_str(), nullptr, 0) == 0;
+}
+
+bool BlobStore::remove_if_idle(const std::string& hash, std::chrono::seconds min_idle) {
+    if (!is_valid_hash(hash)) {
+        return false;
+    }
+    // 检查和删除之间不能插进一次复用：刷新成功的复用方不会再写入，文件必须留着
+    std::lock_guard<std::mutex> lock(m_reuseMutex);
+    struct stat st;
+    if (::stat(path_for(hash).c_str(), &st) != 0) {
+        return false;
+    }
+    // put_batch复用已有blob时会刷新修改时间，最近被复用过的blob可能有还没提交的引用
+    if (std::time(nullptr) - st.st_mtime < min_idle.count()) {
+        return false;
+    }
+    return remove(hash);
+}
+
+bool BlobStore::mark_released(const std::string& hash) {
+    if (!is_valid_hash(hash)) {
+        return false;
+    }
+    // 登记丢失只会漏掉一次回收，不需要fsync
+    int fd = ::open((m_reclaimDir + "/" + hash).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        std::cerr << "Blob store: mark " << hash << " released failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+std::vector<std::string> BlobStore::list_released() const {
+    std::vector<std::string> hashes;
+    std::error_code ec;
+    for (fs::directory_iterator it(m_reclaimDir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (is_valid_hash(name)) {
+            hashes.push_back(std::move(name));
+        }
+    }
+    return hashes;
+}
+
+void BlobStore::clear_released(const std::string& hash) {
+    if (is_valid_hash(hash)) {
+        ::unlink((m_reclaimDir + "/" + hash).c_str());
+    }
+}
+
+bool BlobStore::remove(const std::string& hash) {
+    if (!is_valid_hash(hash)) {
+        return false;
+    }
+    if (::unlink(path_for(hash).c_str()) != 0 && errno != ENOENT) {
+        std::cerr << "Blob store: remove " << hash << " failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace mail_system
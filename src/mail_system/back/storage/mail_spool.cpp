@@ -0,0 +1,659 @@
+#include "mail_system/back/storage/mail_spool.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <future>
+#include <iostream>
+
+namespace mail_system {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// 记录格式：magic(4) type(1) id(8) length(4) payload(length) crc32(4)
+// crc32覆盖从type到payload末尾
+const char kMagic[4] = {'M', 'W', 'A', 'L'};
+const size_t kHeaderSize = 17;
+const size_t kTrailerSize = 4;
+const uint8_t kRecordMail = 1;
+const uint8_t kRecordDone = 2;
+const uint32_t kPayloadVersion = 1;
+const char kSegmentSuffix[] = ".wal";
+// 单封邮件的最大收件人数，解析时用来识别损坏的记录
+const uint32_t kMaxRecipients = 100000;
+// 未刷盘的数据超过这个量时不再等待sync_delay
+const size_t kEagerSyncBytes = 4 * 1024 * 1024;
+
+uint32_t crc32(const char* data, size_t length) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void put_u32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+void put_u64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+void put_string(std::string& out, const std::string& value) {
+    put_u64(out, value.size());
+    out += value;
+}
+
+uint64_t get_le(const char* data, size_t count) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < count; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+// 按顺序读取小端整数和带长度的字符串，越界时返回false
+class Reader {
+public:
+    explicit Reader(const std::string& in) : m_in(in), m_pos(0) {}
+
+    bool get_u32(uint32_t& value) {
+        if (m_in.size() - m_pos < 4) {
+            return false;
+        }
+        value = static_cast<uint32_t>(get_le(m_in.data() + m_pos, 4));
+        m_pos += 4;
+        return true;
+    }
+
+    bool get_u64(uint64_t& value) {
+        if (m_in.size() - m_pos < 8) {
+            return false;
+        }
+        value = get_le(m_in.data() + m_pos, 8);
+        m_pos += 8;
+        return true;
+    }
+
+    bool get_string(std::string& value) {
+        uint64_t length;
+        if (!get_u64(length) || length > m_in.size() - m_pos) {
+            return false;
+        }
+        value.assign(m_in, m_pos, length);
+        m_pos += length;
+        return true;
+    }
+
+    bool at_end() const {
+        return m_pos == m_in.size();
+    }
+
+private:
+    const std::string& m_in;
+    size_t m_pos;
+};
+
+bool pread_all(int fd, char* buffer, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t n = ::pread(fd, buffer, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer += n;
+        length -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// 段文件名为16位十进制序号
+bool parse_segment_name(const std::string& name, uint64_t& seq) {
+    const size_t suffixLength = sizeof(kSegmentSuffix) - 1;
+    if (name.size() != 16 + suffixLength || name.compare(16, suffixLength, kSegmentSuffix) != 0) {
+        return false;
+    }
+    seq = 0;
+    for (size_t i = 0; i < 16; ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(name[i]))) {
+            return false;
+        }
+        seq = seq * 10 + static_cast<uint64_t>(name[i] - '0');
+    }
+    return true;
+}
+
+} // namespace
+
+MailSpool::Segment::~Segment() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+MailSpool::MailSpool(const std::string& dir, uint32_t sync_delay_ms, size_t segment_size)
+    : m_dir(dir),
+      m_badDir(dir + "/bad"),
+      m_syncDelay(sync_delay_ms),
+      m_segmentSize(std::max<size_t>(segment_size, 1024 * 1024)),
+      m_open(false),
+      m_accepting(false),
+      m_nextId(1),
+      m_unsyncedBytes(0),
+      m_syncs(0) {
+    std::error_code ec;
+    fs::create_directories(m_badDir, ec);
+    if (ec) {
+        std::cerr << "Failed to create mail spool at " << m_dir << ": " << ec.message() << std::endl;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!recover()) {
+        return;
+    }
+    if (!m_index.empty()) {
+        std::cout << "Mail spool: " << m_index.size() << " message(s) waiting for replay in " << m_dir << std::endl;
+    }
+    m_open = true;
+    m_accepting = true;
+    m_flusher = std::thread(&MailSpool::flusher_thread, this);
+}
+
+MailSpool::~MailSpool() {
+    close();
+    // 完成记录不等待刷盘，退出前补一次
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& segment : m_dirty) {
+        ::fdatasync(segment->fd);
+    }
+}
+
+bool MailSpool::is_open() const {
+    return m_open;
+}
+
+const std::string& MailSpool::get_dir() const {
+    return m_dir;
+}
+
+size_t MailSpool::pending_count() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index.size();
+}
+
+uint64_t MailSpool::sync_count() const {
+    return m_syncs.load(std::memory_order_relaxed);
+}
+
+bool MailSpool::recover() {
+    std::vector<uint64_t> seqs;
+    std::error_code ec;
+    for (const auto& item : fs::directory_iterator(m_dir, ec)) {
+        uint64_t seq;
+        if (item.is_regular_file() && parse_segment_name(item.path().filename().string(), seq)) {
+            seqs.push_back(seq);
+        }
+    }
+    if (ec) {
+        std::cerr << "Mail spool: failed to list " << m_dir << ": " << ec.message() << std::endl;
+        return false;
+    }
+    std::sort(seqs.begin(), seqs.end());
+
+    uint64_t lastSeq = 0;
+    for (size_t i = 0; i < seqs.size(); ++i) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llu%s", static_cast<unsigned long long>(seqs[i]), kSegmentSuffix);
+        auto segment = std::make_shared<Segment>();
+        segment->seq = seqs[i];
+        segment->path = m_dir + "/" + name;
+        segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CLOEXEC);
+        segment->size = 0;
+        segment->live = 0;
+        if (segment->fd < 0) {
+            std::cerr << "Mail spool: open " << segment->path << " failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (::fstat(segment->fd, &st) != 0) {
+            return false;
+        }
+        m_segments[segment->seq] = segment;
+        segment->size = scan_segment(segment, static_cast<uint64_t>(st.st_size));
+        if (segment->size < static_cast<uint64_t>(st.st_size)) {
+            if (i + 1 == seqs.size()) {
+                // 最后一段末尾是崩溃时没写完的记录，这些邮件没有回复过250
+                std::cerr << "Mail spool: truncating torn tail of " << segment->path << " at "
+                          << segment->size << std::endl;
+                if (::ftruncate(segment->fd, static_cast<off_t>(segment->size)) != 0) {
+                    return false;
+                }
+            } else {
+                std::cerr << "Mail spool: corrupt record in " << segment->path << " at " << segment->size
+                          << ", ignoring the rest of the segment" << std::endl;
+            }
+        }
+        lastSeq = segment->seq;
+    }
+
+    // 每次启动都从新段开始追加，旧段只读
+    if (!open_segment(lastSeq + 1)) {
+        return false;
+    }
+    drop_finished_segments();
+    return true;
+}
+
+uint64_t MailSpool::scan_segment(const std::shared_ptr<Segment>& segment, uint64_t file_size) {
+    uint64_t offset = 0;
+    std::string record;
+    while (file_size - offset >= kHeaderSize + kTrailerSize) {
+        char header[kHeaderSize];
+        if (!pread_all(segment->fd, header, kHeaderSize, offset) || std::memcmp(header, kMagic, 4) != 0) {
+            break;
+        }
+        uint8_t type = static_cast<uint8_t>(header[4]);
+        uint64_t id = get_le(header + 5, 8);
+        uint64_t length = get_le(header + 13, 4);
+        if (length > file_size - offset - kHeaderSize - kTrailerSize) {
+            break;
+        }
+        record.resize(kHeaderSize + length + kTrailerSize);
+        if (!pread_all(segment->fd, &record[0], record.size(), offset)) {
+            break;
+        }
+        uint32_t crc = static_cast<uint32_t>(get_le(record.data() + kHeaderSize + length, 4));
+        if (crc != crc32(record.data() + 4, kHeaderSize - 4 + length)) {
+            break;
+        }
+
+        if (type == kRecordMail) {
+            m_index[id] = Location{segment, offset, static_cast<uint32_t>(record.size()), false};
+            ++segment->live;
+        } else if (type == kRecordDone) {
+            auto it = m_index.find(id);
+            if (it != m_index.end()) {
+                --it->second.segment->live;
+                m_index.erase(it);
+            }
+        }
+        m_nextId = std::max(m_nextId.load(), id + 1);
+        offset += record.size();
+    }
+    return offset;
+}
+
+bool MailSpool::open_segment(uint64_t seq) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llu%s", static_cast<unsigned long long>(seq), kSegmentSuffix);
+    auto segment = std::make_shared<Segment>();
+    segment->seq = seq;
+    segment->path = m_dir + "/" + name;
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0640);
+    segment->size = 0;
+    segment->live = 0;
+    if (segment->fd < 0) {
+        std::cerr << "Mail spool: create " << segment->path << " failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    // 新段的目录项必须先落盘，否则掉电后整段连同已回复250的邮件一起消失
+    if (!sync_directory(m_dir)) {
+        std::cerr << "Mail spool: fsync " << m_dir << " failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    m_segments[seq] = segment;
+    m_active = segment;
+    return true;
+}
+
+bool MailSpool::rotate_if_needed(size_t incoming) {
+    if (m_active->size == 0 || m_active->size + incoming <= m_segmentSize) {
+        return true;
+    }
+    // 旧段在m_dirty中，下一次刷盘时一起fdatasync
+    return open_segment(m_active->seq + 1);
+}
+
+bool MailSpool::write_record(const std::string& record, uint64_t& offset) {
+    if (!rotate_if_needed(record.size())) {
+        return false;
+    }
+    offset = m_active->size;
+    if (!write_all(m_active->fd, record.data(), record.size())) {
+        std::cerr << "Mail spool: write " << m_active->path << " failed: " << std::strerror(errno) << std::endl;
+        // 去掉写了一半的记录，后面的追加仍然从记录边界开始
+        if (::ftruncate(m_active->fd, static_cast<off_t>(offset)) != 0) {
+            open_segment(m_active->seq + 1);
+        }
+        return false;
+    }
+    m_active->size += record.size();
+    m_unsyncedBytes += record.size();
+    if (m_dirty.empty() || m_dirty.back() != m_active) {
+        m_dirty.push_back(m_active);
+    }
+    return true;
+}
+
+void MailSpool::drop_finished_segments() {
+    // 只从最老的段开始删：完成记录总在邮件记录之后，删掉最老的段不会让后面段里的邮件复活
+    while (!m_segments.empty()) {
+        auto it = m_segments.begin();
+        if (it->second == m_active || it->second->live > 0) {
+            break;
+        }
+        ::unlink(it->second->path.c_str());
+        m_segments.erase(it);
+    }
+}
+
+std::string MailSpool::make_record(uint8_t type, uint64_t id, const std::string& payload) {
+    std::string record;
+    record.reserve(kHeaderSize + payload.size() + kTrailerSize);
+    record.append(kMagic, sizeof(kMagic));
+    record.push_back(static_cast<char>(type));
+    put_u64(record, id);
+    put_u32(record, static_cast<uint32_t>(payload.size()));
+    record += payload;
+    put_u32(record, crc32(record.data() + 4, record.size() - 4));
+    return record;
+}
+
+void MailSpool::encode(const mail& data, const std::vector<std::string>& recipients, std::string& out) {
+    out.clear();
+    out.reserve(64 + data.from.size() + data.to.size() + data.header.size() + data.body.size());
+    put_u32(out, kPayloadVersion);
+    put_string(out, data.from);
+    put_string(out, data.to);
+    put_string(out, data.header);
+    put_string(out, data.body);
+    put_u64(out, static_cast<uint64_t>(data.send_time));
+    put_u32(out, static_cast<uint32_t>(recipients.size()));
+    for (const auto& recipient : recipients) {
+        put_string(out, recipient);
+    }
+}
+
+bool MailSpool::decode(const std::string& in, Entry& entry) {
+    Reader reader(in);
+    uint32_t version = 0;
+    if (!reader.get_u32(version) || version != kPayloadVersion) {
+        return false;
+    }
+    auto data = std::make_unique<mail>();
+    uint64_t sendTime = 0;
+    uint32_t count = 0;
+    if (!reader.get_string(data->from) || !reader.get_string(data->to) ||
+        !reader.get_string(data->header) || !reader.get_string(data->body) ||
+        !reader.get_u64(sendTime) || !reader.get_u32(count) || count > kMaxRecipients) {
+        return false;
+    }
+    std::vector<std::string> recipients(count);
+    for (auto& recipient : recipients) {
+        if (!reader.get_string(recipient)) {
+            return false;
+        }
+    }
+    if (!reader.at_end()) {
+        return false;
+    }
+    data->id = 0;
+    data->send_time = static_cast<time_t>(sendTime);
+    data->is_draft = false;
+    data->is_read = false;
+    entry.data = std::move(data);
+    entry.recipients = std::move(recipients);
+    return true;
+}
+
+bool MailSpool::sync_directory(const std::string& dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+void MailSpool::append(const mail& data, const std::vector<std::string>& recipients, AppendCallback callback) {
+    if (!m_open || recipients.size() > kMaxRecipients) {
+        callback(false, 0);
+        return;
+    }
+    // 编码和校验和在锁外完成，锁内只有一次write
+    std::string payload;
+    encode(data, recipients, payload);
+    const uint64_t id = m_nextId.fetch_add(1);
+    std::string record = make_record(kRecordMail, id, payload);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t offset = 0;
+    if (!m_accepting || !write_record(record, offset)) {
+        lock.unlock();
+        callback(false, 0);
+        return;
+    }
+    m_index[id] = Location{m_active, offset, static_cast<uint32_t>(record.size()), true};
+    ++m_active->live;
+    m_waiters.push_back(Waiter{id, std::move(callback)});
+    m_flushCv.notify_one();
+}
+
+bool MailSpool::store(const mail& data, const std::vector<std::string>& recipients) {
+    std::promise<bool> done;
+    uint64_t stored = 0;
+    append(data, recipients, [&done, &stored](bool ok, uint64_t id) {
+        stored = id;
+        done.set_value(ok);
+    });
+    if (!done.get_future().get()) {
+        return false;
+    }
+    release(stored);
+    return true;
+}
+
+void MailSpool::flusher_thread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_flushCv.wait(lock, [this] { return !m_waiters.empty() || !m_accepting; });
+        if (m_waiters.empty()) {
+            // 已关闭且没有等待落盘的记录
+            break;
+        }
+        if (m_accepting) {
+            // 等一小段时间，让其他会话的记录赶上同一次fdatasync
+            m_flushCv.wait_for(lock, m_syncDelay, [this] {
+                return !m_accepting || m_unsyncedBytes >= kEagerSyncBytes;
+            });
+        }
+        std::vector<Waiter> waiters;
+        waiters.swap(m_waiters);
+        std::vector<std::shared_ptr<Segment>> dirty;
+        dirty.swap(m_dirty);
+        m_unsyncedBytes = 0;
+        lock.unlock();
+
+        bool ok = true;
+        for (const auto& segment : dirty) {
+            if (::fdatasync(segment->fd) != 0) {
+                std::cerr << "Mail spool: fdatasync " << segment->path << " failed: " << std::strerror(errno)
+                          << std::endl;
+                ok = false;
+            }
+        }
+        m_syncs.fetch_add(1, std::memory_order_relaxed);
+        for (auto& waiter : waiters) {
+            if (!ok) {
+                // 不确定是否落盘，按失败处理，调用方改走其他路径
+                remove(waiter.id);
+            }
+            waiter.callback(ok, ok ? waiter.id : 0);
+        }
+        lock.lock();
+    }
+}
+
+void MailSpool::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_accepting = false;
+    }
+    m_flushCv.notify_all();
+    if (m_flusher.joinable()) {
+        m_flusher.join();
+    }
+}
+
+bool MailSpool::read_record(const Location& location, std::string& payload) const {
+    std::string record(location.length, '\0');
+    if (location.length < kHeaderSize + kTrailerSize ||
+        !pread_all(location.segment->fd, &record[0], record.size(), location.offset)) {
+        return false;
+    }
+    size_t length = record.size() - kHeaderSize - kTrailerSize;
+    uint32_t crc = static_cast<uint32_t>(get_le(record.data() + kHeaderSize + length, 4));
+    if (crc != crc32(record.data() + 4, kHeaderSize - 4 + length)) {
+        return false;
+    }
+    payload.assign(record, kHeaderSize, length);
+    return true;
+}
+
+std::vector<MailSpool::Entry> MailSpool::load(size_t max_count) {
+    std::vector<std::pair<uint64_t, Location>> picked;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& item : m_index) {
+            if (picked.size() >= max_count) {
+                break;
+            }
+            if (!item.second.claimed) {
+                item.second.claimed = true;
+                picked.emplace_back(item.first, item.second);
+            }
+        }
+    }
+
+    std::vector<Entry> entries;
+    entries.reserve(picked.size());
+    for (const auto& item : picked) {
+        std::string payload;
+        Entry entry;
+        entry.id = item.first;
+        if (!read_record(item.second, payload) || !decode(payload, entry)) {
+            std::cerr << "Mail spool: record " << item.first << " is corrupt, moving it aside" << std::endl;
+            quarantine(item.first);
+            continue;
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+void MailSpool::release(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(id);
+    if (it != m_index.end()) {
+        it->second.claimed = false;
+    }
+}
+
+bool MailSpool::remove(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(id);
+    if (it == m_index.end()) {
+        return false;
+    }
+    --it->second.segment->live;
+    m_index.erase(it);
+    // 完成记录不单独刷盘，随下一次刷盘落盘；掉电丢失只会导致重复回放，邮件不会丢
+    uint64_t offset = 0;
+    bool ok = write_record(make_record(kRecordDone, id, std::string()), offset);
+    drop_finished_segments();
+    return ok;
+}
+
+bool MailSpool::quarantine(uint64_t id) {
+    Location location{};
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(id);
+        if (it == m_index.end()) {
+            return false;
+        }
+        location = it->second;
+    }
+    // 原始记录整条另存，不管能否解析
+    std::string record(location.length, '\0');
+    bool saved = false;
+    if (pread_all(location.segment->fd, &record[0], record.size(), location.offset)) {
+        // 日志清空后重启时id从1重新分配，文件名带上时间，并且绝不覆盖已隔离的记录
+        const std::string base = m_badDir + "/" + std::to_string(std::time(nullptr)) + "-" + std::to_string(id);
+        int fd = ::open((base + ".rec").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+        for (int attempt = 1; fd < 0 && errno == EEXIST && attempt < 100; ++attempt) {
+            fd = ::open((base + "." + std::to_string(attempt) + ".rec").c_str(),
+                        O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+        }
+        if (fd >= 0) {
+            saved = write_all(fd, record.data(), record.size()) && ::fdatasync(fd) == 0;
+            ::close(fd);
+        }
+    }
+    if (!saved) {
+        std::cerr << "Mail spool: failed to save record " << id << " to " << m_badDir << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(id);
+        if (it != m_index.end()) {
+            it->second.claimed = false;
+        }
+        return false;
+    }
+    return remove(id);
+}
+
+} // namespace mail_system
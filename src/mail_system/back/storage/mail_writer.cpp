@@ -0,0 +1,764 @@
+#include "mail_system/back/storage/mail_writer.h"
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mail_system {
+
+namespace {
+
+// 单条语句最多插入的行数
+const size_t kMaxRowsPerStatement = 64;
+// 单条语句携带的邮件数据上限，避免超过服务器的max_allowed_packet
+const size_t kMaxBytesPerStatement = 16 * 1024 * 1024;
+
+// 行数按2的幂切分，每种行数对应连接上缓存的一条预处理语句，总共不超过7种
+size_t chunk_rows(size_t remaining) {
+    size_t rows = kMaxRowsPerStatement;
+    while (rows > remaining) {
+        rows >>= 1;
+    }
+    return rows;
+}
+
+// "(?, ?), (?, ?), ..." 共rows组
+std::string placeholders(const std::string& row, size_t rows) {
+    std::string sql;
+    sql.reserve((row.size() + 2) * rows);
+    for (size_t i = 0; i < rows; ++i) {
+        if (i > 0) {
+            sql += ", ";
+        }
+        sql += row;
+    }
+    return sql;
+}
+
+// 主题列的长度上限
+const size_t kMaxSubjectLength = 255;
+// 收件人列（TEXT）的长度上限，完整的投递关系在mail_mailbox中
+const size_t kMaxRecipientLength = 65535;
+
+// 回放线程的检查间隔
+const std::chrono::seconds kReplayInterval(1);
+// 同一轮里其他邮件能写入、这封邮件单独重试仍失败这么多次后，移出暂存区
+const unsigned int kMaxReplayFailures = 5;
+
+// 按会话拆分时的分隔符还原成完整的原始邮件
+std::string raw_message(const mail& m) {
+    if (m.body.empty()) {
+        return m.header;
+    }
+    std::string raw;
+    raw.reserve(m.header.size() + 4 + m.body.size());
+    raw += m.header;
+    raw += "\r\n\r\n";
+    raw += m.body;
+    return raw;
+}
+
+// 从邮件头中取出Subject作为列表摘要，折行展开，截断时不切断UTF-8字符
+std::string header_summary(const std::string& header) {
+    std::string subject;
+    bool inSubject = false;
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t eol = header.find('\n', pos);
+        std::string line = header.substr(pos, eol == std::string::npos ? std::string::npos : eol - pos);
+        pos = eol == std::string::npos ? header.size() : eol + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (inSubject && !line.empty() && (line[0] == ' ' || line[0] == '\t')) {
+            subject += line;
+            continue;
+        }
+        if (inSubject) {
+            break;
+        }
+        if (boost::algorithm::istarts_with(line, "subject:")) {
+            subject = line.substr(8);
+            inSubject = true;
+        }
+    }
+    boost::algorithm::trim(subject);
+    if (subject.size() > kMaxSubjectLength) {
+        size_t cut = kMaxSubjectLength;
+        while (cut > 0 && (static_cast<unsigned char>(subject[cut]) & 0xC0) == 0x80) {
+            --cut;
+        }
+        subject.resize(cut);
+    }
+    return subject;
+}
+
+// 收件人列只作展示，收件人很多时在逗号处截断
+std::string recipient_summary(const std::string& to) {
+    if (to.size() <= kMaxRecipientLength) {
+        return to;
+    }
+    size_t cut = to.rfind(',', kMaxRecipientLength);
+    return to.substr(0, cut == std::string::npos ? 0 : cut);
+}
+
+size_t mail_bytes(const mail& m, bool inline_body) {
+    size_t bytes = m.from.size() + std::min(m.to.size(), kMaxRecipientLength) + kMaxSubjectLength;
+    return inline_body ? bytes + m.header.size() + m.body.size() : bytes;
+}
+
+struct InboxTarget {
+    int64_t user_id;
+    int64_t mailbox_id;
+};
+
+} // namespace
+
+MailBatchWriter::MailBatchWriter(std::shared_ptr<DBPool> db_pool, size_t max_batch_size, uint32_t max_batch_delay_ms,
+                                 std::shared_ptr<BlobStore> blob_store, std::shared_ptr<MailSpool> spool,
+                                 std::shared_ptr<CircuitBreaker> breaker)
+    : m_dbPool(db_pool),
+      m_blobStore(blob_store),
+      m_spool(spool && spool->is_open() ? spool : nullptr),
+      m_breaker(breaker),
+      m_maxBatchSize(std::max<size_t>(max_batch_size, 1)),
+      m_maxBatchDelay(max_batch_delay_ms),
+      m_running(true),
+      m_batchCount(0),
+      m_mailCount(0),
+      m_spooledCount(0),
+      m_tokenSequence(0) {
+    std::random_device device;
+    m_tokenPrefix = (static_cast<uint64_t>(device()) << 32) ^ device() ^
+                    static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+    if (m_maxBatchSize > 1 || m_spool) {
+        m_thread = std::thread(&MailBatchWriter::writer_thread, this);
+    }
+    if (m_spool || m_breaker) {
+        m_replayThread = std::thread(&MailBatchWriter::replayer_thread, this);
+    }
+}
+
+MailBatchWriter::~MailBatchWriter() {
+    stop();
+}
+
+void MailBatchWriter::submit(std::unique_ptr<mail> data, std::vector<std::string> recipients, CommitCallback callback) {
+    PendingMail pending{std::move(data), std::move(recipients), std::move(callback), {}, 0};
+    if (m_spool) {
+        // 先写预写日志，落盘后立即回复，写库在后台完成；日志写入失败时退回到写库后回复
+        auto holder = std::make_shared<PendingMail>(std::move(pending));
+        m_spool->append(*holder->data, holder->recipients, [this, holder](bool ok, uint64_t id) {
+            if (ok) {
+                holder->spool_id = id;
+                m_spooledCount.fetch_add(1, std::memory_order_relaxed);
+                CommitCallback callback = std::move(holder->callback);
+                holder->callback = nullptr;
+                if (callback) {
+                    callback(true);
+                }
+            }
+            enqueue(std::move(*holder));
+        });
+        return;
+    }
+    enqueue(std::move(pending));
+}
+
+void MailBatchWriter::enqueue(PendingMail pending) {
+    if (!m_thread.joinable()) {
+        // 不合批，直接在调用线程上写入
+        Batch batch;
+        batch.push_back(std::move(pending));
+        commit_batch(batch);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_running) {
+            m_queue.push_back(std::move(pending));
+            m_cv.notify_one();
+            return;
+        }
+    }
+    // 已经停止，不再接收
+    if (pending.spool_id) {
+        m_spool->release(pending.spool_id);
+    } else if (pending.callback) {
+        pending.callback(false);
+    }
+}
+
+void MailBatchWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    m_cv.notify_all();
+    m_replayCv.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_replayThread.joinable()) {
+        m_replayThread.join();
+    }
+    // 日志中还在等待刷盘的邮件回调后进入已停止的队列，留在日志里下次启动回放
+    if (m_spool) {
+        m_spool->close();
+    }
+}
+
+uint64_t MailBatchWriter::batch_count() const {
+    return m_batchCount.load(std::memory_order_relaxed);
+}
+
+uint64_t MailBatchWriter::mail_count() const {
+    return m_mailCount.load(std::memory_order_relaxed);
+}
+
+uint64_t MailBatchWriter::spooled_count() const {
+    return m_spooledCount.load(std::memory_order_relaxed);
+}
+
+bool MailBatchWriter::is_degraded() const {
+    return m_breaker && !m_breaker->is_closed();
+}
+
+bool MailBatchWriter::can_spool() const {
+    return m_spool != nullptr;
+}
+
+void MailBatchWriter::writer_thread() {
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return !m_queue.empty() || !m_running; });
+            if (m_queue.empty()) {
+                // 已停止且队列已清空
+                break;
+            }
+            // 第一封邮件到达后最多再等max_batch_delay，期间凑满一批就立即写入
+            auto deadline = std::chrono::steady_clock::now() + m_maxBatchDelay;
+            m_cv.wait_until(lock, deadline, [this] {
+                return m_queue.size() >= m_maxBatchSize || !m_running;
+            });
+            size_t count = std::min(m_queue.size(), m_maxBatchSize);
+            batch.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                batch.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+        // 写库期间新到的邮件继续在队列里积累，成为下一批
+        commit_batch(batch);
+    }
+}
+
+void MailBatchWriter::commit_batch(Batch& batch) {
+    std::vector<char> results(batch.size(), 0);
+    if (m_breaker && !m_breaker->allow_request()) {
+        // 熔断中，不等连接池超时，直接走暂存区或失败
+    } else if (write_batch_guarded(batch, 0, batch.size())) {
+        std::fill(results.begin(), results.end(), 1);
+    } else if (batch.size() > 1 && !is_degraded()) {
+        std::cerr << "Mail batch of " << batch.size() << " failed, retrying one by one" << std::endl;
+        for (size_t i = 0; i < batch.size() && !is_degraded(); ++i) {
+            results[i] = write_batch(batch, i, i + 1) ? 1 : 0;
+        }
+        record_partial_success(results);
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (batch[i].spool_id) {
+            // 已经回复过，失败的留在日志中由回放线程重试
+            finish_spooled(batch[i], results[i] != 0);
+            continue;
+        }
+        if (!results[i] && m_spool) {
+            results[i] = spool_mail(batch[i]) ? 1 : 0;
+        }
+        if (batch[i].callback) {
+            batch[i].callback(results[i] != 0);
+        }
+    }
+}
+
+bool MailBatchWriter::write_batch_guarded(Batch& batch, size_t begin, size_t end) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = write_batch(batch, begin, end);
+    if (m_breaker) {
+        if (ok) {
+            m_breaker->record_success(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start));
+        } else {
+            m_breaker->record_failure();
+        }
+    }
+    return ok;
+}
+
+void MailBatchWriter::record_partial_success(const std::vector<char>& results) {
+    // 逐封重试有成功的，说明整批失败是个别邮件的问题，不能让它累计成熔断
+    if (m_breaker && std::find(results.begin(), results.end(), 1) != results.end()) {
+        m_breaker->record_success(std::chrono::milliseconds(0));
+    }
+}
+
+bool MailBatchWriter::spool_mail(const PendingMail& pending) {
+    // 部分分片已经提交时，只暂存其余分片上的收件人，回放时不会重复投递
+    std::vector<std::string> recipients;
+    if (pending.committed_shards.empty()) {
+        recipients = pending.recipients;
+    } else {
+        const size_t shardCount = pending.committed_shards.size();
+        for (const auto& recipient : pending.recipients) {
+            size_t shard = shardCount == 1 ? 0 : m_dbPool->get_shard_index(recipient);
+            if (shard >= shardCount || !pending.committed_shards[shard]) {
+                recipients.push_back(recipient);
+            }
+        }
+    }
+    if (recipients.empty()) {
+        return true;
+    }
+    if (!m_spool->store(*pending.data, recipients)) {
+        return false;
+    }
+    m_spooledCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MailBatchWriter::finish_spooled(const PendingMail& pending, bool ok) {
+    if (ok) {
+        m_spool->remove(pending.spool_id);
+        return true;
+    }
+    bool partial = std::find(pending.committed_shards.begin(), pending.committed_shards.end(), 1) !=
+                   pending.committed_shards.end();
+    if (partial && spool_mail(pending)) {
+        // 已经写入部分分片，剩余的收件人另存一条，原记录标记完成
+        m_spool->remove(pending.spool_id);
+        return true;
+    }
+    m_spool->release(pending.spool_id);
+    return false;
+}
+
+void MailBatchWriter::replayer_thread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        m_replayCv.wait_for(lock, kReplayInterval, [this] { return !m_running; });
+        if (!m_running) {
+            break;
+        }
+        lock.unlock();
+        if (is_degraded()) {
+            probe_database();
+        }
+        if (m_spool && !is_degraded() && m_spool->pending_count() > 0) {
+            replay_spool();
+        }
+        lock.lock();
+    }
+}
+
+void MailBatchWriter::probe_database() {
+    if (!m_breaker->allow_request()) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (!database_reachable()) {
+        m_breaker->record_failure();
+        return;
+    }
+    m_breaker->record_success(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start));
+}
+
+bool MailBatchWriter::database_reachable() {
+    const size_t shardCount = std::max<size_t>(m_dbPool->get_shard_count(), 1);
+    for (size_t shard = 0; shard < shardCount; ++shard) {
+        auto connection = m_dbPool->get_shard_connection(shard, DBAccessMode::READ_WRITE);
+        if (!connection || !connection->is_connected() || !connection->query("SELECT 1")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MailBatchWriter::replay_spool() {
+    size_t replayed = 0;
+    while (!is_degraded()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running) {
+                break;
+            }
+        }
+        std::vector<MailSpool::Entry> entries = m_spool->load(m_maxBatchSize);
+        if (entries.empty()) {
+            break;
+        }
+        Batch batch;
+        batch.reserve(entries.size());
+        for (auto& entry : entries) {
+            batch.push_back(PendingMail{std::move(entry.data), std::move(entry.recipients), nullptr, {}, entry.id});
+        }
+
+        // 单独一封不经过熔断器：一条本身写不进去的记录每秒重试一次，会把熔断器反复打开
+        std::vector<char> results(batch.size(), 0);
+        if (batch.size() > 1 && write_batch_guarded(batch, 0, batch.size())) {
+            std::fill(results.begin(), results.end(), 1);
+        } else {
+            for (size_t i = 0; i < batch.size() && !is_degraded(); ++i) {
+                results[i] = write_batch(batch, i, i + 1) ? 1 : 0;
+            }
+            record_partial_success(results);
+        }
+
+        // 一封都没写进去时探测数据库：数据库正常说明是这些记录本身的问题，照样计入失败次数
+        bool progress = std::find(results.begin(), results.end(), 1) != results.end();
+        bool healthy = progress || database_reachable();
+        if (!progress && m_breaker) {
+            if (healthy) {
+                m_breaker->record_success(std::chrono::milliseconds(0));
+            } else if (batch.size() == 1) {
+                // 多封时整批写入已经计过一次失败
+                m_breaker->record_failure();
+            }
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const uint64_t id = batch[i].spool_id;
+            if (finish_spooled(batch[i], results[i] != 0)) {
+                m_replayFailures.erase(id);
+                replayed += results[i] ? 1 : 0;
+            } else if (healthy && ++m_replayFailures[id] >= kMaxReplayFailures) {
+                // 数据库正常时仍然单独写不进去，不能让它一直堵在日志前面
+                std::cerr << "Mail writer: giving up replaying spool record " << id << " after "
+                          << kMaxReplayFailures << " attempts" << std::endl;
+                m_spool->quarantine(id);
+                m_replayFailures.erase(id);
+            }
+        }
+        if (!progress) {
+            break;
+        }
+    }
+    if (replayed > 0) {
+        std::cout << "Mail writer: replayed " << replayed << " spooled message(s), "
+                  << m_spool->pending_count() << " left" << std::endl;
+    }
+}
+
+bool MailBatchWriter::write_batch(Batch& batch, size_t begin, size_t end) {
+    // 0. 原始邮件先写入blob存储，落盘之后才写数据库，数据库里的hash总能找到内容；
+    //    数据库写入失败留下的blob没有引用，重试时按内容寻址直接复用
+    std::vector<std::string> bodyHashes;
+    std::vector<size_t> bodySizes;
+    if (m_blobStore) {
+        std::vector<std::string> rawMessages;
+        std::vector<const std::string*> blobs;
+        rawMessages.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            rawMessages.push_back(raw_message(*batch[i].data));
+            bodySizes.push_back(rawMessages.back().size());
+        }
+        for (const auto& raw : rawMessages) {
+            blobs.push_back(&raw);
+        }
+        if (!m_blobStore->put_batch(blobs, bodyHashes)) {
+            std::cerr << "Mail writer: failed to store message blobs" << std::endl;
+            return false;
+        }
+    }
+
+    // 1. 按收件人所在的分片拆开，每个分片各写一份邮件和自己用户的收件箱记录
+    //    分片之间没有分布式事务，已经在某个分片提交过的邮件重试时跳过该分片
+    const size_t shardCount = std::max<size_t>(m_dbPool->get_shard_count(), 1);
+    std::vector<std::vector<ShardMail>> shards(shardCount);
+    for (size_t i = begin; i < end; ++i) {
+        PendingMail& pending = batch[i];
+        pending.committed_shards.resize(shardCount, 0);
+        if (shardCount == 1) {
+            if (!pending.committed_shards[0]) {
+                shards[0].push_back(ShardMail{i, pending.recipients});
+            }
+            continue;
+        }
+        std::vector<size_t> slot(shardCount, static_cast<size_t>(-1));
+        for (const auto& recipient : pending.recipients) {
+            size_t shard = m_dbPool->get_shard_index(recipient);
+            if (shard >= shardCount || pending.committed_shards[shard]) {
+                continue;
+            }
+            if (slot[shard] == static_cast<size_t>(-1)) {
+                slot[shard] = shards[shard].size();
+                shards[shard].push_back(ShardMail{i, {}});
+            }
+            shards[shard][slot[shard]].recipients.push_back(recipient);
+        }
+    }
+
+    BlobRefs blobs{begin, bodyHashes, bodySizes};
+    for (size_t shard = 0; shard < shardCount; ++shard) {
+        if (shards[shard].empty()) {
+            continue;
+        }
+        if (!write_shard(shard, batch, shards[shard], blobs)) {
+            return false;
+        }
+        for (const auto& item : shards[shard]) {
+            batch[item.index].committed_shards[shard] = 1;
+        }
+        m_batchCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_mailCount.fetch_add(end - begin, std::memory_order_relaxed);
+    return true;
+}
+
+std::string MailBatchWriter::next_insert_token() {
+    // 进程启动时的随机前缀加递增序号，多个进程同时写入也不会重复
+    char buffer[40];
+    std::snprintf(buffer, sizeof(buffer), "%016llx%llx", static_cast<unsigned long long>(m_tokenPrefix),
+                  static_cast<unsigned long long>(m_tokenSequence.fetch_add(1, std::memory_order_relaxed)));
+    return buffer;
+}
+
+bool MailBatchWriter::write_shard(size_t shard, Batch& batch, const std::vector<ShardMail>& items,
+                                  const BlobRefs& blobs) {
+    const bool inlineBody = !m_blobStore;
+
+    auto connection = m_dbPool->get_shard_connection(shard, DBAccessMode::READ_WRITE);
+    if (!connection) {
+        std::cerr << "Mail writer: no database connection available for shard " << shard << std::endl;
+        return false;
+    }
+
+    // 2. 查出本分片所有收件人的用户ID和收件箱ID
+    std::vector<std::string> addresses;
+    {
+        std::unordered_set<std::string> seen;
+        for (const auto& item : items) {
+            for (const auto& recipient : item.recipients) {
+                std::string address = boost::algorithm::to_lower_copy(recipient);
+                if (seen.insert(address).second) {
+                    addresses.push_back(std::move(address));
+                }
+            }
+        }
+    }
+    std::unordered_map<std::string, InboxTarget> inboxes;
+    for (size_t offset = 0; offset < addresses.size();) {
+        size_t rows = chunk_rows(addresses.size() - offset);
+        auto stmt = connection->prepare(
+            "SELECT u.id AS user_id, u.mail_address, b.id AS mailbox_id FROM users u "
+            "JOIN mailboxes b ON b.user_id = u.id AND b.box_type = 1 "
+            "WHERE u.mail_address IN (" + placeholders("?", rows) + ")");
+        if (!stmt) {
+            return false;
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            stmt->bind(i, addresses[offset + i]);
+        }
+        auto result = stmt->query();
+        if (!result) {
+            std::cerr << "Mail writer: inbox lookup failed: " << stmt->get_last_error() << std::endl;
+            return false;
+        }
+        size_t userCol = result->get_column_index("user_id");
+        size_t addressCol = result->get_column_index("mail_address");
+        size_t mailboxCol = result->get_column_index("mailbox_id");
+        for (size_t row = 0; row < result->get_row_count(); ++row) {
+            int64_t userId = result->get_int(row, userCol, -1);
+            int64_t mailboxId = result->get_int(row, mailboxCol, -1);
+            if (userId < 0 || mailboxId < 0) {
+                continue;
+            }
+            std::string address = boost::algorithm::to_lower_copy(std::string(result->get_view(row, addressCol)));
+            inboxes[address] = InboxTarget{userId, mailboxId};
+        }
+        offset += rows;
+    }
+
+    // 每个收件人在收件箱中一条记录，同一封邮件里重复的收件人只算一次
+    // 邮件本身在分片内只存一份，ref_count记录引用它的收件箱记录数，最后一个引用删除时才删除邮件
+    std::vector<std::vector<InboxTarget>> targets(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        std::unordered_set<int64_t> users;
+        for (const auto& recipient : items[i].recipients) {
+            auto it = inboxes.find(boost::algorithm::to_lower_copy(recipient));
+            if (it == inboxes.end()) {
+                // 收件人在RCPT TO之后、写入之前被删除
+                std::cerr << "Mail writer: no inbox for " << recipient << ", recipient skipped" << std::endl;
+            } else if (users.insert(it->second.user_id).second) {
+                targets[i].push_back(it->second);
+            }
+        }
+    }
+
+    // 收件人都已被删除的邮件不写入本分片：没有收件箱记录引用的mails行永远不会被删除，
+    // 它的blob也就永远不会被回收。blob可能还被其他分片引用，交给回收器逐个分片确认
+    std::vector<size_t> kept;
+    std::vector<std::string> orphanedBlobs;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!targets[i].empty()) {
+            kept.push_back(i);
+        } else if (!inlineBody) {
+            orphanedBlobs.push_back(blobs.hashes[items[i].index - blobs.begin]);
+        }
+    }
+    auto releaseOrphanedBlobs = [this, &orphanedBlobs]() {
+        for (const auto& hash : orphanedBlobs) {
+            m_blobStore->mark_released(hash);
+        }
+    };
+    if (kept.empty()) {
+        releaseOrphanedBlobs();
+        return true;
+    }
+
+    if (!connection->begin_transaction()) {
+        return false;
+    }
+    auto abort = [&connection](const std::string& what, const std::string& error) {
+        std::cerr << "Mail writer: " << what << " failed: " << error << std::endl;
+        connection->rollback();
+        return false;
+    };
+
+    // 3. 多行INSERT写入邮件，mailIds与kept一一对应
+    std::vector<int64_t> mailIds;
+    mailIds.reserve(kept.size());
+    for (size_t offset = 0; offset < kept.size();) {
+        size_t rows = chunk_rows(kept.size() - offset);
+        size_t bytes = 0;
+        for (size_t i = 0; i < rows; ++i) {
+            bytes += mail_bytes(*batch[items[kept[offset + i]].index].data, inlineBody);
+        }
+        while (rows > 1 && bytes > kMaxBytesPerStatement) {
+            rows >>= 1;
+            bytes = 0;
+            for (size_t i = 0; i < rows; ++i) {
+                bytes += mail_bytes(*batch[items[kept[offset + i]].index].data, inlineBody);
+            }
+        }
+
+        // 每行带一个本进程唯一的令牌，插入后按令牌读回ID。
+        // 多行INSERT的自增ID不一定连续（innodb_autoinc_lock_mode=2、auto_increment_increment>1），
+        // 不能用 insert_id + i 推算
+        const std::string tokenPrefix = next_insert_token() + "-";
+        std::shared_ptr<IDBStatement> stmt;
+        if (inlineBody) {
+            stmt = connection->prepare("INSERT INTO mails (sender, recipient, subject, body, body_size, ref_count, "
+                                       "insert_token) VALUES " + placeholders("(?, ?, ?, ?, ?, ?, ?)", rows));
+        } else {
+            stmt = connection->prepare("INSERT INTO mails (sender, recipient, subject, body_hash, body_size, "
+                                       "ref_count, insert_token) VALUES " +
+                                       placeholders("(?, ?, ?, ?, ?, ?, ?)", rows));
+        }
+        if (!stmt) {
+            return abort("prepare mails insert", connection->get_last_error());
+        }
+        size_t param = 0;
+        for (size_t i = 0; i < rows; ++i) {
+            size_t index = items[kept[offset + i]].index;
+            const mail& m = *batch[index].data;
+            stmt->bind(param++, m.from);
+            stmt->bind(param++, recipient_summary(m.to));
+            stmt->bind(param++, header_summary(m.header));
+            if (inlineBody) {
+                stmt->bind(param++, m.body);
+                stmt->bind(param++, static_cast<int64_t>(m.body.size()));
+            } else {
+                stmt->bind(param++, blobs.hashes[index - blobs.begin]);
+                stmt->bind(param++, static_cast<int64_t>(blobs.sizes[index - blobs.begin]));
+            }
+            stmt->bind(param++, static_cast<int64_t>(targets[kept[offset + i]].size()));
+            stmt->bind(param++, tokenPrefix + std::to_string(i));
+        }
+        if (!stmt->execute()) {
+            return abort("mails insert", stmt->get_last_error());
+        }
+
+        auto lookup = connection->prepare("SELECT id, insert_token FROM mails WHERE insert_token IN (" +
+                                          placeholders("?", rows) + ")");
+        if (!lookup) {
+            return abort("prepare mail id lookup", connection->get_last_error());
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            lookup->bind(i, tokenPrefix + std::to_string(i));
+        }
+        auto result = lookup->query();
+        if (!result) {
+            return abort("mail id lookup", lookup->get_last_error());
+        }
+        std::vector<int64_t> ids(rows, -1);
+        size_t idCol = result->get_column_index("id");
+        size_t tokenCol = result->get_column_index("insert_token");
+        for (size_t row = 0; row < result->get_row_count(); ++row) {
+            std::string_view token = result->get_view(row, tokenCol);
+            if (token.size() <= tokenPrefix.size() || token.compare(0, tokenPrefix.size(), tokenPrefix) != 0) {
+                continue;
+            }
+            size_t index = std::strtoul(std::string(token.substr(tokenPrefix.size())).c_str(), nullptr, 10);
+            if (index < rows) {
+                ids[index] = result->get_int(row, idCol, -1);
+            }
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            if (ids[i] < 0) {
+                return abort("mail id lookup", "inserted row " + std::to_string(i) + " not found");
+            }
+            mailIds.push_back(ids[i]);
+        }
+        offset += rows;
+    }
+
+    // 4. 插入收件箱记录，只有几十字节，不复制邮件内容
+    struct MailboxRow {
+        int64_t mail_id;
+        InboxTarget inbox;
+    };
+    std::vector<MailboxRow> mailboxRows;
+    for (size_t i = 0; i < kept.size(); ++i) {
+        for (const auto& inbox : targets[kept[i]]) {
+            mailboxRows.push_back(MailboxRow{mailIds[i], inbox});
+        }
+    }
+    for (size_t offset = 0; offset < mailboxRows.size();) {
+        size_t rows = chunk_rows(mailboxRows.size() - offset);
+        auto stmt = connection->prepare("INSERT INTO mail_mailbox (mail_id, mailbox_id, user_id) VALUES " +
+                                        placeholders("(?, ?, ?)", rows));
+        if (!stmt) {
+            return abort("prepare mail_mailbox insert", connection->get_last_error());
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            const MailboxRow& row = mailboxRows[offset + i];
+            stmt->bind(i * 3, row.mail_id);
+            stmt->bind(i * 3 + 1, row.inbox.mailbox_id);
+            stmt->bind(i * 3 + 2, row.inbox.user_id);
+        }
+        if (!stmt->execute()) {
+            return abort("mail_mailbox insert", stmt->get_last_error());
+        }
+        offset += rows;
+    }
+
+    // 5. 本分片的整批一次提交
+    if (!connection->commit()) {
+        return abort("commit", connection->get_last_error());
+    }
+    releaseOrphanedBlobs();
+    return true;
+}
+
+} // namespace mail_system
@@ -0,0 +1,438 @@
+// 离线回放状态机事件轨迹，测量处理函数的吞吐和延迟
+// 不涉及socket和TLS：会话是mock，数据库是内存实现，工作线程池同步执行任务
+// 目前只有SMTPS状态机记录轨迹，也只回放SMTPS事件；轨迹中其他协议的记录计入skipped后跳过
+#include <mail_system/back/mailServer/fsm/fsm_trace.h>
+#include <mail_system/back/mailServer/fsm/smtps/traditional_smtps_fsm.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+
+using namespace mail_system;
+
+namespace {
+
+// 同步执行任务的线程池，保证计时覆盖整个处理函数
+class InlineThreadPool : public ThreadPoolBase {
+public:
+    void start() override { m_running = true; }
+    void stop(bool wait_for_tasks = true) override { m_running = false; }
+    size_t thread_count() const override { return 1; }
+    bool is_running() const override { return m_running; }
+
+protected:
+    void post_impl(std::function<void()> f) override { f(); }
+
+private:
+    bool m_running = true;
+};
+
+// 内存查询结果：每个被查询的字面量都当作存在的一行
+class MemoryResult : public IDBResult {
+public:
+    explicit MemoryResult(std::vector<std::string> values, bool row_ids = false)
+        : m_values(std::move(values)), m_rowIds(row_ids) {}
+
+    size_t get_row_count() const override { return m_values.size(); }
+    size_t get_column_count() const override { return 1; }
+    std::vector<std::string> get_column_names() const override { return {"value"}; }
+    std::map<std::string, std::string> get_row(size_t row_index) const override {
+        std::map<std::string, std::string> row;
+        if (row_index < m_values.size()) {
+            row["value"] = m_values[row_index];
+        }
+        return row;
+    }
+    std::vector<std::map<std::string, std::string>> get_all_rows() const override {
+        std::vector<std::map<std::string, std::string>> rows;
+        for (size_t i = 0; i < m_values.size(); ++i) {
+            rows.push_back(get_row(i));
+        }
+        return rows;
+    }
+    std::string get_value(size_t row_index, const std::string&) const override {
+        return row_index < m_values.size() ? m_values[row_index] : "";
+    }
+    // 按令牌读回自增ID、查收件箱的查询：各ID列为行号（从1开始），其余列都是绑定的值
+    size_t get_column_index(const std::string& column_name) const override {
+        return m_rowIds && (column_name == "id" || column_name == "user_id" || column_name == "mailbox_id") ? 1 : 0;
+    }
+    std::string_view get_view(size_t row_index, size_t column_index) const override {
+        if (is_null(row_index, column_index)) {
+            return std::string_view();
+        }
+        if (column_index == 1) {
+            m_rowId = std::to_string(row_index + 1);
+            return m_rowId;
+        }
+        return m_values[row_index];
+    }
+    bool is_null(size_t row_index, size_t column_index) const override {
+        return column_index > (m_rowIds ? 1u : 0u) || row_index >= m_values.size();
+    }
+
+private:
+    std::vector<std::string> m_values;
+    bool m_rowIds;
+    mutable std::string m_rowId;
+};
+
+// 内存流式结果：与MemoryResult相同的数据逐行返回
+class MemoryStreamResult : public IDBStreamResult {
+public:
+    explicit MemoryStreamResult(std::vector<std::string> values) : m_values(std::move(values)) {}
+
+    size_t get_column_count() const override { return 1; }
+    const std::vector<std::string>& get_column_names() const override { return m_columnNames; }
+    bool next() override { return ++m_row <= m_values.size(); }
+    std::string_view get_value(size_t column_index) const override {
+        return is_null(column_index) ? std::string_view() : std::string_view(m_values[m_row - 1]);
+    }
+    bool is_null(size_t column_index) const override {
+        return column_index != 0 || m_row == 0 || m_row > m_values.size();
+    }
+    bool has_error() const override { return false; }
+    std::string get_last_error() const override { return ""; }
+
+private:
+    std::vector<std::string> m_columnNames{"value"};
+    std::vector<std::string> m_values;
+    size_t m_row = 0;
+};
+
+// 内存预处理语句：查询返回绑定的所有字符串参数
+class MemoryStatement : public IDBStatement {
+public:
+    MemoryStatement(size_t param_count, size_t& queries, bool row_ids)
+        : m_values(param_count), m_queries(queries), m_rowIds(row_ids) {}
+
+    size_t get_param_count() const override { return m_values.size(); }
+    bool bind(size_t index, const std::string& value) override {
+        if (index >= m_values.size()) {
+            return false;
+        }
+        m_values[index] = value;
+        return true;
+    }
+    bool bind(size_t index, int64_t value) override { return bind(index, std::to_string(value)); }
+    bool bind_null(size_t index) override { return bind(index, std::string()); }
+    std::shared_ptr<IDBResult> query() override {
+        ++m_queries;
+        return std::make_shared<MemoryResult>(m_values, m_rowIds);
+    }
+    std::shared_ptr<IDBStreamResult> query_stream() override {
+        ++m_queries;
+        return std::make_shared<MemoryStreamResult>(m_values);
+    }
+    bool execute() override {
+        ++m_queries;
+        return true;
+    }
+    uint64_t get_affected_rows() const override { return 1; }
+    uint64_t get_insert_id() const override { return 0; }
+    std::string get_last_error() const override { return ""; }
+
+private:
+    std::vector<std::string> m_values;
+    size_t& m_queries;
+    bool m_rowIds;
+};
+
+// 内存数据库连接：查询返回SQL中出现的所有字符串字面量，写操作总是成功
+class MemoryConnection : public IDBConnection {
+public:
+    using IDBConnection::query;
+    using IDBConnection::query_stream;
+    using IDBConnection::execute;
+
+    bool connect() override { return true; }
+    void disconnect() override {}
+    bool is_connected() const override { return true; }
+    bool ping() override { return true; }
+    std::shared_ptr<IDBResult> query(const std::string& sql) override {
+        ++m_queries;
+        return std::make_shared<MemoryResult>(extract_literals(sql));
+    }
+    std::shared_ptr<IDBStreamResult> query_stream(const std::string& sql) override {
+        ++m_queries;
+        return std::make_shared<MemoryStreamResult>(extract_literals(sql));
+    }
+    bool execute(const std::string&) override {
+        ++m_queries;
+        return true;
+    }
+    bool begin_transaction() override { return true; }
+    bool commit() override { return true; }
+    bool rollback() override { return true; }
+    std::string get_last_error() const override { return ""; }
+    std::string escape_string(const std::string& str) const override {
+        std::string escaped;
+        escaped.reserve(str.size());
+        for (char c : str) {
+            if (c == '\'' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    std::shared_ptr<IDBStatement> prepare(const std::string& sql) override {
+        return std::make_shared<MemoryStatement>(std::count(sql.begin(), sql.end(), '?'), m_queries,
+                                                 sql.find("insert_token IN") != std::string::npos ||
+                                                 sql.find("JOIN mailboxes") != std::string::npos);
+    }
+
+    size_t query_count() const { return m_queries; }
+
+private:
+    static std::vector<std::string> extract_literals(const std::string& sql) {
+        std::vector<std::string> literals;
+        std::string current;
+        bool in_literal = false;
+        for (size_t i = 0; i < sql.size(); ++i) {
+            char c = sql[i];
+            if (!in_literal) {
+                if (c == '\'') {
+                    in_literal = true;
+                    current.clear();
+                }
+                continue;
+            }
+            if (c == '\\' && i + 1 < sql.size()) {
+                current += sql[++i];
+            } else if (c == '\'') {
+                in_literal = false;
+                literals.push_back(current);
+            } else {
+                current += c;
+            }
+        }
+        return literals;
+    }
+
+    size_t m_queries = 0;
+};
+
+// 内存连接池：所有调用共享同一个内存连接
+class MemoryDBPool : public DBPool {
+public:
+    MemoryDBPool() { initialize_pool(); }
+
+    using DBPool::get_connection;
+    DBConnectionLease get_connection() override { return make_lease(m_connection, nullptr); }
+    size_t get_pool_size() const override { return 1; }
+    size_t get_available_connections() const override { return 1; }
+    void close() override {}
+
+    size_t query_count() const { return m_connection->query_count(); }
+
+protected:
+    void initialize_pool() override { m_connection = std::make_shared<MemoryConnection>(); }
+    std::shared_ptr<IDBConnection> create_connection() override { return m_connection; }
+    void release_lease(std::shared_ptr<IDBConnection>, std::shared_ptr<void>) override {}
+
+private:
+    std::shared_ptr<MemoryConnection> m_connection;
+};
+
+// 不做任何IO的SMTPS会话
+class ReplaySmtpsSession : public SmtpsSession {
+public:
+    ReplaySmtpsSession(boost::asio::io_context& io_context,
+                       boost::asio::ssl::context& ssl_context,
+                       std::shared_ptr<SmtpsFsm> fsm)
+        : SmtpsSession(nullptr,
+                       std::make_unique<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(io_context, ssl_context),
+                       fsm) {}
+
+    void do_handshake(std::function<void(std::weak_ptr<SessionBase> session, const boost::system::error_code&)> callback) override {
+        callback(shared_from_this(), boost::system::error_code());
+    }
+
+    void async_read(std::function<void(const boost::system::error_code&, std::size_t)> callback) override {}
+
+    void async_write(const std::string& data, std::function<void(const boost::system::error_code&)> callback) override {
+        m_bytesWritten += data.size();
+        if (callback) {
+            callback(boost::system::error_code());
+        }
+    }
+
+    // 轨迹逐条驱动状态机，不从缓冲里继续处理命令
+    void continue_commands() override {}
+
+    size_t bytes_written() const { return m_bytesWritten; }
+
+private:
+    size_t m_bytesWritten = 0;
+};
+
+std::string encode_base64(const std::string& input) {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string output;
+    size_t i = 0;
+    for (; i + 2 < input.size(); i += 3) {
+        uint32_t n = (uint8_t(input[i]) << 16) | (uint8_t(input[i + 1]) << 8) | uint8_t(input[i + 2]);
+        output += alphabet[(n >> 18) & 63];
+        output += alphabet[(n >> 12) & 63];
+        output += alphabet[(n >> 6) & 63];
+        output += alphabet[n & 63];
+    }
+    if (i + 1 == input.size()) {
+        uint32_t n = uint8_t(input[i]) << 16;
+        output += alphabet[(n >> 18) & 63];
+        output += alphabet[(n >> 12) & 63];
+        output += "==";
+    } else if (i + 2 == input.size()) {
+        uint32_t n = (uint8_t(input[i]) << 16) | (uint8_t(input[i + 1]) << 8);
+        output += alphabet[(n >> 18) & 63];
+        output += alphabet[(n >> 12) & 63];
+        output += alphabet[(n >> 6) & 63];
+        output += '=';
+    }
+    return output;
+}
+
+// 构造编码后长度约为length的SASL PLAIN响应（\0user\0password）
+std::string synthesize_plain_response(size_t length) {
+    size_t decoded = std::max<size_t>(length / 4 * 3, 6);
+    std::string credentials(1, '\0');
+    credentials.append(decoded / 2 - 1, 'u');
+    credentials += '\0';
+    credentials.append(decoded - credentials.size(), 'p');
+    return encode_base64(credentials);
+}
+
+// 轨迹只记录参数长度，这里按事件类型构造长度相同、语法合法的参数
+std::string synthesize_smtp_args(SmtpsState state, SmtpsEvent event, size_t length) {
+    auto pad = [](std::string prefix, const std::string& suffix, size_t length, char fill) {
+        if (prefix.size() + suffix.size() < length) {
+            prefix.append(length - prefix.size() - suffix.size(), fill);
+        }
+        return prefix + suffix;
+    };
+    switch (event) {
+        case SmtpsEvent::EHLO:
+            return pad("", "", std::max<size_t>(length, 1), 'h');
+        case SmtpsEvent::AUTH:
+            if (state == SmtpsState::WAIT_AUTH) {
+                // 较长的AUTH命令按携带初始响应的PLAIN处理
+                return length > 6 ? "PLAIN " + synthesize_plain_response(length - 6) : "LOGIN";
+            }
+            return encode_base64(std::string(std::max<size_t>(length / 4 * 3, 1), 'u'));
+        case SmtpsEvent::MAIL_FROM:
+            return pad("FROM:<s", "@replay.local>", length, 's');
+        case SmtpsEvent::RCPT_TO:
+            return pad("TO:<r", "@replay.local>", length, 'r');
+        default:
+            return std::string(length, 'x');
+    }
+}
+
+struct LatencyStats {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <trace file> [repeat]\n"
+                  << "Replays SMTPS events only; records of other protocols are counted as skipped." << std::endl;
+        return 1;
+    }
+    const std::string trace_file = argv[1];
+    const int repeat = argc > 2 ? std::max(1, std::atoi(argv[2])) : 1;
+
+    FsmTraceReader reader(trace_file);
+    if (!reader.is_open()) {
+        return 1;
+    }
+
+    boost::asio::io_context io_context;
+    boost::asio::ssl::context ssl_context(boost::asio::ssl::context::sslv23);
+    auto worker_pool = std::make_shared<InlineThreadPool>();
+    auto db_pool = std::make_shared<MemoryDBPool>();
+    ServerConfig config;
+    // 逐封写入，回复在当前线程上产生，回放结果可重复
+    config.mail_batch_size = 1;
+    // 不启用收件人目录，每组RCPT TO结束时查询一次数据库
+    config.recipient_directory_poll_seconds = 0;
+    auto fsm = std::make_shared<TraditionalSmtpsFsm>(worker_pool, worker_pool, db_pool, config);
+
+    std::map<std::pair<SmtpsState, SmtpsEvent>, LatencyStats> stats;
+    uint64_t replayed = 0;
+    uint64_t skipped = 0;
+    size_t bytes_written = 0;
+    auto wall_start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < repeat; ++round) {
+        reader.rewind();
+        std::unordered_map<uint64_t, std::shared_ptr<ReplaySmtpsSession>> sessions;
+        FsmTraceRecord record;
+        while (reader.next(record)) {
+            if (record.protocol != static_cast<uint8_t>(FsmProtocol::SMTPS)) {
+                ++skipped;
+                continue;
+            }
+            auto& session = sessions[record.session_id];
+            if (!session) {
+                session = std::make_shared<ReplaySmtpsSession>(io_context, ssl_context, fsm);
+            }
+            auto state = static_cast<SmtpsState>(record.state);
+            auto event = static_cast<SmtpsEvent>(record.event);
+            // 与会话一样，一组RCPT TO之后的第一个其他命令之前先回复推迟校验的收件人
+            if (event != SmtpsEvent::RCPT_TO && !session->context_.deferred_recipients.empty()) {
+                fsm->flush_deferred_recipients(session);
+            }
+            // 回放的是线上的事件组合，而不是内存数据库下的处理结果，所以每次都恢复录制时的状态
+            session->set_current_state(state);
+            std::string args = synthesize_smtp_args(state, event, record.arg_length);
+
+            auto start = std::chrono::steady_clock::now();
+            fsm->process_event(session, event, args);
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+            auto& entry = stats[std::make_pair(state, event)];
+            entry.count++;
+            entry.total_ns += elapsed;
+            entry.max_ns = std::max<uint64_t>(entry.max_ns, elapsed);
+            ++replayed;
+        }
+        for (auto& pair : sessions) {
+            bytes_written += pair.second->bytes_written();
+        }
+    }
+
+    auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - wall_start).count();
+
+    std::cout << std::left << std::setw(22) << "STATE" << std::setw(12) << "EVENT"
+              << std::right << std::setw(10) << "COUNT" << std::setw(14) << "AVG(ns)"
+              << std::setw(14) << "MAX(ns)" << std::endl;
+    for (const auto& pair : stats) {
+        const auto& entry = pair.second;
+        std::cout << std::left << std::setw(22) << SmtpsFsm::get_state_name(pair.first.first)
+                  << std::setw(12) << SmtpsFsm::get_event_name(pair.first.second)
+                  << std::right << std::setw(10) << entry.count
+                  << std::setw(14) << (entry.count ? entry.total_ns / entry.count : 0)
+                  << std::setw(14) << entry.max_ns << std::endl;
+    }
+    std::cout << "\nreplayed events: " << replayed
+              << "\nskipped events (other protocols): " << skipped
+              << "\nresponse bytes: " << bytes_written
+              << "\ndb queries: " << db_pool->query_count()
+              << "\nthroughput: " << (wall_ns ? replayed * 1000000000.0 / wall_ns : 0) << " events/s"
+              << std::endl;
+
+    std::cout << "\ntransition counters:" << std::endl;
+    TraditionalSmtpsFsm::dump_transition_stats(std::cout);
+    return 0;
+}
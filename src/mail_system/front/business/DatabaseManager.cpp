@@ -126,6 +126,63 @@ bool DatabaseManager::createTables() {
         return false;
     }
     
+    // 创建邮箱统计表，由触发器维护，邮件数和未读数只需一次主键查询
+    if (!query.exec("CREATE TABLE IF NOT EXISTS mailbox_stats ("
+                   "mailbox_id INTEGER PRIMARY KEY, "
+                   "message_count INTEGER NOT NULL DEFAULT 0, "
+                   "unread_count INTEGER NOT NULL DEFAULT 0, "
+                   "FOREIGN KEY (mailbox_id) REFERENCES mailboxes (id) ON DELETE CASCADE)")) {
+        qCritical() << "Failed to create mailbox_stats table:" << query.lastError().text();
+        return false;
+    }
+    
+    const QStringList statsTriggers = {
+        // 邮件加入邮箱
+        "CREATE TRIGGER IF NOT EXISTS mail_mailbox_after_insert AFTER INSERT ON mail_mailbox "
+        "BEGIN "
+        "INSERT OR IGNORE INTO mailbox_stats (mailbox_id) VALUES (NEW.mailbox_id); "
+        "UPDATE mailbox_stats SET message_count = message_count + 1, "
+        "unread_count = unread_count + COALESCE((SELECT NOT is_read FROM mails WHERE id = NEW.mail_id), 0) "
+        "WHERE mailbox_id = NEW.mailbox_id; "
+        "END",
+        // 邮件移出邮箱
+        "CREATE TRIGGER IF NOT EXISTS mail_mailbox_after_delete AFTER DELETE ON mail_mailbox "
+        "BEGIN "
+        "UPDATE mailbox_stats SET message_count = message_count - 1, "
+        "unread_count = unread_count - COALESCE((SELECT NOT is_read FROM mails WHERE id = OLD.mail_id), 0) "
+        "WHERE mailbox_id = OLD.mailbox_id; "
+        "END",
+        // 已读状态变化，影响所有包含该邮件的邮箱
+        "CREATE TRIGGER IF NOT EXISTS mails_after_read_update AFTER UPDATE OF is_read ON mails "
+        "WHEN OLD.is_read <> NEW.is_read "
+        "BEGIN "
+        "UPDATE mailbox_stats SET unread_count = unread_count + (CASE WHEN NEW.is_read THEN -1 ELSE 1 END) "
+        "WHERE mailbox_id IN (SELECT mailbox_id FROM mail_mailbox WHERE mail_id = NEW.id); "
+        "END",
+        // 删除邮件前先移出所有邮箱，不依赖外键级联是否开启
+        "CREATE TRIGGER IF NOT EXISTS mails_before_delete BEFORE DELETE ON mails "
+        "BEGIN "
+        "DELETE FROM mail_mailbox WHERE mail_id = OLD.id; "
+        "END"
+    };
+    for (const QString& sql : statsTriggers) {
+        if (!query.exec(sql)) {
+            qCritical() << "Failed to create mailbox_stats trigger:" << query.lastError().text();
+            return false;
+        }
+    }
+    
+    // 补齐还没有统计行的邮箱（升级前已有的数据）
+    if (!query.exec("INSERT OR IGNORE INTO mailbox_stats (mailbox_id, message_count, unread_count) "
+                   "SELECT b.id, "
+                   "(SELECT COUNT(*) FROM mail_mailbox mm WHERE mm.mailbox_id = b.id), "
+                   "(SELECT COUNT(*) FROM mail_mailbox mm JOIN mails m ON m.id = mm.mail_id "
+                   "WHERE mm.mailbox_id = b.id AND m.is_read = 0) "
+                   "FROM mailboxes b WHERE b.id NOT IN (SELECT mailbox_id FROM mailbox_stats)")) {
+        qCritical() << "Failed to initialize mailbox_stats:" << query.lastError().text();
+        return false;
+    }
+    
     return true;
 }
 
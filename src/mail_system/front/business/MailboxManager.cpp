@@ -138,7 +138,7 @@ mailbox MailboxManager::getMailbox(size_t mailboxId) {
 
 size_t MailboxManager::getMailCount(size_t mailboxId) {
     QSqlQuery query;
-    query.prepare("SELECT COUNT(*) FROM mail_mailbox WHERE mailbox_id = :mailbox_id");
+    query.prepare("SELECT message_count FROM mailbox_stats WHERE mailbox_id = :mailbox_id");
     query.bindValue(":mailbox_id", static_cast<qint64>(mailboxId));
     
     if (query.exec() && query.next()) {
@@ -150,9 +150,7 @@ size_t MailboxManager::getMailCount(size_t mailboxId) {
 
 size_t MailboxManager::getUnreadMailCount(size_t mailboxId) {
     QSqlQuery query;
-    query.prepare("SELECT COUNT(*) FROM mails m "
-                 "JOIN mail_mailbox mm ON m.id = mm.mail_id "
-                 "WHERE mm.mailbox_id = :mailbox_id AND m.is_read = 0");
+    query.prepare("SELECT unread_count FROM mailbox_stats WHERE mailbox_id = :mailbox_id");
     query.bindValue(":mailbox_id", static_cast<qint64>(mailboxId));
     
     if (query.exec() && query.next()) {